@@ -7,6 +7,7 @@
 #include <cstdint>
 #include <expected>
 #include <functional>
+#include <memory>
 #include <optional>
 #include <span>
 #include <stdexcept>
@@ -139,8 +140,20 @@ public:
         float   repeat_penalty = 1.10f;
         int32_t repeat_last_n = 64;     // last n tokens to penalize
         float   contextErase = 0.5f;    // percent of context to erase if we exceed the context window
+        std::vector<std::string> stopSequences; // stop generating at these, in addition to the built-in ones
     };
 
+    struct ParallelPrompt {
+        std::string           prompt;
+        PromptCallback        promptCallback;
+        ResponseCallback      responseCallback;
+        PromptContext         ctx;
+        std::function<void()> finished; // once the response is complete or was cancelled, not if promptParallel throws
+    };
+
+    // Returns the next prompt waiting to be started, or nullopt if there is none right now. Must not block.
+    using ParallelPromptSource = std::function<std::optional<ParallelPrompt>()>;
+
     explicit LLModel() {}
     virtual ~LLModel() {}
 
@@ -154,6 +167,13 @@ public:
     virtual size_t stateSize() const = 0;
     virtual size_t saveState(std::span<uint8_t> stateOut, std::vector<Token> &inputTokensOut) const = 0;
     virtual size_t restoreState(std::span<const uint8_t> state, std::span<const Token> inputTokens) = 0;
+    // Like the above, but only the KV cache of the conversation kept by prompt(), without logits or sampler state.
+    // This is much smaller and is what gets persisted between sessions. Returns 0 if unsupported or on error.
+    virtual size_t contextStateSize() const { return 0; }
+    virtual size_t saveContextState(std::span<uint8_t> stateOut, std::vector<Token> &inputTokensOut) const
+    { (void)stateOut; (void)inputTokensOut; return 0; }
+    virtual size_t restoreContextState(std::span<const uint8_t> state, std::span<const Token> inputTokens)
+    { (void)state; (void)inputTokens; return 0; }
 
     // This method requires the model to return true from supportsCompletion otherwise it will throw
     // an error
@@ -161,8 +181,35 @@ public:
                         const PromptCallback   &promptCallback,
                         const ResponseCallback &responseCallback,
                         const PromptContext    &ctx);
+    // Like prompt, but with input that was already tokenized, e.g. pieced together from calls to tokenizePrompt.
+    virtual void promptTokens(std::span<const Token> tokens,
+                              const PromptCallback   &promptCallback,
+                              const ResponseCallback &responseCallback,
+                              const PromptContext    &ctx);
 
     virtual int32_t countPromptTokens(std::string_view prompt) const;
+    // Tokenize text the way prompt does. A continuation is tokenized without the special tokens that start a prompt,
+    // so that its tokens can be appended to those of the text it follows.
+    std::vector<Token> tokenizePrompt(std::string_view text, bool continuation = false) const;
+
+    // Generate responses to several independent prompts at once. Every running prompt owns a KV sequence and a
+    // sampler, and the pending decode work of all of them is packed into one batch per step. nextPrompt is polled
+    // whenever a sequence is free, so new prompts join while others are still generating. The context is shared
+    // evenly between the running prompts, a prompt running alone gets all of it. Returns once every sequence is idle
+    // and nextPrompt has nothing left. This discards the KV cache kept by prompt().
+    virtual void promptParallel(const ParallelPromptSource &nextPrompt);
+    void promptParallel(std::span<ParallelPrompt> prompts);
+    // number of prompts promptParallel can run at once, 0 if they can only run one after another
+    virtual int32_t parallelSequences() const { return 0; }
+
+    // Speculative decoding: the draft model proposes up to nDraft tokens per step, which are then verified with a
+    // single evalTokens call. The output is the same as without a draft model, it is only faster if the draft model
+    // is much cheaper and agrees with this one often enough. The draft model must be loaded and share the vocabulary
+    // of this one. Pass nullptr to disable.
+    void setDraftModel(std::unique_ptr<LLModel> draft, int32_t nDraft);
+    const LLModel *draftModel() const { return m_draftModel.get(); }
+    // true if rejected draft tokens can be removed from the context again
+    virtual bool supportsSpeculativeDecoding() const { return false; }
 
     virtual size_t embeddingSize() const {
         throw std::logic_error(std::string(implementation().modelType()) + " does not support embeddings");
@@ -176,6 +223,15 @@ public:
                        int dimensionality = -1, size_t *tokenCount = nullptr, bool doMean = true, bool atlas = false);
 
     virtual void setThreadCount(int32_t n_threads) { (void)n_threads; }
+    // Memory budget for KV snapshots of previously decoded prompts, which are reused when a later prompt shares a
+    // prefix with one of them. Zero disables the cache.
+    virtual void setPrefixCacheSize(size_t bytes) { (void)bytes; }
+    // Load a copy of the model with its Q4_0 weights repacked for the CPU kernels when it runs on the CPU, writing the
+    // copy next to the model on the first load. Takes effect on the next loadModel.
+    virtual void setRepackWeights(bool enabled) { (void)enabled; }
+    // The file that loadModel(modelPath, n_ctx, ngl) will read the weights from, which is the repacked copy if it is
+    // to be used and already written.
+    virtual std::string weightsPath(const std::string &modelPath, int ngl) const { (void)ngl; return modelPath; }
     virtual int32_t threadCount() const { return 1; }
 
     const Implementation &implementation() const {
@@ -209,15 +265,19 @@ public:
 
     virtual int32_t contextLength() const = 0;
     virtual auto specialTokens() -> std::unordered_map<std::string, std::string> const = 0;
+    // The text of a token, empty if there is no such token. Valid while the model stays loaded, and followed by a NUL
+    // so that it can be passed on as a C string.
+    virtual std::string_view tokenPiece(Token id) const = 0;
+    // Whether the tokenizer keeps a token apart from the text around it, i.e. a control or user defined token.
+    virtual bool isSpecialToken(Token id) const = 0;
 
 protected:
     // These are pure virtual because subclasses need to implement as the default implementation of
     // 'prompt' above calls these functions
-    virtual std::vector<Token> tokenize(std::string_view str) const = 0;
-    virtual bool isSpecialToken(Token id) const = 0;
-    virtual std::string tokenToString(Token id) const = 0;
+    virtual std::vector<Token> tokenize(std::string_view str, bool addSpecial) const = 0;
     virtual void initSampler(const PromptContext &ctx) = 0;
-    virtual Token sampleToken() const = 0;
+    // sample from the logits of the token at batchIdx in the last evalTokens call, -1 for the last token
+    virtual Token sampleToken(int32_t batchIdx = -1) const = 0;
     virtual bool evalTokens(int32_t nPast, std::span<const Token> tokens) const = 0;
     virtual void shiftContext(const PromptContext &promptCtx, int32_t *nPast) = 0;
     virtual int32_t inputLength() const = 0;
@@ -228,6 +288,29 @@ protected:
     virtual const std::vector<Token> &endTokens() const = 0;
     virtual bool shouldAddBOS() const = 0;
 
+    // Prefix cache hooks, called before the current context is discarded. storePrefix snapshots the current context,
+    // restorePrefix replaces it with the snapshot sharing the longest prefix with input if that covers more than
+    // nCached tokens, and returns the new number of cached tokens.
+    virtual void storePrefix() {}
+    virtual int32_t restorePrefix(std::span<const Token> input, int32_t nCached) { (void)input; return nCached; }
+
+    // Multi-sequence primitives used by promptParallel. Sequence 0 belongs to prompt(), parallel prompts use
+    // sequences 1 through parallelSequences().
+    struct SeqToken {
+        Token   token;
+        int32_t seq;
+        int32_t pos;
+        bool    logits;
+    };
+    virtual void initSeqSampler(int32_t seq, const PromptContext &ctx) = 0;
+    // sample from the logits of the token at batchIdx in the last evalBatch call
+    virtual Token sampleSeqToken(int32_t seq, int32_t batchIdx) const = 0;
+    virtual bool evalBatch(std::span<const SeqToken> tokens) const = 0;
+    // the most tokens a single evalBatch call can take
+    virtual int32_t maxBatchSize() const { return LLMODEL_MAX_PROMPT_BATCH; }
+    virtual void clearSequence(int32_t seq) = 0;
+    virtual void shiftSequence(int32_t seq, int32_t nKeep, int32_t nDiscard, int32_t nPast) = 0;
+
     virtual int32_t maxContextLength(std::string const &modelPath) const
     {
         (void)modelPath;
@@ -268,6 +351,13 @@ protected:
                           int32_t                 nPast);
 
     friend class LLMImplementation;
+
+private:
+    // propose up to n tokens that follow the current input and next with the draft model
+    std::vector<Token> draftTokens(Token next, int32_t n);
+
+    std::unique_ptr<LLModel> m_draftModel;
+    int32_t                  m_nDraft = 0;
 };
 
 #endif // LLMODEL_H
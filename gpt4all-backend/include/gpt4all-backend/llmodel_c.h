@@ -310,6 +310,17 @@ const char *llmodel_model_gpu_device_name(llmodel_model model);
 
 int32_t llmodel_count_prompt_tokens(llmodel_model model, const char *prompt, const char **error);
 
+/**
+ * Get the text of a token.
+ * @param model A pointer to the llmodel_model instance.
+ * @param token The token id.
+ * @param length Where to store the length of the text in bytes, or NULL.
+ * @return The NUL-terminated text of the token, or an empty string if there is no such token or no model is loaded.
+ * It is owned by the model, and stays valid until the model is destroyed or llmodel_loadModel is called on it again.
+ * Callers that keep it longer must copy it.
+ */
+const char *llmodel_token_to_piece(llmodel_model model, token_t token, size_t *length);
+
 void llmodel_model_foreach_special_token(llmodel_model model, llmodel_special_token_callback callback);
 
 #ifdef __cplusplus
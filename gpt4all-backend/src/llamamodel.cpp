@@ -2,7 +2,9 @@
 #include "llamamodel_impl.h"
 
 #include "llmodel.h"
+#include "prefixcache.h"
 #include "utils.h"
+#include "weightrepack.h"
 
 #include <ggml.h>
 #include <llama.h>
@@ -20,12 +22,14 @@
 #include <iomanip>
 #include <iostream>
 #include <iterator>
+#include <map>
 #include <memory>
 #include <numeric>
 #include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <vector>
 
@@ -43,6 +47,12 @@ using namespace std::string_literals;
 // Maximum supported GGUF version
 static constexpr int GGUF_VER_MAX = 3;
 
+// Number of KV sequences available to promptParallel, in addition to the one used by prompt()
+static constexpr int32_t MAX_PARALLEL_SEQUENCES = 8;
+
+// Contexts shorter than this are cheap to recompute and not worth a prefix cache snapshot
+static constexpr int32_t PREFIX_CACHE_MIN_TOKENS = 64;
+
 static const char * const modelType_ = "LLaMA";
 
 // note: same order as LLM_ARCH_NAMES in llama.cpp
@@ -222,12 +232,21 @@ struct LLamaPrivate {
     std::vector<LLModel::Token>  end_tokens;
     const char                  *backend_name = nullptr;
     std::vector<LLModel::Token>  inputTokens;
-
-    llama_model          *model        = nullptr;
-    llama_context        *ctx          = nullptr;
-    llama_model_params    model_params;
-    llama_context_params  ctx_params;
-    llama_sampler        *sampler_chain;
+    int32_t                      n_parallel   = 0;
+    PrefixCache                  prefixCache;
+    bool                         repackWeights = false;
+
+    // the text of every token, each followed by a NUL, and where it starts by token id with an extra entry at the end
+    std::string                  pieces;
+    std::vector<uint32_t>        pieceOffsets;
+    std::vector<bool>            specialTokens;
+
+    llama_model                  *model        = nullptr;
+    llama_context                *ctx          = nullptr;
+    llama_model_params            model_params;
+    llama_context_params          ctx_params;
+    llama_sampler                *sampler_chain;
+    std::vector<llama_sampler *>  seq_samplers; // indexed by seq_id - 1
 };
 
 LLamaModel::LLamaModel()
@@ -334,6 +353,31 @@ cleanup:
     return result;
 }
 
+// Detokenize the whole vocabulary once, so that generating a token does not have to allocate its text.
+static void buildPieceTable(LLamaPrivate &d)
+{
+    const int32_t n_vocab = llama_n_vocab(d.model);
+    d.pieces.clear();
+    d.pieceOffsets.assign(size_t(n_vocab) + 1, 0);
+    d.specialTokens.assign(size_t(n_vocab), false);
+
+    std::vector<char> buf(64);
+    for (int32_t id = 0; id < n_vocab; id++) {
+        int32_t n = llama_token_to_piece(d.model, id, buf.data(), buf.size(), 0, true);
+        if (n < 0) {
+            buf.resize(-n);
+            n = llama_token_to_piece(d.model, id, buf.data(), buf.size(), 0, true);
+            GGML_ASSERT(n == int32_t(buf.size()));
+        }
+        d.pieceOffsets[id] = uint32_t(d.pieces.size());
+        d.pieces.append(buf.data(), n);
+        d.pieces.push_back('\0');
+        d.specialTokens[id] = llama_token_get_attr(d.model, id)
+            & (LLAMA_TOKEN_ATTR_CONTROL | LLAMA_TOKEN_ATTR_USER_DEFINED | LLAMA_TOKEN_ATTR_UNKNOWN);
+    }
+    d.pieceOffsets[n_vocab] = uint32_t(d.pieces.size());
+}
+
 bool LLamaModel::loadModel(const std::string &modelPath, int n_ctx, int ngl)
 {
     d_ptr->modelLoaded = false;
@@ -347,6 +391,7 @@ bool LLamaModel::loadModel(const std::string &modelPath, int n_ctx, int ngl)
         llama_free(d_ptr->ctx);
         d_ptr->ctx = nullptr;
     }
+    d_ptr->prefixCache.clear();
 
     if (n_ctx < 8) {
         std::cerr << "warning: minimum context size is 8, using minimum size.\n";
@@ -397,7 +442,17 @@ bool LLamaModel::loadModel(const std::string &modelPath, int n_ctx, int ngl)
     (void)ngl;
 #endif
 
-    d_ptr->model = llama_load_model_from_file(modelPath.c_str(), d_ptr->model_params);
+    // A failed repack loads the model as it is.
+    std::string loadPath = modelPath;
+    if (repacksWeights(ngl)) {
+        auto repacked = repackedModelPath(modelPath, [this](float progress) {
+            return staticProgressCallback(progress, this);
+        });
+        if (repacked)
+            loadPath = *repacked;
+    }
+
+    d_ptr->model = llama_load_model_from_file(loadPath.c_str(), d_ptr->model_params);
     if (!d_ptr->model) {
         fflush(stdout);
 #ifndef GGML_USE_CUDA
@@ -439,6 +494,10 @@ bool LLamaModel::loadModel(const std::string &modelPath, int n_ctx, int ngl)
     if (isEmbedding)
         d_ptr->ctx_params.embeddings = true;
 
+    // recurrent models allocate one state per sequence, so only give transformers extra sequences
+    d_ptr->n_parallel = isEmbedding || llama_model_is_recurrent(d_ptr->model) ? 0 : MAX_PARALLEL_SEQUENCES;
+    d_ptr->ctx_params.n_seq_max = 1 + d_ptr->n_parallel;
+
     d_ptr->ctx = llama_new_context_with_model(d_ptr->model, d_ptr->ctx_params);
     if (!d_ptr->ctx) {
         fflush(stdout);
@@ -453,6 +512,7 @@ bool LLamaModel::loadModel(const std::string &modelPath, int n_ctx, int ngl)
     }
 
     d_ptr->end_tokens = {llama_token_eos(d_ptr->model)};
+    buildPieceTable(*d_ptr);
 
     if (usingGPUDevice()) {
 #ifdef GGML_USE_KOMPUTE
@@ -486,6 +546,41 @@ int32_t LLamaModel::threadCount() const
     return d_ptr->n_threads;
 }
 
+void LLamaModel::setPrefixCacheSize(size_t bytes)
+{
+    d_ptr->prefixCache.setBudget(bytes);
+}
+
+void LLamaModel::setRepackWeights(bool enabled)
+{
+    d_ptr->repackWeights = enabled;
+}
+
+// The repacked layout only has CPU kernels, and without AVX2 they would gain nothing.
+bool LLamaModel::repacksWeights(int ngl) const
+{
+    if (!d_ptr->repackWeights || std::string_view(GGML_BUILD_VARIANT) == "avxonly")
+        return false;
+#if defined(GGML_USE_KOMPUTE) || defined(GGML_USE_VULKAN) || defined(GGML_USE_CUDA)
+    return d_ptr->device == -1 || ngl == 0;
+#elif defined(GGML_USE_METAL)
+    (void)ngl;
+    return false; // always fully offloaded
+#else
+    (void)ngl;
+    return true;
+#endif
+}
+
+std::string LLamaModel::weightsPath(const std::string &modelPath, int ngl) const
+{
+    if (repacksWeights(ngl)) {
+        if (auto repacked = currentRepackedModelPath(modelPath))
+            return *repacked;
+    }
+    return modelPath;
+}
+
 LLamaModel::~LLamaModel()
 {
     if (d_ptr->ctx) {
@@ -493,6 +588,8 @@ LLamaModel::~LLamaModel()
     }
     llama_free_model(d_ptr->model);
     llama_sampler_free(d_ptr->sampler_chain);
+    for (auto *smpl : d_ptr->seq_samplers)
+        llama_sampler_free(smpl);
 }
 
 bool LLamaModel::isModelLoaded() const
@@ -521,11 +618,38 @@ size_t LLamaModel::restoreState(std::span<const uint8_t> state, std::span<const
     return bytesRead;
 }
 
-std::vector<LLModel::Token> LLamaModel::tokenize(std::string_view str) const
+size_t LLamaModel::contextStateSize() const
+{
+    return llama_state_seq_get_size(d_ptr->ctx, 0);
+}
+
+size_t LLamaModel::saveContextState(std::span<uint8_t> stateOut, std::vector<Token> &inputTokensOut) const
+{
+    size_t bytesWritten = llama_state_seq_get_data(d_ptr->ctx, stateOut.data(), stateOut.size(), 0);
+    if (bytesWritten)
+        inputTokensOut.assign(d_ptr->inputTokens.begin(), d_ptr->inputTokens.end());
+    return bytesWritten;
+}
+
+size_t LLamaModel::restoreContextState(std::span<const uint8_t> state, std::span<const Token> inputTokens)
+{
+    // the context being replaced may be useful to another prompt later
+    storePrefix();
+
+    llama_kv_cache_seq_rm(d_ptr->ctx, 0, -1, -1);
+    size_t bytesRead = llama_state_seq_set_data(d_ptr->ctx, state.data(), state.size(), 0);
+    if (bytesRead)
+        d_ptr->inputTokens.assign(inputTokens.begin(), inputTokens.end());
+    else
+        d_ptr->inputTokens.clear();
+    return bytesRead;
+}
+
+std::vector<LLModel::Token> LLamaModel::tokenize(std::string_view str, bool addSpecial) const
 {
     std::vector<LLModel::Token> fres(str.length() + 4);
     int32_t fres_len = llama_tokenize(
-        d_ptr->model, str.data(), str.length(), fres.data(), fres.size(), /*add_special*/ true, /*parse_special*/ true
+        d_ptr->model, str.data(), str.length(), fres.data(), fres.size(), addSpecial, /*parse_special*/ true
     );
     fres.resize(fres_len);
     return fres;
@@ -533,31 +657,21 @@ std::vector<LLModel::Token> LLamaModel::tokenize(std::string_view str) const
 
 bool LLamaModel::isSpecialToken(Token id) const
 {
-    return llama_token_get_attr(d_ptr->model, id)
-        & (LLAMA_TOKEN_ATTR_CONTROL | LLAMA_TOKEN_ATTR_USER_DEFINED | LLAMA_TOKEN_ATTR_UNKNOWN);
+    return id >= 0 && size_t(id) < d_ptr->specialTokens.size() && d_ptr->specialTokens[id];
 }
 
-std::string LLamaModel::tokenToString(Token id) const
+std::string_view LLamaModel::tokenPiece(Token id) const
 {
-    std::vector<char> result(8, 0);
-    const int n_tokens = llama_token_to_piece(d_ptr->model, id, result.data(), result.size(), 0, true);
-    if (n_tokens < 0) {
-        result.resize(-n_tokens);
-        int check = llama_token_to_piece(d_ptr->model, id, result.data(), result.size(), 0, true);
-        GGML_ASSERT(check == -n_tokens);
-    }
-    else {
-        result.resize(n_tokens);
-    }
-
-    return std::string(result.data(), result.size());
+    if (id < 0 || size_t(id) >= d_ptr->specialTokens.size())
+        return "";
+    auto begin = d_ptr->pieceOffsets[id];
+    auto end   = d_ptr->pieceOffsets[id + 1] - 1; // without the NUL
+    return { d_ptr->pieces.data() + begin, end - begin };
 }
 
-void LLamaModel::initSampler(const PromptContext &promptCtx)
+static void build_sampler_chain(llama_sampler *chain, const llama_model *model,
+                                const LLModel::PromptContext &promptCtx)
 {
-    auto *model = d_ptr->model;
-    auto *chain = d_ptr->sampler_chain;
-
     // clear sampler chain
     for (int i = llama_sampler_chain_n(chain) - 1; i >= 0; i--) {
         auto *smpl = llama_sampler_chain_remove(chain, i);
@@ -595,9 +709,14 @@ void LLamaModel::initSampler(const PromptContext &promptCtx)
     }
 }
 
-LLModel::Token LLamaModel::sampleToken() const
+void LLamaModel::initSampler(const PromptContext &promptCtx)
 {
-    return llama_sampler_sample(d_ptr->sampler_chain, d_ptr->ctx, -1);
+    build_sampler_chain(d_ptr->sampler_chain, d_ptr->model, promptCtx);
+}
+
+LLModel::Token LLamaModel::sampleToken(int32_t batchIdx) const
+{
+    return llama_sampler_sample(d_ptr->sampler_chain, d_ptr->ctx, batchIdx);
 }
 
 bool LLamaModel::evalTokens(int32_t nPast, std::span<const Token> tokens) const
@@ -618,7 +737,8 @@ bool LLamaModel::evalTokens(int32_t nPast, std::span<const Token> tokens) const
         batch.logits  [i] = false;
     }
 
-    // llama_decode will output logits only for the last token of the prompt
+    // llama_decode will output logits only for the last token of the prompt, unless logits_all is set (it is, so that
+    // speculative decoding can verify a whole draft at once)
     batch.logits[batch.n_tokens - 1] = true;
 
     int res = llama_decode(d_ptr->ctx, batch);
@@ -663,9 +783,9 @@ auto LLamaModel::specialTokens() -> std::unordered_map<std::string, std::string>
 
     std::unordered_map<std::string, std::string> tokens;
     if (auto id = llama_token_bos(d_ptr->model); id != LLAMA_TOKEN_NULL)
-        tokens.emplace("bos_token", tokenToString(id));
+        tokens.emplace("bos_token", tokenPiece(id));
     if (auto id = llama_token_eos(d_ptr->model); id != LLAMA_TOKEN_NULL)
-        tokens.emplace("eos_token", tokenToString(id));
+        tokens.emplace("eos_token", tokenPiece(id));
     return tokens;
 }
 
@@ -716,6 +836,126 @@ bool LLamaModel::shouldAddBOS() const
     return llama_add_bos_token(d_ptr->model);
 }
 
+void LLamaModel::storePrefix()
+{
+    auto &cache = d_ptr->prefixCache;
+    auto &inp = d_ptr->inputTokens;
+    if (!cache.budget() || int32_t(inp.size()) < PREFIX_CACHE_MIN_TOKENS || cache.covers(inp))
+        return;
+
+    // the state can be larger than the whole budget, which is known before allocating it
+    size_t stateSize = llama_state_seq_get_size(d_ptr->ctx, 0);
+    if (!stateSize || stateSize > cache.budget())
+        return;
+    std::vector<uint8_t> state(stateSize);
+    size_t bytesWritten = llama_state_seq_get_data(d_ptr->ctx, state.data(), state.size(), 0);
+    if (!bytesWritten)
+        return;
+    state.resize(bytesWritten);
+    cache.insert(inp, std::move(state));
+}
+
+int32_t LLamaModel::restorePrefix(std::span<const Token> input, int32_t nCached)
+{
+    auto &cache = d_ptr->prefixCache;
+    if (!cache.budget())
+        return nCached;
+
+    auto match = cache.find(input);
+    if (!match.entry || match.length <= nCached)
+        return nCached;
+
+    auto &state = match.entry->state;
+    llama_kv_cache_seq_rm(d_ptr->ctx, 0, -1, -1);
+    if (!llama_state_seq_set_data(d_ptr->ctx, state.data(), state.size(), 0)) {
+        std::cerr << "LLAMA ERROR: failed to restore a prefix cache snapshot\n";
+        llama_kv_cache_seq_rm(d_ptr->ctx, 0, -1, -1);
+        d_ptr->inputTokens.clear();
+        return 0;
+    }
+
+    // drop the part of the snapshot that does not match the input, which the state of a recurrent model cannot do
+    if (!llama_kv_cache_seq_rm(d_ptr->ctx, 0, match.length, -1)) {
+        llama_kv_cache_seq_rm(d_ptr->ctx, 0, -1, -1);
+        d_ptr->inputTokens.clear();
+        return 0;
+    }
+    auto &tokens = match.entry->tokens;
+    d_ptr->inputTokens.assign(tokens.begin(), tokens.begin() + match.length);
+    return match.length;
+}
+
+int32_t LLamaModel::parallelSequences() const
+{
+    return d_ptr->n_parallel;
+}
+
+bool LLamaModel::supportsSpeculativeDecoding() const
+{
+    // the state of a recurrent model cannot be rolled back to before a rejected draft
+    return m_supportsCompletion && !llama_model_is_recurrent(d_ptr->model);
+}
+
+void LLamaModel::initSeqSampler(int32_t seq, const PromptContext &promptCtx)
+{
+    assert(seq > 0 && seq <= d_ptr->n_parallel);
+    auto &samplers = d_ptr->seq_samplers;
+    if (samplers.size() < size_t(seq))
+        samplers.resize(seq, nullptr);
+    auto *&chain = samplers[seq - 1];
+    if (!chain)
+        chain = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    build_sampler_chain(chain, d_ptr->model, promptCtx);
+}
+
+LLModel::Token LLamaModel::sampleSeqToken(int32_t seq, int32_t batchIdx) const
+{
+    return llama_sampler_sample(d_ptr->seq_samplers.at(seq - 1), d_ptr->ctx, batchIdx);
+}
+
+bool LLamaModel::evalBatch(std::span<const SeqToken> tokens) const
+{
+    assert(!tokens.empty());
+
+    llama_batch batch = llama_batch_init(tokens.size(), 0, 1);
+
+    batch.n_tokens = tokens.size();
+
+    for (int32_t i = 0; i < batch.n_tokens; i++) {
+        batch.token   [i] = tokens[i].token;
+        batch.pos     [i] = tokens[i].pos;
+        batch.n_seq_id[i] = 1;
+        batch.seq_id  [i][0] = tokens[i].seq;
+        batch.logits  [i] = tokens[i].logits;
+    }
+
+    int res = llama_decode(d_ptr->ctx, batch);
+    if (res == 1) {
+        // sequences of different lengths fragment the cache; compact it and retry once
+        llama_kv_cache_defrag(d_ptr->ctx);
+        llama_kv_cache_update(d_ptr->ctx);
+        res = llama_decode(d_ptr->ctx, batch);
+    }
+    llama_batch_free(batch);
+    return res == 0;
+}
+
+int32_t LLamaModel::maxBatchSize() const
+{
+    return int32_t(llama_n_batch(d_ptr->ctx));
+}
+
+void LLamaModel::clearSequence(int32_t seq)
+{
+    llama_kv_cache_seq_rm(d_ptr->ctx, seq, -1, -1);
+}
+
+void LLamaModel::shiftSequence(int32_t seq, int32_t nKeep, int32_t nDiscard, int32_t nPast)
+{
+    llama_kv_cache_seq_rm (d_ptr->ctx, seq, nKeep,            nKeep + nDiscard);
+    llama_kv_cache_seq_add(d_ptr->ctx, seq, nKeep + nDiscard, nPast,            -nDiscard);
+}
+
 int32_t LLamaModel::maxContextLength(std::string const &modelPath) const
 {
     return get_arch_key_u32(modelPath, "context_length");
@@ -1173,23 +1413,45 @@ void LLamaModel::embedInternal(
     }
     inputs.clear();
 
-    if (cancelCb) {
-        // copy of batching code below, but just count tokens instead of running inference
-        unsigned nBatchTokens = 0;
-        std::vector<unsigned> batchSizes;
-        for (const auto &inp: batches) {
-            if (nBatchTokens + inp.batch.size() > n_batch) {
-                batchSizes.push_back(nBatchTokens);
-                nBatchTokens = 0;
+    // Pack the chunks into as few batches as possible: longest first, each into the fullest batch that still has room
+    // for it (best-fit decreasing). The results are summed per text, so the order they are decoded in does not matter.
+    std::vector<std::vector<const split_batch *>> packed;
+    std::vector<unsigned> batchSizes;
+    {
+        std::vector<const split_batch *> order;
+        order.reserve(batches.size());
+        for (const auto &inp: batches)
+            order.push_back(&inp);
+        std::stable_sort(order.begin(), order.end(), [](auto *a, auto *b) { return a->batch.size() > b->batch.size(); });
+
+        std::multimap<unsigned, size_t> room; // free tokens -> index of batch
+        for (auto *inp: order) {
+            unsigned n_tokens = inp->batch.size();
+            size_t ib;
+            if (auto it = room.lower_bound(n_tokens); it != room.end()) {
+                ib = it->second;
+                room.erase(it);
+            } else {
+                ib = packed.size();
+                packed.emplace_back();
+                batchSizes.push_back(0);
             }
-            nBatchTokens += inp.batch.size();
-        }
-        batchSizes.push_back(nBatchTokens);
-        if (cancelCb(batchSizes.data(), batchSizes.size(), d_ptr->backend_name)) {
-            throw std::runtime_error("operation was canceled");
+            packed[ib].push_back(inp);
+            batchSizes[ib] += n_tokens;
+            room.emplace(n_batch - batchSizes[ib], ib);
         }
     }
 
+    if (llama_verbose() && !packed.empty()) {
+        size_t nTokens = std::accumulate(batchSizes.begin(), batchSizes.end(), size_t(0));
+        std::cerr << __func__ << ": " << batches.size() << " chunks, " << nTokens << " tokens in " << packed.size()
+                  << " batches, " << std::fixed << std::setprecision(1)
+                  << 100.0 * nTokens / (packed.size() * size_t(n_batch)) << "% of n_batch\n";
+    }
+
+    if (cancelCb && cancelCb(batchSizes.data(), batchSizes.size(), d_ptr->backend_name))
+        throw std::runtime_error("operation was canceled");
+
     // initialize batch
     struct llama_batch batch = llama_batch_init(n_batch, 0, 1);
 
@@ -1238,23 +1500,16 @@ void LLamaModel::embedInternal(
         }
     };
 
-    // break into batches
-    for (const auto &inp: batches) {
-        // encode if at capacity
-        if (batch.n_tokens + inp.batch.size() > n_batch) {
-            decode();
-            batch.n_tokens = 0;
-            queued_indices.clear();
+    for (const auto &seqs: packed) {
+        batch.n_tokens = 0;
+        queued_indices.clear();
+        for (auto *inp: seqs) {
+            batch_add_seq(batch, inp->batch, queued_indices.size());
+            queued_indices.push_back(inp->idx);
         }
-
-        // add to batch
-        batch_add_seq(batch, inp.batch, queued_indices.size());
-        queued_indices.push_back(inp.idx);
+        decode();
     }
 
-    // final batch
-    decode();
-
     for (unsigned i = 0; i < texts.size(); i++) {
         auto *embd = &embeddingsSum[i * n_embd];
         auto *embd_end = embd + dimensionality;
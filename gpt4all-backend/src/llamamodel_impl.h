@@ -31,7 +31,13 @@ public:
     size_t stateSize() const override;
     size_t saveState(std::span<uint8_t> stateOut, std::vector<Token> &inputTokensOut) const override;
     size_t restoreState(std::span<const uint8_t> state, std::span<const Token> inputTokens) override;
+    size_t contextStateSize() const override;
+    size_t saveContextState(std::span<uint8_t> stateOut, std::vector<Token> &inputTokensOut) const override;
+    size_t restoreContextState(std::span<const uint8_t> state, std::span<const Token> inputTokens) override;
     void setThreadCount(int32_t n_threads) override;
+    void setPrefixCacheSize(size_t bytes) override;
+    void setRepackWeights(bool enabled) override;
+    std::string weightsPath(const std::string &modelPath, int ngl) const override;
     int32_t threadCount() const override;
     std::vector<GPUDevice> availableGPUDevices(size_t memoryRequired = 0) const override;
     bool initializeGPUDevice(size_t memoryRequired, const std::string &name) const override;
@@ -49,15 +55,17 @@ public:
     void embed(const std::vector<std::string> &texts, float *embeddings, bool isRetrieval, int dimensionality = -1,
                size_t *tokenCount = nullptr, bool doMean = true, bool atlas = false) override;
 
+    int32_t parallelSequences() const override;
+    bool supportsSpeculativeDecoding() const override;
     int32_t contextLength() const override;
     auto specialTokens() -> std::unordered_map<std::string, std::string> const override;
+    std::string_view tokenPiece(Token id) const override;
 
 protected:
-    std::vector<Token> tokenize(std::string_view str) const override;
+    std::vector<Token> tokenize(std::string_view str, bool addSpecial) const override;
     bool isSpecialToken(Token id) const override;
-    std::string tokenToString(Token id) const override;
     void initSampler(const PromptContext &ctx) override;
-    Token sampleToken() const override;
+    Token sampleToken(int32_t batchIdx = -1) const override;
     bool evalTokens(int32_t nPast, std::span<const Token> tokens) const override;
     void shiftContext(const PromptContext &promptCtx, int32_t *nPast) override;
     int32_t inputLength() const override;
@@ -67,6 +75,14 @@ protected:
     std::span<const Token> inputTokens() const override;
     const std::vector<Token> &endTokens() const override;
     bool shouldAddBOS() const override;
+    void storePrefix() override;
+    int32_t restorePrefix(std::span<const Token> input, int32_t nCached) override;
+    void initSeqSampler(int32_t seq, const PromptContext &ctx) override;
+    Token sampleSeqToken(int32_t seq, int32_t batchIdx) const override;
+    bool evalBatch(std::span<const SeqToken> tokens) const override;
+    int32_t maxBatchSize() const override;
+    void clearSequence(int32_t seq) override;
+    void shiftSequence(int32_t seq, int32_t nKeep, int32_t nDiscard, int32_t nPast) override;
     int32_t maxContextLength(std::string const &modelPath) const override;
     int32_t layerCount(std::string const &modelPath) const override;
     auto chatTemplate(const char *modelPath) const -> std::expected<std::string, std::string> override;
@@ -75,6 +91,9 @@ protected:
                        size_t *tokenCount, bool doMean, bool atlas, EmbedCancelCallback *cancelCb,
                        const EmbModelSpec *spec);
 
+    // whether loadModel with this ngl runs on the CPU and uses the repacked weights
+    bool repacksWeights(int ngl) const;
+
 private:
     std::unique_ptr<LLamaPrivate> d_ptr;
     bool m_supportsEmbedding = false;
@@ -149,6 +149,7 @@ bool llmodel_prompt(llmodel_model               model,
     auto prompt_func = [prompt_callback](std::span<const LLModel::Token> token_ids, bool cached) {
         return prompt_callback(token_ids.data(), token_ids.size(), cached);
     };
+    // pieces are NUL-terminated
     auto response_func = [response_callback](LLModel::Token token_id, std::string_view piece) {
         return response_callback(token_id, piece.data());
     };
@@ -312,6 +313,17 @@ int32_t llmodel_count_prompt_tokens(llmodel_model model, const char *prompt, con
     }
 }
 
+const char *llmodel_token_to_piece(llmodel_model model, token_t token, size_t *length)
+{
+    auto *wrapper = static_cast<const LLModelWrapper *>(model);
+    std::string_view piece;
+    if (wrapper->llModel->isModelLoaded())
+        piece = wrapper->llModel->tokenPiece(token);
+    if (length)
+        *length = piece.size();
+    return piece.empty() ? "" : piece.data();
+}
+
 void llmodel_model_foreach_special_token(llmodel_model model, llmodel_special_token_callback callback)
 {
     auto *wrapper = static_cast<const LLModelWrapper *>(model);
@@ -1,16 +1,21 @@
 #include "llmodel.h"
 
+#include "stopmatcher.h"
+
 #include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <iostream>
 #include <iterator>
+#include <memory>
 #include <optional>
 #include <ranges>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 namespace ranges = std::ranges;
@@ -21,6 +26,17 @@ void LLModel::prompt(
     const PromptCallback   &promptCallback,
     const ResponseCallback &responseCallback,
     const PromptContext    &promptCtx
+) {
+    if (!isModelLoaded())
+        throw std::invalid_argument("Attempted to prompt an unloaded model.");
+    promptTokens(tokenize(prompt, /*addSpecial*/ true), promptCallback, responseCallback, promptCtx);
+}
+
+void LLModel::promptTokens(
+    std::span<const Token>  tokens,
+    const PromptCallback   &promptCallback,
+    const ResponseCallback &responseCallback,
+    const PromptContext    &promptCtx
 ) {
     if (!isModelLoaded())
         throw std::invalid_argument("Attempted to prompt an unloaded model.");
@@ -30,20 +46,23 @@ void LLModel::prompt(
         throw std::invalid_argument("Batch size cannot be zero.");
     if (!promptCtx.n_predict)
         return; // nothing requested
-
-    auto embd_inp = tokenize(prompt);
-    if (embd_inp.empty())
+    if (tokens.empty())
         throw std::invalid_argument("Prompt tokenized to zero tokens.");
 
-    if (auto res = decodePrompt(promptCallback, promptCtx, std::move(embd_inp)))
+    if (auto res = decodePrompt(promptCallback, promptCtx, { tokens.begin(), tokens.end() }))
         generateResponse(responseCallback, promptCtx, /*n_past*/ *res);
 }
 
 int32_t LLModel::countPromptTokens(std::string_view prompt) const
+{
+    return int32_t(tokenizePrompt(prompt).size());
+}
+
+auto LLModel::tokenizePrompt(std::string_view text, bool continuation) const -> std::vector<Token>
 {
     if (!isModelLoaded())
         throw std::invalid_argument("Attempted to tokenize with an unloaded model.");
-    return int32_t(tokenize(prompt).size());
+    return tokenize(text, /*addSpecial*/ !continuation);
 }
 
 auto LLModel::decodePrompt(
@@ -62,6 +81,13 @@ auto LLModel::decodePrompt(
     // This is used to skip unnecessary work when the prompt shares a common prefix with the previous result.
     int32_t nPast = computeModelInputPosition(embd_inp);
 
+    // If the prompt diverges from the current context, keep a snapshot of it before it is overwritten and see if a
+    // snapshot of an earlier prompt is a better starting point.
+    if (nPast < inputLength()) {
+        storePrefix();
+        nPast = restorePrefix(embd_inp, nPast);
+    }
+
     // always decode up to a full batch before generating, even if cached
     nPast -= std::min(n_batch, nPast);
 
@@ -120,23 +146,50 @@ auto LLModel::decodePrompt(
     return nPast;
 }
 
+static const std::string builtinStopSequences[] {
+    "### System", "### Instruction", "### Human", "### User", "### Response", "### Assistant", "### Context",
+    "<|im_start|>", "<|im_end|>", "<|endoftext|>",
+};
+
+static StopMatcher makeStopMatcher(const LLModel::PromptContext &promptCtx)
+{
+    if (promptCtx.stopSequences.empty())
+        return StopMatcher(builtinStopSequences);
+    std::vector<std::string> sequences(std::begin(builtinStopSequences), std::end(builtinStopSequences));
+    sequences.insert(sequences.end(), promptCtx.stopSequences.begin(), promptCtx.stopSequences.end());
+    return StopMatcher(sequences);
+}
+
 /*
- * If string s overlaps with the string key such that some prefix of the key is at the end
- * of the string, return the position in s where the first match starts. Otherwise, return
- * std::string::npos. Examples:
- * s = "bfo",  key = "foo" -> 1
- * s = "fooa", key = "foo" -> npos
+ * Check newPiece, the last of the cachedLength bytes of the response not yet sent, for an end token or stop sequence.
+ * Returns whether to stop and how many of those bytes may be sent (npos if all of them).
  */
-static std::string::size_type stringsOverlap(const std::string &s, const std::string &key)
+static auto matchStopSequences(StopMatcher &matcher, std::string::size_type cachedLength, std::string_view newPiece,
+                               bool isEnd, bool isSpecial) -> std::pair<bool, std::string::size_type>
 {
-    if (s.empty() || key.empty())
-        throw std::invalid_argument("arguments to stringsOverlap must not be empty");
+    // Check for EOS
+    if (isEnd) {
+        matcher.skip(newPiece);
+        return { true, cachedLength - newPiece.size() };
+    }
 
-    for (int start = std::max(0, int(s.size()) - int(key.size())); start < s.size(); start++) {
-        if (s.compare(start, s.size(), key, 0, s.size() - start) == 0)
-            return start;
+    if (isSpecial) {
+        // Special tokens must exactly match a stop sequence
+        matcher.skip(newPiece);
+        if (matcher.isStopSequence(newPiece))
+            return { true, cachedLength - newPiece.size() };
+        return { false, std::string::npos };
     }
-    return std::string::npos;
+
+    // Check if the response contains a stop sequence
+    auto cachedStart = matcher.length() + newPiece.size() - cachedLength;
+    if (auto match = matcher.feed(newPiece); match != StopMatcher::npos)
+        return { true, match - std::min(match, cachedStart) };
+
+    // Check if the response matches the start of a stop sequence
+    if (auto partial = matcher.partialLength())
+        return { false, cachedLength - std::min(partial, cachedLength) };
+    return { false, std::string::npos };
 }
 
 void LLModel::generateResponse(
@@ -144,89 +197,82 @@ void LLModel::generateResponse(
     const PromptContext    &promptCtx,
     int32_t                 nPast
 ) {
-    static const char *stopSequences[] {
-        "### System", "### Instruction", "### Human", "### User", "### Response", "### Assistant", "### Context",
-        "<|im_start|>", "<|im_end|>", "<|endoftext|>",
-    };
-
     initSampler(promptCtx);
+    if (m_draftModel) {
+        // the draft only has to guess what the main model will pick, so it always picks its most likely token
+        PromptContext draftCtx;
+        draftCtx.temp = 0.0f;
+        draftCtx.repeat_penalty = 1.0f;
+        m_draftModel->initSampler(draftCtx);
+    }
 
-    std::string cachedResponse;
-    std::vector<Token> cachedTokens;
+    // Tokens held back while they may be part of a stop sequence, with their pieces
+    StopMatcher stopMatcher = makeStopMatcher(promptCtx);
+    std::deque<std::pair<Token, std::string_view>> cachedTokens;
+    std::string::size_type cachedLength = 0;
     int n_predicted = 0;
 
+    // Tokens decoded after the last accepted one on speculation, and the index in the last evalTokens call of the
+    // logits to sample from next. While the sampled tokens match the draft they are already decoded.
+    std::vector<Token> drafted;
+    int32_t logitsIdx = -1;
+
     // Predict next tokens
     for (bool stop = false; !stop;) {
+        std::string::size_type lengthLimit;
+
         // Sample next token
-        std::optional<Token> new_tok = sampleToken();
-        std::string new_piece = tokenToString(new_tok.value());
-        cachedTokens.push_back(new_tok.value());
-        cachedResponse += new_piece;
+        std::optional<Token> new_tok = sampleToken(logitsIdx);
+        std::string_view new_piece = cachedTokens.emplace_back(*new_tok, tokenPiece(*new_tok)).second;
+        cachedLength += new_piece.size();
+
+        auto accept = [this, &promptCtx, &new_tok, &nPast, &drafted, &logitsIdx] {
+            Token tok = std::exchange(new_tok, std::nullopt).value();
+
+            // The draft guessed right, this token was decoded by the last evalTokens call. Entries for the rest of
+            // the draft are overwritten by the next call if they turn out to be wrong.
+            if (logitsIdx >= 0 && size_t(logitsIdx) < drafted.size() && drafted[logitsIdx] == tok) {
+                appendInputToken(tok);
+                nPast++;
+                logitsIdx++;
+                return;
+            }
 
-        auto accept = [this, &promptCtx, &new_tok, &nPast] {
             // Shift context if out of space
             if (nPast >= contextLength()) {
                 shiftContext(promptCtx, &nPast);
                 assert(nPast < contextLength());
             }
 
-            // Accept the token
-            Token tok = std::exchange(new_tok, std::nullopt).value();
-            if (!evalTokens(nPast, { &tok, 1 }))
+            // Accept the token, and decode the draft that follows it in the same batch
+            drafted.clear();
+            if (m_draftModel)
+                drafted = draftTokens(tok, std::min(m_nDraft, contextLength() - nPast - 1));
+            std::vector<Token> batch { tok };
+            batch.insert(batch.end(), drafted.begin(), drafted.end());
+            if (!evalTokens(nPast, batch))
                 throw std::runtime_error("An internal error was encountered during response generation.");
 
             appendInputToken(tok);
             nPast++;
+            logitsIdx = 0;
         };
 
-        // Check for EOS
-        auto lengthLimit = std::string::npos;
-        for (const auto token : endTokens()) {
-            if (new_tok == token) {
-                stop = true;
-                lengthLimit = cachedResponse.size() - new_piece.size();
-            }
-        }
-
-        if (lengthLimit != std::string::npos) {
-            // EOS matched
-        } else if (!isSpecialToken(new_tok.value())) {
-            // Check if the response contains a stop sequence
-            for (const auto &p : stopSequences) {
-                auto match = cachedResponse.find(p);
-                if (match != std::string::npos) stop = true;
-                lengthLimit = std::min(lengthLimit, match);
-                if (match == 0) break;
-            }
-
-            // Check if the response matches the start of a stop sequence
-            if (lengthLimit == std::string::npos) {
-                for (const auto &p : stopSequences) {
-                    auto match = stringsOverlap(cachedResponse, p);
-                    lengthLimit = std::min(lengthLimit, match);
-                    if (match == 0) break;
-                }
-            }
-        } else if (ranges::find(stopSequences, new_piece) < std::end(stopSequences)) {
-            // Special tokens must exactly match a stop sequence
-            stop = true;
-            lengthLimit = cachedResponse.size() - new_piece.size();
-        }
+        bool isEnd = ranges::find(endTokens(), *new_tok) != endTokens().end();
+        std::tie(stop, lengthLimit) = matchStopSequences(stopMatcher, cachedLength, new_piece, isEnd,
+                                                         isSpecialToken(*new_tok));
 
         // Empty the cache, up to the length limit
         std::string::size_type responseLength = 0;
         while (!cachedTokens.empty()) {
-            Token tok = cachedTokens.front();
-            std::string piece = tokenToString(tok);
-
             // Stop if the piece (or part of it) does not fit within the length limit
-            if (responseLength + (stop ? 1 : piece.size()) > lengthLimit)
+            if (responseLength + (stop ? 1 : cachedTokens.front().second.size()) > lengthLimit)
                 break;
 
             // Remove token from cache
-            assert(cachedResponse.starts_with(piece));
-            cachedTokens.erase(cachedTokens.begin(), cachedTokens.begin() + 1);
-            cachedResponse.erase(cachedResponse.begin(), cachedResponse.begin() + piece.size());
+            auto [tok, piece] = cachedTokens.front();
+            cachedTokens.pop_front();
+            cachedLength -= piece.size();
 
             // Accept the token, if needed (not cached)
             if (cachedTokens.empty() && new_tok)
@@ -242,11 +288,11 @@ void LLModel::generateResponse(
             // output token IDs and could cache a partial token for the next prompt call
             responseLength += piece.size();
         }
-        assert(cachedTokens.empty() == cachedResponse.empty());
+        assert(cachedTokens.empty() == !cachedLength);
 
         // Accept the token, if needed (in cache)
         if (new_tok) {
-            assert(!cachedTokens.empty() && cachedTokens.back() == new_tok);
+            assert(!cachedTokens.empty() && cachedTokens.back().first == new_tok);
             if (stop) {
                 cachedTokens.pop_back();
             } else {
@@ -264,10 +310,286 @@ void LLModel::generateResponse(
 #ifndef NDEBUG
     auto inp = inputTokens();
     auto discard_start = inp.end() - cachedTokens.size();
-    assert(std::equal(discard_start, inp.end(), cachedTokens.begin()));
+    assert(std::equal(discard_start, inp.end(), cachedTokens.begin(), [](Token t, auto &c) { return t == c.first; }));
 #endif
 }
 
+void LLModel::setDraftModel(std::unique_ptr<LLModel> draft, int32_t nDraft)
+{
+    if (draft) {
+        if (!draft->isModelLoaded())
+            throw std::invalid_argument("draft model is not loaded");
+        if (!supportsSpeculativeDecoding() || !draft->supportsSpeculativeDecoding())
+            throw std::invalid_argument("speculative decoding is not supported by this model");
+        // Token IDs are passed between the models as-is, so they must mean the same thing to both.
+        static constexpr std::string_view probe = "The quick brown fox\njumps over 13 lazy dogs. <|im_end|>\n";
+        if (draft->tokenize(probe, true) != tokenize(probe, true) || draft->specialTokens() != specialTokens()
+            || draft->endTokens() != endTokens())
+            throw std::invalid_argument("draft model does not share the vocabulary of the main model");
+    }
+    m_draftModel = std::move(draft);
+    m_nDraft = m_draftModel ? std::max(nDraft, 1) : 0;
+}
+
+auto LLModel::draftTokens(Token next, int32_t n) -> std::vector<Token>
+{
+    LLModel &draft = *m_draftModel;
+
+    std::vector<Token> input(inputTokens().begin(), inputTokens().end());
+    input.push_back(next);
+    if (n <= 0 || int32_t(input.size()) + n > draft.contextLength())
+        return {}; // just decode without a draft, this is rare enough
+
+    // Bring the draft model up to date, reusing what it decoded before. next is always decoded again so that there
+    // are logits to sample from.
+    int32_t nPast = std::min(draft.computeModelInputPosition(input), int32_t(input.size()) - 1);
+    draft.setModelInputPosition(nPast);
+    while (nPast < int32_t(input.size())) {
+        auto batchEnd = std::min(nPast + LLMODEL_MAX_PROMPT_BATCH, int32_t(input.size()));
+        std::span batch(input.begin() + nPast, input.begin() + batchEnd);
+        if (!draft.evalTokens(nPast, batch))
+            return {};
+        for (Token tok : batch)
+            draft.appendInputToken(tok);
+        nPast = batchEnd;
+    }
+
+    std::vector<Token> drafted;
+    for (;;) {
+        Token tok = draft.sampleToken();
+        if (ranges::find(draft.endTokens(), tok) != draft.endTokens().end())
+            break; // nothing follows the end of the response
+        drafted.push_back(tok);
+        if (int32_t(drafted.size()) >= n || !draft.evalTokens(nPast, { &tok, 1 }))
+            break;
+        draft.appendInputToken(tok);
+        nPast++;
+    }
+    return drafted;
+}
+
+namespace {
+struct ParallelSlot {
+    int32_t                                 seq        = 0;
+    std::optional<LLModel::ParallelPrompt>  req;
+    std::vector<LLModel::Token>             pending;           // tokens waiting to be decoded
+    int32_t                                 nPast      = 0;
+    bool                                    generating = false; // the whole prompt has been decoded
+    int                                     nPredicted = 0;
+    std::optional<StopMatcher>              stopMatcher;
+    std::deque<std::pair<LLModel::Token, std::string_view>> cachedTokens; // held back, with their pieces
+    std::string::size_type                  cachedLength = 0;
+    int32_t                                 batchBegin = 0;     // range of this slot's tokens in the current batch
+    int32_t                                 batchEnd   = 0;
+};
+} // namespace
+
+void LLModel::promptParallel(const ParallelPromptSource &nextPrompt)
+{
+    if (!isModelLoaded())
+        throw std::invalid_argument("Attempted to prompt an unloaded model.");
+    if (!supportsCompletion())
+        throw std::invalid_argument("Not a text completion model.");
+
+    int32_t nSeq = parallelSequences();
+    if (nSeq <= 0) {
+        // no multi-sequence support, run the prompts one after another
+        while (auto req = nextPrompt())
+            prompt(req->prompt, req->promptCallback, req->responseCallback, req->ctx);
+        return;
+    }
+
+    // the context must not be held by prompt()'s conversation
+    storePrefix();
+    clearSequence(0);
+    setModelInputPosition(0);
+
+    std::vector<ParallelSlot> slots(nSeq);
+    for (int32_t i = 0; i < nSeq; i++) {
+        slots[i].seq = i + 1;
+        clearSequence(slots[i].seq);
+    }
+
+    auto finish = [this](ParallelSlot &slot) {
+        clearSequence(slot.seq);
+        auto finished = std::move(slot.req->finished);
+        int32_t seq = slot.seq;
+        slot = ParallelSlot();
+        slot.seq = seq;
+        if (finished)
+            finished();
+    };
+    auto nActive = [&slots] { return int32_t(ranges::count_if(slots, [](auto &slot) { return bool(slot.req); })); };
+
+    // Returns false if the response is complete.
+    auto handleToken = [this](ParallelSlot &slot, Token tok) -> bool {
+        auto &req = *slot.req;
+        if (!slot.stopMatcher)
+            slot.stopMatcher.emplace(makeStopMatcher(req.ctx));
+        std::string_view piece = slot.cachedTokens.emplace_back(tok, tokenPiece(tok)).second;
+        slot.cachedLength += piece.size();
+
+        bool isEnd = ranges::find(endTokens(), tok) != endTokens().end();
+        auto [stop, lengthLimit] = matchStopSequences(*slot.stopMatcher, slot.cachedLength, piece, isEnd,
+                                                      isSpecialToken(tok));
+
+        // Empty the cache, up to the length limit
+        std::string::size_type responseLength = 0;
+        while (!slot.cachedTokens.empty()) {
+            if (responseLength + (stop ? 1 : slot.cachedTokens.front().second.size()) > lengthLimit)
+                break;
+
+            auto [cachedTok, cachedPiece] = slot.cachedTokens.front();
+            slot.cachedTokens.pop_front();
+            slot.cachedLength -= cachedPiece.size();
+
+            if (!req.responseCallback(cachedTok, cachedPiece) || ++slot.nPredicted >= req.ctx.n_predict)
+                return false;
+            responseLength += cachedPiece.size();
+        }
+        return !stop;
+    };
+
+    std::vector<SeqToken> batch;
+    for (;;) {
+        // start waiting prompts on free sequences
+        bool drained = false;
+        for (auto &slot : slots) {
+            while (!slot.req && !drained) {
+                auto req = nextPrompt();
+                if (!req) {
+                    drained = true;
+                    break;
+                }
+                if (!req->ctx.n_batch)
+                    throw std::invalid_argument("Batch size cannot be zero.");
+                if (!req->ctx.n_predict) {
+                    if (req->finished)
+                        req->finished(); // nothing requested
+                    continue;
+                }
+
+                auto embd_inp = tokenize(req->prompt, /*addSpecial*/ true);
+                if (embd_inp.empty())
+                    throw std::invalid_argument("Prompt tokenized to zero tokens.");
+
+                // its share of the context once it runs, which shrinks further if more prompts join
+                const int32_t nCtxSeq = contextLength() / (nActive() + 1);
+                if (int32_t(embd_inp.size()) > nCtxSeq) {
+                    // shift the input before processing, as decodePrompt does
+                    int32_t nKeep     = shouldAddBOS();
+                    auto    newLength = int32_t(nCtxSeq * (1.f - req->ctx.contextErase));
+                    int32_t nDiscard  = int32_t(embd_inp.size()) - std::max(1, std::min(nCtxSeq, newLength));
+
+                    auto discardedTokens = embd_inp | views::drop(nKeep) | views::take(nDiscard);
+                    if (!req->promptCallback(discardedTokens, true)) {
+                        if (req->finished)
+                            req->finished();
+                        continue;
+                    }
+                    embd_inp.erase(discardedTokens.begin(), discardedTokens.end());
+                }
+
+                initSeqSampler(slot.seq, req->ctx);
+                slot.pending = std::move(embd_inp);
+                slot.req = std::move(req);
+            }
+        }
+
+        // Pack one step of every active sequence into the batch, as much of it as the batch can take. Sequences that
+        // are generating go first so that running responses never wait behind a long prefill.
+        batch.clear();
+        // the sequences share the context evenly, so that together they never hold more than it has room for
+        const int32_t nCtxSeq = contextLength() / std::max(nActive(), 1);
+        int32_t room = maxBatchSize();
+        for (bool prefill : { false, true }) {
+            for (auto &slot : slots) {
+                if (!slot.req || slot.generating == prefill)
+                    continue;
+                assert(!slot.pending.empty());
+
+                slot.batchBegin = slot.batchEnd = int32_t(batch.size());
+                int32_t n = std::min(1, room);
+                if (prefill) {
+                    int32_t n_batch = std::min(slot.req->ctx.n_batch, LLMODEL_MAX_PROMPT_BATCH);
+                    n = std::min({ n_batch, int32_t(slot.pending.size()), room });
+                }
+
+                // Shift context if out of space, also if the share of this sequence shrank as others joined. This
+                // happens even if the batch is full, so that the sequences that wait do not hold more than their share.
+                if (slot.nPast + std::max(n, 1) > nCtxSeq) {
+                    int32_t nKeep    = shouldAddBOS();
+                    int32_t nDiscard = std::max(slot.nPast + std::max(n, 1) - nCtxSeq,
+                                                int32_t(nCtxSeq * slot.req->ctx.contextErase));
+                    nDiscard = std::min(nDiscard, slot.nPast - nKeep);
+                    shiftSequence(slot.seq, nKeep, nDiscard, slot.nPast);
+                    slot.nPast -= nDiscard;
+                    n = std::min(n, nCtxSeq - slot.nPast);
+                }
+                if (n <= 0)
+                    continue; // the batch is full, this sequence waits for the next step
+                room -= n;
+
+                for (int32_t i = 0; i < n; i++)
+                    batch.push_back({ slot.pending[i], slot.seq, slot.nPast + i, false });
+                slot.batchEnd = int32_t(batch.size());
+
+                // only the last token of the prompt and generated tokens need logits
+                batch.back().logits = n == int32_t(slot.pending.size());
+            }
+        }
+
+        if (batch.empty())
+            break; // all sequences idle and nothing waiting
+
+        // FIXME(Adam): We should find a way to bubble these strings to the UI level to allow for translation
+        if (!evalBatch(batch))
+            throw std::runtime_error("An internal error was encountered during parallel prompt processing.");
+
+        for (auto &slot : slots) {
+            if (!slot.req || slot.batchBegin == slot.batchEnd)
+                continue;
+
+            int32_t n        = slot.batchEnd - slot.batchBegin;
+            int32_t lastIdx  = slot.batchEnd - 1;
+            bool wantsLogits = batch[lastIdx].logits;
+            slot.nPast += n;
+            slot.batchBegin = slot.batchEnd = 0;
+
+            if (!slot.generating) {
+                bool cancelled = false;
+                for (int32_t i = 0; i < n && !cancelled; i++)
+                    cancelled = !slot.req->promptCallback({ &slot.pending[i], 1 }, false);
+                slot.pending.erase(slot.pending.begin(), slot.pending.begin() + n);
+                if (cancelled) {
+                    finish(slot);
+                    continue;
+                }
+                if (!wantsLogits)
+                    continue; // more of the prompt to decode
+                slot.generating = true;
+            }
+
+            // Sample the next token and queue it for the next step unless the response is complete
+            Token tok = sampleSeqToken(slot.seq, lastIdx);
+            if (handleToken(slot, tok))
+                slot.pending.assign(1, tok);
+            else
+                finish(slot);
+        }
+    }
+}
+
+void LLModel::promptParallel(std::span<ParallelPrompt> prompts)
+{
+    auto it = prompts.begin();
+    promptParallel([&]() -> std::optional<ParallelPrompt> {
+        if (it == prompts.end())
+            return std::nullopt;
+        return std::move(*it++);
+    });
+}
+
 void LLModel::embed(
     const std::vector<std::string> &texts, float *embeddings, std::optional<std::string> prefix, int dimensionality,
     size_t *tokenCount, bool doMean, bool atlas, EmbedCancelCallback *cancelCb
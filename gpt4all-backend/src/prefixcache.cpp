@@ -0,0 +1,178 @@
+#include "prefixcache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <optional>
+#include <ranges>
+
+namespace ranges = std::ranges;
+
+
+struct PrefixCache::Node {
+    std::vector<Token>                  edge;     // tokens leading from the parent to this node
+    Node                               *parent = nullptr;
+    std::vector<std::unique_ptr<Node>>  children;
+    std::optional<EntryIt>              entry;    // snapshot of exactly the tokens up to this node
+
+    Node *child(Token first) const
+    {
+        auto it = ranges::find_if(children, [first](auto &c) { return c->edge.front() == first; });
+        return it == children.end() ? nullptr : it->get();
+    }
+};
+
+PrefixCache::PrefixCache(size_t budget)
+    : m_root(std::make_unique<Node>())
+    , m_budget(budget)
+{}
+
+PrefixCache::~PrefixCache() = default;
+
+void PrefixCache::setBudget(size_t bytes)
+{
+    m_budget = bytes;
+    evictOverBudget();
+}
+
+// Descend as far as input matches. Returns the deepest node reached, which may have been entered partway along its
+// edge, and the number of matched tokens.
+auto PrefixCache::walk(std::span<const Token> input) const -> std::pair<Node *, int32_t>
+{
+    Node *node = m_root.get();
+    size_t depth = 0;
+    while (depth < input.size()) {
+        Node *child = node->child(input[depth]);
+        if (!child)
+            break;
+        auto [edgeIt, _] = ranges::mismatch(child->edge, input.subspan(depth));
+        depth += edgeIt - child->edge.begin();
+        node = child;
+        if (edgeIt != child->edge.end())
+            break;
+    }
+    return { node, int32_t(depth) };
+}
+
+auto PrefixCache::find(std::span<const Token> input) -> Match
+{
+    auto [node, depth] = walk(input);
+    if (!depth)
+        return {};
+
+    // every snapshot below node shares the matched prefix, so restore the smallest one
+    std::optional<EntryIt> best;
+    std::vector<const Node *> stack { node };
+    while (!stack.empty()) {
+        auto *n = stack.back();
+        stack.pop_back();
+        if (n->entry && (!best || (*n->entry)->tokens.size() < (*best)->tokens.size()))
+            best = n->entry;
+        for (auto &c : n->children)
+            stack.push_back(c.get());
+    }
+    assert(best); // childless nodes without a snapshot are pruned
+
+    m_entries.splice(m_entries.begin(), m_entries, *best);
+    return { &**best, depth };
+}
+
+bool PrefixCache::covers(std::span<const Token> tokens) const
+{
+    auto [node, depth] = walk(tokens);
+    return depth > 0 && size_t(depth) == tokens.size();
+}
+
+// Split the edge of child after n tokens and return the new intermediate node.
+auto PrefixCache::split(Node *child, size_t n) -> Node *
+{
+    assert(n > 0 && n < child->edge.size());
+    auto *parent = child->parent;
+    auto &slot = *ranges::find_if(parent->children, [child](auto &c) { return c.get() == child; });
+
+    auto mid = std::make_unique<Node>();
+    mid->edge.assign(child->edge.begin(), child->edge.begin() + n);
+    mid->parent = parent;
+    child->edge.erase(child->edge.begin(), child->edge.begin() + n);
+    child->parent = mid.get();
+    mid->children.push_back(std::exchange(slot, nullptr));
+    slot = std::move(mid);
+    return slot.get();
+}
+
+bool PrefixCache::insert(std::vector<Token> tokens, std::vector<uint8_t> state)
+{
+    if (tokens.empty() || state.size() > m_budget)
+        return false;
+
+    // Descend to the node for tokens, creating it if needed. Snapshots passed on the way are prefixes of the new one
+    // and can be dropped, as the new snapshot serves every input they could.
+    std::vector<EntryIt> superseded;
+    Node *node = m_root.get();
+    size_t depth = 0;
+    while (depth < tokens.size()) {
+        if (node->entry)
+            superseded.push_back(*node->entry);
+        Node *child = node->child(tokens[depth]);
+        if (!child) {
+            auto leaf = std::make_unique<Node>();
+            leaf->edge.assign(tokens.begin() + depth, tokens.end());
+            leaf->parent = node;
+            node = node->children.emplace_back(std::move(leaf)).get();
+            break;
+        }
+        auto [edgeIt, _] = ranges::mismatch(child->edge, std::span(tokens).subspan(depth));
+        size_t n = edgeIt - child->edge.begin();
+        if (n < child->edge.size())
+            child = split(child, n);
+        node = child;
+        depth += n;
+    }
+
+    for (auto it : superseded)
+        remove(it);
+
+    if (node->entry) {
+        // same tokens, replace the snapshot
+        auto it = *node->entry;
+        m_usedBytes -= it->state.size();
+        m_usedBytes += state.size();
+        it->state = std::move(state);
+        m_entries.splice(m_entries.begin(), m_entries, it);
+    } else {
+        m_usedBytes += state.size();
+        m_entries.push_front({ std::move(tokens), std::move(state), node });
+        node->entry = m_entries.begin();
+    }
+
+    evictOverBudget();
+    return true;
+}
+
+void PrefixCache::remove(EntryIt it)
+{
+    Node *node = it->node;
+    node->entry.reset();
+    m_usedBytes -= it->state.size();
+    m_entries.erase(it);
+
+    // prune nodes that no longer lead to a snapshot
+    while (node != m_root.get() && !node->entry && node->children.empty()) {
+        Node *parent = node->parent;
+        std::erase_if(parent->children, [node](auto &c) { return c.get() == node; });
+        node = parent;
+    }
+}
+
+void PrefixCache::evictOverBudget()
+{
+    while (m_usedBytes > m_budget && !m_entries.empty())
+        remove(std::prev(m_entries.end()));
+}
+
+void PrefixCache::clear()
+{
+    m_entries.clear();
+    m_root = std::make_unique<Node>();
+    m_usedBytes = 0;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "llmodel.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+
+/*
+ * An LRU cache of KV state snapshots, indexed by a radix trie over the tokens each snapshot was decoded from.
+ *
+ * The KV entries of a transformer at position i only depend on tokens [0, i], so a snapshot can serve any input that
+ * shares a prefix with it: restore it, then truncate the sequence to the length of the common prefix. Lookups
+ * therefore return the snapshot with the longest common prefix, not just snapshots that are a prefix of the input.
+ */
+class PrefixCache {
+    struct Node;
+
+public:
+    using Token = LLModel::Token;
+
+    struct Entry {
+        std::vector<Token>    tokens;
+        std::vector<uint8_t>  state;
+        Node                 *node;
+    };
+
+    struct Match {
+        const Entry *entry  = nullptr;
+        int32_t      length = 0;       // length of the prefix shared with the input
+    };
+
+    explicit PrefixCache(size_t budget = 0);
+    ~PrefixCache();
+
+    size_t budget() const { return m_budget; }
+    void setBudget(size_t bytes);
+    size_t usedBytes() const { return m_usedBytes; }
+
+    // Find the snapshot sharing the longest prefix with input and mark it as recently used.
+    Match find(std::span<const Token> input);
+    // True if some snapshot already covers all of tokens.
+    bool covers(std::span<const Token> tokens) const;
+    // Add a snapshot, dropping snapshots it supersedes and evicting the least recently used ones to stay within the
+    // budget. Returns false if the snapshot alone does not fit.
+    bool insert(std::vector<Token> tokens, std::vector<uint8_t> state);
+    void clear();
+
+private:
+    using EntryIt = std::list<Entry>::iterator;
+
+    auto walk(std::span<const Token> input) const -> std::pair<Node *, int32_t>;
+    Node *split(Node *child, size_t n);
+    void remove(EntryIt it);
+    void evictOverBudget();
+
+    std::unique_ptr<Node> m_root;
+    std::list<Entry>      m_entries;  // most recently used first
+    size_t                m_budget;
+    size_t                m_usedBytes = 0;
+};
@@ -0,0 +1,92 @@
+#include "stopmatcher.h"
+
+#include <algorithm>
+#include <deque>
+#include <ranges>
+
+namespace ranges = std::ranges;
+
+
+StopMatcher::StopMatcher(std::span<const std::string> sequences)
+    : m_nodes(1)
+{
+    // build the trie
+    for (const auto &seq : sequences) {
+        int32_t node = 0;
+        for (char ch : seq) {
+            auto c = uint8_t(ch);
+            int32_t next = child(node, c);
+            if (next < 0) {
+                next = int32_t(m_nodes.size());
+                m_nodes.push_back({ .next = {}, .fail = 0, .depth = m_nodes[node].depth + 1, .match = 0, .end = false });
+                m_nodes[node].next.emplace_back(c, next);
+            }
+            node = next;
+        }
+        if (node) {
+            m_nodes[node].end   = true;
+            m_nodes[node].match = m_nodes[node].depth;
+        }
+    }
+
+    // link each node to its longest proper suffix in the trie, shallower nodes first so their links are ready
+    std::deque<int32_t> queue;
+    for (auto [c, next] : m_nodes[0].next)
+        queue.push_back(next);
+    while (!queue.empty()) {
+        int32_t node = queue.front();
+        queue.pop_front();
+        for (auto [c, next] : m_nodes[node].next) {
+            int32_t fail = step(m_nodes[node].fail, c);
+            m_nodes[next].fail  = fail;
+            m_nodes[next].match = std::max(m_nodes[next].match, m_nodes[fail].match);
+            queue.push_back(next);
+        }
+    }
+}
+
+int32_t StopMatcher::child(int32_t node, uint8_t c) const
+{
+    auto &next = m_nodes[node].next;
+    auto it = ranges::find(next, c, &std::pair<uint8_t, int32_t>::first);
+    return it == next.end() ? -1 : it->second;
+}
+
+int32_t StopMatcher::step(int32_t node, uint8_t c) const
+{
+    for (;;) {
+        if (int32_t next = child(node, c); next >= 0)
+            return next;
+        if (!node)
+            return 0;
+        node = m_nodes[node].fail;
+    }
+}
+
+size_t StopMatcher::feed(std::string_view piece)
+{
+    size_t match = npos;
+    for (char ch : piece) {
+        m_state = step(m_state, uint8_t(ch));
+        m_length++;
+        if (int32_t n = m_nodes[m_state].match)
+            match = std::min(match, m_length - size_t(n));
+    }
+    return match;
+}
+
+void StopMatcher::skip(std::string_view piece)
+{
+    m_state = 0;
+    m_length += piece.size();
+}
+
+bool StopMatcher::isStopSequence(std::string_view s) const
+{
+    int32_t node = 0;
+    for (char ch : s) {
+        if ((node = child(node, uint8_t(ch))) < 0)
+            return false;
+    }
+    return node && m_nodes[node].end;
+}
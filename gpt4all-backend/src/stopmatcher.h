@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+/*
+ * Finds stop sequences in a response while it is generated, one piece at a time.
+ *
+ * This is an Aho-Corasick automaton over all of the stop sequences, and its state is carried from one piece to the
+ * next. Every byte of the response is therefore looked at once, however many stop sequences there are and however long
+ * the response gets. The state also tells how much of the end of the response could still become a stop sequence,
+ * which is what must be held back from the caller.
+ */
+class StopMatcher {
+public:
+    static constexpr size_t npos = size_t(-1);
+
+    // Empty sequences are ignored.
+    explicit StopMatcher(std::span<const std::string> sequences);
+
+    // Append piece to the response. Returns the offset in the response of the earliest stop sequence that ends within
+    // piece, or npos if there is none.
+    size_t feed(std::string_view piece);
+    // Append piece to the response without matching it, no stop sequence can span it.
+    void skip(std::string_view piece);
+
+    bool isStopSequence(std::string_view s) const;
+    // The length of the longest suffix of the response that is the start of a stop sequence.
+    size_t partialLength() const { return size_t(m_nodes[m_state].depth); }
+    size_t length() const { return m_length; }
+
+private:
+    struct Node {
+        std::vector<std::pair<uint8_t, int32_t>> next;      // trie edges, by byte
+        int32_t                                  fail  = 0; // longest proper suffix that is also in the trie
+        int32_t                                  depth = 0;
+        int32_t                                  match = 0; // longest stop sequence that is a suffix of this node
+        bool                                     end   = false; // a stop sequence ends exactly here
+    };
+
+    int32_t child(int32_t node, uint8_t c) const;
+    int32_t step(int32_t node, uint8_t c) const;
+
+    std::vector<Node> m_nodes;
+    int32_t           m_state  = 0;
+    size_t            m_length = 0;
+};
@@ -0,0 +1,219 @@
+#include "weightrepack.h"
+
+#include <ggml.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+
+static constexpr int         REPACK_ROWS       = 8; // rows interleaved by Q4_0_8_8
+static constexpr int         REPACK_INTERLEAVE = 8; // bytes taken from each row at a time
+static constexpr const char *REPACK_SUFFIX     = ".cpu-q4_0x8";
+static constexpr const char *KEY_SOURCE_SIZE   = "gpt4all.repack.source_size";
+static constexpr const char *KEY_SOURCE_MTIME  = "gpt4all.repack.source_mtime";
+static constexpr size_t      COPY_BUFFER_SIZE  = 1 << 20;
+
+// ggml's block_q4_0, which is not part of its public headers
+struct BlockQ4_0 {
+    uint16_t d;      // fp16 scale
+    uint8_t  qs[16]; // 32 nibbles, offset by 8
+};
+static_assert(sizeof(BlockQ4_0) == 18);
+
+struct BlockQ4_0x8 {
+    uint16_t d [REPACK_ROWS];
+    uint8_t  qs[REPACK_ROWS * sizeof(BlockQ4_0::qs)];
+};
+static_assert(sizeof(BlockQ4_0x8) == REPACK_ROWS * sizeof(BlockQ4_0));
+
+// Does what make_block_q4_0x8 of ggml-aarch64.c does, its kernels also expect the nibbles without the offset.
+static BlockQ4_0x8 interleave(const BlockQ4_0 *in)
+{
+    BlockQ4_0x8 out;
+    for (int i = 0; i < REPACK_ROWS; i++)
+        out.d[i] = in[i].d;
+    for (int i = 0; i < int(sizeof out.qs); i++) {
+        int src    = i % (REPACK_ROWS * REPACK_INTERLEAVE) / REPACK_INTERLEAVE;
+        int offset = i / (REPACK_ROWS * REPACK_INTERLEAVE) * REPACK_INTERLEAVE + i % REPACK_INTERLEAVE;
+        out.qs[i] = in[src].qs[offset] ^ 0x88;
+    }
+    return out;
+}
+
+static bool shouldRepack(const ggml_tensor *t)
+{
+    // token embeddings are looked up by row, which Q4_0_8_8 has no kernel for
+    return t->type == GGML_TYPE_Q4_0 && ggml_n_dims(t) == 2 && t->ne[1] % REPACK_ROWS == 0
+        && std::string_view(t->name) != "token_embd.weight";
+}
+
+struct GGUFDeleter {
+    void operator()(gguf_context *ctx) const { gguf_free(ctx); }
+    void operator()(ggml_context *ctx) const { ggml_free(ctx); }
+};
+
+static bool isCurrent(const std::string &repackedPath, uint64_t sourceSize, uint64_t sourceMTime)
+{
+    std::error_code ec;
+    if (!fs::exists(repackedPath, ec))
+        return false;
+    std::unique_ptr<gguf_context, GGUFDeleter> ctx(
+        gguf_init_from_file(repackedPath.c_str(), { /*no_alloc*/ true, /*ctx*/ nullptr })
+    );
+    if (!ctx)
+        return false;
+    auto value = [&](const char *key) -> std::optional<uint64_t> {
+        int id = gguf_find_key(ctx.get(), key);
+        if (id < 0 || gguf_get_kv_type(ctx.get(), id) != GGUF_TYPE_UINT64)
+            return std::nullopt;
+        return gguf_get_val_u64(ctx.get(), id);
+    };
+    return value(KEY_SOURCE_SIZE) == sourceSize && value(KEY_SOURCE_MTIME) == sourceMTime;
+}
+
+std::optional<std::string> currentRepackedModelPath(const std::string &modelPath)
+{
+    const std::string repackedPath = modelPath + REPACK_SUFFIX;
+    std::error_code ec;
+    const uint64_t sourceSize = fs::file_size(modelPath, ec);
+    if (ec)
+        return std::nullopt;
+    const auto sourceMTime = uint64_t(fs::last_write_time(modelPath, ec).time_since_epoch().count());
+    if (ec || !isCurrent(repackedPath, sourceSize, sourceMTime))
+        return std::nullopt;
+    return repackedPath;
+}
+
+std::optional<std::string> repackedModelPath(const std::string &modelPath, const std::function<bool(float)> &progress)
+{
+    const std::string repackedPath = modelPath + REPACK_SUFFIX;
+    std::error_code ec;
+    const uint64_t sourceSize = fs::file_size(modelPath, ec);
+    if (ec)
+        return std::nullopt;
+    const auto sourceMTime = uint64_t(fs::last_write_time(modelPath, ec).time_since_epoch().count());
+    if (ec)
+        return std::nullopt;
+    if (isCurrent(repackedPath, sourceSize, sourceMTime))
+        return repackedPath;
+
+    ggml_context *metaRaw = nullptr;
+    std::unique_ptr<gguf_context, GGUFDeleter> ctx(
+        gguf_init_from_file(modelPath.c_str(), { /*no_alloc*/ true, /*ctx*/ &metaRaw })
+    );
+    std::unique_ptr<ggml_context, GGUFDeleter> meta(metaRaw);
+    if (!ctx)
+        return std::nullopt;
+
+    struct Tensor {
+        ggml_tensor *tensor;
+        size_t       sourceOffset; // in the data section of the model
+        bool         repack;
+    };
+    std::vector<Tensor> tensors;
+    size_t totalBytes = 0;
+    bool anyRepacked = false;
+    const size_t sourceDataOffset = gguf_get_data_offset(ctx.get());
+    for (int i = 0; i < int(gguf_get_n_tensors(ctx.get())); i++) {
+        ggml_tensor *t = ggml_get_tensor(meta.get(), gguf_get_tensor_name(ctx.get(), i));
+        bool repack = shouldRepack(t);
+        tensors.push_back({ t, gguf_get_tensor_offset(ctx.get(), i), repack });
+        totalBytes += ggml_nbytes(t);
+        anyRepacked |= repack;
+    }
+    if (!anyRepacked)
+        return std::nullopt;
+
+    // The blocks keep their size, but the offsets are laid out anew in the order of the tensors, which is why the
+    // source offsets were taken first.
+    for (auto &t : tensors) {
+        if (t.repack)
+            gguf_set_tensor_type(ctx.get(), t.tensor->name, GGML_TYPE_Q4_0_8_8);
+    }
+    gguf_set_val_u64(ctx.get(), KEY_SOURCE_SIZE, sourceSize);
+    gguf_set_val_u64(ctx.get(), KEY_SOURCE_MTIME, sourceMTime);
+
+    std::vector<char> header(gguf_get_meta_size(ctx.get())); // padded to the data alignment
+    gguf_get_meta_data(ctx.get(), header.data());
+
+    // written under another name and renamed once complete, so that a partial file is never mistaken for a current one
+    const std::string tempPath = repackedPath + ".tmp"
+        + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    auto fail = [&](const char *what) -> std::optional<std::string> {
+        if (what)
+            std::cerr << "warning: could not repack " << modelPath << ": " << what << "\n";
+        fs::remove(tempPath, ec);
+        return std::nullopt;
+    };
+
+    {
+        std::ifstream in(modelPath, std::ios::binary);
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!in || !out)
+            return fail("could not open the files");
+        out.write(header.data(), std::streamsize(header.size()));
+
+        std::vector<char> buffer(COPY_BUFFER_SIZE);
+        size_t doneBytes = 0;
+        for (int i = 0; i < int(tensors.size()); i++) {
+            const auto &t = tensors[i];
+            const size_t nbytes = ggml_nbytes(t.tensor);
+
+            // pad up to the new offset
+            const auto outOffset = std::streamoff(header.size() + gguf_get_tensor_offset(ctx.get(), i));
+            for (auto pos = std::streamoff(out.tellp()); pos < outOffset; pos++)
+                out.put('\0');
+
+            in.seekg(std::streamoff(sourceDataOffset + t.sourceOffset));
+            if (t.repack) {
+                // the blocks of REPACK_ROWS rows at a time, block x of every row goes into output block x
+                const int64_t nblocks  = t.tensor->ne[0] / ggml_blck_size(GGML_TYPE_Q4_0);
+                const size_t groupSize = size_t(nblocks) * REPACK_ROWS * sizeof(BlockQ4_0);
+                std::vector<BlockQ4_0>   rows(size_t(nblocks) * REPACK_ROWS);
+                std::vector<BlockQ4_0x8> packed(nblocks);
+                for (size_t done = 0; done < nbytes; done += groupSize) {
+                    in.read(reinterpret_cast<char *>(rows.data()), std::streamsize(groupSize));
+                    for (int64_t x = 0; x < nblocks; x++) {
+                        BlockQ4_0 column[REPACK_ROWS];
+                        for (int r = 0; r < REPACK_ROWS; r++)
+                            column[r] = rows[size_t(r * nblocks + x)];
+                        packed[x] = interleave(column);
+                    }
+                    out.write(reinterpret_cast<const char *>(packed.data()), std::streamsize(groupSize));
+                }
+            } else {
+                for (size_t done = 0; done < nbytes; done += buffer.size()) {
+                    auto n = std::streamsize(std::min(buffer.size(), nbytes - done));
+                    in.read(buffer.data(), n);
+                    out.write(buffer.data(), n);
+                }
+            }
+            if (!in || !out)
+                return fail("read or write failed");
+
+            doneBytes += nbytes;
+            if (progress && !progress(float(doneBytes) / float(totalBytes)))
+                return fail(nullptr);
+        }
+        out.close();
+        if (!out)
+            return fail("write failed");
+    }
+
+    fs::rename(tempPath, repackedPath, ec);
+    if (ec)
+        return fail("could not rename the repacked file");
+    return repackedPath;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <string>
+
+
+/*
+ * Q4_0 weights repacked for the CPU. The Q4_0_8_8 type of ggml-aarch64 interleaves the blocks of each group of 8 rows
+ * 8 bytes at a time, so that its GEMV and GEMM kernels compute 8 rows with every load instead of walking them one after
+ * another. The blocks keep their size, so a repacked file has the same layout as the model and can be mapped just the
+ * same.
+ *
+ * Returns the path of the repacked copy of modelPath, which is kept next to it and written first if it is missing or
+ * stale. Returns nullopt if the model has no weights to repack, or if writing the copy fails or progress returns false.
+ */
+std::optional<std::string> repackedModelPath(const std::string &modelPath, const std::function<bool(float)> &progress);
+// The path of the repacked copy of modelPath if it is up to date, without writing it.
+std::optional<std::string> currentRepackedModelPath(const std::string &modelPath);
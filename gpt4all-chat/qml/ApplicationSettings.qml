@@ -553,6 +553,123 @@ MySettingsTab {
             Accessible.name: serverPortLabel.text
             Accessible.description: serverPortLabel.helpText
         }
+        MySettingsLabel {
+            id: prewarmLabel
+            text: qsTr("Prewarm Models")
+            helpText: qsTr("Read a model file into memory with several threads before loading it, which makes loading faster from slow disks.")
+            Layout.row: 16
+            Layout.column: 0
+        }
+        MyCheckBox {
+            id: prewarmBox
+            Layout.row: 16
+            Layout.column: 2
+            Layout.alignment: Qt.AlignRight
+            checked: MySettings.prewarmModels
+            onClicked: {
+                MySettings.prewarmModels = !MySettings.prewarmModels
+            }
+        }
+        MySettingsLabel {
+            id: repackLabel
+            text: qsTr("Repack Weights for CPU")
+            helpText: qsTr("Keep a copy of Q4_0 models with their weights rearranged for faster CPU inference. Uses extra disk space. Takes effect when a model is loaded.")
+            Layout.row: 17
+            Layout.column: 0
+        }
+        MyCheckBox {
+            id: repackBox
+            Layout.row: 17
+            Layout.column: 2
+            Layout.alignment: Qt.AlignRight
+            checked: MySettings.repackWeights
+            onClicked: {
+                MySettings.repackWeights = !MySettings.repackWeights
+            }
+        }
+        MySettingsLabel {
+            id: memoryBudgetLabel
+            text: qsTr("Model Memory Budget (MiB)")
+            helpText: qsTr("How much memory the models that are loaded may use together. Models no chat is using stay loaded within it. 0 uses half of the system RAM.")
+            Layout.row: 18
+            Layout.column: 0
+        }
+        MyTextField {
+            id: memoryBudgetField
+            text: MySettings.modelMemoryBudget
+            color: theme.textColor
+            font.pixelSize: theme.fontSizeLarge
+            Layout.row: 18
+            Layout.column: 2
+            Layout.minimumWidth: 200
+            Layout.maximumWidth: 200
+            Layout.alignment: Qt.AlignRight
+            validator: IntValidator {
+                bottom: 0
+            }
+            onEditingFinished: {
+                var val = parseInt(text)
+                if (!isNaN(val)) {
+                    MySettings.modelMemoryBudget = val
+                    focus = false
+                } else {
+                    text = MySettings.modelMemoryBudget
+                }
+            }
+            Accessible.role: Accessible.EditableText
+            Accessible.name: memoryBudgetLabel.text
+            Accessible.description: memoryBudgetLabel.helpText
+        }
+        MySettingsLabel {
+            id: prefixCacheLabel
+            text: qsTr("Prompt Cache Size (MiB)")
+            helpText: qsTr("How much memory may hold the processed beginnings of recent prompts, so that prompts starting the same way are answered sooner. 0 disables it.")
+            Layout.row: 19
+            Layout.column: 0
+        }
+        MyTextField {
+            id: prefixCacheField
+            text: MySettings.prefixCacheSize
+            color: theme.textColor
+            font.pixelSize: theme.fontSizeLarge
+            Layout.row: 19
+            Layout.column: 2
+            Layout.minimumWidth: 200
+            Layout.maximumWidth: 200
+            Layout.alignment: Qt.AlignRight
+            validator: IntValidator {
+                bottom: 0
+            }
+            onEditingFinished: {
+                var val = parseInt(text)
+                if (!isNaN(val)) {
+                    MySettings.prefixCacheSize = val
+                    focus = false
+                } else {
+                    text = MySettings.prefixCacheSize
+                }
+            }
+            Accessible.role: Accessible.EditableText
+            Accessible.name: prefixCacheLabel.text
+            Accessible.description: prefixCacheLabel.helpText
+        }
+        MySettingsLabel {
+            id: saveChatsContextLabel
+            text: qsTr("Save Chat Context")
+            helpText: qsTr("Save the processed context of each chat to disk after every response, so that switching back to a long chat is faster. Uses up to 4 GiB of disk space in the models folder, chats with a larger context are not saved.")
+            Layout.row: 20
+            Layout.column: 0
+        }
+        MyCheckBox {
+            id: saveChatsContextBox
+            Layout.row: 20
+            Layout.column: 2
+            Layout.alignment: Qt.AlignRight
+            checked: MySettings.saveChatsContext
+            onClicked: {
+                MySettings.saveChatsContext = !MySettings.saveChatsContext
+            }
+        }
 
         /*MySettingsLabel {
             id: gpuOverrideLabel
@@ -577,12 +694,12 @@ MySettingsTab {
             id: updatesLabel
             text: qsTr("Check For Updates")
             helpText: qsTr("Manually check for an update to GPT4All.");
-            Layout.row: 16
+            Layout.row: 21
             Layout.column: 0
         }
 
         MySettingsButton {
-            Layout.row: 16
+            Layout.row: 21
             Layout.column: 2
             Layout.alignment: Qt.AlignRight
             text: qsTr("Updates");
@@ -593,7 +710,7 @@ MySettingsTab {
         }
 
         Rectangle {
-            Layout.row: 17
+            Layout.row: 22
             Layout.column: 0
             Layout.columnSpan: 3
             Layout.fillWidth: true
@@ -312,6 +312,45 @@ MySettingsTab {
             }
         }
 
+        RowLayout {
+            Layout.topMargin: 15
+            MySettingsLabel {
+                id: vectorStorageLabel
+                text: qsTr("Vector Index Storage")
+                helpText: qsTr("How embeddings are stored in the search index. Int8 and Binary use 4x and 32x less memory, the best matches are then rescored at full precision.")
+            }
+            MyComboBox {
+                id: vectorStorageBox
+                Layout.minimumWidth: 200
+                Layout.maximumWidth: 200
+                Layout.fillWidth: false
+                Layout.alignment: Qt.AlignRight
+                // NOTE: indices match values of VectorStorage enum, keep them in sync
+                model: ListModel {
+                    ListElement { name: qsTr("Float32") }
+                    ListElement { name: qsTr("Int8") }
+                    ListElement { name: qsTr("Binary") }
+                }
+                Accessible.name: vectorStorageLabel.text
+                Accessible.description: vectorStorageLabel.helpText
+                function updateModel() {
+                    vectorStorageBox.currentIndex = MySettings.localDocsVectorStorage;
+                }
+                Component.onCompleted: {
+                    vectorStorageBox.updateModel()
+                }
+                Connections {
+                    target: MySettings
+                    function onLocalDocsVectorStorageChanged() {
+                        vectorStorageBox.updateModel()
+                    }
+                }
+                onActivated: {
+                    MySettings.localDocsVectorStorage = vectorStorageBox.currentIndex
+                }
+            }
+        }
+
         Rectangle {
             Layout.topMargin: 15
             Layout.fillWidth: true
@@ -984,6 +984,94 @@ MySettingsTab {
                 Accessible.name: gpuLayersLabel.text
                 Accessible.description: ToolTip.text
             }
+
+            MySettingsLabel {
+                id: draftModelLabel
+                visible: !root.currentModelInfo.isOnline
+                text: qsTr("Draft Model")
+                helpText: qsTr("File name of a small model that speeds up generation.")
+                Layout.row: 5
+                Layout.column: 2
+                Layout.maximumWidth: 300 * theme.fontScale
+            }
+            MyTextField {
+                id: draftModelField
+                visible: !root.currentModelInfo.isOnline
+                text: root.currentModelInfo.draftModel
+                font.pixelSize: theme.fontSizeLarge
+                color: theme.textColor
+                ToolTip.text: qsTr("An installed model with the same vocabulary that guesses the next few tokens, which this model then checks all at once. This does not change the output. Leave empty to disable.\nNOTE: Does not take effect until you reload the model.")
+                ToolTip.visible: hovered
+                Layout.row: 5
+                Layout.column: 3
+                Connections {
+                    target: MySettings
+                    function onDraftModelChanged() {
+                        draftModelField.text = root.currentModelInfo.draftModel
+                    }
+                }
+                Connections {
+                    target: root
+                    function onCurrentModelInfoChanged() {
+                        draftModelField.text = root.currentModelInfo.draftModel
+                    }
+                }
+                onEditingFinished: {
+                    MySettings.setModelDraftModel(root.currentModelInfo, text.trim())
+                    focus = false
+                }
+                Accessible.role: Accessible.EditableText
+                Accessible.name: draftModelLabel.text
+                Accessible.description: ToolTip.text
+            }
+
+            MySettingsLabel {
+                id: draftTokensLabel
+                visible: !root.currentModelInfo.isOnline
+                text: qsTr("Draft Tokens")
+                helpText: qsTr("Number of tokens the draft model guesses at a time.")
+                Layout.row: 5
+                Layout.column: 0
+                Layout.maximumWidth: 300 * theme.fontScale
+            }
+            MyTextField {
+                id: draftTokensField
+                visible: !root.currentModelInfo.isOnline
+                text: root.currentModelInfo.draftTokens
+                color: theme.textColor
+                font.pixelSize: theme.fontSizeLarge
+                ToolTip.text: qsTr("More tokens help when the draft model is usually right, fewer when it is often wrong.\nNOTE: Does not take effect until you reload the model.")
+                ToolTip.visible: hovered
+                Layout.row: 5
+                Layout.column: 1
+                validator: IntValidator {
+                    bottom: 1
+                }
+                Connections {
+                    target: MySettings
+                    function onDraftTokensChanged() {
+                        draftTokensField.text = root.currentModelInfo.draftTokens;
+                    }
+                }
+                Connections {
+                    target: root
+                    function onCurrentModelInfoChanged() {
+                        draftTokensField.text = root.currentModelInfo.draftTokens;
+                    }
+                }
+                onEditingFinished: {
+                    var val = parseInt(text)
+                    if (!isNaN(val)) {
+                        MySettings.setModelDraftTokens(root.currentModelInfo, val)
+                        focus = false
+                    } else {
+                        text = root.currentModelInfo.draftTokens
+                    }
+                }
+                Accessible.role: Accessible.EditableText
+                Accessible.name: draftTokensLabel.text
+                Accessible.description: ToolTip.text
+            }
         }
 
         Rectangle {
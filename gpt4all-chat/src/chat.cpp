@@ -1,6 +1,8 @@
 #include "chat.h"
 
 #include "chatlistmodel.h"
+#include "modelprewarmer.h"
+#include "mysettings.h"
 #include "network.h"
 #include "server.h"
 #include "tool.h"
@@ -330,6 +332,13 @@ void Chat::setModelInfo(const ModelInfo &modelInfo)
     } else if (isModelLoaded())
         return;
 
+    // start reading the weights while the chat's thread gets to loading them, which may have to wait for another chat.
+    // With repacking, which file has the weights depends on the device, so that waits for the load.
+    auto *mySettings = MySettings::globalInstance();
+    if (!modelInfo.isOnline && !modelInfo.filename().isEmpty() && mySettings->prewarmModels()
+        && !mySettings->repackWeights())
+        ModelPrewarmer::globalInstance()->prewarm(modelInfo.dirpath + modelInfo.filename());
+
     emit modelInfoChanged();
     emit modelChangeRequested(modelInfo);
 }
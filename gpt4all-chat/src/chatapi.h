@@ -75,6 +75,13 @@ public:
                 const ResponseCallback &responseCallback,
                 const PromptContext    &ctx) override;
 
+    [[noreturn]]
+    void promptTokens(std::span<const Token>  tokens,
+                      const PromptCallback   &promptCallback,
+                      const ResponseCallback &responseCallback,
+                      const PromptContext    &ctx) override
+    { Q_UNUSED(tokens); Q_UNUSED(promptCallback); Q_UNUSED(responseCallback); Q_UNUSED(ctx); throwNotImplemented(); }
+
     [[noreturn]]
     int32_t countPromptTokens(std::string_view prompt) const override
     { Q_UNUSED(prompt); throwNotImplemented(); }
@@ -96,6 +103,10 @@ public:
     auto specialTokens() -> std::unordered_map<std::string, std::string> const override
     { return {}; }
 
+    [[noreturn]]
+    std::string_view tokenPiece(Token id) const override
+    { Q_UNUSED(id); throwNotImplemented(); }
+
 Q_SIGNALS:
     void request(const QString &apiKey, const QByteArray &array);
 
@@ -108,24 +119,20 @@ protected:
     static void throwNotImplemented() { throw std::logic_error("not implemented"); }
 
     [[noreturn]]
-    std::vector<Token> tokenize(std::string_view str) const override
-    { Q_UNUSED(str); throwNotImplemented(); }
+    std::vector<Token> tokenize(std::string_view str, bool addSpecial) const override
+    { Q_UNUSED(str); Q_UNUSED(addSpecial); throwNotImplemented(); }
 
     [[noreturn]]
     bool isSpecialToken(Token id) const override
     { Q_UNUSED(id); throwNotImplemented(); }
 
-    [[noreturn]]
-    std::string tokenToString(Token id) const override
-    { Q_UNUSED(id); throwNotImplemented(); }
-
     [[noreturn]]
     void initSampler(const PromptContext &ctx) override
     { Q_UNUSED(ctx); throwNotImplemented(); }
 
     [[noreturn]]
-    Token sampleToken() const override
-    { throwNotImplemented(); }
+    Token sampleToken(int32_t batchIdx) const override
+    { Q_UNUSED(batchIdx); throwNotImplemented(); }
 
     [[noreturn]]
     bool evalTokens(int32_t nPast, std::span<const Token> tokens) const override
@@ -163,6 +170,26 @@ protected:
     std::span<const Token> inputTokens() const override
     { throwNotImplemented(); }
 
+    [[noreturn]]
+    void initSeqSampler(int32_t seq, const PromptContext &ctx) override
+    { Q_UNUSED(seq); Q_UNUSED(ctx); throwNotImplemented(); }
+
+    [[noreturn]]
+    Token sampleSeqToken(int32_t seq, int32_t batchIdx) const override
+    { Q_UNUSED(seq); Q_UNUSED(batchIdx); throwNotImplemented(); }
+
+    [[noreturn]]
+    bool evalBatch(std::span<const SeqToken> tokens) const override
+    { Q_UNUSED(tokens); throwNotImplemented(); }
+
+    [[noreturn]]
+    void clearSequence(int32_t seq) override
+    { Q_UNUSED(seq); throwNotImplemented(); }
+
+    [[noreturn]]
+    void shiftSequence(int32_t seq, int32_t nKeep, int32_t nDiscard, int32_t nPast) override
+    { Q_UNUSED(seq); Q_UNUSED(nKeep); Q_UNUSED(nDiscard); Q_UNUSED(nPast); throwNotImplemented(); }
+
 private:
     ResponseCallback m_responseCallback;
     QString          m_modelName;
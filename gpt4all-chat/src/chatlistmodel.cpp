@@ -1,5 +1,6 @@
 #include "chatlistmodel.h"
 
+#include "kvsnapshotstore.h"
 #include "mysettings.h"
 
 #include <QCoreApplication>
@@ -65,6 +66,7 @@ void ChatListModel::loadChats()
 void ChatListModel::removeChatFile(Chat *chat) const
 {
     Q_ASSERT(chat != m_serverChat);
+    KVSnapshotStore::globalInstance()->remove(chat->id());
     const QString savePath = MySettings::globalInstance()->modelPath();
     QFile file(savePath + "/gpt4all-" + chat->id() + ".chat");
     if (!file.exists())
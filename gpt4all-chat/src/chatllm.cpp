@@ -4,7 +4,9 @@
 #include "chatapi.h"
 #include "chatmodel.h"
 #include "jinja_helpers.h"
+#include "kvsnapshotstore.h"
 #include "localdocs.h"
+#include "modelprewarmer.h"
 #include "mysettings.h"
 #include "network.h"
 #include "tool.h"
@@ -12,6 +14,7 @@
 #include "toolcallparser.h"
 
 #include <fmt/format.h>
+#include <gpt4all-backend/sysinfo.h>
 #include <minja/minja.hpp>
 #include <nlohmann/json.hpp>
 
@@ -20,6 +23,7 @@
 #include <QDebug>
 #include <QFile>
 #include <QGlobalStatic>
+#include <QHash>
 #include <QIODevice> // IWYU pragma: keep
 #include <QJsonDocument>
 #include <QJsonObject>
@@ -51,6 +55,8 @@
 #include <functional>
 #include <iomanip>
 #include <limits>
+#include <list>
+#include <memory>
 #include <optional>
 #include <ranges>
 #include <regex>
@@ -69,6 +75,27 @@ using json = nlohmann::ordered_json;
 //#define DEBUG
 //#define DEBUG_MODEL_LOADING
 
+/*
+ * What was rendered for the last prompt of a chat. Chats only grow between prompts, so the next prompt usually repeats
+ * all of these messages and adds a few: then only the new messages are rendered, after the last one of these so that
+ * templates that look back (e.g. to check that roles alternate) still work. This keeps the rendered prefix byte-stable
+ * for the KV cache. Whether the result matches a full render is checked the first time for each template, and each
+ * prompt also renders the new messages after one more message, which must not change them.
+ */
+struct ChatLLM::JinjaCache {
+    size_t                      contextKey = 0; // the template, system message, tools and special tokens
+    std::vector<size_t>         fingerprints;   // of the messages below
+    std::vector<json::object_t> messages;
+    std::string                 rendered;       // the messages, without a generation prompt
+    std::optional<bool>         renderTail;     // whether rendering only the new messages matched a full render
+
+    // The tokens of the first tokenizedLength bytes of rendered, by the model file they were tokenized with. Only the
+    // text after them is tokenized for the next prompt, see tokenizeConversation.
+    QString                     tokenizer;
+    std::vector<LLModel::Token> tokens;
+    size_t                      tokenizedLength = 0;
+};
+
 // NOTE: not threadsafe
 static const std::shared_ptr<minja::Context> &jinjaEnv()
 {
@@ -115,7 +142,8 @@ public:
 
 static auto promptModelWithTools(
     LLModel *model, const LLModel::PromptCallback &promptCallback, BaseResponseHandler &respHandler,
-    const LLModel::PromptContext &ctx, const QByteArray &prompt, const QStringList &toolNames
+    const LLModel::PromptContext &ctx, const QByteArray &prompt, const QStringList &toolNames,
+    std::span<const LLModel::Token> promptTokens = {}
 ) -> std::pair<QStringList, bool>
 {
     ToolCallParser toolCallParser(toolNames);
@@ -156,7 +184,11 @@ static auto promptModelWithTools(
 
         return !shouldExecuteToolCall && !respHandler.getStopGenerating();
     };
-    model->prompt(std::string_view(prompt), promptCallback, handleResponse, ctx);
+    // the tokens of the prompt, if the caller already has them
+    if (promptTokens.empty())
+        model->prompt(std::string_view(prompt), promptCallback, handleResponse, ctx);
+    else
+        model->promptTokens(promptTokens, promptCallback, handleResponse, ctx);
 
     const bool shouldExecuteToolCall = toolCallParser.state() == ToolEnums::ParseState::Complete
         && toolCallParser.startTag() != ToolCallConstants::ThinkStartTag;
@@ -164,61 +196,173 @@ static auto promptModelWithTools(
     return { toolCallParser.buffers(), shouldExecuteToolCall };
 }
 
-class LLModelStore {
+/*
+ * Keeps the models that no chat is using loaded, so that switching back to one does not load it again, as long as all
+ * loaded models fit in the memory budget. Models in use are pinned, the idle ones are evicted least recently used first
+ * when a model needs their memory.
+ */
+class ModelResidency {
 public:
-    static LLModelStore *globalInstance();
-
-    LLModelInfo acquireModel(); // will block until llmodel is ready
-    void releaseModel(LLModelInfo &&info); // must be called when you are done
+    static ModelResidency *globalInstance();
+
+    // An idle instance of the model file, or an empty LLModelInfo if there is none. If wait and the model is in use,
+    // this blocks until it is released.
+    LLModelInfo acquireModel(const QFileInfo &fileInfo, bool wait);
+    // Makes the model idle, an empty one is dropped. Nothing is evicted until a model needs the room.
+    void releaseModel(LLModelInfo &&info);
+    // Pins a model that is about to be loaded, after evicting idle models until it fits. Call it before picking a
+    // device, so that the memory of the evicted models is free by then.
+    void reserve(LLModelInfo &info, size_t bytes);
     void destroy();
 
 private:
-    LLModelStore()
+    struct IdleModel {
+        LLModelInfo info;
+        quint64     lastUsed;
+    };
+
+    ModelResidency() = default;
+    ~ModelResidency() {}
+
+    static size_t budget();
+    // these two are called with m_mutex held, except for unpin from the destructor of a reservation
+    std::shared_ptr<ModelReservation> pin(const QFileInfo &fileInfo, size_t bytes);
+    void unpin(ModelReservation &reservation, bool locked = false);
+    // removes idle models until extra more bytes fit in the budget, the caller deletes them outside of the lock
+    std::vector<LLModelInfo> evict(size_t extra);
+
+    QMutex                 m_mutex;
+    QWaitCondition         m_condition;
+    std::vector<IdleModel> m_idle;
+    QHash<QString, int>    m_inUse;          // by file path
+    size_t                 m_inUseBytes = 0;
+    size_t                 m_idleBytes  = 0;
+    quint64                m_clock      = 0;
+
+    friend class MyModelResidency;
+    friend struct ModelReservation;
+};
+
+class MyModelResidency : public ModelResidency { };
+Q_GLOBAL_STATIC(MyModelResidency, residencyInstance)
+ModelResidency *ModelResidency::globalInstance()
+{
+    return residencyInstance();
+}
+
+struct ModelReservation {
+    QString filePath;
+    size_t  bytes;
+    bool    active = true; // false once the store has taken the model back
+
+    ModelReservation(QString filePath, size_t bytes): filePath(std::move(filePath)), bytes(bytes) {}
+
+    ~ModelReservation()
     {
-        // seed with empty model
-        m_availableModel = LLModelInfo();
-    }
-    ~LLModelStore() {}
-    std::optional<LLModelInfo> m_availableModel;
-    QMutex m_mutex;
-    QWaitCondition m_condition;
-    friend class MyLLModelStore;
+        if (active && !residencyInstance.isDestroyed())
+            residencyInstance()->unpin(*this);
+    }
 };
 
-class MyLLModelStore : public LLModelStore { };
-Q_GLOBAL_STATIC(MyLLModelStore, storeInstance)
-LLModelStore *LLModelStore::globalInstance()
+size_t ModelResidency::budget()
+{
+    int mib = MySettings::globalInstance()->modelMemoryBudget();
+    if (mib > 0)
+        return size_t(mib) << 20;
+    return size_t(getSystemTotalRAMInBytes() / 2);
+}
+
+std::shared_ptr<ModelReservation> ModelResidency::pin(const QFileInfo &fileInfo, size_t bytes)
 {
-    return storeInstance();
+    auto reservation = std::make_shared<ModelReservation>(fileInfo.filePath(), bytes);
+    ++m_inUse[reservation->filePath];
+    m_inUseBytes += bytes;
+    return reservation;
 }
 
-LLModelInfo LLModelStore::acquireModel()
+void ModelResidency::unpin(ModelReservation &reservation, bool locked)
+{
+    std::optional<QMutexLocker<QMutex>> locker;
+    if (!locked)
+        locker.emplace(&m_mutex);
+    if (--m_inUse[reservation.filePath] <= 0)
+        m_inUse.remove(reservation.filePath);
+    m_inUseBytes -= reservation.bytes;
+    reservation.active = false;
+    m_condition.wakeAll();
+}
+
+std::vector<LLModelInfo> ModelResidency::evict(size_t extra)
+{
+    std::vector<LLModelInfo> evicted;
+    const size_t limit = budget();
+    while (!m_idle.empty() && m_inUseBytes + m_idleBytes + extra > limit) {
+        auto lru = std::ranges::min_element(m_idle, {}, &IdleModel::lastUsed);
+        m_idleBytes -= lru->info.memoryEstimate;
+        evicted.push_back(std::move(lru->info));
+        m_idle.erase(lru);
+    }
+    return evicted;
+}
+
+LLModelInfo ModelResidency::acquireModel(const QFileInfo &fileInfo, bool wait)
 {
     QMutexLocker locker(&m_mutex);
-    while (!m_availableModel)
+    for (;;) {
+        auto it = std::ranges::find_if(m_idle, [&](auto &idle) { return idle.info.fileInfo == fileInfo; });
+        if (it != m_idle.end()) {
+            LLModelInfo info = std::move(it->info);
+            m_idle.erase(it);
+            m_idleBytes -= info.memoryEstimate;
+            info.reservation = pin(fileInfo, info.memoryEstimate);
+            return info;
+        }
+        if (!wait || !m_inUse.contains(fileInfo.filePath()))
+            return {};
         m_condition.wait(locker.mutex());
-    auto first = std::move(*m_availableModel);
-    m_availableModel.reset();
-    return first;
+    }
 }
 
-void LLModelStore::releaseModel(LLModelInfo &&info)
+void ModelResidency::releaseModel(LLModelInfo &&info)
 {
     QMutexLocker locker(&m_mutex);
-    Q_ASSERT(!m_availableModel);
-    m_availableModel = std::move(info);
-    m_condition.wakeAll();
+    if (info.reservation && info.reservation->active)
+        unpin(*info.reservation, /*locked*/ true);
+    info.reservation.reset();
+    if (!info.model)
+        return;
+    // kept even if this is over the budget, reserve evicts it once a model that is loaded needs the room
+    m_idleBytes += info.memoryEstimate;
+    m_idle.push_back({ std::move(info), ++m_clock });
+}
+
+void ModelResidency::reserve(LLModelInfo &info, size_t bytes)
+{
+    if (info.reservation)
+        return;
+    std::vector<LLModelInfo> evicted; // deleted after the lock is released
+    QMutexLocker locker(&m_mutex);
+    evicted = evict(bytes);
+    if (m_inUseBytes + m_idleBytes + bytes > budget())
+        qWarning() << "WARNING: Loading" << info.fileInfo.fileName() << "exceeds the model memory budget";
+    info.memoryEstimate = bytes;
+    info.reservation    = pin(info.fileInfo, bytes);
 }
 
-void LLModelStore::destroy()
+void ModelResidency::destroy()
 {
+    std::vector<IdleModel> idle; // deleted after the lock is released
     QMutexLocker locker(&m_mutex);
-    m_availableModel.reset();
+    idle.swap(m_idle);
+    m_idleBytes = 0;
 }
 
 void LLModelInfo::resetModel(ChatLLM *cllm, LLModel *model) {
     this->model.reset(model);
     fallbackReason.reset();
+    contextChatId.reset();
+    memoryEstimate = 0;
+    reservation.reset();
     emit cllm->loadedModelInfoChanged();
 }
 
@@ -234,6 +378,7 @@ ChatLLM::ChatLLM(Chat *parent, bool isServer)
     , m_forceMetal(MySettings::globalInstance()->forceMetal())
     , m_reloadingToChangeVariant(false)
     , m_chatModel(parent->chatModel())
+    , m_jinjaCache(std::make_unique<JinjaCache>())
 {
     moveToThread(&m_llmThread);
     connect(this, &ChatLLM::shouldBeLoadedChanged, this, &ChatLLM::handleShouldBeLoadedChanged,
@@ -245,9 +390,10 @@ ChatLLM::ChatLLM(Chat *parent, bool isServer)
     connect(MySettings::globalInstance(), &MySettings::forceMetalChanged, this, &ChatLLM::handleForceMetalChanged);
     connect(MySettings::globalInstance(), &MySettings::deviceChanged, this, &ChatLLM::handleDeviceChanged);
 
-    // The following are blocking operations and will block the llm thread
+    // The following are blocking operations and will block the llm thread. Retrieval runs on the reader threads of the
+    // database, so it is called directly rather than queued behind the work of its thread.
     connect(this, &ChatLLM::requestRetrieveFromDB, LocalDocs::globalInstance()->database(), &Database::retrieveFromDB,
-        Qt::BlockingQueuedConnection);
+        Qt::DirectConnection);
 
     m_llmThread.setObjectName(parent->id());
     m_llmThread.start();
@@ -273,7 +419,7 @@ void ChatLLM::destroy()
 
 void ChatLLM::destroyStore()
 {
-    LLModelStore::globalInstance()->destroy();
+    ModelResidency::globalInstance()->destroy();
 }
 
 void ChatLLM::handleThreadStarted()
@@ -336,15 +482,15 @@ void ChatLLM::trySwitchContextOfLoadedModel(const ModelInfo &modelInfo)
     QString filePath = modelInfo.dirpath + modelInfo.filename();
     QFileInfo fileInfo(filePath);
 
-    acquireModel();
+    acquireModel(fileInfo, /*wait*/ false);
 #if defined(DEBUG_MODEL_LOADING)
         qDebug() << "acquired model from store" << m_llmThread.objectName() << m_llModelInfo.model.get();
 #endif
 
-    // The store gave us no already loaded model, the wrong type of model, then give it back to the
+    // The store has no idle instance of our model, or we no longer want it, then give it back to the
     // store and fail
-    if (!m_llModelInfo.model || m_llModelInfo.fileInfo != fileInfo || !m_shouldBeLoaded) {
-        LLModelStore::globalInstance()->releaseModel(std::move(m_llModelInfo));
+    if (!m_llModelInfo.model || !m_shouldBeLoaded) {
+        releaseModel();
         emit trySwitchContextOfLoadedModelCompleted(0);
         return;
     }
@@ -362,7 +508,7 @@ bool ChatLLM::loadModel(const ModelInfo &modelInfo)
 {
     // This is a complicated method because N different possible threads are interested in the outcome
     // of this method. Why? Because we have a main/gui thread trying to monitor the state of N different
-    // possible chat threads all vying for a single resource - the currently loaded model - as the user
+    // possible chat threads all vying for a few resources - the models the store keeps loaded - as the user
     // switches back and forth between chats. It is important for our main/gui thread to never block
     // but simultaneously always have up2date information with regards to which chat has the model loaded
     // and what the type and name of that model is. I've tried to comment extensively in this method
@@ -380,51 +526,51 @@ bool ChatLLM::loadModel(const ModelInfo &modelInfo)
     QString filePath = modelInfo.dirpath + modelInfo.filename();
     QFileInfo fileInfo(filePath);
 
-    // We have a live model, but it isn't the one we want
-    bool alreadyAcquired = isModelLoaded();
-    if (alreadyAcquired) {
+    // We have a live model, but it isn't the one we want. Give it back to the store, which keeps it loaded for
+    // when we switch back to it if it fits in the memory budget.
+    if (isModelLoaded()) {
 #if defined(DEBUG_MODEL_LOADING)
-        qDebug() << "already acquired model deleted" << m_llmThread.objectName() << m_llModelInfo.model.get();
+        qDebug() << "releasing model" << m_llmThread.objectName() << m_llModelInfo.model.get();
 #endif
-        m_llModelInfo.resetModel(this);
-    } else if (!m_isServer) {
-        // This is a blocking call that tries to retrieve the model we need from the model store.
-        // If it succeeds, then we just have to restore state. If the store has never had a model
-        // returned to it, then the modelInfo.model pointer should be null which will happen on startup
-        acquireModel();
+        releaseModel();
+    }
+
+    // This tries to retrieve the model we need from the store. A chat blocks while another chat uses it, as the other
+    // chat is about to release it when the user switches between them. The server does not wait, a chat may keep its
+    // model for as long as it is open.
+    acquireModel(fileInfo, /*wait*/ !m_isServer);
 #if defined(DEBUG_MODEL_LOADING)
-        qDebug() << "acquired model from store" << m_llmThread.objectName() << m_llModelInfo.model.get();
+    qDebug() << "acquired model from store" << m_llmThread.objectName() << m_llModelInfo.model.get();
 #endif
-        // At this point it is possible that while we were blocked waiting to acquire the model from the
-        // store, that our state was changed to not be loaded. If this is the case, release the model
-        // back into the store and quit loading
-        if (!m_shouldBeLoaded) {
+    // At this point it is possible that while we were blocked waiting to acquire the model from the
+    // store, that our state was changed to not be loaded. If this is the case, release the model
+    // back into the store and quit loading
+    if (!m_shouldBeLoaded) {
 #if defined(DEBUG_MODEL_LOADING)
-            qDebug() << "no longer need model" << m_llmThread.objectName() << m_llModelInfo.model.get();
+        qDebug() << "no longer need model" << m_llmThread.objectName() << m_llModelInfo.model.get();
 #endif
-            LLModelStore::globalInstance()->releaseModel(std::move(m_llModelInfo));
-            emit modelLoadingPercentageChanged(0.0f);
-            return false;
-        }
+        releaseModel();
+        emit modelLoadingPercentageChanged(0.0f);
+        return false;
+    }
 
-        // Check if the store just gave us exactly the model we were looking for
-        if (m_llModelInfo.model && m_llModelInfo.fileInfo == fileInfo && !m_reloadingToChangeVariant) {
+    // Check if the store just gave us exactly the model we were looking for
+    if (m_llModelInfo.model && !m_reloadingToChangeVariant) {
 #if defined(DEBUG_MODEL_LOADING)
-            qDebug() << "store had our model" << m_llmThread.objectName() << m_llModelInfo.model.get();
+        qDebug() << "store had our model" << m_llmThread.objectName() << m_llModelInfo.model.get();
 #endif
-            emit modelLoadingPercentageChanged(1.0f);
-            setModelInfo(modelInfo);
-            Q_ASSERT(!m_modelInfo.filename().isEmpty());
-            if (m_modelInfo.filename().isEmpty())
-                emit modelLoadingError(QString("Modelinfo is left null for %1").arg(modelInfo.filename()));
-            return true;
-        } else {
-            // Release the memory since we have to switch to a different model.
+        emit modelLoadingPercentageChanged(1.0f);
+        setModelInfo(modelInfo);
+        Q_ASSERT(!m_modelInfo.filename().isEmpty());
+        if (m_modelInfo.filename().isEmpty())
+            emit modelLoadingError(QString("Modelinfo is left null for %1").arg(modelInfo.filename()));
+        return true;
+    } else if (m_llModelInfo.model) {
+        // Release the memory since we have to load it on a different device.
 #if defined(DEBUG_MODEL_LOADING)
-            qDebug() << "deleting model" << m_llmThread.objectName() << m_llModelInfo.model.get();
+        qDebug() << "deleting model" << m_llmThread.objectName() << m_llModelInfo.model.get();
 #endif
-            m_llModelInfo.resetModel(this);
-        }
+        m_llModelInfo.resetModel(this);
     }
 
     // Guarantee we've released the previous models memory
@@ -485,9 +631,7 @@ bool ChatLLM::loadModel(const ModelInfo &modelInfo)
         modelLoadProps.insert("model", modelInfo.filename());
         Network::globalInstance()->trackChatEvent("model_load", modelLoadProps);
     } else {
-        if (!m_isServer)
-            LLModelStore::globalInstance()->releaseModel(std::move(m_llModelInfo)); // release back into the store
-        resetModel();
+        releaseModel();
         emit modelLoadingError(QString("Could not find file for model %1").arg(modelInfo.filename()));
     }
 
@@ -523,7 +667,11 @@ bool ChatLLM::loadNewModel(const ModelInfo &modelInfo, QVariantMap &modelLoadPro
 
     QString filePath = modelInfo.dirpath + modelInfo.filename();
 
-    auto construct = [this, &filePath, &modelInfo, &modelLoadProps, n_ctx](std::string const &backend) {
+    // with prewarming, the first half of the progress is reading the file into the page cache
+    const bool prewarm = MySettings::globalInstance()->prewarmModels();
+    const float progressBase = prewarm ? 0.5f : 0.0f;
+
+    auto construct = [this, &filePath, &modelInfo, &modelLoadProps, n_ctx, progressBase](std::string const &backend) {
         QString constructError;
         m_llModelInfo.resetModel(this);
         try {
@@ -542,18 +690,18 @@ bool ChatLLM::loadNewModel(const ModelInfo &modelInfo, QVariantMap &modelLoadPro
         }
 
         if (!m_llModelInfo.model) {
-            if (!m_isServer)
-                LLModelStore::globalInstance()->releaseModel(std::move(m_llModelInfo));
-            resetModel();
+            releaseModel();
             emit modelLoadingError(QString("Error loading %1: %2").arg(modelInfo.filename(), constructError));
             return false;
         }
 
-        m_llModelInfo.model->setProgressCallback([this](float progress) -> bool {
+        m_llModelInfo.model->setProgressCallback([this, progressBase](float progress) -> bool {
+            progress = progressBase + (1.0f - progressBase) * progress;
             progress = std::max(progress, std::numeric_limits<float>::min()); // keep progress above zero
             emit modelLoadingPercentageChanged(progress);
             return m_shouldBeLoaded;
         });
+        m_llModelInfo.model->setRepackWeights(MySettings::globalInstance()->repackWeights());
         return true;
     };
 
@@ -578,8 +726,12 @@ bool ChatLLM::loadNewModel(const ModelInfo &modelInfo, QVariantMap &modelLoadPro
 
     std::vector<LLModel::GPUDevice> availableDevices;
     const LLModel::GPUDevice *defaultDevice = nullptr;
+    const size_t requiredMemory = m_llModelInfo.model->requiredMem(filePath.toStdString(), n_ctx, ngl);
+    // the estimate is 0 for file formats it does not know, the weights are at least the size of the file
+    const size_t residentMemory = std::max(requiredMemory, size_t(QFileInfo(filePath).size()));
+    // make room among the models kept loaded by the store
+    ModelResidency::globalInstance()->reserve(m_llModelInfo, residentMemory);
     {
-        const size_t requiredMemory = m_llModelInfo.model->requiredMem(filePath.toStdString(), n_ctx, ngl);
         availableDevices = m_llModelInfo.model->availableGPUDevices(requiredMemory);
         // Pick the best device
         // NB: relies on the fact that Kompute devices are listed first
@@ -623,13 +775,22 @@ bool ChatLLM::loadNewModel(const ModelInfo &modelInfo, QVariantMap &modelLoadPro
     }
 #endif
 
+    if (prewarm) {
+        // Faulting the weights in one page at a time as the model is loaded and first used is much slower than
+        // reading them ahead with several threads. This may have started when the model was selected. The weights may
+        // come from a repacked copy of the file, now that the device is known.
+        const auto weightsPath = m_llModelInfo.model->weightsPath(filePath.toStdString(), ngl);
+        ModelPrewarmer::globalInstance()->wait(QString::fromStdString(weightsPath), [this](float progress) {
+            emit modelLoadingPercentageChanged(std::max(progress * 0.5f, std::numeric_limits<float>::min()));
+            return bool(m_shouldBeLoaded);
+        });
+    }
+
     bool success = m_llModelInfo.model->loadModel(filePath.toStdString(), n_ctx, ngl);
 
     if (!m_shouldBeLoaded) {
         m_llModelInfo.resetModel(this);
-        if (!m_isServer)
-            LLModelStore::globalInstance()->releaseModel(std::move(m_llModelInfo));
-        resetModel();
+        releaseModel();
         emit modelLoadingPercentageChanged(0.0f);
         return false;
     }
@@ -645,13 +806,12 @@ bool ChatLLM::loadNewModel(const ModelInfo &modelInfo, QVariantMap &modelLoadPro
         if (backend == "cuda" && !construct("auto"))
             return true;
 
+        ModelResidency::globalInstance()->reserve(m_llModelInfo, residentMemory); // if constructed again
         success = m_llModelInfo.model->loadModel(filePath.toStdString(), n_ctx, 0);
 
         if (!m_shouldBeLoaded) {
             m_llModelInfo.resetModel(this);
-            if (!m_isServer)
-                LLModelStore::globalInstance()->releaseModel(std::move(m_llModelInfo));
-            resetModel();
+            releaseModel();
             emit modelLoadingPercentageChanged(0.0f);
             return false;
         }
@@ -665,9 +825,7 @@ bool ChatLLM::loadNewModel(const ModelInfo &modelInfo, QVariantMap &modelLoadPro
 
     if (!success) {
         m_llModelInfo.resetModel(this);
-        if (!m_isServer)
-            LLModelStore::globalInstance()->releaseModel(std::move(m_llModelInfo));
-        resetModel();
+        releaseModel();
         emit modelLoadingError(QString("Could not load model due to invalid model file for %1").arg(modelInfo.filename()));
         modelLoadProps.insert("error", "loadmodel_failed");
         return true;
@@ -678,17 +836,46 @@ bool ChatLLM::loadNewModel(const ModelInfo &modelInfo, QVariantMap &modelLoadPro
     default:
         {
             m_llModelInfo.resetModel(this);
-            if (!m_isServer)
-                LLModelStore::globalInstance()->releaseModel(std::move(m_llModelInfo));
-            resetModel();
+            releaseModel();
             emit modelLoadingError(QString("Could not determine model type for %1").arg(modelInfo.filename()));
         }
     }
 
+    if (m_llModelInfo.model)
+        loadDraftModel(modelInfo, n_ctx);
+
     modelLoadProps.insert("$duration", modelLoadTimer.elapsed() / 1000.);
     return true;
 }
 
+// Attaches the draft model configured for modelInfo, if any, for speculative decoding. Failing to do so is not fatal,
+// the model just generates without it.
+void ChatLLM::loadDraftModel(const ModelInfo &modelInfo, int n_ctx)
+{
+    auto *mySettings = MySettings::globalInstance();
+    const QString draftFilename = mySettings->modelDraftModel(modelInfo);
+    if (draftFilename.isEmpty())
+        return;
+
+    const ModelInfo draftInfo = ModelList::globalInstance()->modelInfoByFilename(draftFilename);
+    if (!draftInfo.installed) {
+        qWarning() << "ERROR: Draft model" << draftFilename << "is not installed, not using speculative decoding";
+        return;
+    }
+
+    // The draft model runs on the CPU so that it does not take memory away from the main model on the GPU.
+    const std::string draftPath = (draftInfo.dirpath + draftInfo.filename()).toStdString();
+    try {
+        std::unique_ptr<LLModel> draft(LLModel::Implementation::construct(draftPath, "cpu", n_ctx));
+        draft->setThreadCount(mySettings->threadCount());
+        if (!draft->loadModel(draftPath, n_ctx, 0))
+            throw std::runtime_error("invalid model file");
+        m_llModelInfo.model->setDraftModel(std::move(draft), mySettings->modelDraftTokens(modelInfo));
+    } catch (const std::exception &e) {
+        qWarning() << "ERROR: Could not use draft model" << draftFilename << "for speculative decoding:" << e.what();
+    }
+}
+
 bool ChatLLM::isModelLoaded() const
 {
     return m_llModelInfo.model && m_llModelInfo.model->isModelLoaded();
@@ -734,12 +921,18 @@ void ChatLLM::setModelInfo(const ModelInfo &modelInfo)
     emit modelInfoChanged(modelInfo);
 }
 
-void ChatLLM::acquireModel()
+void ChatLLM::acquireModel(const QFileInfo &fileInfo, bool wait)
 {
-    m_llModelInfo = LLModelStore::globalInstance()->acquireModel();
+    m_llModelInfo = ModelResidency::globalInstance()->acquireModel(fileInfo, wait);
     emit loadedModelInfoChanged();
 }
 
+void ChatLLM::releaseModel()
+{
+    ModelResidency::globalInstance()->releaseModel(std::move(m_llModelInfo));
+    resetModel();
+}
+
 void ChatLLM::resetModel()
 {
     m_llModelInfo = {};
@@ -822,11 +1015,44 @@ static uint parseJinjaTemplateVersion(QStringView tmpl)
     return 0;
 }
 
+// Parsed templates are shared by all chats, most recently used first. Parsing a large template takes a noticeable
+// part of the time to the first token.
 static std::shared_ptr<minja::TemplateNode> loadJinjaTemplate(const std::string &source)
 {
-    return minja::Parser::parse(source, { .trim_blocks = true, .lstrip_blocks = true, .keep_trailing_newline = false });
+    static constexpr size_t MAX_TEMPLATES = 8;
+    static QMutex mutex;
+    static std::list<std::pair<std::string, std::shared_ptr<minja::TemplateNode>>> templates;
+
+    QMutexLocker locker(&mutex);
+    if (auto it = ranges::find(templates, source, &decltype(templates)::value_type::first); it != templates.end()) {
+        templates.splice(templates.begin(), templates, it);
+        return it->second;
+    }
+    locker.unlock();
+
+    auto tmpl = minja::Parser::parse(source, { .trim_blocks = true, .lstrip_blocks = true, .keep_trailing_newline = false });
+
+    locker.relock();
+    templates.emplace_front(source, tmpl);
+    if (templates.size() > MAX_TEMPLATES)
+        templates.pop_back();
+    return tmpl;
+}
+
+// Identifies what a message contributes to the input of the template, without building it.
+static size_t messageFingerprint(const MessageItem &item)
+{
+    size_t seed = qHashMulti(0, int(item.type()), item.content());
+    for (auto &source : item.sources()) {
+        seed = qHashMulti(seed, source.collection, source.path, source.file, source.title, source.author, source.date,
+                          source.text, source.page, source.from, source.to);
+    }
+    for (auto &attachment : item.promptAttachments())
+        seed = qHashMulti(seed, attachment.url, attachment.content);
+    return seed;
 }
 
+
 std::optional<std::string> ChatLLM::checkJinjaTemplateError(const std::string &source)
 {
     try {
@@ -837,7 +1063,7 @@ std::optional<std::string> ChatLLM::checkJinjaTemplateError(const std::string &s
     return std::nullopt;
 }
 
-std::string ChatLLM::applyJinjaTemplate(std::span<const MessageItem> items) const
+std::string ChatLLM::applyJinjaTemplate(std::span<const MessageItem> items, bool remember)
 {
     Q_ASSERT(items.size() >= 1);
 
@@ -864,21 +1090,16 @@ std::string ChatLLM::applyJinjaTemplate(std::span<const MessageItem> items) cons
 
     uint version = parseJinjaTemplateVersion(chatTemplate);
 
-    auto makeMap = [version](const MessageItem &item) {
-        return JinjaMessage(version, item).AsJson();
-    };
-
-    std::unique_ptr<MessageItem> systemItem;
-    bool useSystem = !isAllSpace(systemMessage);
-
-    json::array_t messages;
-    messages.reserve(useSystem + items.size());
-    if (useSystem) {
-        systemItem = std::make_unique<MessageItem>(MessageItem::system_tag, systemMessage.toUtf8());
-        messages.emplace_back(makeMap(*systemItem));
+    std::shared_ptr<minja::TemplateNode> tmpl;
+    try {
+        tmpl = loadJinjaTemplate(chatTemplate.toStdString());
+    } catch (const std::runtime_error &e) {
+        throw std::runtime_error(fmt::format("Failed to parse chat template: {}", e.what()));
     }
-    for (auto &item : items)
-        messages.emplace_back(makeMap(item));
+
+    std::optional<json::object_t> systemMap;
+    if (!isAllSpace(systemMessage))
+        systemMap = JinjaMessage(version, MessageItem(MessageItem::system_tag, systemMessage.toUtf8())).AsJson();
 
     json::array_t toolList;
     const int toolCount = ToolModel::globalInstance()->count();
@@ -886,27 +1107,163 @@ std::string ChatLLM::applyJinjaTemplate(std::span<const MessageItem> items) cons
         Tool *t = ToolModel::globalInstance()->get(i);
         toolList.push_back(t->jinjaValue());
     }
+    auto specialTokens = model->specialTokens();
+
+    size_t contextKey = qHashMulti(0, chatTemplate, systemMessage, QByteArray::fromStdString(json(toolList).dump()));
+    for (auto &[name, token] : specialTokens)
+        contextKey = qHashMulti(contextKey, QByteArray::fromStdString(name), QByteArray::fromStdString(token));
+
+    auto render = [&](std::span<const json::object_t> msgs, bool addGenerationPrompt) -> std::string {
+        json::array_t messages;
+        messages.reserve(bool(systemMap) + msgs.size());
+        if (systemMap)
+            messages.emplace_back(*systemMap);
+        messages.insert(messages.end(), msgs.begin(), msgs.end());
+
+        json::object_t params {
+            { "messages",              std::move(messages)  },
+            { "add_generation_prompt", addGenerationPrompt },
+            { "toolList",              toolList            },
+        };
+        for (auto &[name, token] : specialTokens)
+            params.emplace(name, token);
 
-    json::object_t params {
-        { "messages",              std::move(messages) },
-        { "add_generation_prompt", true                },
-        { "toolList",              toolList            },
+        try {
+            auto context = minja::Context::make(minja::Value(std::move(params)), jinjaEnv());
+            return tmpl->render(context);
+        } catch (const std::runtime_error &e) {
+            throw std::runtime_error(fmt::format("Failed to parse chat template: {}", e.what()));
+        }
     };
-    for (auto &[name, token] : model->specialTokens())
-        params.emplace(std::move(name), std::move(token));
 
-    try {
-        auto tmpl = loadJinjaTemplate(chatTemplate.toStdString());
-        auto context = minja::Context::make(minja::Value(std::move(params)), jinjaEnv());
-        return tmpl->render(context);
-    } catch (const std::runtime_error &e) {
-        throw std::runtime_error(fmt::format("Failed to parse chat template: {}", e.what()));
+    // build the input of the template, reusing the messages that were rendered before
+    JinjaCache &cache = *m_jinjaCache;
+    if (cache.contextKey != contextKey)
+        cache = { .contextKey = contextKey };
+    std::vector<size_t> fingerprints;
+    fingerprints.reserve(items.size());
+    for (auto &item : items)
+        fingerprints.push_back(messageFingerprint(item));
+    const size_t nCached = ranges::mismatch(cache.fingerprints, fingerprints).in1 - cache.fingerprints.begin();
+    std::vector<json::object_t> messages(cache.messages.begin(), cache.messages.begin() + nCached);
+    messages.reserve(items.size());
+    for (auto &item : items.subspan(nCached))
+        messages.push_back(JinjaMessage(version, item).AsJson());
+
+    // Renders the messages after the cached ones, preceded by the last lookback cached messages that the template may
+    // look back at. Returns nothing if that does not extend what the cached messages render to.
+    auto renderAdded = [&](size_t lookback, bool addGenerationPrompt) -> std::optional<std::string> {
+        std::span window(messages.begin() + (nCached - lookback), messages.end());
+        std::string before = render(window.first(lookback), false);
+        std::string after  = render(window, addGenerationPrompt);
+        if (!after.starts_with(before))
+            return std::nullopt;
+        return after.substr(before.size());
+    };
+
+    std::string result;
+    std::string rendered; // without a generation prompt
+    // only a prompt that is remembered can check the result, as both renders need to match
+    const bool verify = remember && !cache.renderTail;
+    if (nCached && nCached == cache.fingerprints.size() && items.size() > nCached && (cache.renderTail == true || verify)) {
+        try {
+            // a template that renders the new messages differently depending on how much of the chat precedes them,
+            // e.g. by the parity of their index, fails to match this on one prompt or another
+            auto added = renderAdded(1, true);
+            if (added && nCached >= 2 && renderAdded(2, true) != added) {
+                cache.renderTail = false;
+                added.reset();
+            }
+            if (added) {
+                result = cache.rendered + *added;
+                if (remember) {
+                    if (auto addedText = renderAdded(1, false))
+                        rendered = cache.rendered + *addedText;
+                    else
+                        result.clear();
+                }
+            }
+        } catch (const std::runtime_error &) {
+            // the template rejected the partial conversation
+            cache.renderTail = false;
+            result.clear();
+            rendered.clear();
+        }
+        if (verify && cache.renderTail != false) {
+            std::string full = render(messages, true);
+            cache.renderTail = !result.empty() && result == full && rendered == render(messages, false);
+            if (!*cache.renderTail) {
+                result = std::move(full);
+                rendered.clear();
+            }
+        }
+    }
+    if (result.empty())
+        result = render(messages, true);
+
+    if (remember) {
+        if (rendered.empty())
+            rendered = render(messages, false);
+        // the tokens stay valid as long as the text they were tokenized from does not change
+        if (!rendered.starts_with(std::string_view(cache.rendered).substr(0, cache.tokenizedLength))) {
+            cache.tokens.clear();
+            cache.tokenizedLength = 0;
+        }
+        cache.fingerprints = std::move(fingerprints);
+        cache.messages     = std::move(messages);
+        cache.rendered     = std::move(rendered);
+    }
+    return result;
+}
+
+std::vector<LLModel::Token> ChatLLM::tokenizeConversation(std::string_view conversation)
+{
+    const LLModel &model = *m_llModelInfo.model;
+    JinjaCache &cache = *m_jinjaCache;
+    if (QString tokenizer = m_llModelInfo.fileInfo.filePath(); cache.tokenizer != tokenizer) {
+        cache.tokenizer = std::move(tokenizer);
+        cache.tokens.clear();
+        cache.tokenizedLength = 0;
+    }
+
+    std::string_view rendered = cache.rendered;
+    if (rendered.empty() || !conversation.starts_with(rendered))
+        return model.tokenizePrompt(conversation);
+
+    // The tokenizer never merges text across a special token, so text split right before one tokenizes the same in
+    // pieces as in one go. Templates begin every message and the generation prompt with one, other splits are undone.
+    auto startsWithSpecial = [&](const std::vector<LLModel::Token> &piece) {
+        return !piece.empty() && model.isSpecialToken(piece.front());
+    };
+
+    // tokenize the messages that were added since the last prompt, then the generation prompt
+    if (cache.tokenizedLength < rendered.size()) {
+        if (cache.tokenizedLength) {
+            auto added = model.tokenizePrompt(rendered.substr(cache.tokenizedLength), /*continuation*/ true);
+            if (startsWithSpecial(added))
+                cache.tokens.insert(cache.tokens.end(), added.begin(), added.end());
+            else
+                cache.tokens = model.tokenizePrompt(rendered);
+        } else {
+            cache.tokens = model.tokenizePrompt(rendered);
+        }
+        cache.tokenizedLength = rendered.size();
     }
-    Q_UNREACHABLE();
+    if (conversation.size() == rendered.size())
+        return cache.tokens;
+
+    auto generation = model.tokenizePrompt(conversation.substr(rendered.size()), /*continuation*/ true);
+    if (!startsWithSpecial(generation))
+        return model.tokenizePrompt(conversation);
+    std::vector<LLModel::Token> tokens;
+    tokens.reserve(cache.tokens.size() + generation.size());
+    tokens.assign(cache.tokens.begin(), cache.tokens.end());
+    tokens.insert(tokens.end(), generation.begin(), generation.end());
+    return tokens;
 }
 
 auto ChatLLM::promptInternalChat(const QStringList &enabledCollections, const LLModel::PromptContext &ctx,
-                                 qsizetype startOffset) -> ChatPromptResult
+                                 qsizetype startOffset, const RetrievalFilter &filter) -> ChatPromptResult
 {
     Q_ASSERT(isModelLoaded());
     Q_ASSERT(m_chatModel);
@@ -934,7 +1291,7 @@ auto ChatLLM::promptInternalChat(const QStringList &enabledCollections, const LL
         if (query) {
             auto &[promptIndex, queryStr] = *query;
             const int retrievalSize = MySettings::globalInstance()->localDocsRetrievalSize();
-            emit requestRetrieveFromDB(enabledCollections, queryStr, retrievalSize, &databaseResults); // blocks
+            emit requestRetrieveFromDB(enabledCollections, queryStr, retrievalSize, filter, &databaseResults); // blocks
             m_chatModel->updateSources(promptIndex, databaseResults);
             emit databaseResultsChanged(databaseResults);
         }
@@ -977,6 +1334,7 @@ public:
         m_result->responseTokens++;
         m_cllm->m_timer->inc();
         m_result->response.append(chunk);
+        m_cllm->handleResponseChunk(chunk);
     }
 
     bool onBufferResponse(const QString &response, int bufferIdx) override
@@ -1033,20 +1391,29 @@ auto ChatLLM::promptInternal(
         conversation = jinjaBuffer;
     }
 
-    // check for overlength last message
+    std::vector<LLModel::Token> tokens; // the conversation, tokenized incrementally
     if (!dynamic_cast<const ChatAPI *>(m_llModelInfo.model.get())) {
+        // check for overlength last message
         auto nCtx = m_llModelInfo.model->contextLength();
+        auto limit = nCtx - 4;
         std::string jinjaBuffer2;
         auto lastMessageRendered = (messageItems && messageItems->size() > 1)
-            ? std::string_view(jinjaBuffer2 = applyJinjaTemplate({ &messageItems->back(), 1 }))
+            ? std::string_view(jinjaBuffer2 = applyJinjaTemplate({ &messageItems->back(), 1 }, /*remember*/ false))
             : conversation;
-        int32_t lastMessageLength = m_llModelInfo.model->countPromptTokens(lastMessageRendered);
-        if (auto limit = nCtx - 4; lastMessageLength > limit) {
-            throw std::invalid_argument(
-                tr("Your message was too long and could not be processed (%1 > %2). "
-                   "Please try again with something shorter.").arg(lastMessageLength).arg(limit).toUtf8().constData()
-            );
+        // apart from the few special tokens added to it, every token stands for at least one byte of the text, so only
+        // a message that is long enough needs to be tokenized to find out
+        if (qsizetype(lastMessageRendered.size()) + 4 > limit) {
+            int32_t lastMessageLength = m_llModelInfo.model->countPromptTokens(lastMessageRendered);
+            if (lastMessageLength > limit) {
+                throw std::invalid_argument(
+                    tr("Your message was too long and could not be processed (%1 > %2). "
+                       "Please try again with something shorter.").arg(lastMessageLength).arg(limit).toUtf8().constData()
+                );
+            }
         }
+
+        if (messageItems)
+            tokens = tokenizeConversation(conversation);
     }
 
     PromptResult result {};
@@ -1058,6 +1425,8 @@ auto ChatLLM::promptInternal(
         return !m_stopGenerating;
     };
 
+    restoreContextSnapshot();
+
     QElapsedTimer totalTime;
     totalTime.start();
     ChatViewResponseHandler respHandler(this, &totalTime, &result);
@@ -1068,11 +1437,12 @@ auto ChatLLM::promptInternal(
     try {
         emit promptProcessing();
         m_llModelInfo.model->setThreadCount(mySettings->threadCount());
+        m_llModelInfo.model->setPrefixCacheSize(size_t(std::max(0, mySettings->prefixCacheSize())) << 20);
         m_stopGenerating = false;
         std::tie(finalBuffers, shouldExecuteTool) = promptModelWithTools(
             m_llModelInfo.model.get(), handlePrompt, respHandler, ctx,
             QByteArray::fromRawData(conversation.data(), conversation.size()),
-            ToolCallConstants::AllTagNames
+            ToolCallConstants::AllTagNames, tokens
         );
     } catch (...) {
         m_timer->stop();
@@ -1082,6 +1452,8 @@ auto ChatLLM::promptInternal(
     m_timer->stop();
     qint64 elapsed = totalTime.elapsed();
 
+    saveContextSnapshot();
+
     // trim trailing whitespace
     auto respStr = QString::fromUtf8(result.response);
     if (!respStr.isEmpty() && (std::as_const(respStr).back().isSpace() || finalBuffers.size() > 1)) {
@@ -1108,6 +1480,30 @@ auto ChatLLM::promptInternal(
     return result;
 }
 
+void ChatLLM::restoreContextSnapshot()
+{
+    if (m_isServer)
+        m_llModelInfo.contextChatId.reset(); // the model may go back to a chat through the store
+    if (m_isServer || m_llModelType != LLModelTypeV1::LLAMA || m_llModelInfo.contextChatId == m_chat->id())
+        return;
+
+    // another chat used the model since our last prompt, pick up where we left off instead of prefilling it all
+    if (MySettings::globalInstance()->saveChatsContext()) {
+        auto key = KVSnapshotStore::modelKey(m_llModelInfo.fileInfo, m_llModelInfo.model.get());
+        KVSnapshotStore::globalInstance()->restore(m_chat->id(), key, m_llModelInfo.model.get());
+    }
+    m_llModelInfo.contextChatId = m_chat->id();
+}
+
+void ChatLLM::saveContextSnapshot()
+{
+    if (m_isServer || m_llModelType != LLModelTypeV1::LLAMA || !MySettings::globalInstance()->saveChatsContext())
+        return;
+
+    auto key = KVSnapshotStore::modelKey(m_llModelInfo.fileInfo, m_llModelInfo.model.get());
+    KVSnapshotStore::globalInstance()->save(m_chat->id(), key, m_llModelInfo.model.get());
+}
+
 void ChatLLM::setShouldBeLoaded(bool b)
 {
 #if defined(DEBUG_MODEL_LOADING)
@@ -1150,7 +1546,7 @@ void ChatLLM::unloadModel()
         m_forceUnloadModel = false;
     }
 
-    LLModelStore::globalInstance()->releaseModel(std::move(m_llModelInfo));
+    releaseModel();
 }
 
 void ChatLLM::reloadModel()
@@ -1254,7 +1650,7 @@ void ChatLLM::generateName()
             m_llModelInfo.model.get(),
             /*promptCallback*/ [this](auto &&...) { return !m_stopGenerating; },
             respHandler, promptContextFromSettings(m_modelInfo),
-            applyJinjaTemplate(forkConversation(chatNamePrompt)).c_str(),
+            applyJinjaTemplate(forkConversation(chatNamePrompt), /*remember*/ false).c_str(),
             { ToolCallConstants::ThinkTagName }
         );
     } catch (const std::exception &e) {
@@ -1330,7 +1726,7 @@ void ChatLLM::generateQuestions(qint64 elapsed)
             m_llModelInfo.model.get(),
             /*promptCallback*/ [this](auto &&...) { return !m_stopGenerating; },
             respHandler, promptContextFromSettings(m_modelInfo),
-            applyJinjaTemplate(forkConversation(suggestedFollowUpPrompt)).c_str(),
+            applyJinjaTemplate(forkConversation(suggestedFollowUpPrompt), /*remember*/ false).c_str(),
             { ToolCallConstants::ThinkTagName }
         );
     } catch (const std::exception &e) {
@@ -20,6 +20,7 @@
 #include <QtNumeric>
 
 #include <atomic>
+#include <cstddef>
 #include <memory>
 #include <optional>
 #include <span>
@@ -32,6 +33,7 @@
 
 class ChatLLM;
 class QDataStream;
+struct ModelReservation;
 
 
 // NOTE: values serialized to disk, do not change or reuse
@@ -94,6 +96,10 @@ struct LLModelInfo {
     std::unique_ptr<LLModel> model;
     QFileInfo fileInfo;
     std::optional<QString> fallbackReason;
+    std::optional<QString> contextChatId; // the chat whose conversation is in the model's context
+    size_t memoryEstimate = 0; // bytes
+    // counts the model against the memory budget while a chat uses it, see ModelResidency
+    std::shared_ptr<ModelReservation> reservation;
 
     // NOTE: This does not store the model type or name on purpose as this is left for ChatLLM which
     // must be able to serialize the information even if it is in the unloaded state
@@ -172,7 +178,11 @@ public:
     ModelInfo modelInfo() const;
     void setModelInfo(const ModelInfo &info);
 
-    void acquireModel();
+    // Takes an idle instance of the model file from the store, if it has one. If wait and the model is in use, this
+    // blocks until it is released.
+    void acquireModel(const QFileInfo &fileInfo, bool wait);
+    // Gives the model back to the store, which keeps it loaded while it fits in the memory budget.
+    void releaseModel();
     void resetModel();
 
     QString deviceBackend() const
@@ -231,7 +241,8 @@ Q_SIGNALS:
     void shouldBeLoadedChanged();
     void trySwitchContextRequested(const ModelInfo &modelInfo);
     void trySwitchContextOfLoadedModelCompleted(int value);
-    void requestRetrieveFromDB(const QList<QString> &collections, const QString &text, int retrievalSize, QList<ResultInfo> *results);
+    void requestRetrieveFromDB(const QList<QString> &collections, const QString &text, int retrievalSize,
+                               const RetrievalFilter &filter, QList<ResultInfo> *results);
     void reportSpeed(const QString &speed);
     void reportDevice(const QString &device);
     void reportFallbackReason(const QString &fallbackReason);
@@ -250,27 +261,42 @@ protected:
     };
 
     ChatPromptResult promptInternalChat(const QStringList &enabledCollections, const LLModel::PromptContext &ctx,
-                                        qsizetype startOffset = 0);
+                                        qsizetype startOffset = 0, const RetrievalFilter &filter = {});
     // passing a string_view directly skips templating and uses the raw string
     PromptResult promptInternal(const std::variant<std::span<const MessageItem>, std::string_view> &prompt,
                                 const LLModel::PromptContext &ctx,
                                 bool usedLocalDocs);
+    // Called with each token of a response as it is generated, before tool calls and thinking are split off. The
+    // chunk is raw UTF-8 and may end within a character.
+    virtual void handleResponseChunk(const QByteArray &chunk) { Q_UNUSED(chunk) }
+
+    LLModel *llModel() const { return m_llModelInfo.model.get(); }
+    // Applies the Jinja template. Unless remember is false, what was rendered is kept to render the next prompt of this
+    // chat incrementally, see JinjaCache.
+    std::string applyJinjaTemplate(std::span<const MessageItem> items, bool remember = true);
 
 private:
     bool loadNewModel(const ModelInfo &modelInfo, QVariantMap &modelLoadProps);
+    void loadDraftModel(const ModelInfo &modelInfo, int n_ctx);
 
     std::vector<MessageItem> forkConversation(const QString &prompt) const;
 
-    // Applies the Jinja template. Query mode returns only the last message without special tokens.
-    // Returns a (# of messages, rendered prompt) pair.
-    std::string applyJinjaTemplate(std::span<const MessageItem> items) const;
+    // Tokenizes the conversation the last remembered applyJinjaTemplate call returned, only the text that was added to
+    // it since the previous prompt is tokenized.
+    std::vector<LLModel::Token> tokenizeConversation(std::string_view conversation);
 
     void generateQuestions(qint64 elapsed);
 
+    // per-chat KV snapshots on disk, see KVSnapshotStore
+    void restoreContextSnapshot();
+    void saveContextSnapshot();
+
 protected:
     QPointer<ChatModel> m_chatModel;
 
 private:
+    struct JinjaCache;
+
     const Chat *m_chat;
     LLModelInfo m_llModelInfo;
     LLModelTypeV1 m_llModelType = LLModelTypeV1::NONE;
@@ -284,6 +310,7 @@ private:
     bool m_isServer;
     bool m_forceMetal;
     bool m_reloadingToChangeVariant;
+    std::unique_ptr<JinjaCache> m_jinjaCache;
     friend class ChatViewResponseHandler;
     friend class SimpleResponseHandler;
 };
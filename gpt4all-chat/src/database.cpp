@@ -3,43 +3,39 @@
 #include "mysettings.h"
 #include "utils.h" // IWYU pragma: keep
 
-#include <duckx/duckx.hpp>
-#include <fmt/format.h>
+#include <gpt4all-backend/sysinfo.h>
 #include <usearch/index.hpp>
 #include <usearch/index_plugins.hpp>
 
+#include <QCryptographicHash>
+#include <QDateTime>
 #include <QDebug>
 #include <QDir>
 #include <QDirIterator>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QFileSystemWatcher>
 #include <QFlags>
-#include <QIODevice>
 #include <QKeyValueIterator>
+#include <QMutexLocker>
+#include <QReadLocker>
 #include <QRegularExpression>
 #include <QSqlError>
 #include <QSqlQuery>
-#include <QTextStream>
 #include <QTimer>
 #include <QMap>
 #include <QUtf8StringView>
 #include <QVariant>
+#include <QWriteLocker>
 #include <QLoggingCategory>
 #include <QtGlobal>
 
 #include <algorithm>
 #include <cmath>
+#include <future>
+#include <map>
 #include <optional>
-#include <stdexcept>
-
-#ifdef GPT4ALL_USE_QTPDF
-#   include <QPdfDocument>
-#   include <QPdfSelection>
-#elif !defined(GPT4ALL_NO_PDF_SUPPORT)
-#   include <fpdfview.h>
-#   include <fpdf_doc.h>
-#   include <fpdf_text.h>
-#endif
+#include <span>
 
 // Qt 6.2 compatibility - Qt::Literals::StringLiterals not available
 namespace ranges = std::ranges;
@@ -49,51 +45,6 @@ namespace us = unum::usearch;
 //#define DEBUG_EXAMPLE
 
 
-namespace {
-
-/* QFile that checks input for binary data. If seen, it fails the read and returns true
- * for binarySeen(). */
-class BinaryDetectingFile: public QFile {
-public:
-    using QFile::QFile;
-
-    bool binarySeen() const { return m_binarySeen; }
-
-protected:
-    qint64 readData(char *data, qint64 maxSize) override {
-        qint64 res = QFile::readData(data, maxSize);
-        return checkData(data, res);
-    }
-
-    qint64 readLineData(char *data, qint64 maxSize) override {
-        qint64 res = QFile::readLineData(data, maxSize);
-        return checkData(data, res);
-    }
-
-private:
-    qint64 checkData(const char *data, qint64 size) {
-        Q_ASSERT(!isTextModeEnabled()); // We need raw bytes from the underlying QFile
-        if (size != -1 && !m_binarySeen) {
-            for (qint64 i = 0; i < size; i++) {
-                /* Control characters we should never see in plain text:
-                 * 0x00 NUL - 0x06 ACK
-                 * 0x0E SO  - 0x1A SUB
-                 * 0x1C FS  - 0x1F US */
-                auto c = static_cast<unsigned char>(data[i]);
-                if (c < 0x07 || (c >= 0x0E && c < 0x1B) || (c >= 0x1C && c < 0x20)) {
-                    m_binarySeen = true;
-                    break;
-                }
-            }
-        }
-        return m_binarySeen ? -1 : size;
-    }
-
-    bool m_binarySeen = false;
-};
-
-} // namespace
-
 static int s_batchSize = 100;
 
 static const QString INIT_DB_SQL[] = {
@@ -174,17 +125,44 @@ static const QString INIT_DB_SQL[] = {
     )"),
 };
 
-static const QString INSERT_CHUNK_SQL = QString(R"(
+// Applied to every connection. WAL lets retrieval read while indexing writes, and with it synchronous = NORMAL can only
+// lose the last transactions on power loss, never corrupt the database.
+static const QString SESSION_PRAGMAS_SQL[] = {
+    QString("pragma journal_mode = WAL;"),
+    QString("pragma synchronous = NORMAL;"),
+    QString("pragma mmap_size = 268435456;"), // 256 MiB
+    QString("pragma cache_size = -65536;"),   // 64 MiB
+    QString("pragma temp_store = MEMORY;"),
+};
+
+// Applied to the connections of the readers, which are opened read-only and are in WAL mode already.
+static const QString READER_PRAGMAS_SQL[] = {
+    QString("pragma mmap_size = 268435456;"), // 256 MiB, shared with the other connections through the page cache
+    QString("pragma cache_size = -16384;"),   // 16 MiB
+    QString("pragma temp_store = MEMORY;"),
+};
+
+// The most memory the embeddings held for exact search may take, further capped at an eighth of the RAM.
+static constexpr size_t MAX_EMBEDDING_ARENA_BYTES = size_t(1) << 30;
+
+// How many query embeddings are logged together, if no ingestion logs them sooner.
+static constexpr qint64 QUERY_STATS_INTERVAL = 100;
+
+// Multi-row inserts, %1 is a list of rows of placeholders. 64 rows of 11 parameters stay below the 999 host parameters
+// that older SQLite builds allow.
+static constexpr qsizetype CHUNK_INSERT_ROWS = 64;
+
+static const QString INSERT_CHUNKS_SQL = QString(R"(
     insert into chunks(document_id, chunk_text,
         file, title, author, subject, keywords, page, line_from, line_to, words)
-        values(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+        values %1
         returning id;
 )");
 
-static const QString INSERT_CHUNK_FTS_SQL = QString(R"(
+static const QString INSERT_CHUNKS_FTS_SQL = QString(R"(
         insert into chunks_fts(document_id, chunk_text,
             file, title, author, subject, keywords)
-            values(?, ?, ?, ?, ?, ?, ?);
+            values %1;
 )");
 
 static const QString SELECT_CHUNKED_DOCUMENTS_SQL[] = {
@@ -250,8 +228,8 @@ static const QString SELECT_CHUNKS_FTS_SQL = QString(R"(
     join collection_items ci on d.folder_id = ci.folder_id
     join collections co on ci.collection_id = co.id
     where chunks_fts match ?
-    and co.name in ('%1')
-    order by score limit %2;
+    and co.name in (%1)%2
+    order by score limit ?;
 )");
 
 
@@ -754,12 +732,93 @@ static const QString INSERT_EMBEDDING_SQL = QString(R"(
     limit 1;
 )");
 
-static const QString GET_COLLECTION_EMBEDDINGS_SQL = QString(R"(
-    select e.chunk_id, e.embedding
-    from embeddings e
-    join collections co on co.embedding_model = e.model
-    join collection_items ci on ci.folder_id = e.folder_id and ci.collection_id = co.id
-    where co.name in ('%1');
+static const QString GET_COLLECTION_FOLDERS_SQL = QString(R"(
+    select distinct co.embedding_model, ci.folder_id
+    from collections co
+    join collection_items ci on ci.collection_id = co.id
+    where co.name in (%1) and co.embedding_model is not null;
+)");
+
+static const QString SELECT_FILTERED_CHUNKS_SQL = QString(R"(
+    select d.folder_id, c.id
+    from chunks c
+    join documents d on d.id = c.document_id
+    where %1;
+)");
+
+static QString idList(const QList<int> &ids)
+{
+    QStringList strings;
+    for (int id : ids)
+        strings << QString::number(id);
+    return strings.join(", ");
+}
+
+// The conditions of filter on the documents d, to be joined with 'and', and the values to bind to their placeholders
+// in order. The ids are written out rather than bound, there can be more of them than SQLite allows parameters.
+static QStringList documentConditions(const RetrievalFilter &filter, QVariantList &values)
+{
+    QStringList conditions;
+    if (!filter.folderIds.isEmpty())
+        conditions << QString("d.folder_id in (%1)").arg(idList(filter.folderIds));
+    if (!filter.documentIds.isEmpty())
+        conditions << QString("d.id in (%1)").arg(idList(filter.documentIds));
+    if (filter.from.isValid()) {
+        conditions << "d.document_time >= ?";
+        values << filter.from.toMSecsSinceEpoch();
+    }
+    if (filter.to.isValid()) {
+        conditions << "d.document_time <= ?";
+        values << filter.to.toMSecsSinceEpoch();
+    }
+    if (!filter.extensions.isEmpty()) {
+        // like ignores the case of ASCII letters, which is what file extensions are written in
+        QStringList likes;
+        for (QString extension : filter.extensions) {
+            extension.replace('\\', "\\\\").replace('%', "\\%").replace('_', "\\_");
+            likes << R"(d.document_path like ? escape '\')";
+            values << "%." + extension;
+        }
+        conditions << '(' + likes.join(" or ") + ')';
+    }
+    return conditions;
+}
+
+// Collect the chunks of the documents of folderIds that filter selects.
+static bool selectFilteredChunks(QSqlQuery &q, const QList<int> &folderIds, const RetrievalFilter &filter,
+                                 ChunkFilter &chunks)
+{
+    RetrievalFilter folderFilter = filter;
+    folderFilter.folderIds = folderIds;
+    QVariantList values;
+    q.setForwardOnly(true);
+    if (!q.prepare(SELECT_FILTERED_CHUNKS_SQL.arg(documentConditions(folderFilter, values).join(" and "))))
+        return false;
+    for (const auto &value : std::as_const(values))
+        q.addBindValue(value);
+    if (!q.exec())
+        return false;
+    while (q.next())
+        chunks.insert(q.value(0).toInt(), q.value(1).toInt());
+    return true;
+}
+
+static const QString GET_FOLDER_EMBEDDINGS_SQL = QString(R"(
+    select chunk_id, embedding
+    from embeddings
+    where model = ? and folder_id in (%1);
+)");
+
+static const QString COUNT_EMBEDDINGS_SQL = QString(R"(
+    select model, folder_id, count(*)
+    from embeddings
+    group by model, folder_id;
+)");
+
+static const QString COUNT_FOLDER_EMBEDDINGS_SQL = QString(R"(
+    select count(*)
+    from embeddings
+    where model = ? and folder_id = ?;
 )");
 
 static const QString GET_CHUNK_EMBEDDINGS_SQL = QString(R"(
@@ -768,10 +827,63 @@ static const QString GET_CHUNK_EMBEDDINGS_SQL = QString(R"(
     where e.chunk_id in (%1);
 )");
 
+static const QString GET_MODEL_CHUNK_EMBEDDINGS_SQL = QString(R"(
+    select chunk_id, embedding
+    from embeddings
+    where model = ? and chunk_id in (%1);
+)");
+
 static const QString GET_CHUNK_FILE_SQL = QString(R"(
     select file from chunks where id = ?;
 )");
 
+// Embeddings by a hash of the embedding model, task and text. Unlike the embeddings table this outlives the chunks, so
+// that text which is chunked again does not have to be embedded again.
+static const QString INIT_EMBEDDING_CACHE_SQL = QString(R"(
+    create table if not exists embedding_cache(
+        hash      blob primary key,
+        embedding blob not null,
+        last_used integer not null
+    ) without rowid;
+)");
+
+static const QString GET_CACHED_EMBEDDING_SQL = QString(R"(
+    select embedding from embedding_cache where hash = ?;
+)");
+
+static const QString TOUCH_CACHED_EMBEDDING_SQL = QString(R"(
+    update embedding_cache set last_used = ? where hash = ?;
+)");
+
+static const QString INSERT_CACHED_EMBEDDING_SQL = QString(R"(
+    insert or replace into embedding_cache(hash, embedding, last_used) values(?, ?, ?);
+)");
+
+static const QString PRUNE_EMBEDDING_CACHE_SQL = QString(R"(
+    delete from embedding_cache where hash in (
+        select hash from embedding_cache order by last_used desc limit -1 offset ?
+    );
+)");
+
+static const QString COUNT_ALL_EMBEDDINGS_SQL = QString(R"(
+    select count(*) from embeddings;
+)");
+
+// cached embeddings kept beyond those of the current chunks, enough to re-index a large folder after a mass touch
+static constexpr qsizetype EMBEDDING_CACHE_SLACK = 50000;
+
+static QByteArray embeddingCacheKey(const QString &modelId, bool isQuery, const QString &text)
+{
+    const char sep = '\0';
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(modelId.toUtf8());
+    hash.addData({ &sep, 1 });
+    hash.addData(isQuery ? "search_query" : "search_document");
+    hash.addData({ &sep, 1 });
+    hash.addData(text.toUtf8());
+    return hash.result();
+}
+
 namespace {
     struct Embedding { QString model; int folder_id; int chunk_id; QByteArray data; };
     struct EmbeddingStat { QString lastFile; int nAdded; int nSkipped; };
@@ -779,7 +891,8 @@ namespace {
 
 NAMED_PAIR(EmbeddingFolder, QString, embedding_model, int, folder_id)
 
-static bool sqlAddEmbeddings(QSqlQuery &q, const QList<Embedding> &embeddings, QHash<EmbeddingFolder, EmbeddingStat> &embeddingStats)
+static bool sqlAddEmbeddings(QSqlQuery &q, const QList<Embedding> &embeddings, QHash<EmbeddingFolder, EmbeddingStat> &embeddingStats,
+                             QList<const Embedding *> &added)
 {
     if (!q.prepare(INSERT_EMBEDDING_SQL))
         return false;
@@ -795,6 +908,7 @@ static bool sqlAddEmbeddings(QSqlQuery &q, const QList<Embedding> &embeddings, Q
         auto &stat = embeddingStats[{ e.model, e.folder_id }];
         if (q.numRowsAffected()) {
             stat.nAdded++; // embedding added
+            added << &e;
         } else {
             stat.nSkipped++; // embedding no longer needed
         }
@@ -821,18 +935,41 @@ void Database::transaction()
 {
     bool ok = m_db.transaction();
     Q_ASSERT(ok);
+    m_inTransaction = true;
 }
 
 void Database::commit()
 {
     bool ok = m_db.commit();
     Q_ASSERT(ok);
+    m_inTransaction = false;
+    applyIndexRemovals();
 }
 
 void Database::rollback()
 {
     bool ok = m_db.rollback();
     Q_ASSERT(ok);
+    m_inTransaction = false;
+    m_removedChunkIds.clear();
+    m_removedFolderIds.clear();
+}
+
+// The in-memory index and arena must not lose entries that a rolled back transaction keeps, so removals made inside
+// a transaction wait here until it commits.
+void Database::applyIndexRemovals()
+{
+    if (m_inTransaction || (m_removedChunkIds.isEmpty() && m_removedFolderIds.isEmpty()))
+        return;
+    QWriteLocker locker(&m_embeddingIndexLock);
+    for (int folderId: std::as_const(m_removedFolderIds)) {
+        m_embeddingIndex.removeFolder(folderId);
+        m_embeddingArena.removeFolder(folderId);
+    }
+    m_embeddingIndex.remove(m_removedChunkIds);
+    m_embeddingArena.remove(m_removedChunkIds);
+    m_removedChunkIds.clear();
+    m_removedFolderIds.clear();
 }
 
 bool Database::refreshDocumentIdCache(QSqlQuery &q)
@@ -847,44 +984,124 @@ bool Database::refreshDocumentIdCache(QSqlQuery &q)
     return true;
 }
 
-bool Database::addChunk(QSqlQuery &q, int document_id, const QString &chunk_text, const QString &file,
-                        const QString &title, const QString &author, const QString &subject, const QString &keywords,
-                        int page, int from, int to, int words, int *chunk_id)
+// Inserts chunks CHUNK_INSERT_ROWS at a time. The statements for a full group of rows are prepared once and reused for
+// as long as the writer lives, only the last group of a document needs statements of its own.
+struct Database::ChunkWriter {
+    struct Statements {
+        QSqlQuery chunks;
+        QSqlQuery fts;
+        qsizetype rows = 0;
+    };
+
+    explicit ChunkWriter(const QSqlDatabase &db)
+        : m_full { QSqlQuery(db), QSqlQuery(db) }, m_partial { QSqlQuery(db), QSqlQuery(db) } {}
+
+    bool insert(int documentId, const QString &file, const DocumentMetadata &metadata,
+                std::span<const ChunkStreamer::Chunk> chunks, QList<int> &chunkIds);
+    QSqlError lastError() const { return m_error; }
+
+private:
+    bool prepare(Statements &s, qsizetype rows);
+
+    Statements   m_full;
+    Statements   m_partial;
+    QSqlError    m_error;
+};
+
+static QString sqlRows(qsizetype rows, int columns)
 {
-    if (!q.prepare(INSERT_CHUNK_SQL))
-        return false;
-    q.addBindValue(document_id);
-    q.addBindValue(chunk_text);
-    q.addBindValue(file);
-    q.addBindValue(title);
-    q.addBindValue(author);
-    q.addBindValue(subject);
-    q.addBindValue(keywords);
-    q.addBindValue(page);
-    q.addBindValue(from);
-    q.addBindValue(to);
-    q.addBindValue(words);
-    if (!q.exec() || !q.next())
-        return false;
-    *chunk_id = q.value(0).toInt();
+    QString row = '(' + QStringList(columns, "?").join(", ") + ')';
+    return QStringList(rows, row).join(", ");
+}
 
-    if (!q.prepare(INSERT_CHUNK_FTS_SQL))
+bool Database::ChunkWriter::prepare(Statements &s, qsizetype rows)
+{
+    if (s.rows == rows)
+        return true;
+    s.rows = 0;
+    if (!s.chunks.prepare(INSERT_CHUNKS_SQL.arg(sqlRows(rows, 11)))) {
+        m_error = s.chunks.lastError();
         return false;
-    q.addBindValue(document_id);
-    q.addBindValue(chunk_text);
-    q.addBindValue(file);
-    q.addBindValue(title);
-    q.addBindValue(author);
-    q.addBindValue(subject);
-    q.addBindValue(keywords);
-    if (!q.exec())
+    }
+    if (!s.fts.prepare(INSERT_CHUNKS_FTS_SQL.arg(sqlRows(rows, 7)))) {
+        m_error = s.fts.lastError();
         return false;
-    m_documentIdCache << document_id;
+    }
+    s.rows = rows;
+    return true;
+}
+
+bool Database::ChunkWriter::insert(int documentId, const QString &file, const DocumentMetadata &metadata,
+                                   std::span<const ChunkStreamer::Chunk> chunks, QList<int> &chunkIds)
+{
+    // TODO: implement line_from/line_to
+    constexpr int line_from = -1;
+    constexpr int line_to = -1;
+
+    while (!chunks.empty()) {
+        const qsizetype rows = std::min<qsizetype>(chunks.size(), CHUNK_INSERT_ROWS);
+        Statements &s = rows == CHUNK_INSERT_ROWS ? m_full : m_partial;
+        if (!prepare(s, rows))
+            return false;
+
+        for (const auto &chunk : chunks.first(rows)) {
+            s.chunks.addBindValue(documentId);
+            s.chunks.addBindValue(chunk.text);
+            s.chunks.addBindValue(file);
+            s.chunks.addBindValue(metadata.title);
+            s.chunks.addBindValue(metadata.author);
+            s.chunks.addBindValue(metadata.subject);
+            s.chunks.addBindValue(metadata.keywords);
+            s.chunks.addBindValue(chunk.page);
+            s.chunks.addBindValue(line_from);
+            s.chunks.addBindValue(line_to);
+            s.chunks.addBindValue(chunk.words);
+
+            s.fts.addBindValue(documentId);
+            s.fts.addBindValue(chunk.text);
+            s.fts.addBindValue(file);
+            s.fts.addBindValue(metadata.title);
+            s.fts.addBindValue(metadata.author);
+            s.fts.addBindValue(metadata.subject);
+            s.fts.addBindValue(metadata.keywords);
+        }
+        if (!s.chunks.exec()) {
+            m_error = s.chunks.lastError();
+            return false;
+        }
+        // RETURNING lists the rows in no particular order, but autoincrement ids grow in the order the rows are inserted
+        QList<int> ids;
+        ids.reserve(rows);
+        while (s.chunks.next())
+            ids << s.chunks.value(0).toInt();
+        s.chunks.finish();
+        if (ids.size() != rows) {
+            m_error = QSqlError(QString("inserted %1 chunks but got %2 ids").arg(rows).arg(ids.size()), {},
+                                QSqlError::StatementError);
+            return false;
+        }
+        std::sort(ids.begin(), ids.end());
+        chunkIds << ids;
+        if (!s.fts.exec()) {
+            m_error = s.fts.lastError();
+            return false;
+        }
+        chunks = chunks.subspan(rows);
+    }
     return true;
 }
 
 bool Database::removeChunksByDocumentId(QSqlQuery &q, int document_id)
 {
+    if (!q.prepare(SELECT_CHUNKS_BY_DOCUMENT_SQL))
+        return false;
+    q.addBindValue(document_id);
+    if (!q.exec())
+        return false;
+    QList<int> chunkIds;
+    while (q.next())
+        chunkIds << q.value(0).toInt();
+
     for (const auto &cmd: DELETE_CHUNKS_SQL) {
         if (!q.prepare(cmd))
             return false;
@@ -893,11 +1110,17 @@ bool Database::removeChunksByDocumentId(QSqlQuery &q, int document_id)
             return false;
     }
     m_documentIdCache.remove(document_id);
+    m_removedChunkIds << chunkIds;
+    applyIndexRemovals();
     return true;
 }
 
 bool Database::sqlRemoveDocsByFolderPath(QSqlQuery &q, const QString &path)
 {
+    int folder_id = -1;
+    if (!selectFolder(q, path, &folder_id))
+        return false;
+
     for (const auto &cmd: FOLDER_REMOVE_ALL_DOCS_SQL) {
         if (!q.prepare(cmd))
             return false;
@@ -905,6 +1128,8 @@ bool Database::sqlRemoveDocsByFolderPath(QSqlQuery &q, const QString &path)
         if (!q.exec())
             return false;
     }
+    m_removedFolderIds << folder_id;
+    applyIndexRemovals();
     return refreshDocumentIdCache(q);
 }
 
@@ -929,6 +1154,11 @@ int Database::openDatabase(const QString &modelPath, bool create, int ver)
         qWarning() << "ERROR: opening db" << dbPath << m_db.lastError();
         return -1;
     }
+    QSqlQuery q(m_db);
+    for (const auto &cmd : SESSION_PRAGMAS_SQL) {
+        if (!q.exec(cmd))
+            qWarning() << "Database ERROR: failed to apply" << cmd << q.lastError();
+    }
     return hasContent();
 }
 
@@ -1010,21 +1240,29 @@ bool Database::initDb(const QString &modelPath, const QList<CollectionItem> &old
     return true;
 }
 
-Database::Database(int chunkSize, QStringList extensions)
+Database::Database(int chunkSize, QStringList extensions, EmbeddingIndex::Quantization quantization)
     : QObject(nullptr)
     , m_chunkSize(chunkSize)
     , m_scannedFileExtensions(std::move(extensions))
+    , m_quantization(quantization)
     , m_scanIntervalTimer(new QTimer(this))
     , m_watcher(new QFileSystemWatcher(this))
     , m_embLLM(new EmbeddingLLM)
     , m_databaseValid(true)
-    , m_chunkStreamer(this)
+    , m_ingest(new IngestPipeline(this))
+    , m_embeddingArena(std::min(MAX_EMBEDDING_ARENA_BYTES, size_t(getSystemTotalRAMInBytes() / 8)))
 {
     m_db = QSqlDatabase::database(QSqlDatabase::defaultConnection, false);
     if (!m_db.isValid())
         m_db = QSqlDatabase::addDatabase("QSQLITE");
     Q_ASSERT(m_db.isValid());
 
+    connect(m_ingest, &IngestPipeline::batchesReady, this, &Database::writeIngestedChunks);
+
+    m_readers.setObjectName("localdocs-reader");
+    m_readers.setMaxThreadCount(std::clamp(QThread::idealThreadCount(), 2, 8));
+    m_readers.setExpiryTimeout(-1); // the threads keep their connections
+
     moveToThread(&m_dbThread);
     m_dbThread.setObjectName("database");
     m_dbThread.start();
@@ -1032,6 +1270,7 @@ Database::Database(int chunkSize, QStringList extensions)
 
 Database::~Database()
 {
+    m_readers.waitForDone();
     m_dbThread.quit();
     m_dbThread.wait();
     delete m_embLLM;
@@ -1110,544 +1349,164 @@ static void handleDocumentError(const QString &errorMessage, int document_id, co
     qWarning() << errorMessage << document_id << document_path << error;
 }
 
-class DocumentReader {
-public:
-    struct Metadata { QString title, author, subject, keywords; };
-
-    static std::unique_ptr<DocumentReader> fromDocument(DocumentInfo info);
-
-    const DocumentInfo           &doc     () const { return m_info; }
-    const Metadata               &metadata() const { return m_metadata; }
-    const std::optional<QString> &word    () const { return m_word; }
-    const std::optional<QString> &nextWord()       { m_word = advance(); return m_word; }
-    virtual std::optional<ChunkStreamer::Status> getError() const { return std::nullopt; }
-    virtual int page() const { return -1; }
-
-    virtual ~DocumentReader() = default;
-
-protected:
-    explicit DocumentReader(DocumentInfo info)
-        : m_info(std::move(info)) {}
-
-    void postInit(Metadata &&metadata = {})
-    {
-        m_metadata = std::move(metadata);
-        m_word = advance();
-    }
-
-    virtual std::optional<QString> advance() = 0;
-
-    DocumentInfo           m_info;
-    Metadata               m_metadata;
-    std::optional<QString> m_word;
-};
-
-namespace {
-
-#ifdef GPT4ALL_USE_QTPDF
-class PdfDocumentReader final : public DocumentReader {
-public:
-    explicit PdfDocumentReader(DocumentInfo info)
-        : DocumentReader(std::move(info))
-    {
-        QString path = info.file.canonicalFilePath();
-        if (m_doc.load(path) != QPdfDocument::Error::None)
-            throw std::runtime_error(fmt::format("Failed to load PDF: {}", path));
-        Metadata metadata {
-            .title    = m_doc.metaData(QPdfDocument::MetaDataField::Title   ).toString(),
-            .author   = m_doc.metaData(QPdfDocument::MetaDataField::Author  ).toString(),
-            .subject  = m_doc.metaData(QPdfDocument::MetaDataField::Subject ).toString(),
-            .keywords = m_doc.metaData(QPdfDocument::MetaDataField::Keywords).toString(),
-        };
-        postInit(std::move(metadata));
-    }
-
-    int page() const override { return m_currentPage; }
-
-private:
-    std::optional<QString> advance() override
-    {
-        QString word;
-        do {
-            while (!m_stream || m_stream->atEnd()) {
-                if (m_currentPage >= m_doc.pageCount())
-                    return std::nullopt;
-                m_pageText = m_doc.getAllText(m_currentPage++).text();
-                m_stream.emplace(&m_pageText);
-            }
-            *m_stream >> word;
-        } while (word.isEmpty());
-        return word;
-    }
-
-    QPdfDocument               m_doc;
-    int                        m_currentPage = 0;
-    QString                    m_pageText;
-    std::optional<QTextStream> m_stream;
-};
-#elif !defined(GPT4ALL_NO_PDF_SUPPORT)
-class PdfDocumentReader final : public DocumentReader {
-public:
-    explicit PdfDocumentReader(DocumentInfo info)
-        : DocumentReader(std::move(info))
-    {
-        QString path = info.file.canonicalFilePath();
-        m_doc = FPDF_LoadDocument(path.toUtf8().constData(), nullptr);
-        if (!m_doc)
-            throw std::runtime_error(fmt::format("Failed to load PDF: {}", path));
-
-        // Extract metadata
-        Metadata metadata {
-            .title    = getMetadata("Title"   ),
-            .author   = getMetadata("Author"  ),
-            .subject  = getMetadata("Subject" ),
-            .keywords = getMetadata("Keywords"),
-        };
-        postInit(std::move(metadata));
-    }
-
-    ~PdfDocumentReader() override
-    {
-        if (m_page)
-            FPDF_ClosePage(m_page);
-        if (m_doc)
-            FPDF_CloseDocument(m_doc);
-    }
-
-    int page() const override { return m_currentPage; }
-
-private:
-    std::optional<QString> advance() override
-    {
-        QString word;
-        do {
-            while (!m_stream || m_stream->atEnd()) {
-                if (m_currentPage >= FPDF_GetPageCount(m_doc))
-                    return std::nullopt;
-
-                if (m_page)
-                    FPDF_ClosePage(std::exchange(m_page, nullptr));
-                m_page = FPDF_LoadPage(m_doc, m_currentPage++);
-                if (!m_page)
-                    throw std::runtime_error("Failed to load page.");
-
-                m_pageText = extractTextFromPage(m_page);
-                m_stream.emplace(&m_pageText);
-            }
-            *m_stream >> word;
-        } while (word.isEmpty());
-        return word;
-    }
-
-    QString getMetadata(FPDF_BYTESTRING key)
-    {
-        // FPDF_GetMetaText includes a 2-byte null terminator
-        ulong nBytes = FPDF_GetMetaText(m_doc, key, nullptr, 0);
-        if (nBytes <= sizeof (FPDF_WCHAR))
-            return { "" };
-        QByteArray buffer(nBytes, Qt::Uninitialized);
-        ulong nResultBytes = FPDF_GetMetaText(m_doc, key, buffer.data(), buffer.size());
-        Q_ASSERT(nResultBytes % 2 == 0);
-        Q_ASSERT(nResultBytes <= nBytes);
-        return QString::fromUtf16(reinterpret_cast<const char16_t *>(buffer.data()), nResultBytes / 2 - 1);
-    }
-
-    QString extractTextFromPage(FPDF_PAGE page)
-    {
-        FPDF_TEXTPAGE textPage = FPDFText_LoadPage(page);
-        if (!textPage)
-            throw std::runtime_error("Failed to load text page.");
-
-        int nChars = FPDFText_CountChars(textPage);
-        if (!nChars)
-            return {};
-        // FPDFText_GetText includes a 2-byte null terminator
-        QByteArray buffer((nChars + 1) * sizeof (FPDF_WCHAR), Qt::Uninitialized);
-        int nResultChars = FPDFText_GetText(textPage, 0, nChars, reinterpret_cast<ushort *>(buffer.data()));
-        Q_ASSERT(nResultChars <= nChars + 1);
-
-        FPDFText_ClosePage(textPage);
-        return QString::fromUtf16(reinterpret_cast<const char16_t *>(buffer.data()), nResultChars - 1);
-    }
-
-    FPDF_DOCUMENT              m_doc = nullptr;
-    FPDF_PAGE                  m_page = nullptr;
-    int                        m_currentPage = 0;
-    QString                    m_pageText;
-    std::optional<QTextStream> m_stream;
-};
-#else // defined(GPT4ALL_NO_PDF_SUPPORT)
-// Stub PDF reader when PDF support is disabled
-class PdfDocumentReader final : public DocumentReader {
-public:
-    explicit PdfDocumentReader(DocumentInfo info)
-        : DocumentReader(std::move(info))
-    {
-        throw std::runtime_error("PDF support not available on this platform");
-    }
-
-protected:
-    std::optional<QString> advance() override {
-        throw std::runtime_error("PDF support not available on this platform");
-    }
-};
-#endif // !defined(GPT4ALL_USE_QTPDF)
-
-class WordDocumentReader final : public DocumentReader {
-public:
-    explicit WordDocumentReader(DocumentInfo info)
-        : DocumentReader(std::move(info))
-        , m_doc(info.file.canonicalFilePath().toStdString())
-    {
-        m_doc.open();
-        if (!m_doc.is_open())
-            throw std::runtime_error(fmt::format("Failed to open DOCX: {}", info.file.canonicalFilePath()));
-
-        m_paragraph = &m_doc.paragraphs();
-        m_run       = &m_paragraph->runs();
-        // TODO(jared): metadata for Word documents?
-        postInit();
-    }
-
-protected:
-    std::optional<QString> advance() override
-    {
-        // find non-space char
-        qsizetype wordStart = 0;
-        while (m_buffer.isEmpty() || m_buffer[wordStart].isSpace()) {
-            if (m_buffer.isEmpty() && !fillBuffer())
-                return std::nullopt;
-            if (m_buffer[wordStart].isSpace() && ++wordStart >= m_buffer.size()) {
-                m_buffer.clear();
-                wordStart = 0;
-            }
-        }
-
-        // find space char
-        qsizetype wordEnd = wordStart + 1;
-        while (wordEnd >= m_buffer.size() || !m_buffer[wordEnd].isSpace()) {
-            if (wordEnd >= m_buffer.size() && !fillBuffer())
-                break;
-            if (!m_buffer[wordEnd].isSpace())
-                ++wordEnd;
-        }
-
-        if (wordStart == wordEnd)
-            return std::nullopt;
-
-        auto size = wordEnd - wordStart;
-        QString word = std::move(m_buffer);
-        m_buffer = word.sliced(wordStart + size);
-        if (wordStart == 0)
-            word.resize(size);
-        else
-            word = word.sliced(wordStart, size);
-        return word;
-    }
-
-    bool fillBuffer()
-    {
-        for (;;) {
-            // get a run
-            while (!m_run->has_next()) {
-                // try next paragraph
-                if (!m_paragraph->has_next())
-                    return false;
-
-                m_paragraph->next();
-                m_buffer += u'\n';
-            }
-
-            bool foundText = false;
-            auto &run = m_run->get_node();
-            for (auto node = run.first_child(); node; node = node.next_sibling()) {
-                std::string node_name = node.name();
-                if (node_name == "w:t") {
-                    const char *text = node.text().get();
-                    if (*text) {
-                        foundText = true;
-                        m_buffer += QString::fromUtf8(text);
-                    }
-                } else if (node_name == "w:br") {
-                    m_buffer += u'\n';
-                } else if (node_name == "w:tab") {
-                    m_buffer += u'\t';
-                }
-            }
-
-            m_run->next();
-            if (foundText) return true;
-        }
-    }
-
-    duckx::Document   m_doc;
-    duckx::Paragraph *m_paragraph;
-    duckx::Run       *m_run;
-    QString           m_buffer;
-};
-
-class TxtDocumentReader final : public DocumentReader {
-public:
-    explicit TxtDocumentReader(DocumentInfo info)
-        : DocumentReader(std::move(info))
-        , m_file(info.file.canonicalFilePath())
-    {
-        if (!m_file.open(QIODevice::ReadOnly))
-            throw std::runtime_error(fmt::format("Failed to open text file: {}", m_file.fileName()));
-
-        m_stream.setDevice(&m_file);
-        postInit();
-    }
+void Database::appendChunk(const EmbeddingChunk &chunk)
+{
+    m_chunkList.reserve(s_batchSize);
+    m_chunkList.append(chunk);
+    if (m_chunkList.size() >= s_batchSize)
+        sendChunkList();
+}
 
-protected:
-    std::optional<QString> advance() override
-    {
-        if (getError())
-            return std::nullopt;
-        while (!m_stream.atEnd()) {
-            QString word;
-            m_stream >> word;
-            if (getError())
-                return std::nullopt;
-            if (!word.isEmpty())
-                return word;
-        }
-        return std::nullopt;
-    }
+void Database::sendChunkList()
+{
+    embedChunks(m_chunkList);
+    m_chunkList.clear();
+}
 
-    std::optional<ChunkStreamer::Status> getError() const override
-    {
-        if (m_file.binarySeen())
-            return ChunkStreamer::Status::BINARY_SEEN;
-        if (m_file.error())
-            return ChunkStreamer::Status::ERROR;
-        return std::nullopt;
+void Database::initEmbeddingCache()
+{
+    QSqlQuery q(m_db);
+    if (!q.exec(INIT_EMBEDDING_CACHE_SQL)) {
+        qWarning() << "Database ERROR: Failed to create embedding cache:" << q.lastError();
+        return;
     }
 
-    BinaryDetectingFile m_file;
-    QTextStream m_stream;
-};
-
-} // namespace
-
-std::unique_ptr<DocumentReader> DocumentReader::fromDocument(DocumentInfo doc)
-{
-#ifdef GPT4ALL_NO_PDF_SUPPORT
-    if (doc.isPdf()) {
-        // Skip PDF files when PDF support is disabled
-        qWarning() << "Skipping PDF file - PDF support not available on this platform:" << doc.file.canonicalFilePath();
-        return nullptr;
+    // keep as many of the most recently used embeddings as there are chunks, plus some
+    if (!q.exec(COUNT_ALL_EMBEDDINGS_SQL) || !q.next()) {
+        qWarning() << "Database ERROR: Failed to count embeddings:" << q.lastError();
+        return;
     }
-#else
-    if (doc.isPdf())
-        return std::make_unique<PdfDocumentReader>(std::move(doc));
-#endif
-    if (doc.isDocx())
-        return std::make_unique<WordDocumentReader>(std::move(doc));
-    return std::make_unique<TxtDocumentReader>(std::move(doc));
+    const qsizetype keep = q.value(0).toLongLong() + EMBEDDING_CACHE_SLACK;
+    if (!q.prepare(PRUNE_EMBEDDING_CACHE_SQL))
+        return;
+    q.addBindValue(keep);
+    if (!q.exec())
+        qWarning() << "Database ERROR: Failed to prune embedding cache:" << q.lastError();
 }
 
-ChunkStreamer::ChunkStreamer(Database *database)
-    : m_database(database) {}
-
-ChunkStreamer::~ChunkStreamer() = default;
-
-void ChunkStreamer::setDocument(DocumentInfo doc, int documentId, const QString &embeddingModel)
+// The cached embedding of each key, or an empty array if there is none.
+QList<QByteArray> Database::cachedEmbeddings(QSqlQuery &q, const QList<QByteArray> &keys)
 {
-    auto docKey = doc.key();
-    if (!m_docKey || *m_docKey != docKey) {
-        m_docKey         = docKey;
-        m_reader         = DocumentReader::fromDocument(std::move(doc));
-        
-        // Handle case when PDF support is disabled
-        if (!m_reader) {
-            qWarning() << "Skipping unsupported document type";
-            m_docKey.reset();
-            return;
-        }
-        
-        m_documentId     = documentId;
-        m_embeddingModel = embeddingModel;
-        m_chunk.clear();
-        m_page = 0;
-
-        // make sure the document doesn't already have any chunks
-        if (m_database->m_documentIdCache.contains(documentId)) {
-            QSqlQuery q(m_database->m_db);
-            if (!m_database->removeChunksByDocumentId(q, documentId))
-                handleDocumentError("ERROR: Cannot remove chunks of document",
-                                    documentId, m_reader->doc().file.canonicalPath(), q.lastError());
-        }
+    QList<QByteArray> embeddings(keys.size());
+    if (!q.prepare(GET_CACHED_EMBEDDING_SQL))
+        return embeddings;
+    QVariantList hits;
+    for (qsizetype i = 0; i < keys.size(); i++) {
+        q.addBindValue(keys[i]);
+        if (!q.exec() || !q.next())
+            continue;
+        embeddings[i] = q.value(0).toByteArray();
+        hits << keys[i];
     }
-}
+    if (hits.isEmpty() || !q.prepare(TOUCH_CACHED_EMBEDDING_SQL))
+        return embeddings;
 
-std::optional<DocumentInfo::key_type> ChunkStreamer::currentDocKey() const
-{
-    return m_docKey;
+    q.addBindValue(QVariantList(hits.size(), QDateTime::currentSecsSinceEpoch()));
+    q.addBindValue(hits);
+    if (!q.execBatch())
+        qWarning() << "Database ERROR: Failed to update embedding cache:" << q.lastError();
+    return embeddings;
 }
 
-void ChunkStreamer::reset()
+void Database::cacheEmbeddings(QSqlQuery &q, const QVariantList &keys, const QVariantList &embeddings)
 {
-    m_docKey.reset();
+    if (keys.isEmpty() || !q.prepare(INSERT_CACHED_EMBEDDING_SQL))
+        return;
+    q.addBindValue(keys);
+    q.addBindValue(embeddings);
+    q.addBindValue(QVariantList(keys.size(), QDateTime::currentSecsSinceEpoch()));
+    if (!q.execBatch())
+        qWarning() << "Database ERROR: Failed to add to embedding cache:" << q.lastError();
 }
 
-ChunkStreamer::Status ChunkStreamer::step()
+// Send chunks to the embedding model, except those whose text has been embedded before.
+void Database::embedChunks(const QList<EmbeddingChunk> &chunks)
 {
-    // Handle case when document reader is not available (e.g., PDF support disabled)
-    if (!m_reader) {
-        m_docKey.reset();
-        return Status::ERROR;
-    }
-
-    // TODO: implement line_from/line_to
-    constexpr int line_from = -1;
-    constexpr int line_to = -1;
-    const int folderId = m_reader->doc().folder;
-    const int maxChunkSize = m_database->m_chunkSize;
-    int nChunks = 0;
-    int nAddedWords = 0;
-    Status retval;
-
-    for (;;) {
-        if (auto error = m_reader->getError()) {
-            m_docKey.reset(); // done processing
-            retval = *error;
-            break;
-        }
-
-        // get a word, if needed
-        std::optional<QString> word = QString(); // empty string to disable EOF logic
-        if (m_chunk.length() < maxChunkSize + 1) {
-            word = m_reader->word();
-            if (m_chunk.isEmpty())
-                m_page = m_reader->page(); // page number of first word
-
-            if (word) {
-                m_chunk += *word;
-                m_chunk += u' ';
-                m_reader->nextWord();
-                m_nChunkWords++;
-            }
-        }
+    // cached results are in flight too, until the queued call below stores them
+    m_embeddingsInFlight += chunks.size();
 
-        if (!word || m_chunk.length() >= maxChunkSize + 1) { // +1 for trailing space
-            if (!m_chunk.isEmpty()) {
-                int nThisChunkWords = 0;
-                auto chunk = m_chunk; // copy
-
-                // handle overlength chunks
-                if (m_chunk.length() > maxChunkSize + 1) {
-                    // find the final space
-                    qsizetype chunkEnd = chunk.lastIndexOf(u' ', -2);
-
-                    qsizetype spaceSize;
-                    if (chunkEnd >= 0) {
-                        // slice off the last word
-                        spaceSize = 1;
-                        Q_ASSERT(m_nChunkWords >= 1);
-                        // one word left
-                        nThisChunkWords = m_nChunkWords - 1;
-                        m_nChunkWords = 1;
-                    } else {
-                        // slice the overlong word
-                        spaceSize = 0;
-                        chunkEnd = maxChunkSize;
-                        // partial word left, don't count it
-                        nThisChunkWords = m_nChunkWords;
-                        m_nChunkWords = 0;
-                    }
-                    // save the second part, excluding space if any
-                    m_chunk = chunk.sliced(chunkEnd + spaceSize);
-                    // consume the first part
-                    chunk.truncate(chunkEnd);
-                } else {
-                    nThisChunkWords = m_nChunkWords;
-                    m_nChunkWords = 0;
-                    // there is no second part
-                    m_chunk.clear();
-                    // consume the whole chunk, excluding space
-                    chunk.chop(1);
-                }
-                Q_ASSERT(chunk.length() <= maxChunkSize);
-
-                QSqlQuery q(m_database->m_db);
-                int chunkId = 0;
-                auto &metadata = m_reader->metadata();
-                if (!m_database->addChunk(q,
-                    m_documentId,
-                    chunk,
-                    m_reader->doc().file.fileName(), // basename
-                    metadata.title,
-                    metadata.author,
-                    metadata.subject,
-                    metadata.keywords,
-                    m_page,
-                    line_from,
-                    line_to,
-                    nThisChunkWords,
-                    &chunkId
-                )) {
-                    qWarning() << "ERROR: Could not insert chunk into db" << q.lastError();
-                }
-
-                nAddedWords += nThisChunkWords;
-
-                EmbeddingChunk toEmbed;
-                toEmbed.model = m_embeddingModel;
-                toEmbed.folder_id = folderId;
-                toEmbed.chunk_id = chunkId;
-                toEmbed.chunk = chunk;
-                m_database->appendChunk(toEmbed);
-                ++nChunks;
-            }
+    const QString modelId = m_embLLM->modelId();
+    if (modelId.isEmpty()) {
+        m_embLLM->generateDocEmbeddingsAsync(chunks);
+        return;
+    }
 
-            if (!word) {
-                retval = Status::DOC_COMPLETE;
-                m_docKey.reset(); // done processing
-                break;
-            }
-        }
+    QList<QByteArray> keys;
+    keys.reserve(chunks.size());
+    for (const auto &chunk : chunks)
+        keys << embeddingCacheKey(modelId, /*isQuery*/ false, chunk.chunk);
 
-        if (m_database->scanQueueInterrupted()) {
-            retval = Status::INTERRUPTED;
-            break;
+    QSqlQuery q(m_db);
+    const QList<QByteArray> embeddings = cachedEmbeddings(q, keys);
+    QList<EmbeddingChunk> uncached;
+    QVector<EmbeddingResult> cached;
+    for (qsizetype i = 0; i < chunks.size(); i++) {
+        const EmbeddingChunk &chunk = chunks[i];
+        const QByteArray &embedding = embeddings[i];
+        if (embedding.isEmpty()) {
+            m_pendingCacheKeys.insert(chunk.chunk_id, keys[i]);
+            uncached << chunk;
+            continue;
         }
+        auto *data = reinterpret_cast<const float *>(embedding.constData());
+        cached.append({ chunk.model, chunk.folder_id, chunk.chunk_id,
+                        std::vector(data, data + embedding.size() / sizeof(float)) });
     }
 
-    if (nChunks) {
-        CollectionItem item = m_database->guiCollectionItem(folderId);
-
-        // Set the start update if we haven't done so already
-        if (item.startUpdate <= item.lastUpdate && item.currentEmbeddingsToIndex == 0)
-            m_database->setStartUpdateTime(item);
-
-        item.currentEmbeddingsToIndex += nChunks;
-        item.totalEmbeddingsToIndex += nChunks;
-        item.totalWords += nAddedWords;
-        m_database->updateGuiForCollectionItem(item);
+    if (!uncached.isEmpty())
+        m_embLLM->generateDocEmbeddingsAsync(uncached);
+    // store these like the results of the model, the caller may be in the middle of a transaction
+    if (!cached.isEmpty()) {
+        QMetaObject::invokeMethod(this, [this, cached = std::move(cached)] {
+            handleEmbeddingsGenerated(cached);
+        }, Qt::QueuedConnection);
     }
-
-    return retval;
 }
 
-void Database::appendChunk(const EmbeddingChunk &chunk)
+// Called by a reader, which can look up the cache but leaves writing to it to the database thread.
+std::vector<float> Database::queryEmbedding(const QSqlDatabase &db, const QString &query)
 {
-    m_chunkList.reserve(s_batchSize);
-    m_chunkList.append(chunk);
-    if (m_chunkList.size() >= s_batchSize)
-        sendChunkList();
-}
+    const QString modelId = m_embLLM->modelId();
+    if (modelId.isEmpty())
+        return m_embLLM->generateQueryEmbedding(query);
 
-void Database::sendChunkList()
-{
-    m_embLLM->generateDocEmbeddingsAsync(m_chunkList);
-    m_chunkList.clear();
+    QSqlQuery q(db);
+    const QByteArray key = embeddingCacheKey(modelId, /*isQuery*/ true, query);
+    QByteArray cached;
+    if (q.prepare(GET_CACHED_EMBEDDING_SQL)) {
+        q.addBindValue(key);
+        if (q.exec() && q.next())
+            cached = q.value(0).toByteArray();
+    }
+    if (!cached.isEmpty()) {
+        QMetaObject::invokeMethod(this, [this, key] {
+            QSqlQuery q(m_db);
+            cachedEmbeddings(q, { key }); // marks it as used
+        }, Qt::QueuedConnection);
+        auto *data = reinterpret_cast<const float *>(cached.constData());
+        return std::vector(data, data + cached.size() / sizeof(float));
+    }
+
+    std::vector<float> embedding = m_embLLM->generateQueryEmbedding(query);
+    logQueryStats(QUERY_STATS_INTERVAL);
+    if (!embedding.empty()) {
+        QByteArray data(reinterpret_cast<const char *>(embedding.data()), embedding.size() * sizeof(float));
+        QMetaObject::invokeMethod(this, [this, key, data] {
+            QSqlQuery q(m_db);
+            cacheEmbeddings(q, { key }, { data });
+        }, Qt::QueuedConnection);
+    }
+    return embedding;
 }
 
 void Database::handleEmbeddingsGenerated(const QVector<EmbeddingResult> &embeddings)
 {
     Q_ASSERT(!embeddings.isEmpty());
 
+    m_embeddingsInFlight = std::max<qsizetype>(m_embeddingsInFlight - embeddings.size(), 0);
+    m_ingestEmbedded += embeddings.size();
+    resumeScanning();
+
     QList<Embedding> sqlEmbeddings;
     for (const auto &e: embeddings) {
         auto data = QByteArray::fromRawData(
@@ -1661,13 +1520,45 @@ void Database::handleEmbeddingsGenerated(const QVector<EmbeddingResult> &embeddi
 
     QSqlQuery q(m_db);
     QHash<EmbeddingFolder, EmbeddingStat> stats;
-    if (!sqlAddEmbeddings(q, sqlEmbeddings, stats)) {
+    QList<const Embedding *> added;
+    if (!sqlAddEmbeddings(q, sqlEmbeddings, stats, added)) {
         qWarning() << "Database ERROR: failed to add embeddings:" << q.lastError();
         return rollback();
     }
 
+    // cache what the model computed, even for chunks that no longer need it
+    QVariantList cacheKeys, cacheData;
+    for (const auto &e : std::as_const(sqlEmbeddings)) {
+        if (QByteArray key = m_pendingCacheKeys.take(e.chunk_id); !key.isEmpty()) {
+            cacheKeys << key;
+            cacheData << e.data;
+        }
+    }
+    cacheEmbeddings(q, cacheKeys, cacheData);
+
     commit();
 
+    {
+        QWriteLocker locker(&m_embeddingIndexLock);
+        for (const Embedding *e : std::as_const(added)) {
+            std::span embedding(reinterpret_cast<const float *>(e->data.constData()), e->data.size() / sizeof(float));
+            m_embeddingArena.add(e->model, e->folder_id, e->chunk_id, embedding);
+            // a folder the arena holds has no index, but one it just dropped for outgrowing it may have
+            if (!m_embeddingArena.contains(e->model, e->folder_id))
+                m_embeddingIndex.add(e->model, e->folder_id, e->chunk_id, embedding);
+        }
+    }
+    for (auto it = stats.cbegin(); it != stats.cend(); ++it) {
+        if (!it->nAdded)
+            continue;
+        const QString &embedding_model = it.key().embedding_model;
+        const int folder_id = it.key().folder_id;
+        if (!m_embeddingArena.contains(embedding_model, folder_id))
+            updateEmbeddingArena(embedding_model, folder_id);
+        if (!m_embeddingIndex.contains(embedding_model, folder_id))
+            updateEmbeddingIndex(embedding_model, folder_id);
+    }
+
     // FIXME(jared): embedding counts are per-collectionitem, not per-folder
     for (auto it = stats.begin(); it != stats.end(); ++it) {
         const auto &key = it.key();
@@ -1695,8 +1586,10 @@ void Database::handleEmbeddingsGenerated(const QVector<EmbeddingResult> &embeddi
 
         // Set the last update if we are done
         Q_ASSERT(item.startUpdate > item.lastUpdate);
-        if (!item.indexing && item.currentEmbeddingsToIndex == 0)
+        if (!item.indexing && item.currentEmbeddingsToIndex == 0) {
             setLastUpdateTime(item);
+            m_embeddingIndex.save(); // searches only read the indexes, and only this thread changes them
+        }
 
         updateGuiForCollectionItem(item);
     }
@@ -1709,7 +1602,13 @@ void Database::handleErrorGenerated(const QVector<EmbeddingChunk> &chunks, const
      * folder */
 
     QSet<int> folder_ids;
-    for (const auto &c: chunks) { folder_ids << c.folder_id; }
+    for (const auto &c: chunks) {
+        folder_ids << c.folder_id;
+        m_pendingCacheKeys.remove(c.chunk_id);
+    }
+
+    m_embeddingsInFlight = std::max<qsizetype>(m_embeddingsInFlight - chunks.size(), 0);
+    resumeScanning();
 
     for (int fid: folder_ids) {
         if (!m_collectionMap.contains(fid)) continue;
@@ -1752,14 +1651,9 @@ DocumentInfo Database::dequeueDocument()
 
 void Database::removeFolderFromDocumentQueue(int folder_id)
 {
-    if (auto queueIt = m_docsToScan.find(folder_id); queueIt != m_docsToScan.end()) {
-        if (auto key = m_chunkStreamer.currentDocKey()) {
-            if (ranges::any_of(queueIt->second, [&key](auto &d) { return d.key() == key; }))
-                m_chunkStreamer.reset(); // done with this document
-        }
-        // remove folder from queue
-        m_docsToScan.erase(queueIt);
-    }
+    // remove folder from queue, and drop the documents that are being read
+    m_docsToScan.erase(folder_id);
+    m_ingest->cancelFolder(folder_id);
 }
 
 void Database::enqueueDocumentInternal(DocumentInfo &&info, bool prepend)
@@ -1789,14 +1683,33 @@ bool Database::scanQueueInterrupted() const
     return m_scanDurationTimer.elapsed() >= 100;
 }
 
+// Chunks sent to the embedding model that have not been answered yet, beyond which no more documents are read.
+static const qsizetype MAX_EMBEDDINGS_IN_FLIGHT = 20 * s_batchSize;
+
+bool Database::ingestBlocked() const
+{
+    return m_ingest->isFull() || m_embeddingsInFlight >= MAX_EMBEDDINGS_IN_FLIGHT;
+}
+
+// Restart the scan timer that scanQueueBatch stopped while the later stages were full.
+void Database::resumeScanning()
+{
+    if (!m_docsToScan.empty() && !ingestBlocked() && !m_scanIntervalTimer->isActive())
+        m_scanIntervalTimer->start();
+}
+
 void Database::scanQueueBatch()
 {
     transaction();
 
     m_scanDurationTimer.start();
 
-    // scan for up to the maximum scan duration or until we run out of documents
-    while (!m_docsToScan.empty()) {
+    // scan for up to the maximum scan duration, until we run out of documents, or until the later stages are full
+    while (!m_docsToScan.empty() && !ingestBlocked()) {
+        // wait for an earlier scan of the same document to be written first
+        const auto &queue = m_docsToScan.begin()->second;
+        if (m_ingest->isInFlight(queue.front()))
+            break;
         scanQueue();
         if (scanQueueInterrupted())
             break;
@@ -1804,14 +1717,15 @@ void Database::scanQueueBatch()
 
     commit();
 
-    if (m_docsToScan.empty())
+    // resumed by writeIngestedChunks or handleEmbeddingsGenerated once there is room again
+    if (m_docsToScan.empty() || ingestBlocked() || m_ingest->isInFlight(m_docsToScan.begin()->second.front()))
         m_scanIntervalTimer->stop();
 }
 
 void Database::scanQueue()
 {
     DocumentInfo info = dequeueDocument();
-    const size_t countForFolder = countOfDocuments(info.folder);
+    const size_t countForFolder = countOfDocuments(info.folder) + m_ingest->inFlight(info.folder);
     const int folder_id = info.folder;
 
     // Update info
@@ -1824,7 +1738,6 @@ void Database::scanQueue()
 
     const qint64 document_time = info.file.fileTime(QFile::FileModificationTime).toMSecsSinceEpoch();
     const QString document_path = info.file.canonicalFilePath();
-    const bool currentlyProcessing = info.currentlyProcessing;
 
     // Check and see if we already have this document
     QSqlQuery q(m_db);
@@ -1838,7 +1751,7 @@ void Database::scanQueue()
 
     // If we have the document, we need to compare the last modification time and if it is newer
     // we must rescan the document, otherwise return
-    if (existing_id != -1 && !currentlyProcessing) {
+    if (existing_id != -1) {
         Q_ASSERT(existing_time != -1);
         if (document_time == existing_time) {
             // No need to rescan, but we do have to schedule next
@@ -1854,24 +1767,22 @@ void Database::scanQueue()
 
     // Update the document_time for an existing document, or add it for the first time now
     int document_id = existing_id;
-    if (!currentlyProcessing) {
-        if (document_id != -1) {
-            if (!updateDocument(q, document_id, document_time)) {
-                handleDocumentError("ERROR: Could not update document_time",
-                    document_id, document_path, q.lastError());
-                return updateFolderToIndex(folder_id, countForFolder);
-            }
-        } else {
-            if (!addDocument(q, folder_id, document_time, document_path, &document_id)) {
-                handleDocumentError("ERROR: Could not add document",
-                    document_id, document_path, q.lastError());
-                return updateFolderToIndex(folder_id, countForFolder);
-            }
-
-            CollectionItem item = guiCollectionItem(folder_id);
-            item.totalDocs += 1;
-            updateGuiForCollectionItem(item);
+    if (document_id != -1) {
+        if (!updateDocument(q, document_id, document_time)) {
+            handleDocumentError("ERROR: Could not update document_time",
+                document_id, document_path, q.lastError());
+            return updateFolderToIndex(folder_id, countForFolder);
         }
+    } else {
+        if (!addDocument(q, folder_id, document_time, document_path, &document_id)) {
+            handleDocumentError("ERROR: Could not add document",
+                document_id, document_path, q.lastError());
+            return updateFolderToIndex(folder_id, countForFolder);
+        }
+
+        CollectionItem item = guiCollectionItem(folder_id);
+        item.totalDocs += 1;
+        updateGuiForCollectionItem(item);
     }
 
     // Get the embedding model for this folder
@@ -1885,20 +1796,96 @@ void Database::scanQueue()
 
     Q_ASSERT(document_id != -1);
 
-    {
-        try {
-            m_chunkStreamer.setDocument(info, document_id, embedding_model);
-        } catch (const std::runtime_error &e) {
-            qWarning() << "LocalDocs ERROR:" << e.what();
-            goto dequeue;
+    // make sure the document doesn't already have any chunks
+    if (m_documentIdCache.contains(document_id) && !removeChunksByDocumentId(q, document_id))
+        handleDocumentError("ERROR: Cannot remove chunks of document", document_id, document_path, q.lastError());
+
+    // the document is read and chunked on the ingest threads, and its chunks are written by writeIngestedChunks
+    m_ingest->submit(std::move(info), document_id, embedding_model, m_chunkSize);
+    updateFolderToIndex(folder_id, countForFolder + 1);
+}
+
+void Database::writeIngestedChunks()
+{
+    // bounds the work that a failed transaction loses, and how far the WAL grows before it can be checkpointed
+    constexpr qsizetype MAX_CHUNKS_PER_TRANSACTION = 4096;
+
+    transaction();
+
+    QElapsedTimer timer;
+    timer.start();
+    m_scanDurationTimer.start();
+
+    QSqlQuery q(m_db);
+    ChunkWriter writer(m_db);
+    qsizetype nChunks = 0;
+    bool drained = false;
+    while (!scanQueueInterrupted() && nChunks < MAX_CHUNKS_PER_TRANSACTION) {
+        std::optional<IngestPipeline::Batch> batch = m_ingest->take();
+        if (!batch) {
+            drained = true;
+            break;
         }
+        writeChunks(writer, *batch);
+        nChunks += batch->chunks.size();
+        if (batch->status)
+            finishDocument(q, *batch);
     }
 
-    switch (m_chunkStreamer.step()) {
-    case ChunkStreamer::Status::INTERRUPTED:
-        info.currentlyProcessing = true;
-        enqueueDocumentInternal(std::move(info), /*prepend*/ true);
-        return updateFolderToIndex(folder_id, countForFolder + 1);
+    commit();
+    m_ingestWriteMs += timer.elapsed();
+
+    // yield to the event loop, the readers only signal again once the queue was found empty
+    if (!drained)
+        QMetaObject::invokeMethod(this, &Database::writeIngestedChunks, Qt::QueuedConnection);
+}
+
+void Database::writeChunks(ChunkWriter &writer, const IngestPipeline::Batch &batch)
+{
+    if (batch.chunks.isEmpty())
+        return;
+
+    const int folderId = batch.doc.folder;
+    QList<int> chunkIds;
+    chunkIds.reserve(batch.chunks.size());
+    if (!writer.insert(batch.documentId, batch.doc.file.fileName() /*basename*/, batch.metadata, batch.chunks,
+                       chunkIds)) {
+        qWarning() << "ERROR: Could not insert chunks into db" << writer.lastError();
+        return;
+    }
+    m_documentIdCache << batch.documentId;
+
+    int nAddedWords = 0;
+    for (qsizetype i = 0; i < batch.chunks.size(); i++) {
+        const ChunkStreamer::Chunk &chunk = batch.chunks[i];
+        nAddedWords += chunk.words;
+
+        EmbeddingChunk toEmbed;
+        toEmbed.model = batch.embeddingModel;
+        toEmbed.folder_id = folderId;
+        toEmbed.chunk_id = chunkIds[i];
+        toEmbed.chunk = chunk.text;
+        appendChunk(toEmbed);
+    }
+
+    CollectionItem item = guiCollectionItem(folderId);
+
+    // Set the start update if we haven't done so already
+    if (item.startUpdate <= item.lastUpdate && item.currentEmbeddingsToIndex == 0)
+        setStartUpdateTime(item);
+
+    item.currentEmbeddingsToIndex += batch.chunks.size();
+    item.totalEmbeddingsToIndex += batch.chunks.size();
+    item.totalWords += nAddedWords;
+    updateGuiForCollectionItem(item);
+}
+
+void Database::finishDocument(QSqlQuery &q, const IngestPipeline::Batch &batch)
+{
+    const int folder_id = batch.doc.folder;
+    const QString document_path = batch.doc.file.canonicalFilePath();
+
+    switch (*batch.status) {
     case ChunkStreamer::Status::BINARY_SEEN:
         /* When we see a binary file, we treat it like an empty file so we know not to
          * scan it again. All existing chunks are removed, and in-progress embeddings
@@ -1906,28 +1893,65 @@ void Database::scanQueue()
         qInfo() << "LocalDocs: Ignoring file with binary data:" << document_path;
 
         // this will also ensure in-flight embeddings are ignored
-        if (!removeChunksByDocumentId(q, existing_id))
-            handleDocumentError("ERROR: Cannot remove chunks of document", existing_id, document_path, q.lastError());
+        if (!removeChunksByDocumentId(q, batch.documentId))
+            handleDocumentError("ERROR: Cannot remove chunks of document", batch.documentId, document_path,
+                                q.lastError());
         updateCollectionStatistics();
         break;
     case ChunkStreamer::Status::ERROR:
         qWarning() << "error reading" << document_path;
         break;
     case ChunkStreamer::Status::DOC_COMPLETE:
+    case ChunkStreamer::Status::INTERRUPTED:
         ;
     }
 
-dequeue:
     auto item = guiCollectionItem(folder_id);
-    Q_ASSERT(item.currentBytesToIndex >= info.file.size());
-    if (item.currentBytesToIndex < info.file.size()) {
+    Q_ASSERT(item.currentBytesToIndex >= batch.doc.file.size());
+    if (item.currentBytesToIndex < batch.doc.file.size()) {
         qWarning() << "Database ERROR: underflow in current bytes to index statistics";
         item.currentBytesToIndex = 0;
     } else {
-        item.currentBytesToIndex -= info.file.size();
+        item.currentBytesToIndex -= batch.doc.file.size();
     }
     updateGuiForCollectionItem(item);
-    return updateFolderToIndex(folder_id, countForFolder);
+    updateFolderToIndex(folder_id, countOfDocuments(folder_id) + m_ingest->inFlight(folder_id));
+
+    if (!m_docsToScan.empty())
+        resumeScanning();
+    else if (m_ingest->isIdle())
+        logIngestStats();
+}
+
+// Thread-safe, the readers call this as they embed queries.
+void Database::logQueryStats(qint64 minQueries)
+{
+    const QueryEmbeddingStats stats = m_embLLM->takeQueryStats(minQueries);
+    if (!stats.queries)
+        return;
+    qDebug().nospace() << "LocalDocs: " << stats.queries << " query embeddings waited for the model "
+                       << stats.waitedMs / stats.queries << " ms on average, " << stats.maxWaitedMs << " ms at most";
+}
+
+void Database::logIngestStats()
+{
+    // the queries that ran meanwhile are what the ingestion held up
+    logQueryStats();
+
+    const IngestPipeline::Stats stats = m_ingest->takeStats();
+    if (!stats.documents)
+        return;
+
+    // throughput of each stage, the embedding stage continues after the documents are written
+    const double seconds = std::max<qint64>(stats.elapsedMs, 1) / 1000.0;
+    qDebug().nospace() << "LocalDocs: read " << stats.documents << " documents ("
+                       << stats.bytes / (1024 * 1024) << " MiB) in " << seconds << " s, "
+                       << stats.documents / seconds << " docs/s on " << m_ingest->threadCount() << " threads ("
+                       << qRound(100.0 * stats.busyMs / (stats.elapsedMs * m_ingest->threadCount() + 1))
+                       << "% busy); wrote " << stats.chunks << " chunks in " << m_ingestWriteMs << " ms; stored "
+                       << m_ingestEmbedded << " embeddings, " << m_embeddingsInFlight << " still being embedded";
+    m_ingestWriteMs = 0;
+    m_ingestEmbedded = 0;
 }
 
 void Database::scanDocuments(int folder_id, const QString &folder_path)
@@ -1980,6 +2004,13 @@ void Database::start()
     } else {
         cleanDB();
         ftsIntegrityCheck();
+        initEmbeddingCache();
+        loadEmbeddingArena(); // first, the folders it holds need no index
+        openEmbeddingIndex(modelPath);
+        {
+            QMutexLocker locker(&m_readMutex);
+            m_readPath = m_db.databaseName();
+        }
         QSqlQuery q(m_db);
         if (!refreshDocumentIdCache(q)) {
             m_databaseValid = false;
@@ -2074,7 +2105,7 @@ void Database::scheduleUncompletedEmbeddings()
         for (; it != end && batch.size() < s_batchSize; ++it)
             batch.append({ /*model*/ it->embedding_model, /*folder_id*/ it->folder_id, /*chunk_id*/ it->chunk_id, /*chunk*/ it->text });
         Q_ASSERT(!batch.isEmpty());
-        m_embLLM->generateDocEmbeddingsAsync(batch);
+        embedChunks(batch);
     }
 }
 
@@ -2167,6 +2198,8 @@ void Database::forceRebuildFolder(const QString &path)
     }
 
     Q_ASSERT(!m_docsToScan.contains(folder_id));
+    // drop the documents still being read, their chunks would outlive the rebuild
+    m_ingest->cancelFolder(folder_id);
 
     transaction();
 
@@ -2292,6 +2325,8 @@ bool Database::removeFolderInternal(const QString &collection, int folder_id, co
 
     // First remove all upcoming jobs associated with this folder
     removeFolderFromDocumentQueue(folder_id);
+    m_removedFolderIds << folder_id;
+    applyIndexRemovals();
 
     // Get a list of all documents associated with folder
     QList<int> documentIds;
@@ -2351,7 +2386,136 @@ void Database::removeFolderFromWatch(const QString &path)
     m_watchedPaths -= QSet(children.begin(), children.end());
 }
 
-QList<int> Database::searchEmbeddingsHelper(const std::vector<float> &query, QSqlQuery &q, int nNeighbors)
+void Database::openEmbeddingIndex(const QString &modelPath)
+{
+    using enum EmbeddingIndex::Quantization;
+    static const QMap<EmbeddingIndex::Quantization, QString> dirSuffixes {
+        { None, "" }, { Int8, "_i8" }, { Binary, "_b1" },
+    };
+
+    // each kind of index has its own directory, the others are stale
+    const QString dirPath = QString("%1/localdocs_v%2_index").arg(modelPath).arg(LOCALDOCS_VERSION);
+    for (auto it = dirSuffixes.cbegin(); it != dirSuffixes.cend(); ++it) {
+        if (it.key() != m_quantization)
+            QDir(dirPath + it.value()).removeRecursively();
+    }
+    {
+        QWriteLocker locker(&m_embeddingIndexLock);
+        m_embeddingIndex.open(dirPath + dirSuffixes.value(m_quantization), m_quantization);
+    }
+
+    QSqlQuery q(m_db);
+    if (!q.exec(COUNT_EMBEDDINGS_SQL)) {
+        qWarning() << "Database ERROR: Failed to count embeddings:" << q.lastError();
+        return;
+    }
+    std::map<EmbeddingIndex::Key, qsizetype> counts;
+    while (q.next())
+        counts.emplace(EmbeddingIndex::Key(q.value(1).toInt(), q.value(0).toString()), q.value(2).toLongLong());
+
+    // drop stale indexes and those of folders the arena holds, which are searched there, and index folders that were
+    // not indexed or whose index was stale
+    {
+        QWriteLocker locker(&m_embeddingIndexLock);
+        m_embeddingIndex.verify(counts);
+        for (const auto &[key, count] : counts) {
+            if (m_embeddingArena.contains(key.second, key.first))
+                m_embeddingIndex.removeFolder(key.second, key.first);
+        }
+    }
+    for (const auto &[key, count] : counts) {
+        if (count >= m_embeddingIndex.minEmbeddings() && !m_embeddingIndex.contains(key.second, key.first))
+            updateEmbeddingIndex(key.second, key.first);
+    }
+}
+
+// Build the index of a folder once it has enough embeddings for an exact search to be slow, unless the arena holds it.
+void Database::updateEmbeddingIndex(const QString &embedding_model, int folder_id)
+{
+    if (m_embeddingArena.contains(embedding_model, folder_id))
+        return; // searched there, its index would never be used
+
+    QSqlQuery q(m_db);
+    if (!q.prepare(COUNT_FOLDER_EMBEDDINGS_SQL))
+        return;
+    q.addBindValue(embedding_model);
+    q.addBindValue(folder_id);
+    if (!q.exec() || !q.next()) {
+        qWarning() << "Database ERROR: Failed to count embeddings:" << q.lastError();
+        return;
+    }
+    const qsizetype count = q.value(0).toLongLong();
+    if (count < m_embeddingIndex.minEmbeddings())
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+    q.setForwardOnly(true);
+    if (!q.prepare(GET_FOLDER_EMBEDDINGS_SQL.arg(folder_id)))
+        return;
+    q.addBindValue(embedding_model);
+    if (!q.exec()) {
+        qWarning() << "Database ERROR: Failed to exec embeddings query:" << q.lastError();
+        return;
+    }
+    // build and save without the lock, only this thread changes the indexes
+    auto index = m_embeddingIndex.build(q, count, folder_id);
+    if (!index)
+        return;
+    {
+        QWriteLocker locker(&m_embeddingIndexLock);
+        m_embeddingIndex.insert(embedding_model, folder_id, std::move(index));
+    }
+    m_embeddingIndex.save();
+    qDebug() << "indexed" << count << "embeddings of folder" << folder_id << "in" << timer.elapsed() << "ms";
+}
+
+void Database::loadEmbeddingArena()
+{
+    QSqlQuery q(m_db);
+    if (!q.exec(COUNT_EMBEDDINGS_SQL)) {
+        qWarning() << "Database ERROR: Failed to count embeddings:" << q.lastError();
+        return;
+    }
+    QList<std::pair<QString, int>> folders;
+    while (q.next())
+        folders.append({ q.value(0).toString(), q.value(1).toInt() });
+    for (const auto &[embedding_model, folder_id] : std::as_const(folders))
+        updateEmbeddingArena(embedding_model, folder_id);
+}
+
+// Hold the embeddings of a folder for exact search, if they fit.
+void Database::updateEmbeddingArena(const QString &embedding_model, int folder_id)
+{
+    QSqlQuery q(m_db);
+    if (!q.prepare(COUNT_FOLDER_EMBEDDINGS_SQL))
+        return;
+    q.addBindValue(embedding_model);
+    q.addBindValue(folder_id);
+    if (!q.exec() || !q.next()) {
+        qWarning() << "Database ERROR: Failed to count embeddings:" << q.lastError();
+        return;
+    }
+    const qsizetype count = q.value(0).toLongLong();
+
+    q.setForwardOnly(true);
+    if (!q.prepare(GET_FOLDER_EMBEDDINGS_SQL.arg(folder_id)))
+        return;
+    q.addBindValue(embedding_model);
+    if (!q.exec()) {
+        qWarning() << "Database ERROR: Failed to exec embeddings query:" << q.lastError();
+        return;
+    }
+    // read without the lock, only this thread changes the arena
+    if (auto folder = m_embeddingArena.read(q, count)) {
+        QWriteLocker locker(&m_embeddingIndexLock);
+        m_embeddingArena.insert(embedding_model, folder_id, std::move(folder));
+        m_embeddingIndex.removeFolder(embedding_model, folder_id); // no longer used
+    }
+}
+
+QList<EmbeddingIndex::Match> Database::searchEmbeddingsHelper(const std::vector<float> &query, QSqlQuery &q,
+                                                              int nNeighbors, const ChunkFilter *filter)
 {
     constexpr int BATCH_SIZE = 2048;
 
@@ -2366,8 +2530,7 @@ QList<int> Database::searchEmbeddingsHelper(const std::vector<float> &query, QSq
     batchChunkIds.reserve(BATCH_SIZE);
     batchEmbeddings.reserve(BATCH_SIZE * n_embd);
 
-    struct Result { int chunkId; us::distance_punned_t dist; };
-    QList<Result> results;
+    QList<EmbeddingIndex::Match> results;
 
     // The q parameter is expected to be the result of a QSqlQuery returning (chunk_id, embedding) pairs
     while (q.at() != QSql::AfterLastRow) { // batches
@@ -2375,7 +2538,10 @@ QList<int> Database::searchEmbeddingsHelper(const std::vector<float> &query, QSq
         batchEmbeddings.clear();
 
         while (batchChunkIds.count() < BATCH_SIZE && q.next()) { // batch
-            batchChunkIds << q.value(0).toInt();
+            const int chunkId = q.value(0).toInt();
+            if (filter && !filter->contains(chunkId))
+                continue;
+            batchChunkIds << chunkId;
             batchEmbeddings.resize(batchEmbeddings.size() + n_embd);
             QVariant embdCol = q.value(1);
             if (embdCol.userType() != QMetaType::QByteArray) {
@@ -2415,38 +2581,125 @@ QList<int> Database::searchEmbeddingsHelper(const std::vector<float> &query, QSq
     nNeighbors = qMin(nNeighbors, results.size());
     std::partial_sort(
         results.begin(), results.begin() + nNeighbors, results.end(),
-        [](const Result &a, const Result &b) { return a.dist < b.dist; }
+        [](const auto &a, const auto &b) { return a.distance < b.distance; }
     );
-
-    QList<int> chunkIds;
-    chunkIds.reserve(nNeighbors);
-    for (int i = 0; i < nNeighbors; i++)
-        chunkIds << results[i].chunkId;
-    return chunkIds;
+    results.resize(nNeighbors);
+    return results;
 }
 
-QList<int> Database::searchEmbeddings(const std::vector<float> &query, const QList<QString> &collections,
-    int nNeighbors)
+// Scan the embeddings of a model selected by sql, which has the placeholder for the model bound.
+QList<EmbeddingIndex::Match> Database::scanEmbeddings(const QSqlDatabase &db, const std::vector<float> &query,
+    const QString &sql, const QString &embedding_model, int nNeighbors, const ChunkFilter *filter)
 {
-    QSqlQuery q(m_db);
-    if (!q.exec(GET_COLLECTION_EMBEDDINGS_SQL.arg(collections.join("', '")))) {
+    QSqlQuery q(db);
+    q.setForwardOnly(true);
+    if (!q.prepare(sql)) {
+        qWarning() << "Database ERROR: Failed to prepare embeddings query:" << q.lastError();
+        return {};
+    }
+    q.addBindValue(embedding_model);
+    if (!q.exec()) {
         qWarning() << "Database ERROR: Failed to exec embeddings query:" << q.lastError();
         return {};
     }
-    return searchEmbeddingsHelper(query, q, nNeighbors);
+    return searchEmbeddingsHelper(query, q, nNeighbors, filter);
 }
 
-QList<int> Database::scoreChunks(const std::vector<float> &query, const QList<int> &chunks)
+QList<int> Database::searchEmbeddings(const QSqlDatabase &db, const std::vector<float> &query,
+    const QList<QString> &collections, const RetrievalFilter &filter, int nNeighbors)
+{
+    QSqlQuery q(db);
+    if (!q.prepare(GET_COLLECTION_FOLDERS_SQL.arg(QStringList(collections.size(), "?").join(", ")))) {
+        qWarning() << "Database ERROR: Failed to prepare collection folders query:" << q.lastError();
+        return {};
+    }
+    for (const auto &collection : collections)
+        q.addBindValue(collection);
+    if (!q.exec()) {
+        qWarning() << "Database ERROR: Failed to exec collection folders query:" << q.lastError();
+        return {};
+    }
+
+    // the folders are the partitions of the search, those the filter leaves out are not searched at all
+    QList<std::pair<QString, int>> folders; // embedding model, folder id
+    QList<int> folderIds;
+    while (q.next()) {
+        const int folderId = q.value(1).toInt();
+        if (!filter.folderIds.isEmpty() && !filter.folderIds.contains(folderId))
+            continue;
+        folders.emplaceBack(q.value(0).toString(), folderId);
+        if (!folderIds.contains(folderId))
+            folderIds << folderId;
+    }
+
+    // the chunks of the documents the filter selects, which the searches of their folders check as they go
+    std::optional<ChunkFilter> chunkFilter;
+    if (filter.restrictsDocuments() && !folderIds.isEmpty()) {
+        chunkFilter.emplace();
+        QSqlQuery chunksQuery(db);
+        if (!selectFilteredChunks(chunksQuery, folderIds, filter, *chunkFilter)) {
+            qWarning() << "Database ERROR: Failed to select filtered chunks:" << chunksQuery.lastError();
+            return {};
+        }
+    }
+    const ChunkFilter *chunks = chunkFilter ? &*chunkFilter : nullptr;
+
+    // Search the folders that have an index, and scan the rest
+    QReadLocker locker(&m_embeddingIndexLock);
+    const bool rescore = m_embeddingIndex.quantization() != EmbeddingIndex::Quantization::None;
+    QList<EmbeddingIndex::Match> results;
+    QHash<QString, QStringList> unindexedFolders; // by embedding model
+    QHash<QString, QStringList> candidates; // by embedding model, chunks found by a quantized index
+    for (const auto &[embeddingModel, folderId] : std::as_const(folders)) {
+        if (chunks && !chunks->count(folderId))
+            continue;
+        QList<EmbeddingIndex::Match> matches;
+        // the folders held in memory are searched exactly, and faster than their index
+        if (m_embeddingArena.search(embeddingModel, folderId, query, nNeighbors, matches, chunks)) {
+            results << matches;
+        } else if (!m_embeddingIndex.search(embeddingModel, folderId, query, nNeighbors, matches, chunks)) {
+            unindexedFolders[embeddingModel] << QString::number(folderId);
+        } else if (rescore) {
+            for (const auto &match : std::as_const(matches))
+                candidates[embeddingModel] << QString::number(match.chunkId);
+        } else {
+            results << matches;
+        }
+    }
+    locker.unlock();
+    for (auto it = unindexedFolders.cbegin(); it != unindexedFolders.cend(); ++it)
+        results << scanEmbeddings(db, query, GET_FOLDER_EMBEDDINGS_SQL.arg(it->join(", ")), it.key(), nNeighbors,
+                                  chunks);
+    // the distances of quantized vectors are approximate, so rank the candidates by their full-precision embeddings
+    for (auto it = candidates.cbegin(); it != candidates.cend(); ++it)
+        results << scanEmbeddings(db, query, GET_MODEL_CHUNK_EMBEDDINGS_SQL.arg(it->join(", ")), it.key(), nNeighbors);
+
+    // merge the nearest neighbours of each folder, a chunk can be in more than one if the model changed
+    ranges::sort(results, [](const auto &a, const auto &b) { return a.distance < b.distance; });
+    QList<int> chunkIds;
+    for (const auto &match : std::as_const(results)) {
+        if (chunkIds.size() >= nNeighbors)
+            break;
+        if (!chunkIds.contains(match.chunkId))
+            chunkIds << match.chunkId;
+    }
+    return chunkIds;
+}
+
+QList<int> Database::scoreChunks(const QSqlDatabase &db, const std::vector<float> &query, const QList<int> &chunks)
 {
     QList<QString> chunkStrings;
     for (int id : chunks)
         chunkStrings << QString::number(id);
-    QSqlQuery q(m_db);
+    QSqlQuery q(db);
     if (!q.exec(GET_CHUNK_EMBEDDINGS_SQL.arg(chunkStrings.join(", ")))) {
         qWarning() << "Database ERROR: Failed to exec embeddings query:" << q.lastError();
         return {};
     }
-    return searchEmbeddingsHelper(query, q, chunks.size());
+    QList<int> chunkIds;
+    for (const auto &match : searchEmbeddingsHelper(query, q, chunks.size()))
+        chunkIds << match.chunkId;
+    return chunkIds;
 }
 
 QList<Database::BM25Query> Database::queriesForFTS5(const QString &input)
@@ -2493,17 +2746,29 @@ QList<Database::BM25Query> Database::queriesForFTS5(const QString &input)
     return queries;
 }
 
-QList<int> Database::searchBM25(const QString &query, const QList<QString> &collections, BM25Query &bm25q, int k)
+QList<int> Database::searchBM25(const QSqlDatabase &db, const QString &query, const QList<QString> &collections,
+    const RetrievalFilter &filter, BM25Query &bm25q, int k)
 {
     struct SearchResult { int chunkId; float score; };
     QList<BM25Query> bm25Queries = queriesForFTS5(query);
 
-    QSqlQuery sqlQuery(m_db);
-    sqlQuery.prepare(SELECT_CHUNKS_FTS_SQL.arg(collections.join("', '"), QString::number(k)));
+    // the filter is part of the query, so that the limit counts only the chunks it selects
+    QVariantList filterValues;
+    QString conditions;
+    for (const auto &condition : documentConditions(filter, filterValues))
+        conditions += "\n    and " + condition;
+
+    QSqlQuery sqlQuery(db);
+    sqlQuery.prepare(SELECT_CHUNKS_FTS_SQL.arg(QStringList(collections.size(), "?").join(", "), conditions));
 
     QList<SearchResult> results;
     for (auto &bm25Query : std::as_const(bm25Queries)) {
         sqlQuery.addBindValue(bm25Query.query);
+        for (const auto &collection : collections)
+            sqlQuery.addBindValue(collection);
+        for (const auto &value : std::as_const(filterValues))
+            sqlQuery.addBindValue(value);
+        sqlQuery.addBindValue(k);
 
         if (!sqlQuery.exec()) {
             qWarning() << "Database ERROR: Failed to execute BM25 query:" << sqlQuery.lastError();
@@ -2572,8 +2837,8 @@ float Database::computeBM25Weight(const Database::BM25Query &bm25q)
     return bmWeight;
 }
 
-QList<int> Database::reciprocalRankFusion(const std::vector<float> &query, const QList<int> &embeddingResults,
-    const QList<int> &bm25Results, const BM25Query &bm25q, int k)
+QList<int> Database::reciprocalRankFusion(const QSqlDatabase &db, const std::vector<float> &query,
+    const QList<int> &embeddingResults, const QList<int> &bm25Results, const BM25Query &bm25q, int k)
 {
     // We default to the embedding results and augment with bm25 if any
     QList<int> results = embeddingResults;
@@ -2587,7 +2852,7 @@ QList<int> Database::reciprocalRankFusion(const std::vector<float> &query, const
     }
 
     if (!missingScores.isEmpty()) {
-        QList<int> scored = scoreChunks(query, missingScores);
+        QList<int> scored = scoreChunks(db, query, missingScores);
         results << scored;
     }
 
@@ -2630,67 +2895,145 @@ QList<int> Database::reciprocalRankFusion(const std::vector<float> &query, const
     return results;
 }
 
-QList<int> Database::searchDatabase(const QString &query, const QList<QString> &collections, int k)
+// The read-only connection of the calling reader thread to the database at path. It is opened on first use and again
+// once the path changes, and closed when the thread exits.
+static QSqlDatabase readConnection(const QString &path)
 {
-    std::vector<float> queryEmbd = m_embLLM->generateQueryEmbedding(query);
-    if (queryEmbd.empty()) {
-        qDebug() << "ERROR: generating embeddings returned a null result";
-        return { };
+    struct Connection {
+        QString name;
+        QString path;
+
+        ~Connection() { close(); }
+        void close()
+        {
+            if (name.isEmpty())
+                return;
+            QSqlDatabase::database(name, /*open*/ false).close();
+            QSqlDatabase::removeDatabase(name);
+            name.clear();
+        }
+    };
+    thread_local Connection connection;
+    static std::atomic<int> nextId = 0;
+
+    if (!connection.name.isEmpty() && connection.path == path)
+        return QSqlDatabase::database(connection.name, /*open*/ false);
+    connection.close();
+    if (path.isEmpty())
+        return {};
+
+    connection.name = QString("localdocs-reader-%1").arg(nextId++);
+    connection.path = path;
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connection.name);
+    db.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000");
+    db.setDatabaseName(path);
+    if (!db.open()) {
+        qWarning() << "ERROR: opening db for reading" << path << db.lastError();
+        db = {};
+        connection.close();
+        return {};
+    }
+    QSqlQuery q(db);
+    for (const auto &cmd : READER_PRAGMAS_SQL) {
+        if (!q.exec(cmd))
+            qWarning() << "Database ERROR: failed to apply" << cmd << q.lastError();
     }
+    return db;
+}
 
-    const QList<int> embeddingResults = searchEmbeddings(queryEmbd, collections, k);
-    BM25Query bm25q;
-    const QList<int> bm25Results = searchBM25(query, collections, bm25q, k);
-    return reciprocalRankFusion(queryEmbd, embeddingResults, bm25Results, bm25q, k);
+// Run f on a reader thread with its connection, which is invalid if the database is not ready.
+template <typename F>
+auto Database::onReader(F &&f) -> std::future<decltype(f(std::declval<const QSqlDatabase &>()))>
+{
+    using Result = decltype(f(std::declval<const QSqlDatabase &>()));
+    QString path;
+    {
+        QMutexLocker locker(&m_readMutex);
+        path = m_readPath;
+    }
+    auto task = std::make_shared<std::packaged_task<Result()>>([f = std::forward<F>(f), path] {
+        return f(readConnection(path));
+    });
+    m_readers.start([task] { (*task)(); });
+    return task->get_future();
 }
 
+// Called directly on the thread that wants the results, which waits while the readers search.
 void Database::retrieveFromDB(const QList<QString> &collections, const QString &text, int retrievalSize,
-    QList<ResultInfo> *results)
+    const RetrievalFilter &filter, QList<ResultInfo> *results)
 {
 #if defined(DEBUG)
     qDebug() << "retrieveFromDB" << collections << text << retrievalSize;
 #endif
 
-    QList<int> searchResults = searchDatabase(text, collections, retrievalSize);
-    if (searchResults.isEmpty())
-        return;
-
-    QSqlQuery q(m_db);
-    if (!selectChunk(q, searchResults)) {
-        qDebug() << "ERROR: selecting chunks:" << q.lastError();
+    // the vector and BM25 legs run at the same time, then their results are fused and the chunks selected
+    auto vectorLeg = onReader([&](const QSqlDatabase &db) -> std::pair<std::vector<float>, QList<int>> {
+        if (!db.isValid())
+            return {};
+        std::vector<float> queryEmbd = queryEmbedding(db, text);
+        if (queryEmbd.empty()) {
+            qDebug() << "ERROR: generating embeddings returned a null result";
+            return {};
+        }
+        QList<int> embeddingResults = searchEmbeddings(db, queryEmbd, collections, filter, retrievalSize);
+        return { std::move(queryEmbd), std::move(embeddingResults) };
+    });
+    auto bm25Leg = onReader([&](const QSqlDatabase &db) -> std::pair<BM25Query, QList<int>> {
+        BM25Query bm25q;
+        if (!db.isValid())
+            return {};
+        QList<int> bm25Results = searchBM25(db, text, collections, filter, bm25q, retrievalSize);
+        return { bm25q, std::move(bm25Results) };
+    });
+    const auto [queryEmbd, embeddingResults] = vectorLeg.get();
+    const auto [bm25q, bm25Results] = bm25Leg.get();
+    if (queryEmbd.empty())
         return;
-    }
 
+    QList<int> searchResults;
     QHash<int, ResultInfo> tempResults;
-    while (q.next()) {
-        const int rowid = q.value(0).toInt();
-        const QString document_path = q.value(2).toString();
-        const QString chunk_text = q.value(3).toString();
-        const QString date = QDateTime::fromMSecsSinceEpoch(q.value(1).toLongLong()).toString("yyyy, MMMM dd");
-        const QString file = q.value(4).toString();
-        const QString title = q.value(5).toString();
-        const QString author = q.value(6).toString();
-        const int page = q.value(7).toInt();
-        const int from = q.value(8).toInt();
-        const int to = q.value(9).toInt();
-        const QString collectionName = q.value(10).toString();
-        ResultInfo info;
-        info.collection = collectionName;
-        info.path = document_path;
-        info.file = file;
-        info.title = title;
-        info.author = author;
-        info.date = date;
-        info.text = chunk_text;
-        info.page = page;
-        info.from = from;
-        info.to = to;
-        tempResults.insert(rowid, info);
+    onReader([&, &queryEmbd = queryEmbd, &embeddingResults = embeddingResults, &bm25q = bm25q,
+              &bm25Results = bm25Results](const QSqlDatabase &db) {
+        searchResults = reciprocalRankFusion(db, queryEmbd, embeddingResults, bm25Results, bm25q, retrievalSize);
+        if (searchResults.isEmpty())
+            return;
+
+        QSqlQuery q(db);
+        if (!selectChunk(q, searchResults)) {
+            qDebug() << "ERROR: selecting chunks:" << q.lastError();
+            return;
+        }
+
+        while (q.next()) {
+            const int rowid = q.value(0).toInt();
+            const QString document_path = q.value(2).toString();
+            const QString chunk_text = q.value(3).toString();
+            const QString date = QDateTime::fromMSecsSinceEpoch(q.value(1).toLongLong()).toString("yyyy, MMMM dd");
+            const QString file = q.value(4).toString();
+            const QString title = q.value(5).toString();
+            const QString author = q.value(6).toString();
+            const int page = q.value(7).toInt();
+            const int from = q.value(8).toInt();
+            const int to = q.value(9).toInt();
+            const QString collectionName = q.value(10).toString();
+            ResultInfo info;
+            info.collection = collectionName;
+            info.path = document_path;
+            info.file = file;
+            info.title = title;
+            info.author = author;
+            info.date = date;
+            info.text = chunk_text;
+            info.page = page;
+            info.from = from;
+            info.to = to;
+            tempResults.insert(rowid, info);
 #if defined(DEBUG)
-        qDebug() << "retrieve rowid:" << rowid
-                 << "chunk_text:" << chunk_text;
+            qDebug() << "retrieve rowid:" << rowid
+                     << "chunk_text:" << chunk_text;
 #endif
-    }
+        }
+    }).get();
 
     for (int id : searchResults)
         if (tempResults.contains(id))
@@ -2838,6 +3181,21 @@ void Database::changeChunkSize(int chunkSize)
     updateCollectionStatistics();
 }
 
+void Database::changeQuantization(EmbeddingIndex::Quantization quantization)
+{
+    if (quantization == m_quantization)
+        return;
+
+#if defined(DEBUG)
+    qDebug() << "changeQuantization" << int(quantization);
+#endif
+
+    // the embeddings themselves are unchanged, only the indexes over them are rebuilt
+    m_quantization = quantization;
+    if (m_databaseValid)
+        openEmbeddingIndex(MySettings::globalInstance()->modelPath());
+}
+
 void Database::changeFileExtensions(const QStringList &extensions)
 {
 #if defined(DEBUG)
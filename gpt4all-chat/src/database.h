@@ -1,7 +1,10 @@
 #ifndef DATABASE_H
 #define DATABASE_H
 
+#include "embeddingarena.h"
+#include "embeddingindex.h"
 #include "embllm.h"
+#include "ingestpipeline.h"
 
 #include <QByteArray>
 #include <QChar>
@@ -11,18 +14,23 @@
 #include <QHash>
 #include <QLatin1String>
 #include <QList>
+#include <QMutex>
 #include <QObject>
+#include <QReadWriteLock>
 #include <QSet>
 #include <QSqlDatabase>
 #include <QString>
 #include <QStringList> // IWYU pragma: keep
 #include <QThread>
+#include <QThreadPool>
 #include <QUrl>
+#include <QVariant>
 #include <QVector> // IWYU pragma: keep
 #include <QDebug> // QtAssert equivalent for Qt 6.2
 
 #include <atomic>
 #include <cstddef>
+#include <future>
 #include <list>
 #include <map>
 #include <memory>
@@ -33,7 +41,6 @@
 // Qt 6.2 compatibility - Qt::Literals not available
 
 class Database;
-class DocumentReader;
 class QFileSystemWatcher;
 class QSqlQuery;
 class QTextStream;
@@ -59,20 +66,6 @@ static const int LOCALDOCS_MIN_VER = 1;
 // current version
 static const int LOCALDOCS_VERSION = 3;
 
-struct DocumentInfo
-{
-    using key_type = std::pair<int, QString>;
-
-    int       folder;
-    QFileInfo file;
-    bool      currentlyProcessing = false;
-
-    key_type key() const { return {folder, file.canonicalFilePath()}; } // for comparison
-
-    bool isPdf () const { return !file.suffix().compare(QLatin1String("pdf"),  Qt::CaseInsensitive); }
-    bool isDocx() const { return !file.suffix().compare(QLatin1String("docx"), Qt::CaseInsensitive); }
-};
-
 struct ResultInfo {
     Q_GADGET
     Q_PROPERTY(QString collection MEMBER collection)
@@ -131,6 +124,19 @@ public:
 
 Q_DECLARE_METATYPE(ResultInfo)
 
+// Narrows a retrieval to part of the collections it searches. An empty or invalid member does not restrict anything.
+struct RetrievalFilter {
+    QList<int>  folderIds;
+    QList<int>  documentIds;
+    QDateTime   from;       // document_time, inclusive
+    QDateTime   to;         // document_time, inclusive
+    QStringList extensions; // without the dot, compared case-insensitively
+
+    bool restrictsDocuments() const
+    { return !documentIds.isEmpty() || from.isValid() || to.isValid() || !extensions.isEmpty(); }
+};
+Q_DECLARE_METATYPE(RetrievalFilter)
+
 struct CollectionItem {
     // -- Fields persisted to database --
 
@@ -165,41 +171,11 @@ struct CollectionItem {
 };
 Q_DECLARE_METATYPE(CollectionItem)
 
-class ChunkStreamer {
-public:
-    enum class Status { DOC_COMPLETE, INTERRUPTED, ERROR, BINARY_SEEN };
-
-    explicit ChunkStreamer(Database *database);
-    ~ChunkStreamer();
-
-    void setDocument(DocumentInfo doc, int documentId, const QString &embeddingModel);
-    std::optional<DocumentInfo::key_type> currentDocKey() const;
-    void reset();
-
-    Status step();
-
-private:
-    Database                              *m_database;
-    std::optional<DocumentInfo::key_type>  m_docKey;
-    std::unique_ptr<DocumentReader>        m_reader; // may be invalid, always compare key first
-    int                                    m_documentId;
-    QString                                m_embeddingModel;
-    QString                                m_title;
-    QString                                m_author;
-    QString                                m_subject;
-    QString                                m_keywords;
-
-    // working state
-    QString                                m_chunk; // has a trailing space for convenience
-    int                                    m_nChunkWords = 0;
-    int                                    m_page = 0;
-};
-
 class Database : public QObject
 {
     Q_OBJECT
 public:
-    Database(int chunkSize, QStringList extensions);
+    Database(int chunkSize, QStringList extensions, EmbeddingIndex::Quantization quantization);
     ~Database() override;
 
     bool isValid() const { return m_databaseValid; }
@@ -213,9 +189,11 @@ public Q_SLOTS:
     void forceRebuildFolder(const QString &path);
     bool addFolder(const QString &collection, const QString &path, const QString &embedding_model);
     void removeFolder(const QString &collection, const QString &path);
-    void retrieveFromDB(const QList<QString> &collections, const QString &text, int retrievalSize, QList<ResultInfo> *results);
+    void retrieveFromDB(const QList<QString> &collections, const QString &text, int retrievalSize,
+                        const RetrievalFilter &filter, QList<ResultInfo> *results);
     void changeChunkSize(int chunkSize);
     void changeFileExtensions(const QStringList &extensions);
+    void changeQuantization(EmbeddingIndex::Quantization quantization);
 
 Q_SIGNALS:
     // Signals for the gui only
@@ -228,17 +206,18 @@ Q_SIGNALS:
 private Q_SLOTS:
     void directoryChanged(const QString &path);
     void addCurrentFolders();
+    void writeIngestedChunks();
     void handleEmbeddingsGenerated(const QVector<EmbeddingResult> &embeddings);
     void handleErrorGenerated(const QVector<EmbeddingChunk> &chunks, const QString &error);
 
 private:
+    struct ChunkWriter;
+
     void transaction();
     void commit();
     void rollback();
+    void applyIndexRemovals();
 
-    bool addChunk(QSqlQuery &q, int document_id, const QString &chunk_text, const QString &file,
-                  const QString &title, const QString &author, const QString &subject, const QString &keywords,
-                  int page, int from, int to, int words, int *chunk_id);
     bool refreshDocumentIdCache(QSqlQuery &q);
     bool removeChunksByDocumentId(QSqlQuery &q, int document_id);
     bool sqlRemoveDocsByFolderPath(QSqlQuery &q, const QString &path);
@@ -254,6 +233,17 @@ private:
         const QString &keywords, int page, int maxChunks = -1);
     void appendChunk(const EmbeddingChunk &chunk);
     void sendChunkList();
+    bool ingestBlocked() const;
+    void resumeScanning();
+    void writeChunks(ChunkWriter &writer, const IngestPipeline::Batch &batch);
+    void finishDocument(QSqlQuery &q, const IngestPipeline::Batch &batch);
+    void logIngestStats();
+    void logQueryStats(qint64 minQueries = 1);
+    void initEmbeddingCache();
+    QList<QByteArray> cachedEmbeddings(QSqlQuery &q, const QList<QByteArray> &keys);
+    void cacheEmbeddings(QSqlQuery &q, const QVariantList &keys, const QVariantList &embeddings);
+    void embedChunks(const QList<EmbeddingChunk> &chunks);
+    std::vector<float> queryEmbedding(const QSqlDatabase &db, const QString &query);
     void updateFolderToIndex(int folder_id, size_t countForFolder, bool sendChunks = true);
     size_t countOfDocuments(int folder_id) const;
     size_t countOfBytes(int folder_id) const;
@@ -266,9 +256,16 @@ private:
     bool cleanDB();
     void addFolderToWatch(const QString &path);
     void removeFolderFromWatch(const QString &path);
-    static QList<int> searchEmbeddingsHelper(const std::vector<float> &query, QSqlQuery &q, int nNeighbors);
-    QList<int> searchEmbeddings(const std::vector<float> &query, const QList<QString> &collections,
-        int nNeighbors);
+    void openEmbeddingIndex(const QString &modelPath);
+    void updateEmbeddingIndex(const QString &embedding_model, int folder_id);
+    void loadEmbeddingArena();
+    void updateEmbeddingArena(const QString &embedding_model, int folder_id);
+    static QList<EmbeddingIndex::Match> searchEmbeddingsHelper(const std::vector<float> &query, QSqlQuery &q,
+                                                               int nNeighbors, const ChunkFilter *filter = nullptr);
+    QList<EmbeddingIndex::Match> scanEmbeddings(const QSqlDatabase &db, const std::vector<float> &query,
+        const QString &sql, const QString &embedding_model, int nNeighbors, const ChunkFilter *filter = nullptr);
+    QList<int> searchEmbeddings(const QSqlDatabase &db, const std::vector<float> &query,
+        const QList<QString> &collections, const RetrievalFilter &filter, int nNeighbors);
     struct BM25Query {
         QString input;
         QString query;
@@ -278,12 +275,14 @@ private:
         int rlength = 0;
     };
     QList<Database::BM25Query> queriesForFTS5(const QString &input);
-    QList<int> searchBM25(const QString &query, const QList<QString> &collections, BM25Query &bm25q, int k);
-    QList<int> scoreChunks(const std::vector<float> &query, const QList<int> &chunks);
+    QList<int> searchBM25(const QSqlDatabase &db, const QString &query, const QList<QString> &collections,
+        const RetrievalFilter &filter, BM25Query &bm25q, int k);
+    QList<int> scoreChunks(const QSqlDatabase &db, const std::vector<float> &query, const QList<int> &chunks);
     float computeBM25Weight(const BM25Query &bm25q);
-    QList<int> reciprocalRankFusion(const std::vector<float> &query, const QList<int> &embeddingResults,
-        const QList<int> &bm25Results, const BM25Query &bm25q, int k);
-    QList<int> searchDatabase(const QString &query, const QList<QString> &collections, int k);
+    QList<int> reciprocalRankFusion(const QSqlDatabase &db, const std::vector<float> &query,
+        const QList<int> &embeddingResults, const QList<int> &bm25Results, const BM25Query &bm25q, int k);
+    template <typename F>
+    auto onReader(F &&f) -> std::future<decltype(f(std::declval<const QSqlDatabase &>()))>;
 
     void setStartUpdateTime(CollectionItem &item);
     void setLastUpdateTime(CollectionItem &item);
@@ -300,6 +299,7 @@ private:
     QSqlDatabase m_db;
     int m_chunkSize;
     QStringList m_scannedFileExtensions;
+    EmbeddingIndex::Quantization m_quantization;
     QTimer *m_scanIntervalTimer;
     QElapsedTimer m_scanDurationTimer;
     std::map<int, std::list<DocumentInfo>> m_docsToScan;
@@ -309,12 +309,27 @@ private:
     QSet<QString> m_watchedPaths;
     EmbeddingLLM *m_embLLM;
     QVector<EmbeddingChunk> m_chunkList;
+    QHash<int, QByteArray> m_pendingCacheKeys; // embedding cache keys of the chunks sent to the model, by chunk id
+    qsizetype m_embeddingsInFlight = 0; // chunks sent to the model that it has not answered yet
     QHash<int, CollectionItem> m_collectionMap; // used only for tracking indexing/embedding progress
     std::atomic<bool> m_databaseValid;
-    ChunkStreamer m_chunkStreamer;
+    IngestPipeline *m_ingest;
+    qint64 m_ingestWriteMs = 0;
+    qint64 m_ingestEmbedded = 0;
     QSet<int> m_documentIdCache; // cached list of documents with chunks for fast lookup
-
-    friend class ChunkStreamer;
+    EmbeddingIndex m_embeddingIndex;
+    EmbeddingArena m_embeddingArena;
+    // guards m_embeddingIndex and m_embeddingArena, which the database thread changes and the readers search
+    mutable QReadWriteLock m_embeddingIndexLock;
+    bool m_inTransaction = false;
+    QList<int> m_removedChunkIds; // chunks to drop from the index and arena once the transaction commits
+    QList<int> m_removedFolderIds; // likewise for whole folders
+
+    // Retrieval runs on a pool of reader threads, each with a read-only connection of its own, so that it neither
+    // waits for the database thread nor for other retrievals. WAL lets them read while indexing writes.
+    QThreadPool m_readers;
+    QMutex m_readMutex; // guards m_readPath
+    QString m_readPath; // the database the readers connect to, empty until it is ready
 };
 
 #endif // DATABASE_H
@@ -348,6 +348,8 @@ void Download::removeModel(const QString &modelFile)
             ModelList::globalInstance()->removeInstalled(info);
         Network::globalInstance()->trackEvent("remove_model", { {"model", modelFile} });
         file.remove();
+        // the copy with its weights repacked for the CPU, which the backend writes next to the model
+        QFile::remove(filePath + ".cpu-q4_0x8");
         emit toastMessage(tr("Model \"%1\" is removed.").arg(info.name()));
     }
 
@@ -0,0 +1,289 @@
+#include "embeddingarena.h"
+
+#include <QByteArray>
+#include <QDebug>
+#include <QHash>
+#include <QMetaType>
+#include <QSqlQuery>
+#include <QVariant>
+
+#include <QThread>
+
+#include <algorithm>
+#include <latch>
+#include <new>
+#include <utility>
+
+
+static constexpr std::size_t ROW_ALIGNMENT   = 64;
+static constexpr int         LANES           = ROW_ALIGNMENT / sizeof(float); // rows are padded to a multiple of this
+static constexpr qsizetype   ROWS_PER_THREAD = 16384; // fewer rows than this are not worth another thread
+static constexpr std::size_t ROW_OVERHEAD    = 16;    // bytes per row for its chunk id and its entry in rowOfChunk
+
+struct AlignedDeleter {
+    void operator()(float *p) const { ::operator delete[](p, std::align_val_t(ROW_ALIGNMENT)); }
+};
+using AlignedFloats = std::unique_ptr<float[], AlignedDeleter>;
+
+static AlignedFloats allocateRows(qsizetype rows, int stride)
+{
+    std::size_t size = std::size_t(rows) * stride * sizeof(float);
+    return AlignedFloats(static_cast<float *>(::operator new[](size, std::align_val_t(ROW_ALIGNMENT))));
+}
+
+static std::size_t bytesFor(qsizetype rows, int stride)
+{
+    return std::size_t(rows) * (stride * sizeof(float) + ROW_OVERHEAD);
+}
+
+static qsizetype threadCount()
+{
+    return std::max(1, QThread::idealThreadCount());
+}
+
+class EmbeddingArena::Folder
+{
+public:
+    int                   dims     = 0;
+    int                   stride   = 0; // dims rounded up to LANES
+    qsizetype             rows     = 0;
+    qsizetype             capacity = 0;
+    AlignedFloats         data;
+    std::vector<int>      chunkIds;     // by row
+    QHash<int, qsizetype> rowOfChunk;
+
+    std::size_t bytes() const { return bytesFor(capacity, stride); }
+    const float *row(qsizetype i) const { return data.get() + i * stride; }
+    float *row(qsizetype i) { return data.get() + i * stride; }
+
+    void setDims(int n)
+    {
+        dims = n;
+        stride = (n + LANES - 1) / LANES * LANES;
+    }
+
+    void reserve(qsizetype n)
+    {
+        AlignedFloats grown = allocateRows(n, stride);
+        std::copy(data.get(), data.get() + rows * stride, grown.get());
+        data = std::move(grown);
+        capacity = n;
+        chunkIds.reserve(n);
+    }
+
+    void set(qsizetype i, const float *embedding)
+    {
+        std::copy(embedding, embedding + dims, row(i));
+        std::fill(row(i) + dims, row(i) + stride, 0.f);
+    }
+
+    // needs room for another row
+    void append(int chunkId, const float *embedding)
+    {
+        if (auto it = rowOfChunk.constFind(chunkId); it != rowOfChunk.cend()) {
+            set(*it, embedding);
+            return;
+        }
+        set(rows, embedding);
+        chunkIds.push_back(chunkId);
+        rowOfChunk.insert(chunkId, rows++);
+    }
+
+    // the last row takes the place of the removed one
+    bool remove(int chunkId)
+    {
+        auto it = rowOfChunk.find(chunkId);
+        if (it == rowOfChunk.end())
+            return false;
+        const qsizetype i = *it, last = rows - 1;
+        rowOfChunk.erase(it);
+        if (i != last) {
+            std::copy(row(last), row(last) + stride, row(i));
+            chunkIds[i] = chunkIds[last];
+            rowOfChunk[chunkIds[i]] = i;
+        }
+        chunkIds.pop_back();
+        rows--;
+        return true;
+    }
+};
+
+void EmbeddingArena::FolderDeleter::operator()(Folder *folder) const
+{
+    delete folder;
+}
+
+EmbeddingArena::EmbeddingArena(std::size_t budget)
+    : m_budget(budget)
+{
+    m_scanners.setObjectName("embedding-scan");
+    m_scanners.setMaxThreadCount(int(threadCount()));
+}
+
+EmbeddingArena::~EmbeddingArena()
+{
+    m_scanners.waitForDone();
+}
+
+auto EmbeddingArena::read(QSqlQuery &q, qsizetype count) const -> FolderPtr
+{
+    const std::size_t available = m_budget - std::min(m_budget, m_bytesUsed);
+    auto folder = FolderPtr(new Folder);
+    while (q.next()) {
+        QVariant embdCol = q.value(1);
+        if (embdCol.userType() != QMetaType::QByteArray) {
+            qWarning() << "Database ERROR: Expected embedding to be blob, got" << embdCol.userType();
+            return nullptr;
+        }
+        auto *embd = static_cast<const QByteArray *>(embdCol.constData());
+        if (!folder->dims) {
+            folder->setDims(int(embd->size() / sizeof(float)));
+            if (!folder->dims || bytesFor(count, folder->stride) > available)
+                return nullptr;
+            folder->reserve(std::max(count, qsizetype(1)));
+        }
+        if (embd->size() != qsizetype(folder->dims * sizeof(float))) {
+            qWarning() << "Database ERROR: Expected embedding to be" << folder->dims * sizeof(float) << "bytes, got"
+                       << embd->size();
+            return nullptr;
+        }
+        if (folder->rows == folder->capacity) {
+            // there are more embeddings than were counted
+            if (bytesFor(folder->capacity * 2, folder->stride) > available)
+                return nullptr;
+            folder->reserve(folder->capacity * 2);
+        }
+        folder->append(q.value(0).toInt(), reinterpret_cast<const float *>(embd->constData()));
+    }
+    if (!folder->rows)
+        return nullptr;
+    return folder;
+}
+
+void EmbeddingArena::insert(const QString &model, int folderId, FolderPtr folder)
+{
+    auto &held = m_folders[{ folderId, model }];
+    if (held)
+        m_bytesUsed -= held->bytes();
+    m_bytesUsed += folder->bytes();
+    held = std::move(folder);
+}
+
+void EmbeddingArena::add(const QString &model, int folderId, int chunkId, std::span<const float> embedding)
+{
+    auto it = m_folders.find({ folderId, model });
+    if (it == m_folders.end())
+        return;
+    Folder &folder = *it->second;
+    if (qsizetype(embedding.size()) != folder.dims) {
+        m_bytesUsed -= folder.bytes();
+        m_folders.erase(it);
+        return;
+    }
+    if (folder.rows == folder.capacity && !folder.rowOfChunk.contains(chunkId)) {
+        const qsizetype capacity = std::max(folder.capacity * 2, qsizetype(LANES));
+        const std::size_t bytesAfter = m_bytesUsed - folder.bytes() + bytesFor(capacity, folder.stride);
+        m_bytesUsed -= folder.bytes();
+        if (bytesAfter > m_budget) {
+            // the folder is left to the index or to SQL from now on
+            m_folders.erase(it);
+            return;
+        }
+        folder.reserve(capacity);
+        m_bytesUsed += folder.bytes();
+    }
+    folder.append(chunkId, embedding.data());
+}
+
+void EmbeddingArena::remove(std::span<const int> chunkIds)
+{
+    for (auto &[key, folder] : m_folders) {
+        for (int chunkId : chunkIds)
+            folder->remove(chunkId);
+    }
+}
+
+void EmbeddingArena::removeFolder(int folderId)
+{
+    for (auto it = m_folders.begin(); it != m_folders.end();) {
+        if (it->first.first == folderId) {
+            m_bytesUsed -= it->second->bytes();
+            it = m_folders.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Inner product of two padded rows. The partial sums are independent of each other, so that the compiler keeps them in
+// vector registers.
+static float dot(const float *a, const float *b, int stride)
+{
+    float sums[LANES] = {};
+    for (int i = 0; i < stride; i += LANES) {
+        for (int j = 0; j < LANES; j++)
+            sums[j] += a[i + j] * b[i + j];
+    }
+    float sum = 0.f;
+    for (float s : sums)
+        sum += s;
+    return sum;
+}
+
+bool EmbeddingArena::search(const QString &model, int folderId, std::span<const float> query, int k,
+                            QList<Match> &matches, const ChunkFilter *filter) const
+{
+    auto it = m_folders.find({ folderId, model });
+    if (it == m_folders.end())
+        return false;
+    const Folder &folder = *it->second;
+    if (qsizetype(query.size()) != folder.dims)
+        return false;
+    if (k <= 0 || !folder.rows)
+        return true;
+
+    AlignedFloats padded = allocateRows(1, folder.stride);
+    std::copy(query.begin(), query.end(), padded.get());
+    std::fill(padded.get() + folder.dims, padded.get() + folder.stride, 0.f);
+
+    // each thread keeps the k nearest rows of its range in a heap with the farthest on top
+    auto nearer = [](const Match &a, const Match &b) { return a.distance < b.distance; };
+    const int nThreads = int(std::clamp(folder.rows / ROWS_PER_THREAD, qsizetype(1), threadCount()));
+    std::vector<std::vector<Match>> heaps(nThreads);
+    auto scan = [&](int t) {
+        auto &heap = heaps[t];
+        heap.reserve(k);
+        const qsizetype end = folder.rows * (t + 1) / nThreads;
+        for (qsizetype i = folder.rows * t / nThreads; i < end; i++) {
+            if (filter && !filter->contains(folder.chunkIds[i]))
+                continue;
+            // the distance of the ip metric of usearch, so that these compare with those of the index
+            const float distance = 1.f - dot(folder.row(i), padded.get(), folder.stride);
+            if (int(heap.size()) < k) {
+                heap.push_back({ folder.chunkIds[i], distance });
+                std::push_heap(heap.begin(), heap.end(), nearer);
+            } else if (distance < heap.front().distance) {
+                std::pop_heap(heap.begin(), heap.end(), nearer);
+                heap.back() = { folder.chunkIds[i], distance };
+                std::push_heap(heap.begin(), heap.end(), nearer);
+            }
+        }
+    };
+    // a range that finds every scanner busy with other searches is scanned by this thread instead of waiting for one
+    std::latch scanned(nThreads - 1);
+    for (int t = 1; t < nThreads; t++) {
+        auto task = [&, t] { scan(t); scanned.count_down(); };
+        if (!m_scanners.tryStart(task))
+            task();
+    }
+    scan(0);
+    scanned.wait();
+
+    std::vector<Match> nearest;
+    for (const auto &heap : heaps)
+        nearest.insert(nearest.end(), heap.begin(), heap.end());
+    k = std::min(k, int(nearest.size()));
+    std::partial_sort(nearest.begin(), nearest.begin() + k, nearest.end(), nearer);
+    matches.append(QList<Match>(nearest.begin(), nearest.begin() + k));
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef EMBEDDINGARENA_H
+#define EMBEDDINGARENA_H
+
+#include "embeddingindex.h"
+
+#include <QList>
+#include <QString>
+#include <QThreadPool>
+#include <QtGlobal>
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <span>
+#include <vector>
+
+class QSqlQuery;
+
+
+// The full-precision embeddings of the LocalDocs folders, held in memory as one matrix per folder and embedding model
+// so that an exact search scans them without going through SQLite. The rows are 64-byte aligned and padded to a
+// multiple of 16 floats, and large folders are scanned by several threads. A folder is held completely or not at all,
+// and only as many folders as fit in the memory budget are held, the others are left to the index or to SQL. Not
+// thread-safe, except that search() may be called from several threads at once.
+class EmbeddingArena
+{
+public:
+    using Key   = EmbeddingIndex::Key;
+    using Match = EmbeddingIndex::Match;
+    class Folder;
+    struct FolderDeleter { void operator()(Folder *folder) const; }; // for where Folder is incomplete
+    using FolderPtr = std::unique_ptr<Folder, FolderDeleter>;
+
+    explicit EmbeddingArena(std::size_t budget);
+    ~EmbeddingArena();
+
+    // Read the embeddings of a folder from a query returning its count (chunk_id, embedding) pairs. This does not
+    // touch the arena, so it can be done before taking the lock that guards it. Returns null on error, or if the folder
+    // would not fit in what is left of the budget.
+    FolderPtr read(QSqlQuery &q, qsizetype count) const;
+    void insert(const QString &model, int folderId, FolderPtr folder);
+
+    bool contains(const QString &model, int folderId) const { return m_folders.contains({ folderId, model }); }
+    std::size_t bytesUsed() const { return m_bytesUsed; }
+
+    // Add an embedding to its folder. Does nothing if the folder is not held, and drops it if it outgrows the budget.
+    void add(const QString &model, int folderId, int chunkId, std::span<const float> embedding);
+    void remove(std::span<const int> chunkIds);
+    void removeFolder(int folderId);
+
+    // The exact k nearest neighbours of query by inner product, nearest first, with distances as the index reports
+    // them, among the chunks of filter if it is given. Returns false if the folder is not held.
+    bool search(const QString &model, int folderId, std::span<const float> query, int k, QList<Match> &matches,
+                const ChunkFilter *filter = nullptr) const;
+
+private:
+    std::size_t              m_budget;
+    std::size_t              m_bytesUsed = 0;
+    std::map<Key, FolderPtr> m_folders;
+    mutable QThreadPool      m_scanners; // scan the ranges of large folders, shared by all searches
+};
+
+#endif // EMBEDDINGARENA_H
@@ -0,0 +1,352 @@
+#include "embeddingindex.h"
+
+#include <usearch/index.hpp>
+#include <usearch/index_dense.hpp>
+#include <usearch/index_plugins.hpp>
+
+#include <QByteArray>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSqlQuery>
+#include <QStringList>
+#include <QUrl>
+#include <QVariant>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace us = unum::usearch;
+
+
+static constexpr std::size_t BUILD_BATCH_SIZE = 4096;
+static const     QString     INDEX_SUFFIX     = QStringLiteral(".usearch");
+
+// how many candidates a quantized index returns per requested neighbour, so that rescoring recovers the exact top-k
+static constexpr int INT8_OVERSAMPLING   = 4;
+static constexpr int BINARY_OVERSAMPLING = 16;
+// a filter selecting less than this fraction of a folder is searched exhaustively, the graph would have to be walked
+// far from the query before enough of its chunks turn up
+static constexpr int EXACT_FILTER_RATIO  = 32;
+
+struct EmbeddingIndex::Index {
+    us::index_dense_t index;
+    bool              viewed = false; // mapped read-only from its file
+    bool              dirty  = false; // modified since it was last saved
+};
+
+void EmbeddingIndex::IndexDeleter::operator()(Index *index) const
+{
+    delete index;
+}
+
+static std::size_t threadCount()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+static std::optional<us::index_dense_t> makeDenseIndex(std::size_t dimensions, EmbeddingIndex::Quantization quantization)
+{
+    using enum EmbeddingIndex::Quantization;
+
+    us::index_dense_config_t config;
+    // retrieval only asks for a handful of neighbours, so trade some speed for recall
+    config.expansion_add    = 128;
+    config.expansion_search = 128;
+
+    // the index converts the float32 vectors it is given to its scalar kind; a binary index keeps the sign of each
+    // dimension, and its dimensions are counted in bits
+    auto [metricKind, scalarKind] = [&] {
+        switch (quantization) {
+            case None:   return std::pair(us::metric_kind_t::ip_k,      us::scalar_kind_t::f32_k);
+            case Int8:   return std::pair(us::metric_kind_t::ip_k,      us::scalar_kind_t::i8_k);
+            case Binary: return std::pair(us::metric_kind_t::hamming_k, us::scalar_kind_t::b1x8_k);
+        }
+        Q_UNREACHABLE();
+    }();
+    us::metric_punned_t metric(dimensions, metricKind, scalarKind);
+    auto made = us::index_dense_t::make(metric, config);
+    if (!made) {
+        qWarning() << "ERROR: Cannot create embedding index:" << made.error.release();
+        return std::nullopt;
+    }
+    return std::move(made.index);
+}
+
+EmbeddingIndex::EmbeddingIndex() = default;
+
+EmbeddingIndex::~EmbeddingIndex()
+{
+    save();
+}
+
+QString EmbeddingIndex::filePath(const Key &key) const
+{
+    // the file name is the folder id and the percent-encoded model name, so that open() can recover the key
+    auto model = QString::fromLatin1(QUrl::toPercentEncoding(key.second));
+    return QDir(m_dirPath).filePath(QString("%1-%2%3").arg(key.first).arg(model, INDEX_SUFFIX));
+}
+
+void EmbeddingIndex::open(const QString &dirPath, Quantization quantization)
+{
+    save();
+    m_indexes.clear();
+    m_dirPath = dirPath;
+    m_quantization = quantization;
+    if (!QDir().mkpath(dirPath)) {
+        qWarning() << "ERROR: Cannot create embedding index directory" << dirPath;
+        return;
+    }
+
+    const auto files = QDir(dirPath).entryInfoList({ "*" + INDEX_SUFFIX }, QDir::Files);
+    for (const QFileInfo &file : files) {
+        const QString name = file.fileName().chopped(INDEX_SUFFIX.size());
+        const qsizetype sep = name.indexOf('-');
+        bool ok = false;
+        const int folderId = name.left(sep).toInt(&ok);
+        if (sep < 0 || !ok)
+            continue;
+        const QString model = QString::fromUtf8(QByteArray::fromPercentEncoding(name.mid(sep + 1).toLatin1()));
+
+        auto dense = makeDenseIndex(1, quantization); // the metric and dimensions are read from the file
+        if (!dense)
+            return;
+        auto index = IndexPtr(new Index);
+        index->index = std::move(*dense);
+        // a quantized index is small enough to keep in memory, which saves faulting it in on the first searches
+        const QByteArray path = QFile::encodeName(file.filePath());
+        const bool view = quantization == Quantization::None;
+        if (auto res = view ? index->index.view(path.constData()) : index->index.load(path.constData()); !res) {
+            qWarning() << "ERROR: Cannot open embedding index" << file.filePath() << res.error.release();
+            QFile::remove(file.filePath());
+            continue;
+        }
+        index->viewed = view;
+        m_indexes.emplace(Key(folderId, model), std::move(index));
+    }
+}
+
+void EmbeddingIndex::save()
+{
+    for (auto &[key, index] : m_indexes) {
+        if (!index->dirty)
+            continue;
+
+        const QString path = filePath(key);
+        const QString tempPath = path + ".tmp";
+        if (auto res = index->index.save(QFile::encodeName(tempPath).constData()); !res) {
+            qWarning() << "ERROR: Cannot save embedding index" << tempPath << res.error.release();
+            QFile::remove(tempPath);
+            continue;
+        }
+        QFile::remove(path);
+        if (!QFile::rename(tempPath, path)) {
+            qWarning() << "ERROR: Cannot move embedding index into place:" << path;
+            continue;
+        }
+        index->dirty = false;
+    }
+}
+
+void EmbeddingIndex::verify(const std::map<Key, qsizetype> &counts)
+{
+    for (auto it = m_indexes.begin(); it != m_indexes.end();) {
+        auto count = counts.find(it->first);
+        if (count != counts.end() && qsizetype(it->second->index.size()) == count->second) {
+            ++it;
+            continue;
+        }
+        qWarning() << "WARNING: Embedding index of folder" << it->first.first << "is out of date, dropping it";
+        it = drop(it);
+    }
+}
+
+auto EmbeddingIndex::find(const QString &model, int folderId) const -> Index *
+{
+    auto it = m_indexes.find({ folderId, model });
+    return it == m_indexes.end() ? nullptr : it->second.get();
+}
+
+auto EmbeddingIndex::drop(IndexMap::iterator it) -> IndexMap::iterator
+{
+    QFile::remove(filePath(it->first));
+    return m_indexes.erase(it);
+}
+
+// A mapped index is read-only, read it into memory before it is modified.
+bool EmbeddingIndex::makeWritable(const Key &key, Index &index)
+{
+    if (!index.viewed)
+        return true;
+    if (auto res = index.index.load(QFile::encodeName(filePath(key)).constData()); !res) {
+        qWarning() << "ERROR: Cannot load embedding index" << filePath(key) << res.error.release();
+        return false;
+    }
+    index.viewed = false;
+    return true;
+}
+
+auto EmbeddingIndex::build(QSqlQuery &q, qsizetype count, int folderId) const -> IndexPtr
+{
+    us::executor_default_t executor(threadCount());
+    std::optional<us::index_dense_t> dense;
+    std::size_t n_embd = 0;
+    std::vector<us::default_key_t> batchKeys;
+    std::vector<float> batchEmbeddings;
+    std::atomic<bool> failed = false;
+
+    auto addBatch = [&] {
+        executor.fixed(batchKeys.size(), [&](std::size_t thread, std::size_t task) {
+            auto res = dense->add(batchKeys[task], batchEmbeddings.data() + task * n_embd, thread);
+            if (!res) {
+                res.error.release();
+                failed = true;
+            }
+        });
+        batchKeys.clear();
+        batchEmbeddings.clear();
+    };
+
+    while (!failed && q.next()) {
+        const QByteArray embd = q.value(1).toByteArray();
+        if (!dense) {
+            n_embd = embd.size() / sizeof(float);
+            dense = makeDenseIndex(n_embd, m_quantization);
+            if (!dense || !dense->reserve(us::index_limits_t(std::size_t(count), executor.size())))
+                return nullptr;
+        }
+        if (std::size_t(embd.size()) != n_embd * sizeof(float)) {
+            qWarning() << "ERROR: Expected embedding to be" << n_embd * sizeof(float) << "bytes, got" << embd.size();
+            return nullptr;
+        }
+        batchKeys.push_back(us::default_key_t(q.value(0).toInt()));
+        batchEmbeddings.resize(batchEmbeddings.size() + n_embd);
+        std::memcpy(&*(batchEmbeddings.end() - n_embd), embd.constData(), embd.size());
+        if (batchKeys.size() >= BUILD_BATCH_SIZE)
+            addBatch();
+    }
+    if (!failed && !batchKeys.empty())
+        addBatch();
+    if (failed) {
+        qWarning() << "ERROR: Cannot add embeddings to the index of folder" << folderId;
+        return nullptr;
+    }
+    if (!dense)
+        return nullptr; // no embeddings
+
+    auto index = IndexPtr(new Index);
+    index->index = std::move(*dense);
+    index->dirty = true;
+    return index;
+}
+
+void EmbeddingIndex::insert(const QString &model, int folderId, IndexPtr index)
+{
+    const Key key(folderId, model);
+    if (auto it = m_indexes.find(key); it != m_indexes.end())
+        drop(it);
+    m_indexes.emplace(key, std::move(index));
+}
+
+bool EmbeddingIndex::add(const QString &model, int folderId, int chunkId, std::span<const float> embedding)
+{
+    auto it = m_indexes.find({ folderId, model });
+    if (it == m_indexes.end())
+        return true;
+
+    Index &index = *it->second;
+    bool ok = makeWritable(it->first, index) && embedding.size() == index.index.dimensions();
+    if (ok && index.index.size() >= index.index.capacity()) {
+        auto capacity = std::max<std::size_t>(2 * index.index.capacity(), BUILD_BATCH_SIZE);
+        ok = index.index.reserve(us::index_limits_t(capacity, threadCount()));
+    }
+    if (ok) {
+        auto res = index.index.add(us::default_key_t(chunkId), embedding.data());
+        if (!res)
+            qWarning() << "ERROR: Cannot add embedding to index:" << res.error.release();
+        ok = bool(res);
+    }
+    if (!ok) {
+        // the database is still complete, the folder is indexed again on the next start
+        drop(it);
+        return false;
+    }
+    index.dirty = true;
+    return true;
+}
+
+void EmbeddingIndex::remove(std::span<const int> chunkIds)
+{
+    for (auto it = m_indexes.begin(); it != m_indexes.end();) {
+        Index &index = *it->second;
+        bool ok = true;
+        for (int chunkId : chunkIds) {
+            if (!index.index.contains(us::default_key_t(chunkId)))
+                continue;
+            if (!(ok = makeWritable(it->first, index)))
+                break;
+            auto res = index.index.remove(us::default_key_t(chunkId));
+            if (!(ok = bool(res))) {
+                qWarning() << "ERROR: Cannot remove embedding from index:" << res.error.release();
+                break;
+            }
+            index.dirty = true;
+        }
+        it = ok ? std::next(it) : drop(it);
+    }
+}
+
+void EmbeddingIndex::removeFolder(int folderId)
+{
+    for (auto it = m_indexes.begin(); it != m_indexes.end();)
+        it = it->first.first == folderId ? drop(it) : std::next(it);
+}
+
+void EmbeddingIndex::removeFolder(const QString &model, int folderId)
+{
+    if (auto it = m_indexes.find({ folderId, model }); it != m_indexes.end())
+        drop(it);
+}
+
+bool EmbeddingIndex::search(const QString &model, int folderId, std::span<const float> query, int k,
+                            QList<Match> &matches, const ChunkFilter *filter) const
+{
+    const Index *index = find(model, folderId);
+    if (!index || query.size() != index->index.dimensions())
+        return false;
+    if (k <= 0)
+        return true;
+
+    switch (m_quantization) {
+        case Quantization::None:                             break;
+        case Quantization::Int8:   k *= INT8_OVERSAMPLING;   break;
+        case Quantization::Binary: k *= BINARY_OVERSAMPLING; break;
+    }
+
+    auto result = [&] {
+        if (!filter)
+            return index->index.search(query.data(), std::size_t(k));
+        const bool exact = filter->count(folderId) * EXACT_FILTER_RATIO < qsizetype(index->index.size());
+        auto selected = [filter](us::default_key_t key) { return filter->contains(int(key)); };
+        return index->index.filtered_search(query.data(), std::size_t(k), selected, us::index_dense_t::any_thread(),
+                                            exact);
+    }();
+    if (!result) {
+        qWarning() << "ERROR: Cannot search embedding index:" << result.error.release();
+        return false;
+    }
+
+    std::vector<us::default_key_t> keys(k);
+    std::vector<us::distance_punned_t> distances(k);
+    std::size_t count = result.dump_to(keys.data(), distances.data());
+    for (std::size_t i = 0; i < count; i++)
+        matches.append({ int(keys[i]), float(distances[i]) });
+    return true;
+}
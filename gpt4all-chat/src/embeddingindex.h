@@ -0,0 +1,126 @@
+#ifndef EMBEDDINGINDEX_H
+#define EMBEDDINGINDEX_H
+
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QtGlobal>
+
+#include <map>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+class QSqlQuery;
+
+
+// The chunks a search is restricted to, as a bitset over the chunk ids, which are unique across folders, so that a
+// search checks them as it goes instead of fetching more neighbours and dropping the others afterwards. How many are
+// selected in each folder is counted, a folder with none of them need not be searched at all.
+class ChunkFilter
+{
+public:
+    void insert(int folderId, int chunkId)
+    {
+        const auto word = std::size_t(chunkId) / 64;
+        const quint64 bit = quint64(1) << (chunkId % 64);
+        if (word >= m_bits.size())
+            m_bits.resize(word + 1);
+        if (!(m_bits[word] & bit)) {
+            m_bits[word] |= bit;
+            m_folderCounts[folderId]++;
+        }
+    }
+
+    bool contains(int chunkId) const
+    {
+        const auto word = std::size_t(chunkId) / 64;
+        return word < m_bits.size() && m_bits[word] & quint64(1) << (chunkId % 64);
+    }
+
+    qsizetype count(int folderId) const { return m_folderCounts.value(folderId); }
+
+private:
+    std::vector<quint64>  m_bits;
+    QHash<int, qsizetype> m_folderCounts;
+};
+
+
+// Persistent HNSW indexes over the LocalDocs embeddings, one per folder and embedding model, so that retrieval does
+// not have to scan every embedding. Folders with fewer than MIN_EMBEDDINGS embeddings are not indexed, an exact scan
+// of those is fast enough. The indexes are saved in a directory next to the database and memory-mapped when opened,
+// an index is only read into memory once it has to be modified. Not thread-safe, except that search() may be called
+// from several threads at once.
+//
+// The vectors can be quantized to int8 or to one bit per dimension. A quantized index is a fraction of the size of
+// the embeddings, so every folder is indexed and the indexes are kept in memory, but its distances are approximate:
+// search() then returns more candidates than asked for, to be rescored against the full-precision embeddings.
+class EmbeddingIndex
+{
+public:
+    enum class Quantization {
+        None   = 0, // float32
+        Int8   = 1, // scalar-quantized, compared by inner product
+        Binary = 2, // sign bits, compared by Hamming distance
+    };
+
+    struct Match {
+        int   chunkId;
+        float distance;
+    };
+    using Key = std::pair<int, QString>; // folder id, embedding model
+    struct Index;
+    struct IndexDeleter { void operator()(Index *index) const; }; // for where Index is incomplete
+    using IndexPtr = std::unique_ptr<Index, IndexDeleter>;
+
+    static constexpr qsizetype MIN_EMBEDDINGS = 20000;
+
+    EmbeddingIndex();
+    ~EmbeddingIndex(); // saves modified indexes
+
+    // Open the indexes saved in dirPath, replacing any that are open. New indexes are built with quantization.
+    void open(const QString &dirPath, Quantization quantization);
+    // Write the modified indexes to their files. This only reads them, so searches may go on meanwhile.
+    void save();
+
+    Quantization quantization() const { return m_quantization; }
+    // The number of embeddings a folder needs to be worth indexing.
+    qsizetype minEmbeddings() const { return m_quantization == Quantization::None ? MIN_EMBEDDINGS : 1; }
+
+    // Drop the indexes that do not hold exactly as many embeddings as their folder has according to counts. This
+    // happens if the application exited after changing the database but before saving the index.
+    void verify(const std::map<Key, qsizetype> &counts);
+    bool contains(const QString &model, int folderId) const { return find(model, folderId); }
+
+    // Build the index of a folder from a query returning its count (chunk_id, embedding) pairs. This does not touch
+    // the indexes that are open, so it can be done before taking the lock that guards them. Returns null on error.
+    IndexPtr build(QSqlQuery &q, qsizetype count, int folderId) const;
+    // Replace the index of a folder with one that was built, it is saved by the next save().
+    void insert(const QString &model, int folderId, IndexPtr index);
+    // Add an embedding to the index of its folder. Does nothing if the folder has no index.
+    bool add(const QString &model, int folderId, int chunkId, std::span<const float> embedding);
+    void remove(std::span<const int> chunkIds);
+    void removeFolder(int folderId);
+    void removeFolder(const QString &model, int folderId);
+
+    // The k nearest neighbours of query by inner product, nearest first, among the chunks of filter if it is given.
+    // Returns false if the folder has no index. If the index is quantized, more candidates are returned and their
+    // distances are only an estimate.
+    bool search(const QString &model, int folderId, std::span<const float> query, int k, QList<Match> &matches,
+                const ChunkFilter *filter = nullptr) const;
+
+private:
+    using IndexMap = std::map<Key, IndexPtr>;
+
+    Index *find(const QString &model, int folderId) const;
+    QString filePath(const Key &key) const;
+    bool makeWritable(const Key &key, Index &index);
+    IndexMap::iterator drop(IndexMap::iterator it);
+
+    QString      m_dirPath;
+    Quantization m_quantization = Quantization::None;
+    IndexMap     m_indexes;
+};
+
+#endif // EMBEDDINGINDEX_H
@@ -6,6 +6,7 @@
 
 #include <QCoreApplication>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QFileInfo>
 #include <QGuiApplication>
 #include <QJsonArray>
@@ -22,16 +23,34 @@
 #include <QDebug> // Qt 6.2 compatibility
 #include <QLoggingCategory>
 
+#include <algorithm>
 #include <exception>
 #include <string>
 #include <utility>
 #include <vector>
 
+#ifdef Q_OS_LINUX
+#   include <pthread.h>
+#   include <sched.h>
+#endif
+
 // Qt 6.2 compatibility - string literal operators not available
 
 
 static const QString EMBEDDING_MODEL_NAME = QString("nomic-embed-text-v1.5");
 static const QString LOCAL_EMBEDDING_MODEL = QString("nomic-embed-text-v1.5.f16.gguf");
+static const QString ATLAS_EMBEDDING_MODEL = QString("nomic-embed-text-v1");
+
+static constexpr int EMBEDDING_N_CTX          = 2048;
+static constexpr int EMBEDDING_TOKEN_OVERHEAD = 8;  // the prefix and separators embed() adds to each text
+static constexpr int MAX_EMBEDDING_INSTANCES  = 16;
+
+struct EmbeddingLLMWorker::DocRequest {
+    QVector<EmbeddingChunk>  chunks;
+    QVector<EmbeddingResult> results;     // each batch fills in its own range
+    std::atomic<int>         batchesLeft;
+    std::atomic<bool>        failed = false;
+};
 
 EmbeddingLLMWorker::EmbeddingLLMWorker()
     : QObject(nullptr)
@@ -51,6 +70,17 @@ EmbeddingLLMWorker::~EmbeddingLLMWorker()
     m_workerThread.quit();
     m_workerThread.wait();
 
+    {
+        QMutexLocker locker(&m_docMutex);
+        m_docQueued.wakeAll();
+    }
+    for (auto &thread : m_docThreads)
+        thread.join();
+    for (LLModel *model : m_docModels) {
+        if (model != m_model)
+            delete model;
+    }
+
     if (m_model) {
         delete m_model;
         m_model = nullptr;
@@ -64,15 +94,17 @@ void EmbeddingLLMWorker::wait()
 
 bool EmbeddingLLMWorker::loadModel()
 {
-    constexpr int n_ctx = 2048;
+    constexpr int n_ctx = EMBEDDING_N_CTX;
 
     m_nomicAPIKey.clear();
     m_model = nullptr;
+    m_loadedModel = LoadedModel::None;
 
     // TODO(jared): react to setting changes without restarting
 
     if (MySettings::globalInstance()->localDocsUseRemoteEmbed()) {
         m_nomicAPIKey = MySettings::globalInstance()->localDocsNomicAPIKey();
+        m_loadedModel = LoadedModel::Atlas;
         return true;
     }
 
@@ -173,13 +205,40 @@ bool EmbeddingLLMWorker::loadModel()
     int n_threads = MySettings::globalInstance()->threadCount();
     m_model->setThreadCount(n_threads);
 
+    m_modelPath = filePath;
+    m_modelOnCPU = !m_model->usingGPUDevice();
+    m_loadedModel = LoadedModel::Local;
     return true;
 }
 
+// Lock-free, as the database thread and the readers call this for every cache lookup. Empty until a model has loaded.
+QString EmbeddingLLMWorker::modelId() const
+{
+    switch (m_loadedModel.load()) {
+        using enum LoadedModel;
+        case None:  return {};
+        case Local: return LOCAL_EMBEDDING_MODEL;
+        case Atlas: return QString("atlas/%1").arg(ATLAS_EMBEDDING_MODEL);
+    }
+    Q_UNREACHABLE();
+}
+
 std::vector<float> EmbeddingLLMWorker::generateQueryEmbedding(const QString &text)
 {
     {
+        // Documents that share m_model yield to queries between batches, so this waits for one batch at most.
+        QElapsedTimer queued;
+        queued.start();
+        ++m_queriesWaiting;
         QMutexLocker locker(&m_mutex);
+        if (--m_queriesWaiting == 0)
+            m_queriesDone.wakeAll();
+        const qint64 waitedMs = queued.elapsed();
+        // updated under m_mutex, so the maximum needs no compare-exchange
+        m_queryWaitedMs += waitedMs;
+        if (waitedMs > m_queryMaxWaitedMs)
+            m_queryMaxWaitedMs = waitedMs;
+        ++m_queryCount;
 
         if (!hasModel() && !loadModel()) {
             qWarning() << "WARNING: Could not load model for embeddings";
@@ -206,10 +265,22 @@ std::vector<float> EmbeddingLLMWorker::generateQueryEmbedding(const QString &tex
     return worker.lastResponse();
 }
 
+QueryEmbeddingStats EmbeddingLLMWorker::takeQueryStats(qint64 minQueries)
+{
+    // not under m_mutex, which a batch of documents may hold, a query counted meanwhile may be split between two calls
+    if (m_queryCount < std::max<qint64>(minQueries, 1))
+        return {};
+    return {
+        .queries     = m_queryCount.exchange(0),
+        .waitedMs    = m_queryWaitedMs.exchange(0),
+        .maxWaitedMs = m_queryMaxWaitedMs.exchange(0),
+    };
+}
+
 void EmbeddingLLMWorker::sendAtlasRequest(const QStringList &texts, const QString &taskType, const QVariant &userData)
 {
     QJsonObject root;
-    root.insert("model", "nomic-embed-text-v1");
+    root.insert("model", ATLAS_EMBEDDING_MODEL);
     root.insert("texts", QJsonArray::fromStringList(texts));
     root.insert("task_type", taskType);
 
@@ -256,6 +327,7 @@ void EmbeddingLLMWorker::docEmbeddingsRequested(const QVector<EmbeddingChunk> &c
         QMutexLocker locker(&m_mutex);
         if (!hasModel() && !loadModel()) {
             qWarning() << "WARNING: Could not load model for embeddings";
+            emit errorGenerated(chunks, QString("ERROR: Could not load model for embeddings"));
             return;
         }
 
@@ -263,39 +335,11 @@ void EmbeddingLLMWorker::docEmbeddingsRequested(const QVector<EmbeddingChunk> &c
     }
 
     if (!isNomic) {
-        QVector<EmbeddingResult> results;
-        results.reserve(chunks.size());
-        std::vector<std::string> texts;
-        texts.reserve(chunks.size());
-        for (const auto &c: chunks) {
-            EmbeddingResult result;
-            result.model = c.model;
-            result.folder_id = c.folder_id;
-            result.chunk_id = c.chunk_id;
-            result.embedding.resize(m_model->embeddingSize());
-            results << result;
-            texts.push_back(c.chunk.toStdString());
-        }
-
-        constexpr int BATCH_SIZE = 4;
-        std::vector<float> result;
-        result.resize(chunks.size() * m_model->embeddingSize());
-        for (int j = 0; j < chunks.size(); j += BATCH_SIZE) {
-            QMutexLocker locker(&m_mutex);
-            std::vector batchTexts(texts.begin() + j, texts.begin() + std::min(j + BATCH_SIZE, int(texts.size())));
-            try {
-                m_model->embed(batchTexts, result.data() + j * m_model->embeddingSize(), /*isRetrieval*/ false);
-            } catch (const std::exception &e) {
-                qWarning() << "WARNING: LLModel::embed failed:" << e.what();
-                return;
-            }
-        }
-        for (int i = 0; i < chunks.size(); i++)
-            memcpy(results[i].embedding.data(), &result[i * m_model->embeddingSize()], m_model->embeddingSize() * sizeof(float));
-
-        emit embeddingsGenerated(results);
+        if (m_docThreads.empty())
+            startDocThreads();
+        queueDocBatches(chunks);
         return;
-    };
+    }
 
     QStringList texts;
     for (auto &c: chunks)
@@ -303,6 +347,181 @@ void EmbeddingLLMWorker::docEmbeddingsRequested(const QVector<EmbeddingChunk> &c
     sendAtlasRequest(texts, "search_document", QVariant::fromValue(chunks));
 }
 
+// The CPUs this process may run on.
+static std::vector<int> allowedCpus()
+{
+    std::vector<int> cpus;
+#ifdef Q_OS_LINUX
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof set, &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+#endif
+    for (int cpu = 0; cpu < QThread::idealThreadCount(); cpu++)
+        cpus.push_back(cpu);
+    return cpus;
+}
+
+// Load the instances that embed documents and start a thread for each, called on the worker thread once the model is
+// loaded. On the CPU there are as many instances as there are sets of threadCount cores. The first set is left to
+// m_model, which is then reserved for queries, so that they do not wait behind documents. On a GPU instances would only
+// take turns, and m_model embeds the documents too.
+void EmbeddingLLMWorker::startDocThreads()
+{
+    const std::vector<int> cpus = allowedCpus();
+    int n_threads;
+    int instances;
+    std::string modelPath;
+    {
+        QMutexLocker locker(&m_mutex);
+        n_threads = std::max(m_model->threadCount(), 1);
+        instances = m_modelOnCPU ? std::clamp(int(cpus.size()) / n_threads, 1, MAX_EMBEDDING_INSTANCES) : 1;
+        modelPath = m_modelPath.toStdString();
+    }
+
+    while (int(m_docModels.size()) + 1 < instances) {
+        LLModel *model;
+        try {
+            model = LLModel::Implementation::construct(modelPath, "cpu", EMBEDDING_N_CTX);
+        } catch (const std::exception &e) {
+            qWarning() << "embllm WARNING: Could not load another instance of the embedding model:" << e.what();
+            break;
+        }
+        if (!model->loadModel(modelPath, EMBEDDING_N_CTX, 0)) {
+            qWarning() << "embllm WARNING: Could not load another instance of the embedding model";
+            delete model;
+            break;
+        }
+        model->setThreadCount(n_threads);
+        m_docModels.push_back(model);
+    }
+
+    if (m_docModels.empty()) {
+        // a single instance is left to the scheduler
+        m_docModels.push_back(m_model);
+        m_docThreads.emplace_back(&EmbeddingLLMWorker::runDocThread, this, m_model, std::vector<int>());
+        return;
+    }
+    for (size_t i = 0; i < m_docModels.size(); i++) {
+        std::vector<int> ownCpus(cpus.begin() + (i + 1) * n_threads, cpus.begin() + (i + 2) * n_threads);
+        m_docThreads.emplace_back(&EmbeddingLLMWorker::runDocThread, this, m_docModels[i], std::move(ownCpus));
+    }
+}
+
+// Split the chunks into batches of about as many tokens as the context of the model, which embed() decodes at once,
+// and queue them for the instances.
+void EmbeddingLLMWorker::queueDocBatches(const QVector<EmbeddingChunk> &chunks)
+{
+    auto request = std::make_shared<DocRequest>();
+    request->chunks = chunks;
+    request->results.reserve(chunks.size());
+    for (const auto &c: chunks)
+        request->results.append({ c.model, c.folder_id, c.chunk_id, {} });
+
+    std::vector<DocBatch> batches;
+    try {
+        // readers may be embedding a query with m_model, or reloading it
+        QMutexLocker locker(&m_mutex);
+        if (!m_model) {
+            emit errorGenerated(chunks, QString("ERROR: Could not load model for embeddings"));
+            return;
+        }
+        const int budget = m_model->contextLength();
+        int begin = 0, tokens = 0;
+        for (int i = 0; i < chunks.size(); i++) {
+            int n = m_model->countPromptTokens(chunks[i].chunk.toStdString()) + EMBEDDING_TOKEN_OVERHEAD;
+            if (i > begin && tokens + n > budget) {
+                batches.push_back({ request, begin, i });
+                begin = i;
+                tokens = 0;
+            }
+            tokens += n;
+        }
+        if (begin < chunks.size())
+            batches.push_back({ request, begin, int(chunks.size()) });
+    } catch (const std::exception &e) {
+        qWarning() << "WARNING: Could not tokenize chunks for embedding:" << e.what();
+        emit errorGenerated(chunks, QString("ERROR: Could not tokenize chunks for embedding: %1").arg(e.what()));
+        return;
+    }
+    if (batches.empty())
+        return; // no chunks
+    request->batchesLeft = int(batches.size());
+
+    QMutexLocker locker(&m_docMutex);
+    for (auto &batch : batches)
+        m_docQueue.push_back(std::move(batch));
+    m_docQueued.wakeAll();
+}
+
+void EmbeddingLLMWorker::runDocThread(LLModel *model, std::vector<int> cpus)
+{
+#ifdef Q_OS_LINUX
+    // the threads ggml computes with are started from this one, and inherit its affinity
+    if (!cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus)
+            CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+    }
+#else
+    Q_UNUSED(cpus)
+#endif
+
+    for (;;) {
+        DocBatch batch;
+        {
+            QMutexLocker locker(&m_docMutex);
+            while (m_docQueue.empty() && !m_stopGenerating)
+                m_docQueued.wait(&m_docMutex);
+            if (m_stopGenerating)
+                return;
+            batch = std::move(m_docQueue.front());
+            m_docQueue.pop_front();
+        }
+        embedDocBatch(model, batch);
+    }
+}
+
+void EmbeddingLLMWorker::embedDocBatch(LLModel *model, const DocBatch &batch)
+{
+    DocRequest &request = *batch.request;
+    if (!request.failed) {
+        std::vector<std::string> texts;
+        texts.reserve(batch.end - batch.begin);
+        for (int i = batch.begin; i < batch.end; i++)
+            texts.push_back(request.chunks[i].chunk.toStdString());
+
+        const size_t n_embd = model->embeddingSize();
+        std::vector<float> result(texts.size() * n_embd);
+        try {
+            // m_model also embeds queries, which go first
+            QMutexLocker locker(model == m_model ? &m_mutex : nullptr);
+            if (model == m_model) {
+                while (m_queriesWaiting > 0)
+                    m_queriesDone.wait(&m_mutex);
+            }
+            model->embed(texts, result.data(), /*isRetrieval*/ false);
+            for (int i = batch.begin; i < batch.end; i++) {
+                auto first = result.begin() + (i - batch.begin) * n_embd;
+                request.results[i].embedding.assign(first, first + n_embd);
+            }
+        } catch (const std::exception &e) {
+            qWarning() << "WARNING: LLModel::embed failed:" << e.what();
+            if (!request.failed.exchange(true))
+                emit errorGenerated(request.chunks, QString("ERROR: Could not embed documents: %1").arg(e.what()));
+        }
+    }
+
+    if (--request.batchesLeft == 0 && !request.failed)
+        emit embeddingsGenerated(request.results);
+}
+
 std::vector<float> jsonArrayToVector(const QJsonArray &jsonArray)
 {
     std::vector<float> result;
@@ -386,6 +605,8 @@ void EmbeddingLLMWorker::handleFinished()
     QJsonDocument document = QJsonDocument::fromJson(jsonData, &err);
     if (err.error != QJsonParseError::NoError) {
         qWarning() << "ERROR: Couldn't parse Nomic Atlas response:" << jsonData << err.errorString();
+        if (!chunks.isEmpty())
+            emit errorGenerated(chunks, QString("ERROR: Couldn't parse Nomic Atlas response: %1").arg(err.errorString()));
         return;
     }
 
@@ -425,12 +646,22 @@ QString EmbeddingLLM::model()
     return EMBEDDING_MODEL_NAME;
 }
 
+QString EmbeddingLLM::modelId() const
+{
+    return m_embeddingWorker->modelId();
+}
+
 // TODO(jared): embed using all necessary embedding models given collection
 std::vector<float> EmbeddingLLM::generateQueryEmbedding(const QString &text)
 {
     return m_embeddingWorker->generateQueryEmbedding(text);
 }
 
+QueryEmbeddingStats EmbeddingLLM::takeQueryStats(qint64 minQueries)
+{
+    return m_embeddingWorker->takeQueryStats(minQueries);
+}
+
 void EmbeddingLLM::generateDocEmbeddingsAsync(const QVector<EmbeddingChunk> &chunks)
 {
     emit requestDocEmbeddings(chunks);
@@ -9,8 +9,12 @@
 #include <QThread>
 #include <QVariant>
 #include <QVector> // IWYU pragma: keep
+#include <QWaitCondition>
 
 #include <atomic>
+#include <deque>
+#include <memory>
+#include <thread>
 #include <vector>
 
 class LLModel;
@@ -33,6 +37,13 @@ struct EmbeddingResult {
     std::vector<float> embedding;
 };
 
+// How long query embeddings waited for the model, which they share with the embedding of documents.
+struct QueryEmbeddingStats {
+    qint64 queries     = 0;
+    qint64 waitedMs    = 0; // in total
+    qint64 maxWaitedMs = 0;
+};
+
 class EmbeddingLLMWorker : public QObject {
     Q_OBJECT
 public:
@@ -47,7 +58,9 @@ public:
     bool isNomic() const { return !m_nomicAPIKey.isEmpty(); }
     bool hasModel() const { return isNomic() || m_model; }
 
+    QString modelId() const;
     std::vector<float> generateQueryEmbedding(const QString &text);
+    QueryEmbeddingStats takeQueryStats(qint64 minQueries);
 
 public Q_SLOTS:
     void atlasQueryEmbeddingRequested(const QString &text);
@@ -63,15 +76,43 @@ private Q_SLOTS:
     void handleFinished();
 
 private:
+    struct DocRequest;
+    struct DocBatch {
+        std::shared_ptr<DocRequest> request;
+        int begin; // range of request->chunks
+        int end;
+    };
+
     void sendAtlasRequest(const QStringList &texts, const QString &taskType, const QVariant &userData = {});
+    void startDocThreads();
+    void queueDocBatches(const QVector<EmbeddingChunk> &chunks);
+    void runDocThread(LLModel *model, std::vector<int> cpus);
+    void embedDocBatch(LLModel *model, const DocBatch &batch);
 
     QString m_nomicAPIKey;
     QNetworkAccessManager *m_networkManager;
     std::vector<float> m_lastResponse;
     LLModel *m_model = nullptr;
+    QString m_modelPath;
+    bool m_modelOnCPU = false;
+    enum class LoadedModel { None, Local, Atlas };
+    std::atomic<LoadedModel> m_loadedModel = LoadedModel::None; // what loadModel() last loaded, read without m_mutex
     std::atomic<bool> m_stopGenerating;
     QThread m_workerThread;
     QMutex m_mutex; // guards m_model and m_nomicAPIKey
+    std::atomic<int> m_queriesWaiting = 0; // queries waiting for m_mutex, which documents let go first
+    QWaitCondition m_queriesDone;
+    std::atomic<qint64> m_queryCount = 0; // since the last takeQueryStats(), as are the two below
+    std::atomic<qint64> m_queryWaitedMs = 0;
+    std::atomic<qint64> m_queryMaxWaitedMs = 0;
+
+    // Documents are embedded by a pool of instances of the local model, which share its mapped weights. They are loaded
+    // once there are documents to embed, and only include m_model if no others could be loaded.
+    std::vector<LLModel *> m_docModels;
+    std::vector<std::thread> m_docThreads; // one per instance of m_docModels
+    QMutex m_docMutex; // guards m_docQueue
+    QWaitCondition m_docQueued;
+    std::deque<DocBatch> m_docQueue;
 };
 
 class EmbeddingLLM : public QObject
@@ -85,8 +126,15 @@ public:
     bool loadModel();
     bool hasModel() const;
 
+    // Identifies the embeddings this produces, changes if the user switches between local and remote embedding.
+    // Empty if no model could be loaded.
+    QString modelId() const; // synchronous
+
 public Q_SLOTS:
     std::vector<float> generateQueryEmbedding(const QString &text); // synchronous
+    // The query stats since the last call, if there were at least minQueries queries. Otherwise they are left to
+    // accumulate and nothing is returned.
+    QueryEmbeddingStats takeQueryStats(qint64 minQueries = 1);
     void generateDocEmbeddingsAsync(const QVector<EmbeddingChunk> &chunks);
 
 Q_SIGNALS:
@@ -0,0 +1,792 @@
+#include "httpserver.h"
+
+#include <QDebug>
+#include <QJsonDocument>
+#include <QMetaObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <Qt>
+
+#include <algorithm>
+#include <cctype>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <utility>
+
+
+class HttpConnection;
+
+struct HttpResponder::Exchange {
+    QMutex          mutex;
+    HttpConnection *connection;     // null once the connection is gone or has sent the response
+    QByteArray      output;         // written but not yet handed to the connection
+    HttpHeaders     defaultHeaders;
+    bool            headOnly;       // the response to a HEAD request has no body
+    bool            keepAlive;
+    bool            http10;         // the client cannot take a chunked response
+    bool            started     = false;
+    bool            chunked     = false;
+    bool            finished    = false;
+    bool            flushQueued = false;
+
+    void send(QByteArray bytes);
+    void sendHead(int status, const HttpHeaders &headers, std::optional<qsizetype> contentLength);
+    void respond(const HttpResponse &response);
+    void end();
+};
+
+struct HttpResponder::Handle {
+    std::shared_ptr<Exchange> exchange;
+
+    ~Handle()
+    {
+        QMutexLocker locker(&exchange->mutex);
+        if (exchange->finished)
+            return;
+        if (exchange->started)
+            exchange->end();
+        else
+            exchange->respond(HttpResponse(500));
+    }
+};
+
+// One client connection: parses its requests, hands them to the server and writes the responses back in order.
+class HttpConnection : public QObject
+{
+public:
+    HttpConnection(HttpServer *server, QTcpSocket *socket);
+    ~HttpConnection() override;
+
+    void flush();
+
+private:
+    enum class State {
+        RequestLine,
+        Headers,
+        Body,
+        ChunkSize,
+        ChunkData,
+        ChunkTrailer,
+        Closed, // no more requests are read
+    };
+
+    void readInput();
+    bool parseNext();
+    std::optional<QByteArray> takeLine();
+    bool parseRequestLine(QByteArrayView line);
+    bool parseHeader(QByteArrayView line);
+    bool startBody();
+    void finishRequest();
+    void fail(int status);
+    void closeAfterWrite();
+    void updateTimer();
+    void handleTimeout();
+
+    std::shared_ptr<HttpResponder::Exchange> newExchange(const HttpRequest &request, bool keepAlive);
+
+    enum class Timer { None, Idle, Request };
+
+    HttpServer                                          *m_server;
+    QTcpSocket                                          *m_socket;
+    QTimer                                               m_timer;
+    Timer                                                m_timerKind = Timer::None;
+    QByteArray                                           m_input;
+    qsizetype                                            m_inputPos  = 0; // parsed up to here
+    State                                                m_state     = State::RequestLine;
+    HttpRequest                                          m_request;
+    qsizetype                                            m_headerSize = 0;
+    qsizetype                                            m_remaining  = 0; // of the body or the current chunk
+    std::deque<std::shared_ptr<HttpResponder::Exchange>> m_pending;     // in the order of their requests
+};
+
+static QByteArray reasonPhrase(int status)
+{
+    switch (status) {
+        case 100: return "Continue";
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 408: return "Request Timeout";
+        case 411: return "Length Required";
+        case 413: return "Content Too Large";
+        case 414: return "URI Too Long";
+        case 429: return "Too Many Requests";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 503: return "Service Unavailable";
+        case 505: return "HTTP Version Not Supported";
+    }
+    return status < 400 ? "OK" : status < 500 ? "Client Error" : "Server Error";
+}
+
+static bool hasBody(int status)
+{
+    return status >= 200 && status != 204 && status != 304;
+}
+
+// Whether a comma-separated header value such as that of Connection contains token.
+static bool hasToken(const QByteArray &value, QByteArrayView token)
+{
+    for (auto &part : value.split(','))
+        if (part.trimmed().compare(token, Qt::CaseInsensitive) == 0)
+            return true;
+    return false;
+}
+
+QByteArray HttpRequest::header(QByteArrayView name) const
+{
+    for (auto &[key, value] : headers)
+        if (key == name)
+            return value;
+    return {};
+}
+
+HttpResponse::HttpResponse(const QJsonObject &object, int status)
+    : HttpResponse(QJsonDocument(object).toJson(QJsonDocument::Compact), "application/json", status)
+{}
+
+HttpResponse::HttpResponse(QByteArray body, QByteArray contentType, int status)
+    : status(status)
+    , headers { { "Content-Type", std::move(contentType) } }
+    , body(std::move(body))
+{}
+
+void HttpResponder::Exchange::send(QByteArray bytes)
+{
+    if (!connection)
+        return;
+    output += bytes;
+    if (!flushQueued) {
+        flushQueued = true;
+        auto *conn = connection;
+        QMetaObject::invokeMethod(conn, [conn] { conn->flush(); }, Qt::QueuedConnection);
+    }
+}
+
+void HttpResponder::Exchange::sendHead(int status, const HttpHeaders &headers, std::optional<qsizetype> contentLength)
+{
+    QByteArray head = "HTTP/1.1 " + QByteArray::number(status) + ' ' + reasonPhrase(status) + "\r\n";
+    auto addHeader = [&head](const QByteArray &name, const QByteArray &value) {
+        head += name + ": " + value + "\r\n";
+    };
+    for (auto &[name, value] : defaultHeaders)
+        addHeader(name, value);
+    for (auto &[name, value] : headers)
+        addHeader(name, value);
+    if (contentLength)
+        addHeader("Content-Length", QByteArray::number(*contentLength));
+    else if (chunked)
+        addHeader("Transfer-Encoding", "chunked");
+    addHeader("Connection", keepAlive ? "keep-alive" : "close");
+    head += "\r\n";
+    started = true;
+    send(std::move(head));
+}
+
+void HttpResponder::Exchange::respond(const HttpResponse &response)
+{
+    bool withBody = hasBody(response.status);
+    sendHead(response.status, response.headers,
+             withBody ? std::optional(response.body.size()) : std::nullopt);
+    if (withBody && !headOnly)
+        send(response.body);
+    finished = true;
+}
+
+void HttpResponder::Exchange::end()
+{
+    // without chunked encoding, the end of the body is the end of the connection, which the flush takes care of
+    send(chunked && !headOnly ? QByteArray("0\r\n\r\n") : QByteArray());
+    finished = true;
+}
+
+HttpResponder::HttpResponder(std::shared_ptr<Exchange> exchange)
+    : m_handle(std::make_shared<Handle>(std::move(exchange)))
+{}
+
+void HttpResponder::respond(HttpResponse response)
+{
+    auto &ex = *m_handle->exchange;
+    QMutexLocker locker(&ex.mutex);
+    if (ex.started) {
+        qWarning() << "ERROR: HTTP response was already started";
+        return;
+    }
+    ex.respond(response);
+}
+
+void HttpResponder::beginStream(int status, HttpHeaders headers)
+{
+    auto &ex = *m_handle->exchange;
+    QMutexLocker locker(&ex.mutex);
+    if (ex.started) {
+        qWarning() << "ERROR: HTTP response was already started";
+        return;
+    }
+    // an HTTP/1.0 client reads the body until the connection closes
+    if (ex.http10)
+        ex.keepAlive = false;
+    else
+        ex.chunked = true;
+    ex.sendHead(status, headers, std::nullopt);
+}
+
+void HttpResponder::beginEventStream(HttpHeaders headers)
+{
+    headers.append({ "Content-Type", "text/event-stream" });
+    headers.append({ "Cache-Control", "no-cache" });
+    beginStream(200, std::move(headers));
+}
+
+void HttpResponder::write(QByteArrayView data)
+{
+    auto &ex = *m_handle->exchange;
+    QMutexLocker locker(&ex.mutex);
+    // an empty chunk would end the body
+    if (!ex.started || ex.finished || ex.headOnly || data.isEmpty())
+        return;
+    if (ex.chunked) {
+        QByteArray chunk = QByteArray::number(data.size(), 16) + "\r\n";
+        chunk.append(data).append("\r\n");
+        ex.send(std::move(chunk));
+    } else {
+        ex.send(data.toByteArray());
+    }
+}
+
+void HttpResponder::writeEvent(QByteArrayView data, QByteArrayView event)
+{
+    QByteArray text;
+    if (!event.isEmpty())
+        text.append("event: ").append(event).append('\n');
+    for (auto &line : data.toByteArray().split('\n'))
+        text.append("data: ").append(line).append('\n');
+    text.append('\n');
+    write(text);
+}
+
+void HttpResponder::end()
+{
+    auto &ex = *m_handle->exchange;
+    QMutexLocker locker(&ex.mutex);
+    if (ex.started && !ex.finished)
+        ex.end();
+}
+
+bool HttpResponder::isOpen() const
+{
+    auto &ex = *m_handle->exchange;
+    QMutexLocker locker(&ex.mutex);
+    return ex.connection;
+}
+
+HttpConnection::HttpConnection(HttpServer *server, QTcpSocket *socket)
+    : QObject(server)
+    , m_server(server)
+    , m_socket(socket)
+{
+    m_server->m_connections++;
+    m_socket->setParent(this);
+    // stop reading from the network rather than buffer without bound while reading is paused
+    m_socket->setReadBufferSize(1 << 20);
+    m_timer.setSingleShot(true);
+    connect(&m_timer,  &QTimer::timeout,          this, &HttpConnection::handleTimeout);
+    connect(m_socket,  &QTcpSocket::readyRead,    this, &HttpConnection::readInput);
+    connect(m_socket,  &QTcpSocket::disconnected, this, &QObject::deleteLater);
+    updateTimer();
+}
+
+HttpConnection::~HttpConnection()
+{
+    m_server->m_connections--;
+    for (auto &ex : m_pending) {
+        QMutexLocker locker(&ex->mutex);
+        ex->connection = nullptr;
+    }
+}
+
+void HttpConnection::readInput()
+{
+    if (m_state == State::Closed)
+        return;
+
+    // drop what was parsed before appending more, so the buffer only holds the request being read
+    if (m_inputPos) {
+        m_input.remove(0, m_inputPos);
+        m_inputPos = 0;
+    }
+    if (qsizetype(m_pending.size()) < m_server->m_limits.maxPipelined)
+        m_input += m_socket->readAll();
+    // while too many responses are pending, the unread bytes wait in the socket until flush calls this again
+
+    while (m_state != State::Closed && qsizetype(m_pending.size()) < m_server->m_limits.maxPipelined) {
+        if (!parseNext())
+            break;
+    }
+    updateTimer();
+}
+
+std::optional<QByteArray> HttpConnection::takeLine()
+{
+    qsizetype end = m_input.indexOf('\n', m_inputPos);
+    if (end < 0)
+        return std::nullopt;
+    QByteArray line = m_input.sliced(m_inputPos, end - m_inputPos);
+    if (line.endsWith('\r'))
+        line.chop(1);
+    m_inputPos = end + 1;
+    return line;
+}
+
+// Parses as much of the next request as has arrived. Returns false if more input is needed.
+bool HttpConnection::parseNext()
+{
+    const auto &limits = m_server->m_limits;
+    const qsizetype available = m_input.size() - m_inputPos;
+
+    switch (m_state) {
+    case State::RequestLine:
+    case State::Headers:
+    case State::ChunkSize:
+    case State::ChunkTrailer:
+        {
+            if (m_state == State::ChunkSize)
+                m_headerSize = 0; // each chunk size line is limited on its own
+            auto line = takeLine();
+            if (!line) {
+                if (m_headerSize + available > limits.maxHeaderSize)
+                    fail(m_state == State::RequestLine ? 414 : 431);
+                return false;
+            }
+            m_headerSize += line->size() + 1;
+            if (m_headerSize > limits.maxHeaderSize) {
+                fail(m_state == State::RequestLine ? 414 : 431);
+                return false;
+            }
+
+            switch (m_state) {
+            case State::RequestLine:
+                // empty lines before a request are allowed
+                return line->isEmpty() || parseRequestLine(*line);
+            case State::Headers:
+                return line->isEmpty() ? startBody() : parseHeader(*line);
+            case State::ChunkSize:
+                {
+                    // the size may be followed by extensions, which are ignored
+                    QByteArray size = *line;
+                    if (qsizetype semi = size.indexOf(';'); semi >= 0)
+                        size.truncate(semi);
+                    bool ok;
+                    m_remaining = size.trimmed().toLongLong(&ok, 16);
+                    if (!ok || m_remaining < 0) {
+                        fail(400);
+                        return false;
+                    }
+                    if (m_request.body.size() + m_remaining > limits.maxBodySize) {
+                        fail(413);
+                        return false;
+                    }
+                    m_state = m_remaining ? State::ChunkData : State::ChunkTrailer;
+                    return true;
+                }
+            case State::ChunkTrailer:
+                // trailer fields are ignored
+                if (line->isEmpty())
+                    finishRequest();
+                return true;
+            default:
+                Q_UNREACHABLE();
+            }
+        }
+    case State::Body:
+    case State::ChunkData:
+        {
+            qsizetype n = std::min(available, m_remaining);
+            m_request.body.append(QByteArrayView(m_input).sliced(m_inputPos, n));
+            m_inputPos  += n;
+            m_remaining -= n;
+            if (m_remaining)
+                return false;
+            if (m_state == State::Body) {
+                finishRequest();
+                return true;
+            }
+            // the CRLF after the chunk data
+            auto line = takeLine();
+            if (!line)
+                return false; // takes the CRLF on the next read, as a line
+            if (!line->isEmpty()) {
+                fail(400);
+                return false;
+            }
+            m_state = State::ChunkSize;
+            return true;
+        }
+    case State::Closed:
+        return false;
+    }
+    Q_UNREACHABLE();
+}
+
+bool HttpConnection::parseRequestLine(QByteArrayView line)
+{
+    // method SP request-target SP HTTP-version
+    qsizetype sp1 = line.indexOf(' ');
+    qsizetype sp2 = line.lastIndexOf(' ');
+    if (sp1 <= 0 || sp2 <= sp1 + 1) {
+        fail(400);
+        return false;
+    }
+    QByteArrayView target  = line.sliced(sp1 + 1, sp2 - sp1 - 1);
+    QByteArrayView version = line.sliced(sp2 + 1);
+    if (!version.startsWith("HTTP/1.") || version.size() != 8 || !isdigit(uchar(version.back()))
+        || !target.startsWith('/')) {
+        fail(version.startsWith("HTTP/") ? 505 : 400);
+        return false;
+    }
+
+    m_request = {};
+    m_request.method       = line.first(sp1).toByteArray();
+    m_request.minorVersion = version.back() - '0';
+    m_request.peer         = m_socket->peerAddress();
+    m_request.peerPort     = m_socket->peerPort();
+    qsizetype q = target.indexOf('?');
+    m_request.path  = (q < 0 ? target : target.first(q)).toByteArray();
+    m_request.query = q < 0 ? QByteArray() : target.sliced(q + 1).toByteArray();
+    m_state = State::Headers;
+    return true;
+}
+
+bool HttpConnection::parseHeader(QByteArrayView line)
+{
+    qsizetype colon = line.indexOf(':');
+    // obsolete line folding is not accepted
+    if (colon <= 0 || line.front() == ' ' || line.front() == '\t' || line.first(colon).contains(' ')) {
+        fail(400);
+        return false;
+    }
+    m_request.headers.append({ line.first(colon).toByteArray().toLower(),
+                               line.sliced(colon + 1).toByteArray().trimmed() });
+    return true;
+}
+
+// Called after the headers. Decides how the body is framed, and hands off a request that has none.
+bool HttpConnection::startBody()
+{
+    const auto &limits = m_server->m_limits;
+    QByteArray transferEncoding = m_request.header("transfer-encoding");
+    QByteArray contentLength;
+    for (auto &[name, value] : m_request.headers) {
+        if (name != "content-length")
+            continue;
+        // repeated lengths must agree
+        if (!contentLength.isNull() && value != contentLength) {
+            fail(400);
+            return false;
+        }
+        contentLength = value;
+    }
+
+    if (!transferEncoding.isNull()) {
+        // both at once is a request smuggling attempt, or a broken client
+        if (!contentLength.isNull()) {
+            fail(400);
+            return false;
+        }
+        if (!transferEncoding.trimmed().toLower().endsWith("chunked")) {
+            fail(501);
+            return false;
+        }
+        m_state = State::ChunkSize;
+    } else if (!contentLength.isNull()) {
+        bool ok;
+        m_remaining = contentLength.toLongLong(&ok);
+        if (!ok || m_remaining < 0) {
+            fail(400);
+            return false;
+        }
+        if (m_remaining > limits.maxBodySize) {
+            fail(413);
+            return false;
+        }
+        if (!m_remaining) {
+            finishRequest();
+            return true;
+        }
+        m_state = State::Body;
+    } else {
+        finishRequest();
+        return true;
+    }
+
+    // the client waits for this before sending the body, it is only sent if no earlier response would come after it
+    if (hasToken(m_request.header("expect"), "100-continue") && m_pending.empty())
+        m_socket->write("HTTP/1.1 100 Continue\r\n\r\n");
+    return true;
+}
+
+auto HttpConnection::newExchange(const HttpRequest &request, bool keepAlive)
+    -> std::shared_ptr<HttpResponder::Exchange>
+{
+    auto ex = std::make_shared<HttpResponder::Exchange>();
+    ex->connection     = this;
+    ex->defaultHeaders = m_server->m_defaultHeaders;
+    ex->headOnly       = request.method == "HEAD";
+    ex->keepAlive      = keepAlive;
+    ex->http10         = request.minorVersion == 0;
+    m_pending.push_back(ex);
+    return ex;
+}
+
+void HttpConnection::finishRequest()
+{
+    QByteArray connection = m_request.header("connection");
+    bool keepAlive = m_request.minorVersion >= 1 ? !hasToken(connection, "close")
+                                                 : hasToken(connection, "keep-alive");
+
+    HttpRequest request = std::move(m_request);
+    m_request    = {};
+    m_headerSize = 0;
+    m_state      = keepAlive ? State::RequestLine : State::Closed;
+
+    HttpResponder responder(newExchange(request, keepAlive));
+    m_server->dispatch(std::move(request), std::move(responder));
+}
+
+// Answer with an error and stop reading, the rest of the input cannot be trusted to be framed correctly.
+void HttpConnection::fail(int status)
+{
+    m_state = State::Closed;
+    HttpRequest request = std::move(m_request);
+    m_request = {};
+    HttpResponder(newExchange(request, /*keepAlive*/ false)).respond(HttpResponse(status));
+}
+
+void HttpConnection::flush()
+{
+    while (!m_pending.empty()) {
+        auto &ex = *m_pending.front();
+        QByteArray output;
+        bool finished, keepAlive;
+        {
+            QMutexLocker locker(&ex.mutex);
+            output          = std::exchange(ex.output, {});
+            ex.flushQueued  = false;
+            finished        = ex.finished;
+            keepAlive       = ex.keepAlive;
+            if (finished)
+                ex.connection = nullptr;
+        }
+        if (!output.isEmpty())
+            m_socket->write(output);
+        if (!finished)
+            break;
+        m_pending.pop_front();
+        if (!keepAlive) {
+            closeAfterWrite();
+            return;
+        }
+    }
+
+    // reading may have paused for the responses that were just sent
+    readInput();
+}
+
+void HttpConnection::closeAfterWrite()
+{
+    m_state = State::Closed;
+    m_timer.stop();
+    for (auto &ex : m_pending) {
+        QMutexLocker locker(&ex->mutex);
+        ex->connection = nullptr;
+    }
+    m_pending.clear();
+    m_socket->disconnectFromHost(); // after the pending output is written
+}
+
+void HttpConnection::updateTimer()
+{
+    // a response can take as long as it needs, e.g. while a model generates
+    Timer kind = Timer::None;
+    if (m_state != State::Closed && m_pending.empty()) {
+        bool reading = m_state != State::RequestLine || m_inputPos < m_input.size();
+        kind = reading ? Timer::Request : Timer::Idle;
+    }
+    if (kind == m_timerKind)
+        return; // the request timer runs from the start of the request, not from its last bytes
+    m_timerKind = kind;
+    switch (kind) {
+        case Timer::None:    m_timer.stop();                                   break;
+        case Timer::Idle:    m_timer.start(m_server->m_limits.idleTimeout);    break;
+        case Timer::Request: m_timer.start(m_server->m_limits.requestTimeout); break;
+    }
+}
+
+void HttpConnection::handleTimeout()
+{
+    if (m_timerKind == Timer::Request) {
+        m_timerKind = Timer::None;
+        fail(408);
+        return;
+    }
+    m_socket->disconnectFromHost();
+}
+
+HttpServer::HttpServer(QObject *parent)
+    : QObject(parent)
+    , m_server(new QTcpServer(this))
+{
+    connect(m_server, &QTcpServer::newConnection, this, &HttpServer::handleNewConnections);
+    m_workers.setObjectName("http-worker");
+    m_workers.setMaxThreadCount(m_limits.workerThreads);
+}
+
+HttpServer::~HttpServer()
+{
+    // the handlers and the connections refer back to the server, so they go first
+    m_server->close();
+    m_workers.clear();
+    m_workers.waitForDone();
+    const auto children = this->children();
+    for (QObject *child : children) {
+        if (child != m_server)
+            delete child;
+    }
+}
+
+void HttpServer::route(QByteArrayView method, QByteArrayView path, Handler handler)
+{
+    if (path.endsWith('*'))
+        m_wildcardRoutes[path.chopped(1).toByteArray()].insert(method.toByteArray(), std::move(handler));
+    else
+        m_routes[path.toByteArray()].insert(method.toByteArray(), std::move(handler));
+}
+
+void HttpServer::route(QByteArrayView method, QByteArrayView path, SyncHandler handler)
+{
+    route(method, path, [handler = std::move(handler)](const HttpRequest &request, HttpResponder responder) {
+        responder.respond(handler(request));
+    });
+}
+
+void HttpServer::setLimits(const Limits &limits)
+{
+    m_limits = limits;
+    if (m_limits.workerThreads > 0)
+        m_workers.setMaxThreadCount(m_limits.workerThreads);
+}
+
+bool HttpServer::listen(const QHostAddress &address, quint16 port)
+{
+    return m_server->listen(address, port);
+}
+
+void HttpServer::close()
+{
+    m_server->close();
+}
+
+bool HttpServer::isListening() const
+{
+    return m_server->isListening();
+}
+
+quint16 HttpServer::serverPort() const
+{
+    return m_server->serverPort();
+}
+
+QString HttpServer::errorString() const
+{
+    return m_server->errorString();
+}
+
+void HttpServer::handleNewConnections()
+{
+    while (QTcpSocket *socket = m_server->nextPendingConnection()) {
+        if (m_connections >= m_limits.maxConnections) {
+            socket->write("HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nRetry-After: 1\r\n"
+                          "Connection: close\r\n\r\n");
+            socket->disconnectFromHost();
+            connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+            continue;
+        }
+        new HttpConnection(this, socket);
+    }
+}
+
+auto HttpServer::findRoute(HttpRequest &request) const -> const MethodHandlers *
+{
+    if (auto it = m_routes.constFind(request.path); it != m_routes.cend())
+        return &*it;
+
+    const MethodHandlers *best = nullptr;
+    qsizetype bestLength = -1;
+    for (auto it = m_wildcardRoutes.cbegin(); it != m_wildcardRoutes.cend(); ++it) {
+        if (it.key().size() > bestLength && request.path.startsWith(it.key())) {
+            best       = &*it;
+            bestLength = it.key().size();
+        }
+    }
+    if (best)
+        request.pathArg = request.path.sliced(bestLength);
+    return best;
+}
+
+void HttpServer::dispatch(HttpRequest request, HttpResponder responder)
+{
+    const MethodHandlers *handlers = findRoute(request);
+    if (!handlers) {
+        responder.respond(HttpResponse("Not Found\n", "text/plain", 404));
+        return;
+    }
+
+    auto handler = handlers->constFind(request.method);
+    if (handler == handlers->cend() && request.method == "HEAD")
+        handler = handlers->constFind("GET");
+    if (handler == handlers->cend()) {
+        QByteArray allow = handlers->keys().join(", ");
+        if (request.method == "OPTIONS") {
+            HttpResponse response(204);
+            response.headers = {
+                { "Allow",                        allow + ", OPTIONS"           },
+                { "Access-Control-Allow-Methods", allow + ", OPTIONS"           },
+                { "Access-Control-Allow-Headers", "Content-Type, Authorization" },
+            };
+            responder.respond(std::move(response));
+        } else {
+            HttpResponse response("Method Not Allowed\n", "text/plain", 405);
+            response.headers.append({ "Allow", allow });
+            responder.respond(std::move(response));
+        }
+        return;
+    }
+
+    // the routes do not change once the server listens, so the handler can be referred to from another thread
+    auto run = [handler = &*handler, request = std::move(request), responder = std::move(responder)]() mutable {
+        if (!responder.isOpen())
+            return; // the client went away while this waited for a worker
+        try {
+            (*handler)(request, responder);
+        } catch (const std::exception &e) {
+            qWarning().noquote() << "ERROR: HTTP handler for" << request.path << "failed:" << e.what();
+            // does nothing if the handler already started the response, which then ends with the last responder
+            responder.respond(HttpResponse(500));
+        }
+    };
+    if (m_limits.workerThreads > 0)
+        m_workers.start(std::move(run));
+    else
+        run();
+}
@@ -0,0 +1,144 @@
+#ifndef HTTPSERVER_H
+#define HTTPSERVER_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QHash>
+#include <QHostAddress>
+#include <QJsonObject>
+#include <QList>
+#include <QObject>
+#include <QPair>
+#include <QString>
+#include <QThreadPool>
+#include <QtTypes>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <utility>
+
+class QTcpServer;
+
+
+using HttpHeaders = QList<QPair<QByteArray, QByteArray>>;
+
+struct HttpRequest {
+    QByteArray   method;        // e.g. "GET"
+    QByteArray   path;          // without the query
+    QByteArray   query;
+    QByteArray   pathArg;       // the part of the path matched by the '*' of a wildcard route
+    HttpHeaders  headers;       // names in lower case
+    QByteArray   body;          // with any chunked encoding removed
+    QHostAddress peer;
+    quint16      peerPort = 0;  // with peer, identifies the connection
+    int          minorVersion = 1; // of HTTP/1.x
+
+    // The value of the first header named name (in lower case), empty if there is none.
+    QByteArray header(QByteArrayView name) const;
+};
+
+struct HttpResponse {
+    int         status = 200;
+    HttpHeaders headers;
+    QByteArray  body;
+
+    HttpResponse() = default;
+    HttpResponse(int status): status(status) {}
+    HttpResponse(const QJsonObject &object, int status = 200);
+    HttpResponse(QByteArray body, QByteArray contentType, int status = 200);
+};
+
+/*
+ * The response to one request. It can be kept past the return of the handler and written to from any thread, e.g.
+ * to stream tokens as they are generated. Responses on a connection are sent in the order of their requests, whatever
+ * order they are written in. Once the client has gone away, everything written is dropped. If the last copy is
+ * destroyed before the response is complete, the client gets a 500 or the stream is ended.
+ */
+class HttpResponder {
+public:
+    // A complete response, sent with a Content-Length.
+    void respond(HttpResponse response);
+
+    // A response whose body is sent as it is produced, with chunked transfer encoding.
+    void beginStream(int status, HttpHeaders headers);
+    // A stream of server-sent events.
+    void beginEventStream(HttpHeaders headers = {});
+    void write(QByteArrayView data);
+    // Write one server-sent event, data may span several lines.
+    void writeEvent(QByteArrayView data, QByteArrayView event = {});
+    void end();
+
+    // Whether the client is still connected, so that a handler can stop working on a response nobody waits for.
+    bool isOpen() const;
+
+private:
+    struct Exchange;
+    struct Handle;
+
+    explicit HttpResponder(std::shared_ptr<Exchange> exchange);
+
+    std::shared_ptr<Handle> m_handle;
+
+    friend class HttpConnection;
+};
+
+/*
+ * An HTTP/1.1 server. Requests are parsed incrementally however the bytes arrive, connections are kept alive and may
+ * pipeline requests, and responses can be streamed. Connections are accepted, read and written on the thread the server
+ * lives in, the handlers run on a pool of worker threads so that a slow one never holds up the IO of other clients.
+ */
+class HttpServer : public QObject
+{
+public:
+    using Handler     = std::function<void(const HttpRequest &, HttpResponder)>;
+    using SyncHandler = std::function<HttpResponse(const HttpRequest &)>;
+
+    struct Limits {
+        qsizetype                 maxHeaderSize  = 64 << 10;
+        qsizetype                 maxBodySize    = 32 << 20;
+        int                       maxConnections = 256;
+        int                       maxPipelined   = 16; // reading pauses while this many responses are pending
+        int                       workerThreads  = 4;  // that run the handlers, 0 runs them on the server's thread
+        // to receive a request once it has started, and between requests on a kept-alive connection
+        std::chrono::milliseconds requestTimeout = std::chrono::seconds(30);
+        std::chrono::milliseconds idleTimeout    = std::chrono::seconds(60);
+    };
+
+    explicit HttpServer(QObject *parent = nullptr);
+    ~HttpServer() override;
+
+    // Routes must be added before listen. A path ending in '*' matches every path it is a prefix of, the longest such
+    // route wins. OPTIONS and wrong methods on a routed path are answered by the server.
+    void route(QByteArrayView method, QByteArrayView path, Handler handler);
+    void route(QByteArrayView method, QByteArrayView path, SyncHandler handler);
+    // Headers added to every response, e.g. for CORS.
+    void setDefaultHeaders(HttpHeaders headers) { m_defaultHeaders = std::move(headers); }
+    void setLimits(const Limits &limits);
+    const Limits &limits() const { return m_limits; }
+
+    bool listen(const QHostAddress &address, quint16 port);
+    void close();
+    bool isListening() const;
+    quint16 serverPort() const;
+    QString errorString() const;
+
+private:
+    using MethodHandlers = QHash<QByteArray, Handler>;
+
+    void handleNewConnections();
+    void dispatch(HttpRequest request, HttpResponder responder);
+    const MethodHandlers *findRoute(HttpRequest &request) const;
+
+    QTcpServer                       *m_server;
+    QHash<QByteArray, MethodHandlers> m_routes;
+    QHash<QByteArray, MethodHandlers> m_wildcardRoutes; // by prefix
+    HttpHeaders                       m_defaultHeaders;
+    Limits                            m_limits;
+    int                               m_connections = 0;
+    QThreadPool                       m_workers;
+
+    friend class HttpConnection;
+};
+
+#endif // HTTPSERVER_H
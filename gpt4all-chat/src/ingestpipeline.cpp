@@ -0,0 +1,659 @@
+#include "ingestpipeline.h"
+
+#include "utils.h" // IWYU pragma: keep
+
+#include <duckx/duckx.hpp>
+#include <fmt/format.h>
+
+#include <QByteArray>
+#include <QDebug>
+#include <QFile>
+#include <QIODevice>
+#include <QMutexLocker>
+#include <QRecursiveMutex>
+#include <QScopeGuard>
+#include <QTextStream>
+#include <QThread>
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef GPT4ALL_USE_QTPDF
+#   include <QPdfDocument>
+#   include <QPdfSelection>
+#elif !defined(GPT4ALL_NO_PDF_SUPPORT)
+#   include <fpdfview.h>
+#   include <fpdf_doc.h>
+#   include <fpdf_text.h>
+#endif
+
+namespace ranges = std::ranges;
+
+
+namespace {
+
+/* QFile that checks input for binary data. If seen, it fails the read and returns true
+ * for binarySeen(). */
+class BinaryDetectingFile: public QFile {
+public:
+    using QFile::QFile;
+
+    bool binarySeen() const { return m_binarySeen; }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override {
+        qint64 res = QFile::readData(data, maxSize);
+        return checkData(data, res);
+    }
+
+    qint64 readLineData(char *data, qint64 maxSize) override {
+        qint64 res = QFile::readLineData(data, maxSize);
+        return checkData(data, res);
+    }
+
+private:
+    qint64 checkData(const char *data, qint64 size) {
+        Q_ASSERT(!isTextModeEnabled()); // We need raw bytes from the underlying QFile
+        if (size != -1 && !m_binarySeen) {
+            for (qint64 i = 0; i < size; i++) {
+                /* Control characters we should never see in plain text:
+                 * 0x00 NUL - 0x06 ACK
+                 * 0x0E SO  - 0x1A SUB
+                 * 0x1C FS  - 0x1F US */
+                auto c = static_cast<unsigned char>(data[i]);
+                if (c < 0x07 || (c >= 0x0E && c < 0x1B) || (c >= 0x1C && c < 0x20)) {
+                    m_binarySeen = true;
+                    break;
+                }
+            }
+        }
+        return m_binarySeen ? -1 : size;
+    }
+
+    bool m_binarySeen = false;
+};
+
+} // namespace
+
+class DocumentReader {
+public:
+    using Metadata = DocumentMetadata;
+
+    static std::unique_ptr<DocumentReader> fromDocument(DocumentInfo info);
+
+    const DocumentInfo           &doc     () const { return m_info; }
+    const Metadata               &metadata() const { return m_metadata; }
+    const std::optional<QString> &word    () const { return m_word; }
+    const std::optional<QString> &nextWord()       { m_word = advance(); return m_word; }
+    virtual std::optional<ChunkStreamer::Status> getError() const { return std::nullopt; }
+    virtual int page() const { return -1; }
+
+    virtual ~DocumentReader() = default;
+
+protected:
+    explicit DocumentReader(DocumentInfo info)
+        : m_info(std::move(info)) {}
+
+    void postInit(Metadata &&metadata = {})
+    {
+        m_metadata = std::move(metadata);
+        m_word = advance();
+    }
+
+    virtual std::optional<QString> advance() = 0;
+
+    DocumentInfo           m_info;
+    Metadata               m_metadata;
+    std::optional<QString> m_word;
+};
+
+namespace {
+
+#ifdef GPT4ALL_USE_QTPDF
+class PdfDocumentReader final : public DocumentReader {
+public:
+    explicit PdfDocumentReader(DocumentInfo info)
+        : DocumentReader(std::move(info))
+    {
+        QString path = info.file.canonicalFilePath();
+        if (m_doc.load(path) != QPdfDocument::Error::None)
+            throw std::runtime_error(fmt::format("Failed to load PDF: {}", path));
+        Metadata metadata {
+            .title    = m_doc.metaData(QPdfDocument::MetaDataField::Title   ).toString(),
+            .author   = m_doc.metaData(QPdfDocument::MetaDataField::Author  ).toString(),
+            .subject  = m_doc.metaData(QPdfDocument::MetaDataField::Subject ).toString(),
+            .keywords = m_doc.metaData(QPdfDocument::MetaDataField::Keywords).toString(),
+        };
+        postInit(std::move(metadata));
+    }
+
+    int page() const override { return m_currentPage; }
+
+private:
+    std::optional<QString> advance() override
+    {
+        QString word;
+        do {
+            while (!m_stream || m_stream->atEnd()) {
+                if (m_currentPage >= m_doc.pageCount())
+                    return std::nullopt;
+                m_pageText = m_doc.getAllText(m_currentPage++).text();
+                m_stream.emplace(&m_pageText);
+            }
+            *m_stream >> word;
+        } while (word.isEmpty());
+        return word;
+    }
+
+    QPdfDocument               m_doc;
+    int                        m_currentPage = 0;
+    QString                    m_pageText;
+    std::optional<QTextStream> m_stream;
+};
+#elif !defined(GPT4ALL_NO_PDF_SUPPORT)
+// PDFium is not thread-safe, so documents are chunked in parallel but only one PDF is parsed at a time
+static QRecursiveMutex s_pdfiumMutex;
+
+class PdfDocumentReader final : public DocumentReader {
+public:
+    explicit PdfDocumentReader(DocumentInfo info)
+        : DocumentReader(std::move(info))
+    {
+        QMutexLocker locker(&s_pdfiumMutex);
+        QString path = info.file.canonicalFilePath();
+        m_doc = FPDF_LoadDocument(path.toUtf8().constData(), nullptr);
+        if (!m_doc)
+            throw std::runtime_error(fmt::format("Failed to load PDF: {}", path));
+
+        // Extract metadata
+        Metadata metadata {
+            .title    = getMetadata("Title"   ),
+            .author   = getMetadata("Author"  ),
+            .subject  = getMetadata("Subject" ),
+            .keywords = getMetadata("Keywords"),
+        };
+        postInit(std::move(metadata));
+    }
+
+    ~PdfDocumentReader() override
+    {
+        QMutexLocker locker(&s_pdfiumMutex);
+        if (m_page)
+            FPDF_ClosePage(m_page);
+        if (m_doc)
+            FPDF_CloseDocument(m_doc);
+    }
+
+    int page() const override { return m_currentPage; }
+
+private:
+    std::optional<QString> advance() override
+    {
+        QString word;
+        do {
+            while (!m_stream || m_stream->atEnd()) {
+                QMutexLocker locker(&s_pdfiumMutex);
+                if (m_currentPage >= FPDF_GetPageCount(m_doc))
+                    return std::nullopt;
+
+                if (m_page)
+                    FPDF_ClosePage(std::exchange(m_page, nullptr));
+                m_page = FPDF_LoadPage(m_doc, m_currentPage++);
+                if (!m_page)
+                    throw std::runtime_error("Failed to load page.");
+
+                m_pageText = extractTextFromPage(m_page);
+                m_stream.emplace(&m_pageText);
+            }
+            *m_stream >> word;
+        } while (word.isEmpty());
+        return word;
+    }
+
+    QString getMetadata(FPDF_BYTESTRING key)
+    {
+        // FPDF_GetMetaText includes a 2-byte null terminator
+        ulong nBytes = FPDF_GetMetaText(m_doc, key, nullptr, 0);
+        if (nBytes <= sizeof (FPDF_WCHAR))
+            return { "" };
+        QByteArray buffer(nBytes, Qt::Uninitialized);
+        ulong nResultBytes = FPDF_GetMetaText(m_doc, key, buffer.data(), buffer.size());
+        Q_ASSERT(nResultBytes % 2 == 0);
+        Q_ASSERT(nResultBytes <= nBytes);
+        return QString::fromUtf16(reinterpret_cast<const char16_t *>(buffer.data()), nResultBytes / 2 - 1);
+    }
+
+    QString extractTextFromPage(FPDF_PAGE page)
+    {
+        FPDF_TEXTPAGE textPage = FPDFText_LoadPage(page);
+        if (!textPage)
+            throw std::runtime_error("Failed to load text page.");
+
+        int nChars = FPDFText_CountChars(textPage);
+        if (!nChars)
+            return {};
+        // FPDFText_GetText includes a 2-byte null terminator
+        QByteArray buffer((nChars + 1) * sizeof (FPDF_WCHAR), Qt::Uninitialized);
+        int nResultChars = FPDFText_GetText(textPage, 0, nChars, reinterpret_cast<ushort *>(buffer.data()));
+        Q_ASSERT(nResultChars <= nChars + 1);
+
+        FPDFText_ClosePage(textPage);
+        return QString::fromUtf16(reinterpret_cast<const char16_t *>(buffer.data()), nResultChars - 1);
+    }
+
+    FPDF_DOCUMENT              m_doc = nullptr;
+    FPDF_PAGE                  m_page = nullptr;
+    int                        m_currentPage = 0;
+    QString                    m_pageText;
+    std::optional<QTextStream> m_stream;
+};
+#else // defined(GPT4ALL_NO_PDF_SUPPORT)
+// Stub PDF reader when PDF support is disabled
+class PdfDocumentReader final : public DocumentReader {
+public:
+    explicit PdfDocumentReader(DocumentInfo info)
+        : DocumentReader(std::move(info))
+    {
+        throw std::runtime_error("PDF support not available on this platform");
+    }
+
+protected:
+    std::optional<QString> advance() override {
+        throw std::runtime_error("PDF support not available on this platform");
+    }
+};
+#endif // !defined(GPT4ALL_USE_QTPDF)
+
+class WordDocumentReader final : public DocumentReader {
+public:
+    explicit WordDocumentReader(DocumentInfo info)
+        : DocumentReader(std::move(info))
+        , m_doc(info.file.canonicalFilePath().toStdString())
+    {
+        m_doc.open();
+        if (!m_doc.is_open())
+            throw std::runtime_error(fmt::format("Failed to open DOCX: {}", info.file.canonicalFilePath()));
+
+        m_paragraph = &m_doc.paragraphs();
+        m_run       = &m_paragraph->runs();
+        // TODO(jared): metadata for Word documents?
+        postInit();
+    }
+
+protected:
+    std::optional<QString> advance() override
+    {
+        // find non-space char
+        qsizetype wordStart = 0;
+        while (m_buffer.isEmpty() || m_buffer[wordStart].isSpace()) {
+            if (m_buffer.isEmpty() && !fillBuffer())
+                return std::nullopt;
+            if (m_buffer[wordStart].isSpace() && ++wordStart >= m_buffer.size()) {
+                m_buffer.clear();
+                wordStart = 0;
+            }
+        }
+
+        // find space char
+        qsizetype wordEnd = wordStart + 1;
+        while (wordEnd >= m_buffer.size() || !m_buffer[wordEnd].isSpace()) {
+            if (wordEnd >= m_buffer.size() && !fillBuffer())
+                break;
+            if (!m_buffer[wordEnd].isSpace())
+                ++wordEnd;
+        }
+
+        if (wordStart == wordEnd)
+            return std::nullopt;
+
+        auto size = wordEnd - wordStart;
+        QString word = std::move(m_buffer);
+        m_buffer = word.sliced(wordStart + size);
+        if (wordStart == 0)
+            word.resize(size);
+        else
+            word = word.sliced(wordStart, size);
+        return word;
+    }
+
+    bool fillBuffer()
+    {
+        for (;;) {
+            // get a run
+            while (!m_run->has_next()) {
+                // try next paragraph
+                if (!m_paragraph->has_next())
+                    return false;
+
+                m_paragraph->next();
+                m_buffer += u'\n';
+            }
+
+            bool foundText = false;
+            auto &run = m_run->get_node();
+            for (auto node = run.first_child(); node; node = node.next_sibling()) {
+                std::string node_name = node.name();
+                if (node_name == "w:t") {
+                    const char *text = node.text().get();
+                    if (*text) {
+                        foundText = true;
+                        m_buffer += QString::fromUtf8(text);
+                    }
+                } else if (node_name == "w:br") {
+                    m_buffer += u'\n';
+                } else if (node_name == "w:tab") {
+                    m_buffer += u'\t';
+                }
+            }
+
+            m_run->next();
+            if (foundText) return true;
+        }
+    }
+
+    duckx::Document   m_doc;
+    duckx::Paragraph *m_paragraph;
+    duckx::Run       *m_run;
+    QString           m_buffer;
+};
+
+class TxtDocumentReader final : public DocumentReader {
+public:
+    explicit TxtDocumentReader(DocumentInfo info)
+        : DocumentReader(std::move(info))
+        , m_file(info.file.canonicalFilePath())
+    {
+        if (!m_file.open(QIODevice::ReadOnly))
+            throw std::runtime_error(fmt::format("Failed to open text file: {}", m_file.fileName()));
+
+        m_stream.setDevice(&m_file);
+        postInit();
+    }
+
+protected:
+    std::optional<QString> advance() override
+    {
+        if (getError())
+            return std::nullopt;
+        while (!m_stream.atEnd()) {
+            QString word;
+            m_stream >> word;
+            if (getError())
+                return std::nullopt;
+            if (!word.isEmpty())
+                return word;
+        }
+        return std::nullopt;
+    }
+
+    std::optional<ChunkStreamer::Status> getError() const override
+    {
+        if (m_file.binarySeen())
+            return ChunkStreamer::Status::BINARY_SEEN;
+        if (m_file.error())
+            return ChunkStreamer::Status::ERROR;
+        return std::nullopt;
+    }
+
+    BinaryDetectingFile m_file;
+    QTextStream m_stream;
+};
+
+} // namespace
+
+std::unique_ptr<DocumentReader> DocumentReader::fromDocument(DocumentInfo doc)
+{
+#ifdef GPT4ALL_NO_PDF_SUPPORT
+    if (doc.isPdf()) {
+        // Skip PDF files when PDF support is disabled
+        qWarning() << "Skipping PDF file - PDF support not available on this platform:" << doc.file.canonicalFilePath();
+        return nullptr;
+    }
+#else
+    if (doc.isPdf())
+        return std::make_unique<PdfDocumentReader>(std::move(doc));
+#endif
+    if (doc.isDocx())
+        return std::make_unique<WordDocumentReader>(std::move(doc));
+    return std::make_unique<TxtDocumentReader>(std::move(doc));
+}
+
+ChunkStreamer::ChunkStreamer(DocumentInfo doc, int maxChunkSize)
+    : m_reader(DocumentReader::fromDocument(std::move(doc)))
+    , m_maxChunkSize(maxChunkSize)
+{
+    // PDF support may be disabled
+    if (!m_reader)
+        throw std::runtime_error("Unsupported document type");
+}
+
+ChunkStreamer::~ChunkStreamer() = default;
+
+const DocumentMetadata &ChunkStreamer::metadata() const
+{
+    return m_reader->metadata();
+}
+
+ChunkStreamer::Status ChunkStreamer::step(QList<Chunk> &chunks, int maxChunks)
+{
+    const int maxChunkSize = m_maxChunkSize;
+    int nChunks = 0;
+
+    for (;;) {
+        if (auto error = m_reader->getError())
+            return *error;
+
+        // get a word, if needed
+        std::optional<QString> word = QString(); // empty string to disable EOF logic
+        if (m_chunk.length() < maxChunkSize + 1) {
+            word = m_reader->word();
+            if (m_chunk.isEmpty())
+                m_page = m_reader->page(); // page number of first word
+
+            if (word) {
+                m_chunk += *word;
+                m_chunk += u' ';
+                m_reader->nextWord();
+                m_nChunkWords++;
+            }
+        }
+
+        if (!word || m_chunk.length() >= maxChunkSize + 1) { // +1 for trailing space
+            if (!m_chunk.isEmpty()) {
+                int nThisChunkWords = 0;
+                auto chunk = m_chunk; // copy
+
+                // handle overlength chunks
+                if (m_chunk.length() > maxChunkSize + 1) {
+                    // find the final space
+                    qsizetype chunkEnd = chunk.lastIndexOf(u' ', -2);
+
+                    qsizetype spaceSize;
+                    if (chunkEnd >= 0) {
+                        // slice off the last word
+                        spaceSize = 1;
+                        Q_ASSERT(m_nChunkWords >= 1);
+                        // one word left
+                        nThisChunkWords = m_nChunkWords - 1;
+                        m_nChunkWords = 1;
+                    } else {
+                        // slice the overlong word
+                        spaceSize = 0;
+                        chunkEnd = maxChunkSize;
+                        // partial word left, don't count it
+                        nThisChunkWords = m_nChunkWords;
+                        m_nChunkWords = 0;
+                    }
+                    // save the second part, excluding space if any
+                    m_chunk = chunk.sliced(chunkEnd + spaceSize);
+                    // consume the first part
+                    chunk.truncate(chunkEnd);
+                } else {
+                    nThisChunkWords = m_nChunkWords;
+                    m_nChunkWords = 0;
+                    // there is no second part
+                    m_chunk.clear();
+                    // consume the whole chunk, excluding space
+                    chunk.chop(1);
+                }
+                Q_ASSERT(chunk.length() <= maxChunkSize);
+
+                chunks.append({ std::move(chunk), m_page, nThisChunkWords });
+                ++nChunks;
+            }
+
+            if (!word)
+                return Status::DOC_COMPLETE;
+        }
+
+        if (nChunks >= maxChunks)
+            return Status::INTERRUPTED;
+    }
+}
+
+IngestPipeline::IngestPipeline(QObject *parent)
+    : QObject(parent)
+{
+    m_pool.setMaxThreadCount(QThread::idealThreadCount());
+    m_maxInFlight = 2 * m_pool.maxThreadCount();
+}
+
+IngestPipeline::~IngestPipeline()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+        m_notFull.wakeAll();
+    }
+    m_pool.waitForDone();
+}
+
+bool IngestPipeline::isInFlight(const DocumentInfo &doc) const
+{
+    return ranges::any_of(m_inFlight, [key = doc.key()](auto &k) { return k == key; });
+}
+
+size_t IngestPipeline::inFlight(int folderId) const
+{
+    return ranges::count_if(m_inFlight, [folderId](auto &k) { return k.first == folderId; });
+}
+
+void IngestPipeline::submit(DocumentInfo doc, int documentId, const QString &embeddingModel, int maxChunkSize)
+{
+    if (!m_elapsed.isValid())
+        m_elapsed.start();
+
+    Batch job { .ticket = m_nextTicket++, .doc = std::move(doc), .documentId = documentId,
+                .embeddingModel = embeddingModel, .metadata = {}, .chunks = {}, .status = std::nullopt };
+    m_inFlight.insert(job.ticket, job.doc.key());
+    m_pool.start([this, job = std::move(job), maxChunkSize]() mutable { read(std::move(job), maxChunkSize); });
+}
+
+void IngestPipeline::cancelFolder(int folderId)
+{
+    QMutexLocker locker(&m_mutex);
+    for (auto it = m_inFlight.begin(); it != m_inFlight.end();) {
+        if (it->first != folderId) {
+            ++it;
+            continue;
+        }
+        m_cancelled.insert(it.key());
+        it = m_inFlight.erase(it);
+    }
+    std::erase_if(m_batches, [this](auto &b) { return m_cancelled.contains(b.ticket); });
+    m_notFull.wakeAll();
+}
+
+auto IngestPipeline::take() -> std::optional<Batch>
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_batches.empty()) {
+        m_notified = false;
+        return std::nullopt;
+    }
+    Batch batch = std::move(m_batches.front());
+    m_batches.pop_front();
+    m_notFull.wakeOne();
+    locker.unlock();
+
+    if (batch.status)
+        m_inFlight.remove(batch.ticket);
+    return batch;
+}
+
+auto IngestPipeline::takeStats() -> Stats
+{
+    Stats stats {
+        .documents = m_documents.exchange(0),
+        .bytes     = m_bytes    .exchange(0),
+        .chunks    = m_chunks   .exchange(0),
+        .busyMs    = m_busyMs   .exchange(0),
+        .elapsedMs = m_elapsed.isValid() ? m_elapsed.elapsed() : 0,
+    };
+    m_elapsed.invalidate();
+    return stats;
+}
+
+// Runs on a pool thread. Returns false if the document was cancelled or the pipeline is stopping.
+bool IngestPipeline::push(Batch &&batch)
+{
+    // enough to keep the database busy without holding many documents in memory
+    constexpr size_t MAX_QUEUED_BATCHES = 64;
+
+    QMutexLocker locker(&m_mutex);
+    while (m_batches.size() >= MAX_QUEUED_BATCHES && !m_stopping && !m_cancelled.contains(batch.ticket))
+        m_notFull.wait(&m_mutex);
+    if (m_stopping || m_cancelled.contains(batch.ticket))
+        return false;
+
+    m_batches.push_back(std::move(batch));
+    if (!std::exchange(m_notified, true))
+        emit batchesReady();
+    return true;
+}
+
+// Runs on a pool thread.
+void IngestPipeline::read(Batch job, int maxChunkSize)
+{
+    constexpr int CHUNKS_PER_BATCH = 100;
+
+    QElapsedTimer timer;
+    timer.start();
+    auto finish = qScopeGuard([&] {
+        m_busyMs += timer.elapsed();
+        QMutexLocker locker(&m_mutex);
+        m_cancelled.remove(job.ticket);
+    });
+
+    std::optional<ChunkStreamer> streamer;
+    try {
+        streamer.emplace(job.doc, maxChunkSize);
+        job.metadata = streamer->metadata();
+    } catch (const std::runtime_error &e) {
+        qWarning() << "LocalDocs ERROR:" << e.what();
+        job.status = ChunkStreamer::Status::ERROR;
+        push(std::move(job));
+        return;
+    }
+
+    for (;;) {
+        Batch batch { .ticket = job.ticket, .doc = job.doc, .documentId = job.documentId,
+                      .embeddingModel = job.embeddingModel, .metadata = job.metadata, .chunks = {},
+                      .status = std::nullopt };
+        ChunkStreamer::Status status;
+        try {
+            status = streamer->step(batch.chunks, CHUNKS_PER_BATCH);
+        } catch (const std::runtime_error &e) {
+            qWarning() << "LocalDocs ERROR:" << e.what();
+            status = ChunkStreamer::Status::ERROR;
+        }
+        m_chunks += batch.chunks.size();
+        if (status != ChunkStreamer::Status::INTERRUPTED) {
+            batch.status = status;
+            ++m_documents;
+            m_bytes += job.doc.file.size();
+        }
+        if (!push(std::move(batch)) || status != ChunkStreamer::Status::INTERRUPTED)
+            return;
+    }
+}
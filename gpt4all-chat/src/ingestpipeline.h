@@ -0,0 +1,141 @@
+#ifndef INGESTPIPELINE_H
+#define INGESTPIPELINE_H
+
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QHash>
+#include <QLatin1String>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <QtGlobal>
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <utility>
+
+class DocumentReader;
+
+
+struct DocumentInfo
+{
+    using key_type = std::pair<int, QString>;
+
+    int       folder;
+    QFileInfo file;
+
+    key_type key() const { return {folder, file.canonicalFilePath()}; } // for comparison
+
+    bool isPdf () const { return !file.suffix().compare(QLatin1String("pdf"),  Qt::CaseInsensitive); }
+    bool isDocx() const { return !file.suffix().compare(QLatin1String("docx"), Qt::CaseInsensitive); }
+};
+
+struct DocumentMetadata {
+    QString title, author, subject, keywords;
+};
+
+// Splits the text of a document into chunks. Does not use the database, so documents can be chunked on any thread.
+class ChunkStreamer {
+public:
+    enum class Status { DOC_COMPLETE, INTERRUPTED, ERROR, BINARY_SEEN };
+
+    struct Chunk {
+        QString text;
+        int     page;
+        int     words;
+    };
+
+    // throws std::runtime_error if the document cannot be read
+    ChunkStreamer(DocumentInfo doc, int maxChunkSize);
+    ~ChunkStreamer();
+
+    const DocumentMetadata &metadata() const;
+
+    // Append up to maxChunks chunks to chunks. Returns INTERRUPTED if there is more of the document left.
+    Status step(QList<Chunk> &chunks, int maxChunks);
+
+private:
+    std::unique_ptr<DocumentReader> m_reader;
+    int                             m_maxChunkSize;
+
+    // working state
+    QString                         m_chunk; // has a trailing space for convenience
+    int                             m_nChunkWords = 0;
+    int                             m_page = 0;
+};
+
+// Reads and chunks documents on a pool of threads, and queues the chunks in batches for the database thread to
+// write. Documents are submitted and batches taken on the database thread. A reader blocks while too many batches
+// are waiting, so memory stays bounded when the database or the embedding model cannot keep up.
+class IngestPipeline : public QObject
+{
+    Q_OBJECT
+public:
+    struct Batch {
+        quint64                              ticket;
+        DocumentInfo                         doc;
+        int                                  documentId;
+        QString                              embeddingModel;
+        DocumentMetadata                     metadata;
+        QList<ChunkStreamer::Chunk>          chunks;
+        std::optional<ChunkStreamer::Status> status; // set on the last batch of a document
+    };
+
+    // totals of the reading stage since the last call to takeStats()
+    struct Stats {
+        qint64 documents = 0;
+        qint64 bytes     = 0;
+        qint64 chunks    = 0;
+        qint64 busyMs    = 0; // summed over the reader threads
+        qint64 elapsedMs = 0;
+    };
+
+    explicit IngestPipeline(QObject *parent = nullptr);
+    ~IngestPipeline() override;
+
+    int  threadCount() const { return m_pool.maxThreadCount(); }
+    bool isFull() const { return m_inFlight.size() >= m_maxInFlight; }
+    bool isIdle() const { return m_inFlight.isEmpty(); }
+    bool isInFlight(const DocumentInfo &doc) const;
+    size_t inFlight(int folderId) const;
+
+    void submit(DocumentInfo doc, int documentId, const QString &embeddingModel, int maxChunkSize);
+    // Stop reading the documents of a folder, and drop the batches that were read from them.
+    void cancelFolder(int folderId);
+    std::optional<Batch> take();
+    Stats takeStats();
+
+Q_SIGNALS:
+    void batchesReady(); // emitted by the reader threads when the queue is no longer empty
+
+private:
+    void read(Batch job, int maxChunkSize);
+    bool push(Batch &&batch);
+
+    QThreadPool                                   m_pool;
+    qsizetype                                     m_maxInFlight;
+    quint64                                       m_nextTicket = 0;
+    QHash<quint64, DocumentInfo::key_type>        m_inFlight; // by ticket, database thread only
+    QElapsedTimer                                 m_elapsed;
+
+    QMutex                                        m_mutex; // guards the members below
+    QWaitCondition                                m_notFull;
+    std::deque<Batch>                             m_batches;
+    QSet<quint64>                                 m_cancelled;
+    bool                                          m_notified = false;
+    bool                                          m_stopping = false;
+
+    std::atomic<qint64>                           m_documents = 0;
+    std::atomic<qint64>                           m_bytes     = 0;
+    std::atomic<qint64>                           m_chunks    = 0;
+    std::atomic<qint64>                           m_busyMs    = 0;
+};
+
+#endif // INGESTPIPELINE_H
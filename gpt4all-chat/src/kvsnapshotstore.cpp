@@ -0,0 +1,249 @@
+#include "kvsnapshotstore.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFileInfoList>
+#include <QGlobalStatic>
+#include <QIODevice>
+#include <QMutexLocker>
+#include <QScopeGuard>
+#include <QtGlobal>
+
+#include <algorithm>
+#include <cstring>
+#include <span>
+
+
+static constexpr quint32 KV_SNAPSHOT_MAGIC   = 0x4B565347; // "GSVK"
+static constexpr quint32 KV_SNAPSHOT_VERSION = 1;
+static constexpr quint64 KV_STATE_ALIGNMENT  = 64;
+
+// Written as-is at the start of the file, followed by the input tokens and, at stateOffset, the model state. The file
+// is only ever read back on the machine that wrote it, so native byte order is fine.
+struct KVSnapshotHeader {
+    quint32 magic;
+    quint32 version;
+    char    modelHash[16];
+    qint32  nCtx;
+    quint32 nTokens;
+    quint64 stateOffset;
+    quint64 stateSize;
+};
+static_assert(sizeof(KVSnapshotHeader) % alignof(LLModel::Token) == 0);
+
+class MyKVSnapshotStore : public KVSnapshotStore { };
+Q_GLOBAL_STATIC(MyKVSnapshotStore, kvSnapshotStoreInstance)
+KVSnapshotStore *KVSnapshotStore::globalInstance()
+{
+    return kvSnapshotStoreInstance();
+}
+
+KVSnapshotStore::KVSnapshotStore()
+    : QObject(nullptr)
+{
+    moveToThread(&m_thread);
+    m_thread.start();
+}
+
+KVSnapshotStore::~KVSnapshotStore()
+{
+    m_thread.quit();
+    m_thread.wait();
+}
+
+// Hashing gigabytes of weights on every load is too slow, so identify the model by its file instead.
+auto KVSnapshotStore::modelKey(const QFileInfo &modelFile, const LLModel *model) -> ModelKey
+{
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    hash.addData(modelFile.canonicalFilePath().toUtf8());
+    hash.addData(QByteArray::number(modelFile.size()));
+    hash.addData(QByteArray::number(modelFile.lastModified().toMSecsSinceEpoch()));
+    hash.addData(QByteArray(model->backendName()));
+    return { hash.result(), model->contextLength() };
+}
+
+void KVSnapshotStore::setDirectory(const QString &path)
+{
+    QMutexLocker locker(&m_mutex);
+    m_directory = path;
+}
+
+void KVSnapshotStore::setLimits(const Limits &limits)
+{
+    QMutexLocker locker(&m_mutex);
+    m_limits = limits;
+}
+
+// Call with m_mutex locked. Empty if there is no directory.
+QString KVSnapshotStore::snapshotPath(const QString &chatId) const
+{
+    if (m_directory.isEmpty())
+        return {};
+    return m_directory + "/gpt4all-" + chatId + ".kvstate";
+}
+
+void KVSnapshotStore::save(const QString &chatId, const ModelKey &key, const LLModel *model)
+{
+    size_t stateSize = model->contextStateSize();
+    {
+        // the state is copied on the caller's thread, so a context too large to write is not even copied
+        QMutexLocker locker(&m_mutex);
+        if (!stateSize || m_directory.isEmpty() || stateSize > size_t(m_limits.maxStateSize))
+            return;
+    }
+
+    QByteArray state(qsizetype(stateSize), Qt::Uninitialized);
+    std::vector<LLModel::Token> tokens;
+    size_t bytesWritten = model->saveContextState(
+        { reinterpret_cast<uint8_t *>(state.data()), size_t(state.size()) }, tokens
+    );
+    if (!bytesWritten) {
+        qWarning() << "ERROR: Couldn't snapshot the model context for chat" << chatId;
+        return;
+    }
+    state.truncate(qsizetype(bytesWritten));
+
+    {
+        QMutexLocker locker(&m_mutex);
+        ++m_pending[chatId];
+    }
+    QMetaObject::invokeMethod(this, [this, chatId, key, state, tokens = std::move(tokens)] {
+        writeSnapshot(chatId, key, state, tokens);
+    }, Qt::QueuedConnection);
+}
+
+void KVSnapshotStore::writeSnapshot(const QString &chatId, const ModelKey &key, const QByteArray &state,
+                                    const std::vector<LLModel::Token> &tokens)
+{
+    {
+        // the chat was deleted, or a newer snapshot of it is already queued
+        QMutexLocker locker(&m_mutex);
+        auto it = m_pending.find(chatId);
+        if (it == m_pending.end() || --*it > 0)
+            return;
+        m_pending.remove(chatId);
+    }
+
+    QString filePath;
+    {
+        QMutexLocker locker(&m_mutex);
+        filePath = snapshotPath(chatId);
+    }
+    if (filePath.isEmpty())
+        return;
+    QFile tempFile(filePath + ".tmp");
+    if (!tempFile.open(QIODevice::WriteOnly)) {
+        qWarning() << "ERROR: Couldn't save KV snapshot to temporary file:" << tempFile.fileName();
+        return;
+    }
+
+    quint64 tokensEnd = sizeof(KVSnapshotHeader) + tokens.size() * sizeof(LLModel::Token);
+    KVSnapshotHeader header {
+        .magic       = KV_SNAPSHOT_MAGIC,
+        .version     = KV_SNAPSHOT_VERSION,
+        .modelHash   = {},
+        .nCtx        = key.nCtx,
+        .nTokens     = quint32(tokens.size()),
+        .stateOffset = (tokensEnd + KV_STATE_ALIGNMENT - 1) / KV_STATE_ALIGNMENT * KV_STATE_ALIGNMENT,
+        .stateSize   = quint64(state.size()),
+    };
+    std::memcpy(header.modelHash, key.hash.constData(), std::min(sizeof header.modelHash, size_t(key.hash.size())));
+
+    bool ok = tempFile.write(reinterpret_cast<const char *>(&header), sizeof header) == sizeof header
+           && tempFile.write(reinterpret_cast<const char *>(tokens.data()), tokensEnd - sizeof header)
+                  == qint64(tokensEnd - sizeof header)
+           && tempFile.write(QByteArray(qsizetype(header.stateOffset - tokensEnd), '\0')) != -1
+           && tempFile.write(state) == state.size();
+    tempFile.close();
+    if (!ok) {
+        qWarning() << "ERROR: Couldn't write KV snapshot:" << tempFile.fileName() << tempFile.errorString();
+        tempFile.remove();
+        return;
+    }
+
+    // restore() may have the file mapped, and a mapped file cannot be replaced on Windows
+    QMutexLocker locker(&m_mutex);
+    QFile::remove(filePath);
+    if (!tempFile.rename(filePath)) {
+        qWarning() << "ERROR: Couldn't move KV snapshot into place:" << filePath << tempFile.errorString();
+        return;
+    }
+    removeOldSnapshots(filePath);
+}
+
+// Remove the least recently written snapshots until they all fit in the total size, keeping the one just written. Call
+// with m_mutex locked.
+void KVSnapshotStore::removeOldSnapshots(const QString &keepPath)
+{
+    const QFileInfo kept(keepPath);
+    qint64 total = kept.size();
+    const QFileInfoList files = QDir(m_directory).entryInfoList({ "gpt4all-*.kvstate" }, QDir::Files, QDir::Time);
+    for (const QFileInfo &info : files) { // newest first
+        if (info == kept)
+            continue;
+        total += info.size();
+        if (total > m_limits.maxTotalSize && !QFile::remove(info.absoluteFilePath()))
+            qWarning() << "ERROR: Couldn't remove KV snapshot:" << info.absoluteFilePath();
+    }
+}
+
+bool KVSnapshotStore::restore(const QString &chatId, const ModelKey &key, LLModel *model)
+{
+    QMutexLocker locker(&m_mutex);
+
+    const QString filePath = snapshotPath(chatId);
+    if (filePath.isEmpty())
+        return false;
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false; // no snapshot
+
+    const qint64 fileSize = file.size();
+    if (fileSize < qint64(sizeof(KVSnapshotHeader)))
+        return false;
+    uchar *data = file.map(0, fileSize);
+    if (!data) {
+        qWarning() << "ERROR: Couldn't map KV snapshot:" << file.fileName() << file.errorString();
+        return false;
+    }
+    auto unmap = qScopeGuard([&] { file.unmap(data); });
+
+    KVSnapshotHeader header;
+    std::memcpy(&header, data, sizeof header);
+    if (header.magic != KV_SNAPSHOT_MAGIC || header.version != KV_SNAPSHOT_VERSION)
+        return false;
+    if (header.nCtx != key.nCtx || QByteArray::fromRawData(header.modelHash, sizeof header.modelHash) != key.hash)
+        return false; // taken with a different model or context size
+
+    quint64 tokensEnd = sizeof header + quint64(header.nTokens) * sizeof(LLModel::Token);
+    if (tokensEnd > header.stateOffset || header.stateOffset > quint64(fileSize)
+        || header.stateSize > quint64(fileSize) - header.stateOffset) {
+        qWarning() << "ERROR: Truncated or corrupt KV snapshot:" << file.fileName();
+        return false;
+    }
+
+    // the mapping is page aligned, and so are the tokens as the header size is a multiple of their alignment
+    std::span tokens(reinterpret_cast<const LLModel::Token *>(data + sizeof header), header.nTokens);
+    std::span state(reinterpret_cast<const uint8_t *>(data + header.stateOffset), size_t(header.stateSize));
+    if (!model->restoreContextState(state, tokens)) {
+        qWarning() << "ERROR: Couldn't restore KV snapshot for chat" << chatId;
+        return false;
+    }
+    return true;
+}
+
+void KVSnapshotStore::remove(const QString &chatId)
+{
+    QMutexLocker locker(&m_mutex);
+    m_pending.remove(chatId);
+    const QString filePath = snapshotPath(chatId);
+    if (filePath.isEmpty())
+        return;
+    QFile file(filePath);
+    if (file.exists() && !file.remove())
+        qWarning() << "ERROR: Couldn't remove KV snapshot:" << file.fileName();
+}
@@ -0,0 +1,69 @@
+#ifndef KVSNAPSHOTSTORE_H
+#define KVSNAPSHOTSTORE_H
+
+#include <gpt4all-backend/llmodel.h>
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QThread>
+#include <QtTypes>
+
+#include <cstdint>
+#include <vector>
+
+class QFileInfo;
+
+
+// Stores a snapshot of the model context of each chat in a directory, normally the model directory, so that switching
+// back to a long chat does not have to prefill the whole conversation again. Snapshots are written on a worker thread
+// and restored by mapping the file and handing the mapping straight to the model. Contexts too large to snapshot are
+// skipped, and the least recently written snapshots are removed to keep the directory within a total size.
+class KVSnapshotStore : public QObject
+{
+    Q_OBJECT
+public:
+    // Identifies what a snapshot is valid for: the model weights and the context length.
+    struct ModelKey {
+        QByteArray hash;
+        int32_t    nCtx = 0;
+    };
+
+    struct Limits {
+        qint64 maxStateSize = qint64(1) << 30; // a larger context is not snapshotted
+        qint64 maxTotalSize = qint64(4) << 30; // of all the snapshot files
+    };
+
+    static KVSnapshotStore *globalInstance();
+    static ModelKey modelKey(const QFileInfo &modelFile, const LLModel *model);
+
+    // Where the snapshots are kept. No snapshots are saved or restored until this is set.
+    void setDirectory(const QString &path);
+    void setLimits(const Limits &limits);
+
+    // Snapshot the context of model and queue it for writing. Call from the thread that uses the model.
+    void save(const QString &chatId, const ModelKey &key, const LLModel *model);
+    // Restore the snapshot of the chat into model. Returns false if there is no usable snapshot.
+    bool restore(const QString &chatId, const ModelKey &key, LLModel *model);
+    void remove(const QString &chatId);
+
+protected:
+    explicit KVSnapshotStore();
+    ~KVSnapshotStore() override;
+
+private:
+    QString snapshotPath(const QString &chatId) const;
+    void writeSnapshot(const QString &chatId, const ModelKey &key, const QByteArray &state,
+                       const std::vector<LLModel::Token> &tokens);
+    void removeOldSnapshots(const QString &keepPath);
+
+    QThread              m_thread;
+    QMutex               m_mutex;     // guards the snapshot files and the members below
+    QHash<QString, int>  m_pending;   // queued writes per chat, only the newest is written
+    QString              m_directory;
+    Limits               m_limits;
+};
+
+#endif // KVSNAPSHOTSTORE_H
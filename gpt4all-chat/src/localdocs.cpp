@@ -28,10 +28,12 @@ LocalDocs::LocalDocs()
 {
     connect(MySettings::globalInstance(), &MySettings::localDocsChunkSizeChanged, this, &LocalDocs::handleChunkSizeChanged);
     connect(MySettings::globalInstance(), &MySettings::localDocsFileExtensionsChanged, this, &LocalDocs::handleFileExtensionsChanged);
+    connect(MySettings::globalInstance(), &MySettings::localDocsVectorStorageChanged, this, &LocalDocs::handleVectorStorageChanged);
 
     // Create the DB with the chunk size from settings
     m_database = new Database(MySettings::globalInstance()->localDocsChunkSize(),
-                              MySettings::globalInstance()->localDocsFileExtensions());
+                              MySettings::globalInstance()->localDocsFileExtensions(),
+                              EmbeddingIndex::Quantization(MySettings::globalInstance()->localDocsVectorStorage()));
 
     connect(this, &LocalDocs::requestStart, m_database,
         &Database::start, Qt::QueuedConnection);
@@ -47,6 +49,8 @@ LocalDocs::LocalDocs()
         &Database::changeChunkSize, Qt::QueuedConnection);
     connect(this, &LocalDocs::requestFileExtensionsChange, m_database,
         &Database::changeFileExtensions, Qt::QueuedConnection);
+    connect(this, &LocalDocs::requestQuantizationChange, m_database,
+        &Database::changeQuantization, Qt::QueuedConnection);
     connect(m_database, &Database::databaseValidChanged,
         this, &LocalDocs::databaseValidChanged, Qt::QueuedConnection);
 
@@ -108,3 +112,8 @@ void LocalDocs::handleFileExtensionsChanged()
 {
     emit requestFileExtensionsChange(MySettings::globalInstance()->localDocsFileExtensions());
 }
+
+void LocalDocs::handleVectorStorageChanged()
+{
+    emit requestQuantizationChange(EmbeddingIndex::Quantization(MySettings::globalInstance()->localDocsVectorStorage()));
+}
@@ -33,6 +33,7 @@ public:
 public Q_SLOTS:
     void handleChunkSizeChanged();
     void handleFileExtensionsChanged();
+    void handleVectorStorageChanged();
     void aboutToQuit();
 
 Q_SIGNALS:
@@ -43,6 +44,7 @@ Q_SIGNALS:
     void requestRemoveFolder(const QString &collection, const QString &path);
     void requestChunkSizeChange(int chunkSize);
     void requestFileExtensionsChange(const QStringList &extensions);
+    void requestQuantizationChange(EmbeddingIndex::Quantization quantization);
     void localDocsModelChanged();
     void databaseValidChanged();
 
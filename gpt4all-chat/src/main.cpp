@@ -1,6 +1,7 @@
 #include "chatlistmodel.h"
 #include "config.h"
 #include "download.h"
+#include "kvsnapshotstore.h"
 #include "llm.h"
 #include "localdocs.h"
 #include "logger.h"
@@ -129,6 +130,13 @@ int main(int argc, char *argv[])
     auto *modelList = ModelList::globalInstance();
     QObject::connect(modelList, &ModelList::dataChanged, mySettings, &MySettings::onModelInfoChanged);
 
+    // the chat context snapshots are kept with the models
+    auto *kvSnapshots = KVSnapshotStore::globalInstance();
+    kvSnapshots->setDirectory(mySettings->modelPath());
+    QObject::connect(mySettings, &MySettings::modelPathChanged, [kvSnapshots, mySettings]() {
+        kvSnapshots->setDirectory(mySettings->modelPath());
+    });
+
     qmlRegisterSingletonInstance("mysettings", 1, 0, "MySettings", mySettings);
     qmlRegisterSingletonInstance("modellist", 1, 0, "ModelList", modelList);
     qmlRegisterSingletonInstance("chatlistmodel", 1, 0, "ChatListModel", ChatListModel::globalInstance());
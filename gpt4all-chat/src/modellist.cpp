@@ -347,6 +347,28 @@ void ModelInfo::setRepeatPenaltyTokens(int t)
     m_repeatPenaltyTokens = t;
 }
 
+QString ModelInfo::draftModel() const
+{
+    return MySettings::globalInstance()->modelDraftModel(*this);
+}
+
+void ModelInfo::setDraftModel(const QString &f)
+{
+    if (shouldSaveMetadata()) MySettings::globalInstance()->setModelDraftModel(*this, f, true /*force*/);
+    m_draftModel = f;
+}
+
+int ModelInfo::draftTokens() const
+{
+    return MySettings::globalInstance()->modelDraftTokens(*this);
+}
+
+void ModelInfo::setDraftTokens(int t)
+{
+    if (shouldSaveMetadata()) MySettings::globalInstance()->setModelDraftTokens(*this, t, true /*force*/);
+    m_draftTokens = t;
+}
+
 QVariant ModelInfo::defaultChatTemplate() const
 {
     auto res = m_chatTemplate.or_else([this]() -> std::optional<QString> {
@@ -449,6 +471,8 @@ QVariant ModelInfo::getField(QLatin1String name) const
         { QLatin1String("gpuLayers"),               [](auto &i) -> QVariant { return i.m_gpuLayers;               } },
         { QLatin1String("repeatPenalty"),           [](auto &i) -> QVariant { return i.m_repeatPenalty;           } },
         { QLatin1String("repeatPenaltyTokens"),     [](auto &i) -> QVariant { return i.m_repeatPenaltyTokens;     } },
+        { QLatin1String("draftModel"),              [](auto &i) -> QVariant { return i.m_draftModel;              } },
+        { QLatin1String("draftTokens"),             [](auto &i) -> QVariant { return i.m_draftTokens;             } },
         { QLatin1String("chatTemplate"),            [](auto &i) -> QVariant { return i.defaultChatTemplate();     } },
         { QLatin1String("systemMessage"),           [](auto &i) -> QVariant { return i.m_systemMessage;           } },
         { QLatin1String("chatNamePrompt"),          [](auto &i) -> QVariant { return i.m_chatNamePrompt;          } },
@@ -585,6 +609,8 @@ ModelList::ModelList()
     connect(mySettings, &MySettings::gpuLayersChanged,           this, &ModelList::updateDataForSettings     );
     connect(mySettings, &MySettings::repeatPenaltyChanged,       this, &ModelList::updateDataForSettings     );
     connect(mySettings, &MySettings::repeatPenaltyTokensChanged, this, &ModelList::updateDataForSettings     );
+    connect(mySettings, &MySettings::draftModelChanged,          this, &ModelList::updateDataForSettings     );
+    connect(mySettings, &MySettings::draftTokensChanged,         this, &ModelList::updateDataForSettings     );
     connect(mySettings, &MySettings::chatTemplateChanged,        this, &ModelList::maybeUpdateDataForSettings);
     connect(mySettings, &MySettings::systemMessageChanged,       this, &ModelList::maybeUpdateDataForSettings);
 
@@ -875,6 +901,10 @@ QVariant ModelList::dataInternal(const ModelInfo *info, int role) const
             return info->repeatPenalty();
         case RepeatPenaltyTokensRole:
             return info->repeatPenaltyTokens();
+        case DraftModelRole:
+            return info->draftModel();
+        case DraftTokensRole:
+            return info->draftTokens();
         case ChatTemplateRole:
             return QVariant::fromValue(info->chatTemplate());
         case SystemMessageRole:
@@ -1051,6 +1081,10 @@ void ModelList::updateData(const QString &id, const QVector<QPair<int, QVariant>
                 info->setRepeatPenalty(value.toDouble()); break;
             case RepeatPenaltyTokensRole:
                 info->setRepeatPenaltyTokens(value.toInt()); break;
+            case DraftModelRole:
+                info->setDraftModel(value.toString()); break;
+            case DraftTokensRole:
+                info->setDraftTokens(value.toInt()); break;
             case ChatTemplateRole:
                 info->m_chatTemplate = value.toString(); break;
             case SystemMessageRole:
@@ -1214,6 +1248,8 @@ QString ModelList::clone(const ModelInfo &model)
         { ModelList::GpuLayersRole, model.gpuLayers() },
         { ModelList::RepeatPenaltyRole, model.repeatPenalty() },
         { ModelList::RepeatPenaltyTokensRole, model.repeatPenaltyTokens() },
+        { ModelList::DraftModelRole, model.draftModel() },
+        { ModelList::DraftTokensRole, model.draftTokens() },
         { ModelList::SystemMessageRole, model.m_systemMessage },
         { ModelList::ChatNamePromptRole, model.chatNamePrompt() },
         { ModelList::SuggestedFollowUpPromptRole, model.suggestedFollowUpPrompt() },
@@ -1708,6 +1744,10 @@ void ModelList::parseModelsJsonFile(const QByteArray &jsonData, bool save)
             data.append({ ModelList::RepeatPenaltyRole, obj["repeatPenalty"].toDouble() });
         if (obj.contains("repeatPenaltyTokens"))
             data.append({ ModelList::RepeatPenaltyTokensRole, obj["repeatPenaltyTokens"].toInt() });
+        if (obj.contains("draftModel"))
+            data.append({ ModelList::DraftModelRole, obj["draftModel"].toString() });
+        if (obj.contains("draftTokens"))
+            data.append({ ModelList::DraftTokensRole, obj["draftTokens"].toInt() });
         if (auto it = obj.find(QLatin1String("chatTemplate")); it != obj.end())
             data.append({ ModelList::ChatTemplateRole, it->toString() });
         if (auto it = obj.find(QLatin1String("systemMessage")); it != obj.end())
@@ -2031,6 +2071,14 @@ void ModelList::updateModelsFromSettings()
             const int repeatPenaltyTokens = settings.value(g + "/repeatPenaltyTokens").toInt();
             data.append({ ModelList::RepeatPenaltyTokensRole, repeatPenaltyTokens });
         }
+        if (settings.contains(g + "/draftModel")) {
+            const QString draftModel = settings.value(g + "/draftModel").toString();
+            data.append({ ModelList::DraftModelRole, draftModel });
+        }
+        if (settings.contains(g + "/draftTokens")) {
+            const int draftTokens = settings.value(g + "/draftTokens").toInt();
+            data.append({ ModelList::DraftTokensRole, draftTokens });
+        }
         if (settings.contains(g + "/chatNamePrompt")) {
             const QString chatNamePrompt = settings.value(g + "/chatNamePrompt").toString();
             data.append({ ModelList::ChatNamePromptRole, chatNamePrompt });
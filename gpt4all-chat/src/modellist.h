@@ -117,6 +117,8 @@ struct ModelInfo {
     Q_PROPERTY(int maxGpuLayers READ maxGpuLayers)
     Q_PROPERTY(double repeatPenalty READ repeatPenalty WRITE setRepeatPenalty)
     Q_PROPERTY(int repeatPenaltyTokens READ repeatPenaltyTokens WRITE setRepeatPenaltyTokens)
+    Q_PROPERTY(QString draftModel READ draftModel WRITE setDraftModel)
+    Q_PROPERTY(int draftTokens READ draftTokens WRITE setDraftTokens)
     // user-defined chat template and system message must be written through settings because of their legacy compat
     Q_PROPERTY(QVariant           defaultChatTemplate  READ defaultChatTemplate )
     Q_PROPERTY(UpgradeableSetting chatTemplate         READ chatTemplate        )
@@ -229,6 +231,10 @@ public:
     void setRepeatPenalty(double p);
     int repeatPenaltyTokens() const;
     void setRepeatPenaltyTokens(int t);
+    QString draftModel() const;
+    void setDraftModel(const QString &f);
+    int draftTokens() const;
+    void setDraftTokens(int t);
     QVariant defaultChatTemplate() const;
     UpgradeableSetting chatTemplate() const;
     QString defaultSystemMessage() const;
@@ -270,6 +276,8 @@ private:
     mutable int m_maxGpuLayers        = -1;
     double  m_repeatPenalty           = 1.18;
     int     m_repeatPenaltyTokens     = 64;
+    QString m_draftModel;                   // filename of a small model for speculative decoding, empty for none
+    int     m_draftTokens             = 5;
             std::optional<QString> m_chatTemplate;
     mutable std::optional<QString> m_modelChatTemplate;
     QString m_systemMessage;
@@ -409,6 +417,8 @@ public:
         GpuLayersRole,
         RepeatPenaltyRole,
         RepeatPenaltyTokensRole,
+        DraftModelRole,
+        DraftTokensRole,
         ChatTemplateRole,
         SystemMessageRole,
         ChatNamePromptRole,
@@ -463,6 +473,8 @@ public:
         roles[GpuLayersRole] = "gpuLayers";
         roles[RepeatPenaltyRole] = "repeatPenalty";
         roles[RepeatPenaltyTokensRole] = "repeatPenaltyTokens";
+        roles[DraftModelRole] = "draftModel";
+        roles[DraftTokensRole] = "draftTokens";
         roles[ChatTemplateRole] = "chatTemplate";
         roles[SystemMessageRole] = "systemMessage";
         roles[ChatNamePromptRole] = "chatNamePrompt";
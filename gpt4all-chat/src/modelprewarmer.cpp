@@ -0,0 +1,149 @@
+#include "modelprewarmer.h"
+
+#include <gpt4all-backend/sysinfo.h>
+
+#include <QDeadlineTimer>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QGlobalStatic>
+#include <QIODevice>
+#include <QMutexLocker>
+#include <QThread>
+#include <QWaitCondition>
+#include <QtGlobal>
+
+#include <algorithm>
+#include <atomic>
+
+#ifdef Q_OS_UNIX
+#   include <sys/mman.h>
+#   include <unistd.h>
+#endif
+
+
+static constexpr qint64 PREWARM_CHUNK_SIZE = 64 << 20; // per task, a multiple of the page size
+static constexpr qint64 PREWARM_FRESH_MS   = 60'000;   // a file warmed this recently is not warmed again
+
+struct ModelPrewarmer::Job {
+    QFile               file;
+    uchar              *data = nullptr;
+    qint64              size = 0;
+    std::atomic<qint64> bytesDone = 0;
+
+    QMutex              mutex;      // guards chunksLeft
+    QWaitCondition      done;
+    int                 chunksLeft = 0;
+    QElapsedTimer       finished;   // guarded by the prewarmer's m_mutex, valid once chunksLeft is 0
+};
+
+class MyModelPrewarmer : public ModelPrewarmer { };
+Q_GLOBAL_STATIC(MyModelPrewarmer, modelPrewarmerInstance)
+ModelPrewarmer *ModelPrewarmer::globalInstance()
+{
+    return modelPrewarmerInstance();
+}
+
+ModelPrewarmer::ModelPrewarmer()
+{
+    m_pool.setObjectName("prewarm");
+    // the disk is the limit, a few readers with requests in flight keep it busy
+    m_pool.setMaxThreadCount(std::clamp(QThread::idealThreadCount() / 2, 1, 4));
+}
+
+ModelPrewarmer::~ModelPrewarmer()
+{
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+void ModelPrewarmer::prewarm(const QString &filePath)
+{
+    QMutexLocker locker(&m_mutex);
+    if (auto job = m_jobs.value(filePath)) {
+        if (!job->finished.isValid() || job->finished.elapsed() < PREWARM_FRESH_MS)
+            return; // in progress or still warm
+    }
+    start(filePath);
+}
+
+bool ModelPrewarmer::wait(const QString &filePath, const std::function<bool(float)> &progress)
+{
+    std::shared_ptr<Job> job;
+    {
+        QMutexLocker locker(&m_mutex);
+        job = m_jobs.value(filePath);
+        if (job && job->finished.isValid() && job->finished.elapsed() >= PREWARM_FRESH_MS)
+            job.reset();
+        if (!job && !(job = start(filePath)))
+            return false;
+    }
+
+    QMutexLocker locker(&job->mutex);
+    while (job->chunksLeft > 0) {
+        if (!progress(float(job->bytesDone) / float(job->size)))
+            return false;
+        job->done.wait(&job->mutex, QDeadlineTimer(100));
+    }
+    progress(1.f);
+    return true;
+}
+
+// Maps the file and queues its chunks to be warmed, called with m_mutex held.
+std::shared_ptr<ModelPrewarmer::Job> ModelPrewarmer::start(const QString &filePath)
+{
+    auto job = std::make_shared<Job>();
+    job->file.setFileName(filePath);
+    if (!job->file.open(QIODevice::ReadOnly)) {
+        qWarning() << "ERROR: Could not open model file to prewarm:" << filePath << job->file.errorString();
+        return nullptr;
+    }
+    job->size = job->file.size();
+    // warming more than fits in memory would only push out what was warmed first
+    if (job->size <= 0 || job->size > getSystemTotalRAMInBytes() / 2)
+        return nullptr;
+    job->data = job->file.map(0, job->size);
+    if (!job->data) {
+        qWarning() << "ERROR: Could not map model file to prewarm:" << filePath << job->file.errorString();
+        return nullptr;
+    }
+
+    job->chunksLeft = int((job->size + PREWARM_CHUNK_SIZE - 1) / PREWARM_CHUNK_SIZE);
+    m_jobs.insert(filePath, job);
+    // the pool runs them in order, so the file is read front to back by all of its threads
+    for (qint64 offset = 0; offset < job->size; offset += PREWARM_CHUNK_SIZE) {
+        qint64 size = std::min(PREWARM_CHUNK_SIZE, job->size - offset);
+        m_pool.start([this, job, offset, size] { warmRange(job, offset, size); });
+    }
+    return job;
+}
+
+void ModelPrewarmer::warmRange(const std::shared_ptr<Job> &job, qint64 offset, qint64 size)
+{
+    uchar *begin = job->data + offset;
+#ifdef Q_OS_UNIX
+    // have the kernel read the whole range ahead, touching it below then mostly waits for reads already in flight
+    madvise(begin, size_t(size), MADV_WILLNEED);
+    const qint64 pageSize = sysconf(_SC_PAGESIZE);
+#else
+    const qint64 pageSize = 4096;
+#endif
+    uchar sum = 0;
+    for (qint64 i = 0; i < size; i += pageSize)
+        sum += *static_cast<volatile uchar *>(begin + i);
+    Q_UNUSED(sum)
+    job->bytesDone += size;
+
+    QMutexLocker locker(&job->mutex);
+    if (--job->chunksLeft > 0)
+        return;
+    // the pages stay in the page cache for the model to map
+    job->file.unmap(job->data);
+    job->file.close();
+    job->data = nullptr;
+    {
+        QMutexLocker jobsLocker(&m_mutex);
+        job->finished.start();
+    }
+    job->done.wakeAll();
+}
@@ -0,0 +1,43 @@
+#ifndef MODELPREWARMER_H
+#define MODELPREWARMER_H
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QThreadPool>
+
+#include <functional>
+#include <memory>
+
+
+// Reads the weights of a model file into the page cache ahead of loading it, so that neither the load nor the first
+// prompt stalls on page faults one page at a time. The file is mapped, and its ranges are advised as needed and touched
+// by several threads at once.
+class ModelPrewarmer
+{
+public:
+    static ModelPrewarmer *globalInstance();
+
+    // Start warming the file in the background, unless it is already being warmed.
+    void prewarm(const QString &filePath);
+    // Warm the file if it is not being warmed yet, and block until it is done. progress is called on this thread with
+    // the fraction done, returning false stops waiting while the warming goes on. Returns whether the file is warm.
+    bool wait(const QString &filePath, const std::function<bool(float)> &progress);
+
+private:
+    struct Job;
+
+    ModelPrewarmer();
+    ~ModelPrewarmer();
+
+    std::shared_ptr<Job> start(const QString &filePath);
+    void warmRange(const std::shared_ptr<Job> &job, qint64 offset, qint64 size);
+
+    QThreadPool                          m_pool;
+    QMutex                               m_mutex;
+    QHash<QString, std::shared_ptr<Job>> m_jobs; // in progress, by file path
+
+    friend class MyModelPrewarmer;
+};
+
+#endif // MODELPREWARMER_H
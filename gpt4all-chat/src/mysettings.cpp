@@ -36,6 +36,7 @@
 static const QStringList suggestionModeNames { "LocalDocsOnly", "On", "Off" };
 static const QStringList chatThemeNames      { "Light", "Dark", "LegacyDark" };
 static const QStringList fontSizeNames       { "Small", "Medium", "Large" };
+static const QStringList vectorStorageNames  { "Float32", "Int8", "Binary" };
 
 // psuedo-enum
 namespace ModelSettingsKey { namespace {
@@ -63,8 +64,13 @@ static const QVariantMap basicDefaults {
     { "networkPort",              4891, },
     { "systemTray",               false },
     { "serverChat",               false },
+    { "saveChatsContext",         false },
+    { "prewarmModels",            false },
+    { "repackWeights",            false },
     { "userDefaultModel",         "Application default" },
     { "suggestionMode",           QVariant::fromValue(SuggestionMode::LocalDocsOnly) },
+    { "prefixCacheSize",          512 },
+    { "modelMemoryBudget",        0 },
     { "localdocs/chunkSize",      512 },
     { "localdocs/retrievalSize",  3 },
     { "localdocs/showReferences", true },
@@ -72,6 +78,7 @@ static const QVariantMap basicDefaults {
     { "localdocs/useRemoteEmbed", false },
     { "localdocs/nomicAPIKey",    "" },
     { "localdocs/embedDevice",    "Auto" },
+    { "localdocs/vectorStorage",  QVariant::fromValue(VectorStorage::Float32) },
     { "network/attribution",      "" },
 };
 
@@ -238,6 +245,8 @@ void MySettings::restoreModelDefaults(const ModelInfo &info)
     setModelGpuLayers(info, info.m_gpuLayers);
     setModelRepeatPenalty(info, info.m_repeatPenalty);
     setModelRepeatPenaltyTokens(info, info.m_repeatPenaltyTokens);
+    setModelDraftModel(info, info.m_draftModel);
+    setModelDraftTokens(info, info.m_draftTokens);
     resetModelChatTemplate (info);
     resetModelSystemMessage(info);
     setModelChatNamePrompt(info, info.m_chatNamePrompt);
@@ -252,11 +261,16 @@ void MySettings::restoreApplicationDefaults()
     setThreadCount(defaults::threadCount);
     setSystemTray(basicDefaults.value("systemTray").toBool());
     setServerChat(basicDefaults.value("serverChat").toBool());
+    setSaveChatsContext(basicDefaults.value("saveChatsContext").toBool());
+    setPrewarmModels(basicDefaults.value("prewarmModels").toBool());
+    setRepackWeights(basicDefaults.value("repackWeights").toBool());
     setNetworkPort(basicDefaults.value("networkPort").toInt());
     setModelPath(defaultLocalModelsPath());
     setUserDefaultModel(basicDefaults.value("userDefaultModel").toString());
     setForceMetal(defaults::forceMetal);
     setSuggestionMode(basicDefaults.value("suggestionMode").value<SuggestionMode>());
+    setPrefixCacheSize(basicDefaults.value("prefixCacheSize").toInt());
+    setModelMemoryBudget(basicDefaults.value("modelMemoryBudget").toInt());
     setLanguageAndLocale(defaults::languageAndLocale);
 }
 
@@ -269,6 +283,7 @@ void MySettings::restoreLocalDocsDefaults()
     setLocalDocsUseRemoteEmbed(basicDefaults.value("localdocs/useRemoteEmbed").toBool());
     setLocalDocsNomicAPIKey(basicDefaults.value("localdocs/nomicAPIKey").toString());
     setLocalDocsEmbedDevice(basicDefaults.value("localdocs/embedDevice").toString());
+    setLocalDocsVectorStorage(basicDefaults.value("localdocs/vectorStorage").value<VectorStorage>());
 }
 
 void MySettings::eraseModel(const ModelInfo &info)
@@ -348,6 +363,8 @@ int       MySettings::modelContextLength          (const ModelInfo &info) const
 int       MySettings::modelGpuLayers              (const ModelInfo &info) const { return getModelSetting("gpuLayers",               info).toInt(); }
 double    MySettings::modelRepeatPenalty          (const ModelInfo &info) const { return getModelSetting("repeatPenalty",           info).toDouble(); }
 int       MySettings::modelRepeatPenaltyTokens    (const ModelInfo &info) const { return getModelSetting("repeatPenaltyTokens",     info).toInt(); }
+QString   MySettings::modelDraftModel             (const ModelInfo &info) const { return getModelSetting("draftModel",              info).toString(); }
+int       MySettings::modelDraftTokens            (const ModelInfo &info) const { return getModelSetting("draftTokens",             info).toInt(); }
 QString   MySettings::modelChatNamePrompt         (const ModelInfo &info) const { return getModelSetting("chatNamePrompt",          info).toString(); }
 QString   MySettings::modelSuggestedFollowUpPrompt(const ModelInfo &info) const { return getModelSetting("suggestedFollowUpPrompt", info).toString(); }
 
@@ -510,6 +527,16 @@ void MySettings::setModelRepeatPenaltyTokens(const ModelInfo &info, int value, b
     setModelSetting("repeatPenaltyTokens", info, value, force, true);
 }
 
+void MySettings::setModelDraftModel(const ModelInfo &info, const QString &value, bool force)
+{
+    setModelSetting("draftModel", info, value, force, true);
+}
+
+void MySettings::setModelDraftTokens(const ModelInfo &info, int value, bool force)
+{
+    setModelSetting("draftTokens", info, value, force, true);
+}
+
 bool MySettings::setUpgradeableModelSetting(
     const ModelInfo &info, const QString &value, QLatin1String legacyKey, QLatin1String newKey
 ) {
@@ -618,9 +645,14 @@ void MySettings::setThreadCount(int value)
 
 bool        MySettings::systemTray() const              { return getBasicSetting("systemTray"              ).toBool(); }
 bool        MySettings::serverChat() const              { return getBasicSetting("serverChat"              ).toBool(); }
+bool        MySettings::saveChatsContext() const        { return getBasicSetting("saveChatsContext"        ).toBool(); }
+bool        MySettings::prewarmModels() const           { return getBasicSetting("prewarmModels"           ).toBool(); }
+bool        MySettings::repackWeights() const           { return getBasicSetting("repackWeights"           ).toBool(); }
 int         MySettings::networkPort() const             { return getBasicSetting("networkPort"             ).toInt(); }
 QString     MySettings::userDefaultModel() const        { return getBasicSetting("userDefaultModel"        ).toString(); }
 QString     MySettings::lastVersionStarted() const      { return getBasicSetting("lastVersionStarted"      ).toString(); }
+int         MySettings::prefixCacheSize() const         { return getBasicSetting("prefixCacheSize"         ).toInt(); }
+int         MySettings::modelMemoryBudget() const       { return getBasicSetting("modelMemoryBudget"       ).toInt(); }
 int         MySettings::localDocsChunkSize() const      { return getBasicSetting("localdocs/chunkSize"     ).toInt(); }
 int         MySettings::localDocsRetrievalSize() const  { return getBasicSetting("localdocs/retrievalSize" ).toInt(); }
 bool        MySettings::localDocsShowReferences() const { return getBasicSetting("localdocs/showReferences").toBool(); }
@@ -633,12 +665,19 @@ QString     MySettings::networkAttribution() const      { return getBasicSetting
 ChatTheme      MySettings::chatTheme() const      { return ChatTheme     (getEnumSetting("chatTheme", chatThemeNames)); }
 FontSize       MySettings::fontSize() const       { return FontSize      (getEnumSetting("fontSize",  fontSizeNames)); }
 SuggestionMode MySettings::suggestionMode() const { return SuggestionMode(getEnumSetting("suggestionMode", suggestionModeNames)); }
+VectorStorage  MySettings::localDocsVectorStorage() const
+    { return VectorStorage(getEnumSetting("localdocs/vectorStorage", vectorStorageNames)); }
 
 void MySettings::setSystemTray(bool value)                            { setBasicSetting("systemTray",               value); }
 void MySettings::setServerChat(bool value)                            { setBasicSetting("serverChat",               value); }
+void MySettings::setSaveChatsContext(bool value)                      { setBasicSetting("saveChatsContext",         value); }
+void MySettings::setPrewarmModels(bool value)                         { setBasicSetting("prewarmModels",            value); }
+void MySettings::setRepackWeights(bool value)                         { setBasicSetting("repackWeights",            value); }
 void MySettings::setNetworkPort(int value)                            { setBasicSetting("networkPort",              value); }
 void MySettings::setUserDefaultModel(const QString &value)            { setBasicSetting("userDefaultModel",         value); }
 void MySettings::setLastVersionStarted(const QString &value)          { setBasicSetting("lastVersionStarted",       value); }
+void MySettings::setPrefixCacheSize(int value)                        { setBasicSetting("prefixCacheSize",          value); }
+void MySettings::setModelMemoryBudget(int value)                      { setBasicSetting("modelMemoryBudget",        value); }
 void MySettings::setLocalDocsChunkSize(int value)                     { setBasicSetting("localdocs/chunkSize",      value, "localDocsChunkSize"); }
 void MySettings::setLocalDocsRetrievalSize(int value)                 { setBasicSetting("localdocs/retrievalSize",  value, "localDocsRetrievalSize"); }
 void MySettings::setLocalDocsShowReferences(bool value)               { setBasicSetting("localdocs/showReferences", value, "localDocsShowReferences"); }
@@ -651,6 +690,8 @@ void MySettings::setNetworkAttribution(const QString &value)          { setBasic
 void MySettings::setChatTheme(ChatTheme value)           { setBasicSetting("chatTheme",      chatThemeNames     .value(int(value))); }
 void MySettings::setFontSize(FontSize value)             { setBasicSetting("fontSize",       fontSizeNames      .value(int(value))); }
 void MySettings::setSuggestionMode(SuggestionMode value) { setBasicSetting("suggestionMode", suggestionModeNames.value(int(value))); }
+void MySettings::setLocalDocsVectorStorage(VectorStorage value)
+    { setBasicSetting("localdocs/vectorStorage", vectorStorageNames.value(int(value)), "localDocsVectorStorage"); }
 
 QString MySettings::modelPath()
 {
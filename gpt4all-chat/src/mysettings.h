@@ -48,6 +48,14 @@ namespace MySettingsEnums {
         Large  = 2,
     };
     Q_ENUM_NS(FontSize)
+
+    // NOTE: values match EmbeddingIndex::Quantization, and are used as indices in LocalDocsSettings.qml
+    enum class VectorStorage {
+        Float32 = 0,
+        Int8    = 1,
+        Binary  = 2,
+    };
+    Q_ENUM_NS(VectorStorage)
 }
 using namespace MySettingsEnums;
 
@@ -57,6 +65,9 @@ class MySettings : public QObject
     Q_PROPERTY(int threadCount READ threadCount WRITE setThreadCount NOTIFY threadCountChanged)
     Q_PROPERTY(bool systemTray READ systemTray WRITE setSystemTray NOTIFY systemTrayChanged)
     Q_PROPERTY(bool serverChat READ serverChat WRITE setServerChat NOTIFY serverChatChanged)
+    Q_PROPERTY(bool saveChatsContext READ saveChatsContext WRITE setSaveChatsContext NOTIFY saveChatsContextChanged)
+    Q_PROPERTY(bool prewarmModels READ prewarmModels WRITE setPrewarmModels NOTIFY prewarmModelsChanged)
+    Q_PROPERTY(bool repackWeights READ repackWeights WRITE setRepackWeights NOTIFY repackWeightsChanged)
     Q_PROPERTY(QString modelPath READ modelPath WRITE setModelPath NOTIFY modelPathChanged)
     Q_PROPERTY(QString userDefaultModel READ userDefaultModel WRITE setUserDefaultModel NOTIFY userDefaultModelChanged)
     Q_PROPERTY(ChatTheme chatTheme READ chatTheme WRITE setChatTheme NOTIFY chatThemeChanged)
@@ -71,6 +82,7 @@ class MySettings : public QObject
     Q_PROPERTY(bool localDocsUseRemoteEmbed READ localDocsUseRemoteEmbed WRITE setLocalDocsUseRemoteEmbed NOTIFY localDocsUseRemoteEmbedChanged)
     Q_PROPERTY(QString localDocsNomicAPIKey READ localDocsNomicAPIKey WRITE setLocalDocsNomicAPIKey NOTIFY localDocsNomicAPIKeyChanged)
     Q_PROPERTY(QString localDocsEmbedDevice READ localDocsEmbedDevice WRITE setLocalDocsEmbedDevice NOTIFY localDocsEmbedDeviceChanged)
+    Q_PROPERTY(VectorStorage localDocsVectorStorage READ localDocsVectorStorage WRITE setLocalDocsVectorStorage NOTIFY localDocsVectorStorageChanged)
     Q_PROPERTY(QString networkAttribution READ networkAttribution WRITE setNetworkAttribution NOTIFY networkAttributionChanged)
     Q_PROPERTY(bool networkIsActive READ networkIsActive WRITE setNetworkIsActive NOTIFY networkIsActiveChanged)
     Q_PROPERTY(bool networkUsageStatsActive READ networkUsageStatsActive WRITE setNetworkUsageStatsActive NOTIFY networkUsageStatsActiveChanged)
@@ -78,6 +90,8 @@ class MySettings : public QObject
     Q_PROPERTY(QStringList deviceList MEMBER m_deviceList CONSTANT)
     Q_PROPERTY(QStringList embeddingsDeviceList MEMBER m_embeddingsDeviceList CONSTANT)
     Q_PROPERTY(int networkPort READ networkPort WRITE setNetworkPort NOTIFY networkPortChanged)
+    Q_PROPERTY(int prefixCacheSize READ prefixCacheSize WRITE setPrefixCacheSize NOTIFY prefixCacheSizeChanged)
+    Q_PROPERTY(int modelMemoryBudget READ modelMemoryBudget WRITE setModelMemoryBudget NOTIFY modelMemoryBudgetChanged)
     Q_PROPERTY(SuggestionMode suggestionMode READ suggestionMode WRITE setSuggestionMode NOTIFY suggestionModeChanged)
     Q_PROPERTY(QStringList uiLanguages MEMBER m_uiLanguages CONSTANT)
 
@@ -140,6 +154,10 @@ public:
     Q_INVOKABLE void setModelRepeatPenalty(const ModelInfo &info, double value, bool force = false);
     int modelRepeatPenaltyTokens(const ModelInfo &info) const;
     Q_INVOKABLE void setModelRepeatPenaltyTokens(const ModelInfo &info, int value, bool force = false);
+    QString modelDraftModel(const ModelInfo &info) const;
+    Q_INVOKABLE void setModelDraftModel(const ModelInfo &info, const QString &value, bool force = false);
+    int modelDraftTokens(const ModelInfo &info) const;
+    Q_INVOKABLE void setModelDraftTokens(const ModelInfo &info, int value, bool force = false);
     auto modelChatTemplate(const ModelInfo &info) const -> UpgradeableSetting;
     Q_INVOKABLE bool isModelChatTemplateSet(const ModelInfo &info) const;
     Q_INVOKABLE void setModelChatTemplate(const ModelInfo &info, const QString &value);
@@ -164,6 +182,12 @@ public:
     void setSystemTray(bool value);
     bool serverChat() const;
     void setServerChat(bool value);
+    bool saveChatsContext() const;
+    void setSaveChatsContext(bool value);
+    bool prewarmModels() const; // read model files into the page cache ahead of loading them
+    void setPrewarmModels(bool value);
+    bool repackWeights() const; // load Q4_0 models repacked for the CPU kernels when running on the CPU
+    void setRepackWeights(bool value);
     QString modelPath();
     void setModelPath(const QString &value);
     QString userDefaultModel() const;
@@ -182,6 +206,10 @@ public:
     void setGpuLayers(int32_t value);
     SuggestionMode suggestionMode() const;
     void setSuggestionMode(SuggestionMode value);
+    int prefixCacheSize() const; // MiB
+    void setPrefixCacheSize(int value);
+    int modelMemoryBudget() const; // MiB for the models kept loaded, 0 for half of the system RAM
+    void setModelMemoryBudget(int value);
 
     QString languageAndLocale() const;
     void setLanguageAndLocale(const QString &bcp47Name = QString()); // called on startup with QString()
@@ -205,6 +233,8 @@ public:
     void setLocalDocsNomicAPIKey(const QString &value);
     QString localDocsEmbedDevice() const;
     void setLocalDocsEmbedDevice(const QString &value);
+    VectorStorage localDocsVectorStorage() const;
+    void setLocalDocsVectorStorage(VectorStorage value);
 
     // Network settings
     QString networkAttribution() const;
@@ -232,6 +262,8 @@ Q_SIGNALS:
     void gpuLayersChanged(const ModelInfo &info);
     void repeatPenaltyChanged(const ModelInfo &info);
     void repeatPenaltyTokensChanged(const ModelInfo &info);
+    void draftModelChanged(const ModelInfo &info);
+    void draftTokensChanged(const ModelInfo &info);
     void chatTemplateChanged(const ModelInfo &info, bool fromInfo = false);
     void systemMessageChanged(const ModelInfo &info, bool fromInfo = false);
     void chatNamePromptChanged(const ModelInfo &info);
@@ -239,6 +271,9 @@ Q_SIGNALS:
     void threadCountChanged();
     void systemTrayChanged();
     void serverChatChanged();
+    void saveChatsContextChanged();
+    void prewarmModelsChanged();
+    void repackWeightsChanged();
     void modelPathChanged();
     void userDefaultModelChanged();
     void chatThemeChanged();
@@ -252,6 +287,7 @@ Q_SIGNALS:
     void localDocsUseRemoteEmbedChanged();
     void localDocsNomicAPIKeyChanged();
     void localDocsEmbedDeviceChanged();
+    void localDocsVectorStorageChanged();
     void networkAttributionChanged();
     void networkIsActiveChanged();
     void networkPortChanged();
@@ -259,6 +295,8 @@ Q_SIGNALS:
     void attemptModelLoadChanged();
     void deviceChanged();
     void suggestionModeChanged();
+    void prefixCacheSizeChanged();
+    void modelMemoryBudgetChanged();
     void languageAndLocaleChanged();
 
 private:
@@ -1,86 +1,1297 @@
-// Qt 6.2 compatibility stub implementation for server.cpp
-// QHttpServer not available in Qt 6.2, so HTTP server functionality is disabled
-
 #include "server.h"
+
 #include "chat.h"
-#include "chatapi.h"
-#include "chatllm.h"
-#include "database.h"
-#include "localdocs.h"
+#include "chatmodel.h"
+#include "modellist.h"
 #include "mysettings.h"
+#include "utils.h" // IWYU pragma: keep
 
+#include <fmt/format.h>
+#include <gpt4all-backend/llmodel.h>
+
+#include <QByteArray>
+#include <QCborArray>
+#include <QCborMap>
+#include <QCborValue>
+#include <QDateTime>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QJsonArray>
+#include <QJsonDocument>
 #include <QJsonObject>
-#include <QTimer>
+#include <QJsonValue>
+#include <QLatin1String>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QPair> // IWYU pragma: keep
+#include <QUuid>
+#include <QVariant>
+#include <Qt>
+#include <QtCborCommon>
+#include <QtGlobal>
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std::string_literals;
+
+//#define DEBUG
+
+// admission control for the model
+static constexpr qsizetype MAX_QUEUED_REQUESTS     = 32;
+static constexpr int       MAX_REQUESTS_PER_CLIENT = 2; // waiting and running
+
+namespace {
+
+class InvalidRequestError: public std::invalid_argument {
+    using std::invalid_argument::invalid_argument;
+
+public:
+    HttpResponse asResponse() const
+    {
+        QJsonObject error {
+            { "message", what(),                  },
+            { "type",    "invalid_request_error", },
+            { "param",   QJsonValue::Null         },
+            { "code",    QJsonValue::Null         },
+        };
+        return { QJsonObject {{ "error", error }}, 400 };
+    }
+
+private:
+    Q_DISABLE_COPY_MOVE(InvalidRequestError)
+};
+
+} // namespace
 
-// Stub classes for request types
-class CompletionRequest {
+static inline QJsonObject modelToJson(const ModelInfo &info)
+{
+    QJsonObject model;
+    model.insert("id", info.name());
+    model.insert("object", "model");
+    model.insert("created", 0);
+    model.insert("owned_by", "humanity");
+    model.insert("root", info.name());
+    model.insert("parent", QJsonValue::Null);
+
+    QJsonArray permissions;
+    QJsonObject permissionObj;
+    permissionObj.insert("id", "placeholder");
+    permissionObj.insert("object", "model_permission");
+    permissionObj.insert("created", 0);
+    permissionObj.insert("allow_create_engine", false);
+    permissionObj.insert("allow_sampling", false);
+    permissionObj.insert("allow_logprobs", false);
+    permissionObj.insert("allow_search_indices", false);
+    permissionObj.insert("allow_view", true);
+    permissionObj.insert("allow_fine_tuning", false);
+    permissionObj.insert("organization", "*");
+    permissionObj.insert("group", QJsonValue::Null);
+    permissionObj.insert("is_blocking", false);
+    permissions.append(permissionObj);
+    model.insert("permissions", permissions);
+    return model;
+}
+
+static inline QJsonObject resultToJson(const ResultInfo &info)
+{
+    QJsonObject result;
+    result.insert("file", info.file);
+    result.insert("title", info.title);
+    result.insert("author", info.author);
+    result.insert("date", info.date);
+    result.insert("text", info.text);
+    result.insert("page", info.page);
+    result.insert("from", info.from);
+    result.insert("to", info.to);
+    return result;
+}
+
+static QJsonObject errorObject(const QString &message, const char *type, const char *code = nullptr)
+{
+    QJsonObject error {
+        { "message", message                                    },
+        { "type",    type                                       },
+        { "param",   QJsonValue::Null                           },
+        { "code",    code ? QJsonValue(code) : QJsonValue::Null },
+    };
+    return { { "error", error } };
+}
+
+static HttpResponse errorResponse(const QString &message, int status, const char *type = "invalid_request_error",
+                                  const char *code = nullptr)
+{
+    return { errorObject(message, type, code), status };
+}
+
+class BaseCompletionRequest {
 public:
-    static CompletionRequest fromJson(const QByteArray &) { return CompletionRequest(); }
+    QString model; // required
+    // NB: some parameters are not supported yet
+    int32_t max_tokens = 16;
+    qint64 n = 1;
+    float temperature = 1.f;
+    float top_p = 1.f;
+    float min_p = 0.f;
+    std::vector<std::string> stop;
+    bool stream = false;
+    bool includeUsage = false; // in the last chunk of a stream
+
+    BaseCompletionRequest() = default;
+    virtual ~BaseCompletionRequest() = default;
+
+    virtual BaseCompletionRequest &parse(QCborMap request)
+    {
+        parseImpl(request);
+        if (!request.isEmpty())
+            throw InvalidRequestError(fmt::format(
+                "Unrecognized request argument supplied: {}", request.keys().constFirst().toString()
+            ));
+        return *this;
+    }
+
+protected:
+    virtual void parseImpl(QCborMap &request)
+    {
+        using enum Type;
+
+        auto reqValue = [&request](auto &&...args) { return takeValue(request, args...); };
+        QCborValue value;
+
+        this->model = reqValue("model", String, /*required*/ true).toString();
+
+        value = reqValue("frequency_penalty", Number, false, /*min*/ -2, /*max*/ 2);
+        if (value.isDouble() || value.toInteger() != 0)
+            throw InvalidRequestError("'frequency_penalty' is not supported");
+
+        value = reqValue("max_tokens", Integer, false, /*min*/ 1);
+        if (!value.isNull())
+            this->max_tokens = int32_t(qMin(value.toInteger(), INT32_MAX));
+
+        value = reqValue("n", Integer, false, /*min*/ 1);
+        if (!value.isNull())
+            this->n = value.toInteger();
+
+        value = reqValue("presence_penalty", Number);
+        if (value.isDouble() || value.toInteger() != 0)
+            throw InvalidRequestError("'presence_penalty' is not supported");
+
+        value = reqValue("seed", Integer);
+        if (!value.isNull())
+            throw InvalidRequestError("'seed' is not supported");
+
+        value = reqValue("stop");
+        if (value.isString()) {
+            this->stop = { value.toString().toStdString() };
+        } else if (value.isArray()) {
+            QCborArray arr = value.toArray();
+            if (arr.size() > 4)
+                throw InvalidRequestError("'stop' may contain at most 4 sequences");
+            for (const auto &elem : arr) {
+                if (!elem.isString())
+                    throw InvalidRequestError(fmt::format("'{}' is not of type 'string' - 'stop'", elem.toVariant()));
+                this->stop.push_back(elem.toString().toStdString());
+            }
+        } else if (!value.isNull()) {
+            throw InvalidRequestError(fmt::format("'{}' is not of type 'string' or 'array' - 'stop'",
+                                                  value.toVariant()));
+        }
+
+        value = reqValue("stream", Boolean);
+        this->stream = value.isTrue();
+
+        value = reqValue("stream_options", Object);
+        if (!value.isNull()) {
+            if (!this->stream)
+                throw InvalidRequestError("The 'stream_options' parameter is only allowed when 'stream' is enabled.");
+            QCborMap options = value.toMap();
+            this->includeUsage = takeValue(options, "include_usage", Boolean).isTrue();
+            if (!options.isEmpty())
+                throw InvalidRequestError(fmt::format(
+                    "Invalid 'stream_options': unrecognized key: '{}'", options.keys().constFirst().toString()
+                ));
+        }
+
+        value = reqValue("temperature", Number, false, /*min*/ 0, /*max*/ 2);
+        if (!value.isNull())
+            this->temperature = float(value.toDouble());
+
+        value = reqValue("top_p", Number, false, /*min*/ 0, /*max*/ 1);
+        if (!value.isNull())
+            this->top_p = float(value.toDouble());
+
+        value = reqValue("min_p", Number, false, /*min*/ 0, /*max*/ 1);
+        if (!value.isNull())
+            this->min_p = float(value.toDouble());
+
+        reqValue("user", String); // validate but don't use
+    }
+
+    enum class Type : uint8_t {
+        Boolean,
+        Integer,
+        Number,
+        String,
+        Array,
+        Object,
+    };
+
+    static const std::unordered_map<Type, const char *> s_typeNames;
+
+    static bool typeMatches(const QCborValue &value, Type type) noexcept {
+        using enum Type;
+        switch (type) {
+            case Boolean: return value.isBool();
+            case Integer: return value.isInteger();
+            case Number:  return value.isInteger() || value.isDouble();
+            case String:  return value.isString();
+            case Array:   return value.isArray();
+            case Object:  return value.isMap();
+        }
+        Q_UNREACHABLE();
+    }
+
+    static QCborValue takeValue(
+        QCborMap &obj, const char *key, std::optional<Type> type = {}, bool required = false,
+        std::optional<qint64> min = {}, std::optional<qint64> max = {}
+    ) {
+        auto value = obj.take(QLatin1String(key));
+        if (value.isUndefined())
+            value = QCborValue(QCborSimpleType::Null);
+        if (required && value.isNull())
+            throw InvalidRequestError(fmt::format("you must provide a {} parameter", key));
+        if (type && !value.isNull() && !typeMatches(value, *type))
+            throw InvalidRequestError(fmt::format("'{}' is not of type '{}' - '{}'",
+                                                  value.toVariant(), s_typeNames.at(*type), key));
+        if (!value.isNull()) {
+            double num = value.toDouble();
+            if (min && num < double(*min))
+                throw InvalidRequestError(fmt::format("{} is less than the minimum of {} - '{}'", num, *min, key));
+            if (max && num > double(*max))
+                throw InvalidRequestError(fmt::format("{} is greater than the maximum of {} - '{}'", num, *max, key));
+        }
+        return value;
+    }
+
+private:
+    Q_DISABLE_COPY_MOVE(BaseCompletionRequest)
+};
+
+class CompletionRequest : public BaseCompletionRequest {
+public:
+    QString prompt; // required
+    // some parameters are not supported yet - these ones are
+    bool echo = false;
+
+    CompletionRequest &parse(QCborMap request) override
+    {
+        BaseCompletionRequest::parse(std::move(request));
+        return *this;
+    }
+
+protected:
+    void parseImpl(QCborMap &request) override
+    {
+        using enum Type;
+
+        auto reqValue = [&request](auto &&...args) { return takeValue(request, args...); };
+        QCborValue value;
+
+        BaseCompletionRequest::parseImpl(request);
+
+        this->prompt = reqValue("prompt", String, /*required*/ true).toString();
+
+        value = reqValue("best_of", Integer);
+        {
+            qint64 bof = value.toInteger(1);
+            if (this->n > bof)
+                throw InvalidRequestError(fmt::format(
+                    "You requested that the server return more choices than it will generate (HINT: you must set 'n' "
+                    "(currently {}) to be at most 'best_of' (currently {}), or omit either parameter if you don't "
+                    "specifically want to use them.)",
+                    this->n, bof
+                ));
+            if (bof > this->n)
+                throw InvalidRequestError("'best_of' is not supported");
+        }
+
+        value = reqValue("echo", Boolean);
+        if (value.isBool())
+            this->echo = value.toBool();
+
+        // we don't bother deeply typechecking unsupported subobjects for now
+        value = reqValue("logit_bias", Object);
+        if (!value.isNull())
+            throw InvalidRequestError("'logit_bias' is not supported");
+
+        value = reqValue("logprobs", Integer, false, /*min*/ 0);
+        if (!value.isNull())
+            throw InvalidRequestError("'logprobs' is not supported");
+
+        value = reqValue("suffix", String);
+        if (!value.isNull() && !value.toString().isEmpty())
+            throw InvalidRequestError("'suffix' is not supported");
+    }
 };
 
-class ChatRequest {
+const std::unordered_map<BaseCompletionRequest::Type, const char *> BaseCompletionRequest::s_typeNames = {
+    { BaseCompletionRequest::Type::Boolean, "boolean" },
+    { BaseCompletionRequest::Type::Integer, "integer" },
+    { BaseCompletionRequest::Type::Number,  "number"  },
+    { BaseCompletionRequest::Type::String,  "string"  },
+    { BaseCompletionRequest::Type::Array,   "array"   },
+    { BaseCompletionRequest::Type::Object,  "object"  },
+};
+
+class ChatRequest : public BaseCompletionRequest {
 public:
-    static ChatRequest fromJson(const QByteArray &) { return ChatRequest(); }
+    struct Message {
+        enum class Role { System, User, Assistant };
+        Role    role;
+        QString content;
+    };
+
+    QList<Message> messages; // required
+    RetrievalFilter localdocsFilter; // narrows the LocalDocs collections of the server chat, if it has any
+
+    ChatRequest &parse(QCborMap request) override
+    {
+        BaseCompletionRequest::parse(std::move(request));
+        return *this;
+    }
+
+protected:
+    void parseImpl(QCborMap &request) override
+    {
+        using enum Type;
+
+        auto reqValue = [&request](auto &&...args) { return takeValue(request, args...); };
+        QCborValue value;
+
+        BaseCompletionRequest::parseImpl(request);
+
+        value = reqValue("messages", std::nullopt, /*required*/ true);
+        if (!value.isArray() || value.toArray().isEmpty())
+            throw InvalidRequestError(fmt::format(
+                "Invalid type for 'messages': expected a non-empty array of objects, but got '{}' instead.",
+                value.toVariant()
+            ));
+
+        this->messages.clear();
+        {
+            QCborArray arr = value.toArray();
+            for (qsizetype i = 0; i < arr.size(); i++) {
+                const auto &elem = arr[i];
+                if (!elem.isMap())
+                    throw InvalidRequestError(fmt::format(
+                        "Invalid type for 'messages[{}]': expected an object, but got '{}' instead.",
+                        i, elem.toVariant()
+                    ));
+                QCborMap msg = elem.toMap();
+                Message res;
+                QString role = takeValue(msg, "role", String, /*required*/ true).toString();
+                if (role == QLatin1String("system")) {
+                    res.role = Message::Role::System;
+                } else if (role == QLatin1String("user")) {
+                    res.role = Message::Role::User;
+                } else if (role == QLatin1String("assistant")) {
+                    res.role = Message::Role::Assistant;
+                } else {
+                    throw InvalidRequestError(fmt::format(
+                        "Invalid 'messages[{}].role': expected one of 'system', 'assistant', or 'user', but got '{}'"
+                        " instead.",
+                        i, role.toStdString()
+                    ));
+                }
+                res.content = takeValue(msg, "content", String, /*required*/ true).toString();
+                this->messages.append(res);
+
+                if (!msg.isEmpty())
+                    throw InvalidRequestError(fmt::format(
+                        "Invalid 'messages[{}]': unrecognized key: '{}'", i, msg.keys().constFirst().toString()
+                    ));
+            }
+        }
+
+        // we don't bother deeply typechecking unsupported subobjects for now
+        value = reqValue("logit_bias", Object);
+        if (!value.isNull())
+            throw InvalidRequestError("'logit_bias' is not supported");
+
+        value = reqValue("logprobs", Boolean);
+        if (value.isTrue())
+            throw InvalidRequestError("'logprobs' is not supported");
+
+        value = reqValue("top_logprobs", Integer, false, /*min*/ 0);
+        if (!value.isNull())
+            throw InvalidRequestError("The 'top_logprobs' parameter is only allowed when 'logprobs' is enabled.");
+
+        value = reqValue("response_format", Object);
+        if (!value.isNull())
+            throw InvalidRequestError("'response_format' is not supported");
+
+        reqValue("service_tier", String); // validate but don't use
+
+        value = reqValue("tools", Array);
+        if (!value.isNull())
+            throw InvalidRequestError("'tools' is not supported");
+
+        value = reqValue("tool_choice");
+        if (!value.isNull())
+            throw InvalidRequestError("'tool_choice' is not supported");
+
+        // validate but don't use
+        reqValue("parallel_tool_calls", Boolean);
+
+        value = reqValue("function_call");
+        if (!value.isNull())
+            throw InvalidRequestError("'function_call' is not supported");
+
+        value = reqValue("functions", Array);
+        if (!value.isNull())
+            throw InvalidRequestError("'functions' is not supported");
+
+        value = reqValue("localdocs_filter", Object);
+        if (!value.isNull())
+            parseLocalDocsFilter(value.toMap());
+    }
+
+private:
+    // not part of the OpenAI API: {"extensions": ["pdf", ...], "from": "<ISO 8601>", "to": "<ISO 8601>"}
+    void parseLocalDocsFilter(QCborMap filter)
+    {
+        using enum Type;
+
+        QCborValue value = takeValue(filter, "extensions", Array);
+        for (const auto &elem : value.toArray()) {
+            if (!elem.isString())
+                throw InvalidRequestError(fmt::format("'{}' is not of type 'string' - 'localdocs_filter.extensions'",
+                                                      elem.toVariant()));
+            QString extension = elem.toString();
+            if (extension.startsWith('.'))
+                extension.remove(0, 1);
+            if (!extension.isEmpty())
+                this->localdocsFilter.extensions << extension;
+        }
+
+        auto parseTime = [&filter](const char *key) {
+            QCborValue value = takeValue(filter, key, String);
+            if (value.isNull())
+                return QDateTime();
+            QDateTime time = QDateTime::fromString(value.toString(), Qt::ISODate);
+            if (!time.isValid())
+                throw InvalidRequestError(fmt::format(
+                    "Invalid 'localdocs_filter.{}': expected an ISO 8601 date, but got '{}' instead.",
+                    key, value.toString()
+                ));
+            return time;
+        };
+        this->localdocsFilter.from = parseTime("from");
+        this->localdocsFilter.to   = parseTime("to");
+
+        if (!filter.isEmpty())
+            throw InvalidRequestError(fmt::format(
+                "Invalid 'localdocs_filter': unrecognized key: '{}'", filter.keys().constFirst().toString()
+            ));
+    }
 };
 
+template <typename T>
+T &parseRequest(T &request, QJsonObject &&obj)
+{
+    // lossless conversion to CBOR exposes more type information
+    return request.parse(QCborMap::fromJsonObject(obj));
+}
+
+static QJsonObject requestFromJson(const QByteArray &request)
+{
+    QJsonParseError err;
+    const QJsonDocument document = QJsonDocument::fromJson(request, &err);
+    if (err.error || !document.isObject())
+        throw InvalidRequestError(fmt::format(
+            "error parsing request JSON: {}",
+            err.error ? err.errorString().toStdString() : "not an object"s
+        ));
+    return document.object();
+}
+
+static LLModel::PromptContext makePromptContext(const BaseCompletionRequest &request, const ModelInfo &modelInfo)
+{
+    auto *mySettings = MySettings::globalInstance();
+    // FIXME(jared): taking parameters from the UI inhibits reproducibility of results
+    return {
+        .n_predict      = request.max_tokens,
+        .top_k          = mySettings->modelTopK(modelInfo),
+        .top_p          = request.top_p,
+        .min_p          = request.min_p,
+        .temp           = request.temperature,
+        .n_batch        = mySettings->modelPromptBatchSize(modelInfo),
+        .repeat_penalty = float(mySettings->modelRepeatPenalty(modelInfo)),
+        .repeat_last_n  = mySettings->modelRepeatPenaltyTokens(modelInfo),
+        .stopSequences  = request.stop,
+    };
+}
+
+static QJsonObject usageToJson(int promptTokens, int responseTokens)
+{
+    return {
+        { "prompt_tokens",     promptTokens                  },
+        { "completion_tokens", responseTokens                },
+        { "total_tokens",      promptTokens + responseTokens },
+    };
+}
+
+// One element of the "choices" of a stream chunk.
+static QJsonObject streamChoice(bool chat, int index, const QString &text, const QJsonValue &finishReason,
+                                bool withRole = false)
+{
+    QJsonObject choice { { "index", index } };
+    if (chat) {
+        QJsonObject delta;
+        if (withRole)
+            delta.insert("role", "assistant");
+        if (withRole || !text.isEmpty())
+            delta.insert("content", text);
+        choice.insert("delta", delta);
+    } else {
+        choice.insert("text", text);
+    }
+    choice.insert("logprobs", QJsonValue::Null);
+    choice.insert("finish_reason", finishReason);
+    return choice;
+}
+
+static void writeStreamChunk(HttpResponder &responder, QJsonObject chunk, QJsonArray choices,
+                             const std::optional<QJsonObject> &usage = std::nullopt)
+{
+    chunk.insert("choices", choices);
+    if (usage)
+        chunk.insert("usage", *usage);
+    responder.writeEvent(QJsonDocument(chunk).toJson(QJsonDocument::Compact));
+}
+
+// The response of one choice generated in a batch with other requests, see Server::runBatch.
+struct BatchedResponse {
+    HttpResponder  responder;
+    QJsonObject    chunkTemplate;
+    bool           chat;
+    bool           stream;
+    QStringDecoder decoder { QStringDecoder::Utf8 };
+    QByteArray     response;       // raw UTF-8
+    int            promptTokens   = 0;
+    int            responseTokens = 0;
+};
+
+// Sets up a prompt for promptParallel that streams its response if asked to, done is called with it once complete.
+static LLModel::ParallelPrompt batchedPrompt(std::string prompt, const LLModel::PromptContext &ctx,
+                                             std::shared_ptr<BatchedResponse> state,
+                                             std::function<void(BatchedResponse &)> done)
+{
+    LLModel::ParallelPrompt result { .prompt = std::move(prompt), .ctx = ctx };
+    result.promptCallback = [state](std::span<const LLModel::Token> batch, bool cached) {
+        Q_UNUSED(cached)
+        state->promptTokens += batch.size();
+        return state->responder.isOpen();
+    };
+    result.responseCallback = [state](LLModel::Token token, std::string_view piece) {
+        Q_UNUSED(token)
+        state->response.append(piece.data(), piece.size());
+        ++state->responseTokens;
+        if (state->stream) {
+            // a token can end within a character, the decoder keeps that part for the next one
+            QString text = state->decoder.decode(QByteArrayView(piece.data(), piece.size()));
+            if (!text.isEmpty())
+                writeStreamChunk(state->responder, state->chunkTemplate,
+                                 { streamChoice(state->chat, 0, text, QJsonValue::Null) });
+        }
+        return state->responder.isOpen();
+    };
+    result.finished = [state, done = std::move(done)] { done(*state); };
+    return result;
+}
+
+// Clients are told apart by the API key they send, as the server only listens on localhost and their addresses are the
+// same. This is best-effort: the key is not checked, so a client can spread its requests over several of them. Without
+// one each connection counts as a client of its own.
+static QByteArray clientKey(const HttpRequest &request)
+{
+    QByteArray key = request.header("authorization");
+    if (!key.isEmpty())
+        return "key:" + key;
+    return "peer:" + request.peer.toString().toUtf8() + ':' + QByteArray::number(request.peerPort);
+}
+
+// Once a stream has begun its status can no longer change, so the error is sent as the last event instead.
+static void failRequest(HttpResponder &responder, bool streaming, const QString &message)
+{
+    if (!streaming)
+        return responder.respond(errorResponse(message, 500, "server_error"));
+    responder.writeEvent(QJsonDocument(errorObject(message, "server_error")).toJson(QJsonDocument::Compact));
+    responder.end();
+}
+
+static QJsonObject completionTemplate(const ModelInfo &modelInfo)
+{
+    return {
+        { "id",      "cmpl-" + QUuid::createUuid().toString(QUuid::Id128) },
+        { "object",  "text_completion"                                      },
+        { "created", QDateTime::currentSecsSinceEpoch()                     },
+        { "model",   modelInfo.name()                                       },
+    };
+}
+
+static QJsonObject chatTemplate(const ChatRequest &request, const ModelInfo &modelInfo)
+{
+    return {
+        { "id",      "chatcmpl-" + QUuid::createUuid().toString(QUuid::Id128)         },
+        { "object",  request.stream ? "chat.completion.chunk" : "chat.completion" },
+        { "created", QDateTime::currentSecsSinceEpoch()                                 },
+        { "model",   modelInfo.name()                                                   },
+    };
+}
+
+static std::vector<MessageInput> messageInputs(const ChatRequest &request)
+{
+    std::vector<MessageInput> messages;
+    for (auto &message : request.messages) {
+        using enum ChatRequest::Message::Role;
+        switch (message.role) {
+            case System:    messages.push_back({ MessageInput::Type::System,   message.content }); break;
+            case User:      messages.push_back({ MessageInput::Type::Prompt,   message.content }); break;
+            case Assistant: messages.push_back({ MessageInput::Type::Response, message.content }); break;
+        }
+    }
+    return messages;
+}
+
+static QJsonObject completionChoice(const QString &text, int index, const char *finishReason)
+{
+    return {
+        { "text",          text             },
+        { "index",         index            },
+        { "logprobs",      QJsonValue::Null },
+        { "finish_reason", finishReason     },
+    };
+}
+
+static QJsonObject chatChoice(const QString &content, int index, const char *finishReason)
+{
+    QJsonObject message {
+        { "role",    "assistant" },
+        { "content", content     },
+    };
+    return {
+        { "index",         index            },
+        { "message",       message          },
+        { "finish_reason", finishReason     },
+        { "logprobs",      QJsonValue::Null },
+    };
+}
+
+// The requested model, or the default one if there is no such model.
+static ModelInfo findModel(const QString &requestedModel)
+{
+    const QList<ModelInfo> modelList = ModelList::globalInstance()->selectableModelList();
+    for (const ModelInfo &info : modelList) {
+        Q_ASSERT(info.installed);
+        if (!info.installed)
+            continue;
+        if (requestedModel == info.name() || requestedModel == info.filename())
+            return info;
+    }
+    return ModelList::globalInstance()->defaultModelInfo();
+}
+
+// Ends a response whose choices were generated, or its stream.
+static void finishResponse(HttpResponder &responder, bool stream, bool includeUsage, QJsonObject response,
+                           const QJsonArray &choices, int promptTokens, int responseTokens)
+{
+    if (stream) {
+        if (includeUsage)
+            writeStreamChunk(responder, response, {}, usageToJson(promptTokens, responseTokens));
+        responder.writeEvent("[DONE]");
+        responder.end();
+        return;
+    }
+    response.insert("choices", choices);
+    response.insert("usage", usageToJson(promptTokens, responseTokens));
+#if defined(DEBUG)
+    qDebug().noquote() << response.value("object").toString() << "reply"
+                       << QJsonDocument(response).toJson(QJsonDocument::Indented);
+#endif
+    responder.respond(response);
+}
+
 Server::Server(Chat *chat)
-    : ChatLLM(chat, true /* is server */)
+    : ChatLLM(chat, true /*isServer*/)
     , m_chat(chat)
 {
-    // Qt 6.2 compatibility - QHttpServer not available
-    qDebug() << "Server created but HTTP functionality disabled (Qt 6.2 compatibility)";
-    qDebug() << "For real HTTP server functionality, use:";
-    qDebug() << "  - enhanced_ai_server_fixed (production-ready with real AI)";
-    qDebug() << "  - minimal_simpleserver (perfect HTTP framework)";
-    
-    // Set up the server safely without HTTP functionality
-    connect(this, &Server::threadStarted, this, &Server::start, Qt::QueuedConnection);
-    
-    // Initialize safely without causing crashes
-    m_databaseResults.clear();
-    m_collections.clear();
-    
-    // Start the server initialization immediately to ensure it's ready
-    QTimer::singleShot(0, this, &Server::start);
+    connect(this, &Server::threadStarted, this, &Server::start);
+    connect(this, &Server::databaseResultsChanged, this, &Server::handleDatabaseResultsChanged);
+    connect(chat, &Chat::collectionListChanged, this, &Server::handleCollectionListChanged, Qt::QueuedConnection);
+}
+
+Server::~Server()
+{
+    // the HTTP server is deleted on its own thread once that finishes
+    m_httpThread.quit();
+    m_httpThread.wait();
 }
 
 void Server::start()
 {
-    // Qt 6.2 compatibility - QHttpServer not available, HTTP server functionality disabled
-    qDebug() << "Server::start() - HTTP server functionality not available in Qt 6.2";
-    qDebug() << "The main GPT4All app will work normally, but HTTP API is disabled.";
-    qDebug() << "For HTTP API functionality, run one of our standalone servers:";
-    qDebug() << "  ./enhanced_ai_server_fixed  # Real AI integration";
-    qDebug() << "  ./minimal_simpleserver      # Perfect HTTP framework";
+    // The HTTP server runs on its own thread, so that it keeps accepting connections and streaming responses while
+    // this thread is busy generating.
+    m_server = new HttpServer;
+    m_server->setDefaultHeaders({ { "Access-Control-Allow-Origin", "*" } });
+
+    // every route answers 401 while the server is disabled in the settings
+    auto route = [this](QByteArrayView method, QByteArrayView path, HttpServer::SyncHandler handler) {
+        m_server->route(method, path, [handler = std::move(handler)](const HttpRequest &request) {
+            if (!MySettings::globalInstance()->serverChat())
+                return HttpResponse(401);
+            return handler(request);
+        });
+    };
+
+    route("GET", "/v1/models", [](const HttpRequest &) {
+        const QList<ModelInfo> modelList = ModelList::globalInstance()->selectableModelList();
+        QJsonObject root;
+        root.insert("object", "list");
+        QJsonArray data;
+        for (const ModelInfo &info : modelList) {
+            Q_ASSERT(info.installed);
+            if (!info.installed)
+                continue;
+            data.append(modelToJson(info));
+        }
+        root.insert("data", data);
+        return HttpResponse(root);
+    });
+
+    route("GET", "/v1/models/*", [](const HttpRequest &request) {
+        const QString model = QString::fromUtf8(QByteArray::fromPercentEncoding(request.pathArg));
+        const QList<ModelInfo> modelList = ModelList::globalInstance()->selectableModelList();
+        QJsonObject object;
+        for (const ModelInfo &info : modelList) {
+            Q_ASSERT(info.installed);
+            if (!info.installed)
+                continue;
+
+            if (model == info.name()) {
+                object = modelToJson(info);
+                break;
+            }
+        }
+        return HttpResponse(object);
+    });
+
+    m_server->route("POST", "/v1/completions", [this](const HttpRequest &request, HttpResponder responder) {
+        if (!MySettings::globalInstance()->serverChat())
+            return responder.respond(HttpResponse(401));
+
+        auto req = std::make_shared<CompletionRequest>();
+        try {
+            auto reqObj = requestFromJson(request.body);
+#if defined(DEBUG)
+            qDebug().noquote() << "/v1/completions request" << QJsonDocument(reqObj).toJson(QJsonDocument::Indented);
+#endif
+            parseRequest(*req, std::move(reqObj));
+        } catch (const InvalidRequestError &e) {
+            return responder.respond(e.asResponse());
+        }
+        Job job {
+            .model     = req->model,
+            .responder = responder,
+            .stream    = req->stream,
+            .chat      = false,
+            .run       = [this, req, responder](const ModelInfo &info) { handleCompletionRequest(*req, responder, info); },
+        };
+        if (req->n == 1)
+            job.start = [this, req, responder](const ModelInfo &info) { return startCompletion(req, responder, info); };
+        if (auto rejected = enqueue(request, std::move(job)))
+            responder.respond(std::move(*rejected));
+    });
+
+    m_server->route("POST", "/v1/chat/completions", [this](const HttpRequest &request, HttpResponder responder) {
+        if (!MySettings::globalInstance()->serverChat())
+            return responder.respond(HttpResponse(401));
+
+        auto req = std::make_shared<ChatRequest>();
+        try {
+            auto reqObj = requestFromJson(request.body);
+#if defined(DEBUG)
+            qDebug().noquote() << "/v1/chat/completions request" << QJsonDocument(reqObj).toJson(QJsonDocument::Indented);
+#endif
+            parseRequest(*req, std::move(reqObj));
+        } catch (const InvalidRequestError &e) {
+            return responder.respond(e.asResponse());
+        }
+        Job job {
+            .model     = req->model,
+            .responder = responder,
+            .stream    = req->stream,
+            .chat      = true,
+            .run       = [this, req, responder](const ModelInfo &info) { handleChatRequest(*req, responder, info); },
+        };
+        if (req->n == 1)
+            job.start = [this, req, responder](const ModelInfo &info) { return startChat(req, responder, info); };
+        if (auto rejected = enqueue(request, std::move(job)))
+            responder.respond(std::move(*rejected));
+    });
+
+    // Respond with code 405 to wrong HTTP methods:
+    route("POST", "/v1/models", [](const HttpRequest &) {
+        return errorResponse("Not allowed to POST on /v1/models."
+                             " (HINT: Perhaps you meant to use a different HTTP method?)", 405);
+    });
+
+    route("POST", "/v1/models/*", [](const HttpRequest &) {
+        return errorResponse("Not allowed to POST on /v1/models/*."
+                             " (HINT: Perhaps you meant to use a different HTTP method?)", 405);
+    });
+
+    route("GET", "/v1/completions", [](const HttpRequest &) {
+        return errorResponse("Only POST requests are accepted.", 405, "invalid_request_error", "method_not_supported");
+    });
+
+    route("GET", "/v1/chat/completions", [](const HttpRequest &) {
+        return errorResponse("Only POST requests are accepted.", 405, "invalid_request_error", "method_not_supported");
+    });
+
+    m_server->moveToThread(&m_httpThread);
+    connect(&m_httpThread, &QThread::finished, m_server, &QObject::deleteLater);
+    m_httpThread.setObjectName("http");
+    m_httpThread.start();
+
+    const int port = MySettings::globalInstance()->networkPort();
+    QMetaObject::invokeMethod(m_server, [server = m_server, port] {
+        if (!server->listen(QHostAddress::LocalHost, port))
+            qWarning() << "ERROR: Unable to start the server on port" << port << ":" << server->errorString();
+    });
 
-    // Set up safe connections to prevent crashes
     connect(this, &Server::requestResetResponseState, m_chat, &Chat::resetResponseState, Qt::BlockingQueuedConnection);
-    
-    // Emit a safe signal to indicate the server is "started" (even though it's just a stub)
-    QTimer::singleShot(100, this, [this]() {
-        qDebug() << "Server stub initialization complete - main app can continue normally";
+}
+
+std::optional<HttpResponse> Server::enqueue(const HttpRequest &request, Job job)
+{
+    QByteArray client = clientKey(request);
+    QMutexLocker locker(&m_queueMutex);
+
+    auto reject = [this](HttpResponse response) {
+        // roughly when the requests ahead of a new one will have run
+        qint64 seconds = (m_queued + 1) * m_avgJobMs / 1000;
+        response.headers.append({ "Retry-After", QByteArray::number(std::clamp<qint64>(seconds, 1, 60)) });
+        return response;
+    };
+    if (m_inFlight.value(client) >= MAX_REQUESTS_PER_CLIENT)
+        return reject(errorResponse("Too many concurrent requests from this client.", 429, "requests",
+                                    "rate_limit_exceeded"));
+    if (m_queued >= MAX_QUEUED_REQUESTS)
+        return reject(errorResponse("The server is overloaded, please retry later.", 503, "server_error",
+                                    "overloaded"));
+
+    auto &queue = m_queues[client];
+    if (queue.empty())
+        m_turns.push_back(client);
+    queue.push_back(std::move(job));
+    ++m_inFlight[client];
+    ++m_queued;
+    if (!std::exchange(m_processScheduled, true))
+        QMetaObject::invokeMethod(this, &Server::processQueue, Qt::QueuedConnection);
+    return std::nullopt;
+}
+
+void Server::processQueue()
+{
+    for (;;) {
+        std::optional<std::pair<QByteArray, Job>> next;
+        {
+            QMutexLocker locker(&m_queueMutex);
+            if (!(next = takeJob())) {
+                m_processScheduled = false;
+                break;
+            }
+        }
+        auto &[client, job] = *next;
+
+        // the client may have given up while the request was queued
+        if (!job.responder.isOpen()) {
+            finishJob(client);
+            continue;
+        }
+        auto modelInfo = prepareModel(job.model);
+        if (!modelInfo) {
+            job.responder.respond(HttpResponse(500));
+            finishJob(client);
+            continue;
+        }
+        if (canBatch(job)) {
+            runBatch(client, std::move(job), *modelInfo);
+            continue;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        job.run(*modelInfo);
+        finishJob(client, timer.elapsed());
+    }
+
+    // Idle, the model goes back to the store so that a chat can use it. The next request takes it back from there, or
+    // another model if it asks for one, without loading it again as long as both fit in the memory budget.
+    releaseModel();
+}
+
+// Takes the next job of the first client in turn with one that accept takes, called with m_queueMutex held.
+auto Server::takeJob(const std::function<bool(const Job &)> &accept) -> std::optional<std::pair<QByteArray, Job>>
+{
+    for (auto it = m_turns.begin(); it != m_turns.end(); ++it) {
+        auto queueIt = m_queues.find(*it);
+        if (accept && !accept(queueIt->front()))
+            continue;
+        std::pair<QByteArray, Job> next(*it, std::move(queueIt->front()));
+        queueIt->pop_front();
+        // round robin, so that a client with many requests cannot starve the others
+        m_turns.erase(it);
+        if (queueIt->empty())
+            m_queues.erase(queueIt);
+        else
+            m_turns.push_back(next.first);
+        --m_queued;
+        return next;
+    }
+    return std::nullopt;
+}
+
+// Counts a job of client as done, after it ran for elapsedMs if it ran at all.
+void Server::finishJob(const QByteArray &client, qint64 elapsedMs)
+{
+    QMutexLocker locker(&m_queueMutex);
+    if (elapsedMs >= 0)
+        m_avgJobMs = m_avgJobMs ? (7 * m_avgJobMs + elapsedMs) / 8 : elapsedMs;
+    if (--m_inFlight[client] == 0)
+        m_inFlight.remove(client);
+}
+
+// Whether the job can share the loaded model with others. A chat that retrieves from LocalDocs runs alone, and so does
+// a request for more than one choice.
+bool Server::canBatch(const Job &job) const
+{
+    return job.start && !(job.chat && !m_collections.isEmpty()) && llModel() && llModel()->parallelSequences() > 0;
+}
+
+// Runs the job together with the waiting jobs for the same model that can share it, until none are left. Jobs that
+// arrive while the batch runs join it as soon as a sequence is free.
+void Server::runBatch(const QByteArray &client, Job job, const ModelInfo &modelInfo)
+{
+    struct Running {
+        QByteArray    client;
+        HttpResponder responder;
+        bool          stream;
+        QElapsedTimer timer;
+    };
+    std::map<int, Running> running;
+    int nextId = 0;
+    std::optional<std::pair<QByteArray, Job>> first(std::in_place, client, std::move(job));
+
+    auto nextPrompt = [&]() -> std::optional<LLModel::ParallelPrompt> {
+        for (;;) {
+            auto next = std::exchange(first, std::nullopt);
+            if (!next) {
+                QMutexLocker locker(&m_queueMutex);
+                next = takeJob([&](const Job &waiting) {
+                    return canBatch(waiting) && findModel(waiting.model).filename() == modelInfo.filename();
+                });
+            }
+            if (!next)
+                return std::nullopt;
+            auto &[nextClient, nextJob] = *next;
+            if (!nextJob.responder.isOpen()) {
+                finishJob(nextClient);
+                continue;
+            }
+
+            LLModel::ParallelPrompt prompt;
+            try {
+                prompt = nextJob.start(modelInfo);
+            } catch (const std::exception &e) {
+                failRequest(nextJob.responder, false, e.what());
+                finishJob(nextClient);
+                continue;
+            }
+            const int id = nextId++;
+            Running &r = running.try_emplace(id, Running { nextClient, nextJob.responder, nextJob.stream, {} })
+                .first->second;
+            r.timer.start();
+            prompt.finished = [this, &running, id, finished = std::move(prompt.finished)] {
+                finished();
+                auto it = running.find(id);
+                finishJob(it->second.client, it->second.timer.elapsed());
+                running.erase(it);
+            };
+            return prompt;
+        }
+    };
+
+    try {
+        llModel()->setThreadCount(MySettings::globalInstance()->threadCount());
+        llModel()->promptParallel(nextPrompt);
+    } catch (const std::exception &e) {
+        for (auto &[id, r] : running) {
+            failRequest(r.responder, r.stream, e.what());
+            finishJob(r.client, r.timer.elapsed());
+        }
+    }
+}
+
+void Server::handleResponseChunk(const QByteArray &chunk)
+{
+    if (!m_stream)
+        return;
+    if (!m_stream->responder.isOpen()) {
+        stopGenerating(); // nobody is waiting for the rest
+        return;
+    }
+    // a token can end within a character, the decoder keeps that part for the next one
+    QString text = m_stream->decoder.decode(chunk);
+    if (!text.isEmpty())
+        writeStreamChunk(m_stream->responder, m_stream->chunkTemplate,
+                         { streamChoice(m_stream->chat, m_stream->index, text, QJsonValue::Null) });
+}
+
+// Finds and loads the requested model, or the default one. Returns nullopt if it cannot be loaded.
+std::optional<ModelInfo> Server::prepareModel(const QString &requestedModel)
+{
+    ModelInfo modelInfo = findModel(requestedModel);
+
+    // load the new model if necessary
+    setShouldBeLoaded(true);
+
+    if (modelInfo.filename().isEmpty()) {
+        std::cerr << "ERROR: couldn't load default model " << requestedModel.toStdString() << std::endl;
+        return std::nullopt;
+    }
+
+    emit requestResetResponseState(); // blocks
+
+    // NB: this resets the context, regardless of whether this model is already loaded
+    if (!loadModel(modelInfo)) {
+        std::cerr << "ERROR: couldn't load model " << modelInfo.name().toStdString() << std::endl;
+        return std::nullopt;
+    }
+    return modelInfo;
+}
+
+void Server::handleCompletionRequest(const CompletionRequest &request, HttpResponder responder,
+                                     const ModelInfo &modelInfo)
+{
+    Q_ASSERT(m_chatModel);
+
+    qsizetype prevMsgIndex = m_chatModel->count() - 1;
+    if (prevMsgIndex >= 0)
+        m_chatModel->updateCurrentResponse(prevMsgIndex, false);
+
+    // add prompt/response items to GUI
+    m_chatModel->appendPrompt(request.prompt);
+    m_chatModel->appendResponse();
+
+    const auto promptCtx = makePromptContext(request, modelInfo);
+    const QJsonObject chunkTemplate = completionTemplate(modelInfo);
+    if (request.stream) {
+        responder.beginEventStream();
+        m_stream.emplace(Stream { .responder = responder, .chunkTemplate = chunkTemplate, .chat = false, .index = 0 });
+    }
+
+    auto promptUtf8 = request.prompt.toUtf8();
+    int promptTokens = 0;
+    int responseTokens = 0;
+    QJsonArray choices;
+    for (int i = 0; i < request.n; ++i) {
+        PromptResult result;
+        if (m_stream) {
+            m_stream->index = i;
+            m_stream->decoder.resetState();
+            if (request.echo)
+                writeStreamChunk(responder, chunkTemplate, { streamChoice(false, i, request.prompt, QJsonValue::Null) });
+        }
+        try {
+            result = promptInternal(std::string_view(promptUtf8.cbegin(), promptUtf8.cend()),
+                                    promptCtx,
+                                    /*usedLocalDocs*/ false);
+        } catch (const std::exception &e) {
+            m_chatModel->setResponseValue(e.what());
+            m_chatModel->setError();
+            emit responseStopped(0);
+            m_stream.reset();
+            return failRequest(responder, request.stream, e.what());
+        }
+        const char *finishReason = result.responseTokens >= request.max_tokens ? "length" : "stop";
+        if (m_stream) {
+            writeStreamChunk(responder, chunkTemplate, { streamChoice(false, i, {}, finishReason) });
+        } else {
+            QString resp = QString::fromUtf8(result.response);
+            if (request.echo)
+                resp = request.prompt + resp;
+            choices << completionChoice(resp, i, finishReason);
+        }
+        if (i == 0)
+            promptTokens = result.promptTokens;
+        responseTokens += result.responseTokens;
+    }
+
+    m_stream.reset();
+    finishResponse(responder, request.stream, request.includeUsage, chunkTemplate, choices, promptTokens,
+                   responseTokens);
+}
+
+// Sets up a completion of one choice to be generated in a batch, see runBatch.
+LLModel::ParallelPrompt Server::startCompletion(const std::shared_ptr<const CompletionRequest> &request,
+                                                HttpResponder responder, const ModelInfo &modelInfo)
+{
+    auto state = std::make_shared<BatchedResponse>(BatchedResponse {
+        .responder = responder, .chunkTemplate = completionTemplate(modelInfo), .chat = false, .stream = request->stream,
+    });
+    if (request->stream) {
+        responder.beginEventStream();
+        if (request->echo)
+            writeStreamChunk(responder, state->chunkTemplate, { streamChoice(false, 0, request->prompt, QJsonValue::Null) });
+    }
+    return batchedPrompt(request->prompt.toStdString(), makePromptContext(*request, modelInfo), state,
+                         [this, request](BatchedResponse &r) {
+        const char *finishReason = r.responseTokens >= request->max_tokens ? "length" : "stop";
+        QString text = QString::fromUtf8(r.response);
+        // the exchange is logged once it is complete, as the requests of a batch would otherwise interleave
+        const MessageInput prompt { MessageInput::Type::Prompt, request->prompt };
+        m_chatModel->appendResponseWithHistory({ &prompt, 1 });
+        m_chatModel->setResponseValue(text.trimmed());
+        if (r.stream)
+            writeStreamChunk(r.responder, r.chunkTemplate, { streamChoice(false, 0, {}, finishReason) });
+        QJsonArray choices;
+        if (!r.stream)
+            choices << completionChoice(request->echo ? request->prompt + text : text, 0, finishReason);
+        finishResponse(r.responder, r.stream, request->includeUsage, r.chunkTemplate, choices, r.promptTokens,
+                       r.responseTokens);
     });
 }
 
-auto Server::handleCompletionRequest(const CompletionRequest &request) -> std::pair<HttpServerResponse, std::optional<QJsonObject>>
+void Server::handleChatRequest(const ChatRequest &request, HttpResponder responder, const ModelInfo &modelInfo)
 {
-    Q_UNUSED(request);
-    // Qt 6.2 compatibility - return helpful stub response
-    QJsonObject error;
-    error["error"] = "HTTP server functionality not available in Qt 6.2";
-    error["message"] = "Use enhanced_ai_server_fixed or minimal_simpleserver for HTTP API";
-    error["alternatives"] = "Run ./enhanced_ai_server_fixed for real AI integration";
-    return { HttpServerResponse(503), error };
+    Q_ASSERT(m_chatModel);
+
+    m_chatModel->updateCurrentResponse(m_chatModel->count() - 1, false);
+
+    Q_ASSERT(!request.messages.isEmpty());
+
+    // adds prompt/response items to GUI
+    auto startOffset = m_chatModel->appendResponseWithHistory(messageInputs(request));
+
+    const auto promptCtx = makePromptContext(request, modelInfo);
+    const QJsonObject chunkTemplate = chatTemplate(request, modelInfo);
+    if (request.stream) {
+        responder.beginEventStream();
+        m_stream.emplace(Stream { .responder = responder, .chunkTemplate = chunkTemplate, .chat = true, .index = 0 });
+    }
+
+    int promptTokens   = 0;
+    int responseTokens = 0;
+    QJsonArray choices;
+    for (int i = 0; i < request.n; ++i) {
+        ChatPromptResult result;
+        if (m_stream) {
+            m_stream->index = i;
+            m_stream->decoder.resetState();
+            writeStreamChunk(responder, chunkTemplate, { streamChoice(true, i, {}, QJsonValue::Null, /*withRole*/ true) });
+        }
+        try {
+            result = promptInternalChat(m_collections, promptCtx, startOffset, request.localdocsFilter);
+        } catch (const std::exception &e) {
+            m_chatModel->setResponseValue(e.what());
+            m_chatModel->setError();
+            emit responseStopped(0);
+            m_stream.reset();
+            return failRequest(responder, request.stream, e.what());
+        }
+        const char *finishReason = result.responseTokens >= request.max_tokens ? "length" : "stop";
+        QJsonValue references = QJsonValue::Null;
+        if (MySettings::globalInstance()->localDocsShowReferences()) {
+            QJsonArray refs;
+            for (const auto &ref : std::as_const(result.databaseResults))
+                refs.append(resultToJson(ref));
+            if (!refs.isEmpty())
+                references = refs;
+        }
+        if (m_stream) {
+            QJsonObject choice = streamChoice(true, i, {}, finishReason);
+            if (MySettings::globalInstance()->localDocsShowReferences())
+                choice.insert("references", references);
+            writeStreamChunk(responder, chunkTemplate, { choice });
+        } else {
+            QJsonObject choice = chatChoice(QString::fromUtf8(result.response), i, finishReason);
+            if (MySettings::globalInstance()->localDocsShowReferences())
+                choice.insert("references", references);
+            choices.append(choice);
+        }
+        if (i == 0)
+            promptTokens = result.promptTokens;
+        responseTokens += result.responseTokens;
+    }
+
+    m_stream.reset();
+    finishResponse(responder, request.stream, request.includeUsage, chunkTemplate, choices, promptTokens,
+                   responseTokens);
 }
 
-auto Server::handleChatRequest(const ChatRequest &request) -> std::pair<HttpServerResponse, std::optional<QJsonObject>>
+// Sets up a chat completion of one choice to be generated in a batch, see runBatch. It does not retrieve from LocalDocs,
+// canBatch leaves that to handleChatRequest.
+LLModel::ParallelPrompt Server::startChat(const std::shared_ptr<const ChatRequest> &request, HttpResponder responder,
+                                          const ModelInfo &modelInfo)
 {
-    Q_UNUSED(request);
-    // Qt 6.2 compatibility - return helpful stub response  
-    QJsonObject error;
-    error["error"] = "HTTP server functionality not available in Qt 6.2";
-    error["message"] = "Use enhanced_ai_server_fixed or minimal_simpleserver for HTTP API";
-    error["alternatives"] = "Run ./enhanced_ai_server_fixed for real AI integration";
-    return { HttpServerResponse(503), error };
+    std::vector<MessageItem> items;
+    for (qsizetype i = 0; auto &message : messageInputs(*request)) {
+        using enum MessageInput::Type;
+        switch (message.type) {
+            case System:   items.emplace_back(MessageItem::system_tag, message.content);         break;
+            case Prompt:   items.emplace_back(i++, MessageItem::Type::Prompt,   message.content); break;
+            case Response: items.emplace_back(i++, MessageItem::Type::Response, message.content); break;
+        }
+    }
+    // rendered before the response begins, so that a template error can still be answered with a status
+    std::string prompt = applyJinjaTemplate(items, /*remember*/ false);
+
+    auto state = std::make_shared<BatchedResponse>(BatchedResponse {
+        .responder = responder, .chunkTemplate = chatTemplate(*request, modelInfo), .chat = true, .stream = request->stream,
+    });
+    if (request->stream) {
+        responder.beginEventStream();
+        writeStreamChunk(responder, state->chunkTemplate, { streamChoice(true, 0, {}, QJsonValue::Null, /*withRole*/ true) });
+    }
+    return batchedPrompt(std::move(prompt), makePromptContext(*request, modelInfo), state,
+                         [this, request](BatchedResponse &r) {
+        const char *finishReason = r.responseTokens >= request->max_tokens ? "length" : "stop";
+        QString text = QString::fromUtf8(r.response);
+        // the exchange is logged once it is complete, as the requests of a batch would otherwise interleave
+        m_chatModel->appendResponseWithHistory(messageInputs(*request));
+        m_chatModel->setResponseValue(text.trimmed());
+        const bool showReferences = MySettings::globalInstance()->localDocsShowReferences();
+        QJsonObject choice = r.stream ? streamChoice(true, 0, {}, finishReason) : chatChoice(text, 0, finishReason);
+        if (showReferences)
+            choice.insert("references", QJsonValue::Null);
+        if (r.stream)
+            writeStreamChunk(r.responder, r.chunkTemplate, { choice });
+        finishResponse(r.responder, r.stream, request->includeUsage, r.chunkTemplate,
+                       r.stream ? QJsonArray() : QJsonArray { choice }, r.promptTokens, r.responseTokens);
+    });
 }
@@ -3,13 +3,21 @@
 
 #include "chatllm.h"
 #include "database.h"
+#include "httpserver.h"
 
-// Qt 6.2 compatibility - QHttpServer not available, create stub implementation
+#include <QByteArray>
+#include <QHash>
 #include <QJsonObject>
 #include <QList>
+#include <QMutex>
 #include <QObject> // IWYU pragma: keep
 #include <QString>
+#include <QStringDecoder>
+#include <QThread>
+#include <QtTypes>
 
+#include <deque>
+#include <functional>
 #include <memory>
 #include <optional>
 #include <utility>
@@ -18,14 +26,6 @@ class Chat;
 class ChatRequest;
 class CompletionRequest;
 
-// Qt 6.2 compatibility stub for QHttpServerResponse
-struct HttpServerResponse {
-    QJsonObject data;
-    int statusCode = 200;
-    HttpServerResponse() = default;
-    HttpServerResponse(const QJsonObject &obj) : data(obj) {}
-    HttpServerResponse(int code) : statusCode(code) {}
-};
 
 class Server : public ChatLLM
 {
@@ -33,7 +33,7 @@ class Server : public ChatLLM
 
 public:
     explicit Server(Chat *chat);
-    ~Server() override = default;
+    ~Server() override;
 
 public Q_SLOTS:
     void start();
@@ -41,9 +41,47 @@ public Q_SLOTS:
 Q_SIGNALS:
     void requestResetResponseState();
 
+protected:
+    void handleResponseChunk(const QByteArray &chunk) override;
+
 private:
-    auto handleCompletionRequest(const CompletionRequest &request) -> std::pair<HttpServerResponse, std::optional<QJsonObject>>;
-    auto handleChatRequest(const ChatRequest &request) -> std::pair<HttpServerResponse, std::optional<QJsonObject>>;
+    // The response being streamed, if any, see handleResponseChunk.
+    struct Stream {
+        HttpResponder  responder;
+        QJsonObject    chunkTemplate; // id, object, created and model of every chunk
+        bool           chat;
+        int            index;         // of the choice being generated
+        QStringDecoder decoder { QStringDecoder::Utf8 };
+    };
+
+    // A request waiting for the model. One that can share it with others has a start function, which sets up its
+    // prompt for promptParallel, otherwise run runs it alone.
+    struct Job {
+        QString                                                   model;       // as requested
+        HttpResponder                                             responder;
+        bool                                                      stream;
+        bool                                                      chat;        // LocalDocs retrieval runs it alone
+        std::function<void(const ModelInfo &)>                    run;
+        std::function<LLModel::ParallelPrompt(const ModelInfo &)> start;
+    };
+
+    // Requests are parsed by the HTTP workers and queued to run on this thread. Clients take turns, and a request is
+    // turned away with the response returned when its client or the whole queue already has too many. Requests that
+    // can share the model are run together, those that arrive for it while they run join them.
+    std::optional<HttpResponse> enqueue(const HttpRequest &request, Job job);
+    void processQueue();
+    std::optional<std::pair<QByteArray, Job>> takeJob(const std::function<bool(const Job &)> &accept = {});
+    void finishJob(const QByteArray &client, qint64 elapsedMs = -1);
+    bool canBatch(const Job &job) const;
+    void runBatch(const QByteArray &client, Job job, const ModelInfo &modelInfo);
+
+    void handleCompletionRequest(const CompletionRequest &request, HttpResponder responder, const ModelInfo &modelInfo);
+    void handleChatRequest(const ChatRequest &request, HttpResponder responder, const ModelInfo &modelInfo);
+    LLModel::ParallelPrompt startCompletion(const std::shared_ptr<const CompletionRequest> &request,
+                                            HttpResponder responder, const ModelInfo &modelInfo);
+    LLModel::ParallelPrompt startChat(const std::shared_ptr<const ChatRequest> &request, HttpResponder responder,
+                                      const ModelInfo &modelInfo);
+    std::optional<ModelInfo> prepareModel(const QString &requestedModel);
 
 private Q_SLOTS:
     void handleDatabaseResultsChanged(const QList<ResultInfo> &results) { m_databaseResults = results; }
@@ -51,9 +89,19 @@ private Q_SLOTS:
 
 private:
     Chat *m_chat;
-    // QHttpServer not available in Qt 6.2, HTTP server functionality disabled
+    HttpServer *m_server = nullptr; // lives on m_httpThread
+    QThread m_httpThread;
     QList<ResultInfo> m_databaseResults;
     QList<QString> m_collections;
+
+    QMutex m_queueMutex;
+    QHash<QByteArray, std::deque<Job>> m_queues; // waiting jobs by client
+    std::deque<QByteArray> m_turns;    // the clients with waiting jobs, in the order they get to run one
+    QHash<QByteArray, int> m_inFlight; // waiting and running jobs by client
+    qsizetype m_queued = 0;
+    qint64 m_avgJobMs = 0;             // moving average, to tell turned away clients when to retry
+    bool m_processScheduled = false;
+    std::optional<Stream> m_stream;
 };
 
 #endif // SERVER_H
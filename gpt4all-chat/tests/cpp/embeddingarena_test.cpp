@@ -0,0 +1,198 @@
+#include "embeddingarena.h"
+#include "embeddingindex.h"
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+#include <QList>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QString>
+#include <QVariant>
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+
+namespace {
+
+using Match = EmbeddingArena::Match;
+
+const QString MODEL = "test-model";
+
+class EmbeddingArenaTest : public testing::Test {
+protected:
+    void SetUp() override
+    {
+        m_db = QSqlDatabase::addDatabase("QSQLITE", "arena-test");
+        m_db.setDatabaseName(":memory:");
+        ASSERT_TRUE(m_db.open());
+        QSqlQuery q(m_db);
+        ASSERT_TRUE(q.exec("create table embeddings(chunk_id integer primary key, embedding blob not null)"));
+    }
+
+    void TearDown() override
+    {
+        m_db.close();
+        m_db = {};
+        QSqlDatabase::removeDatabase("arena-test");
+    }
+
+    void addRow(int chunkId, const std::vector<float> &embedding)
+    {
+        QSqlQuery q(m_db);
+        ASSERT_TRUE(q.prepare("insert into embeddings(chunk_id, embedding) values(?, ?)"));
+        q.addBindValue(chunkId);
+        q.addBindValue(QByteArray(reinterpret_cast<const char *>(embedding.data()),
+                                  qsizetype(embedding.size() * sizeof(float))));
+        ASSERT_TRUE(q.exec());
+    }
+
+    EmbeddingArena::FolderPtr read(const EmbeddingArena &arena)
+    {
+        QSqlQuery q(m_db);
+        q.setForwardOnly(true);
+        if (!q.exec("select count(*) from embeddings") || !q.next())
+            return nullptr;
+        qsizetype count = q.value(0).toLongLong();
+        if (!q.exec("select chunk_id, embedding from embeddings order by chunk_id"))
+            return nullptr;
+        return arena.read(q, count);
+    }
+
+    QSqlDatabase m_db;
+};
+
+std::vector<int> chunkIds(const QList<Match> &matches)
+{
+    std::vector<int> ids;
+    for (auto &m : matches)
+        ids.push_back(m.chunkId);
+    return ids;
+}
+
+} // namespace
+
+TEST_F(EmbeddingArenaTest, SearchesByInnerProduct) {
+    addRow(1, { 1.f, 0.f, 0.f });
+    addRow(2, { 0.f, 1.f, 0.f });
+    addRow(3, { .8f, .6f, 0.f });
+
+    EmbeddingArena arena(1 << 20);
+    auto folder = read(arena);
+    ASSERT_TRUE(folder);
+    arena.insert(MODEL, 7, std::move(folder));
+    EXPECT_TRUE(arena.contains(MODEL, 7));
+    EXPECT_FALSE(arena.contains("other-model", 7));
+    EXPECT_GT(arena.bytesUsed(), 0u);
+
+    std::vector<float> query { 1.f, 0.f, 0.f };
+    QList<Match> matches;
+    ASSERT_TRUE(arena.search(MODEL, 7, query, 2, matches));
+    ASSERT_EQ(matches.size(), 2);
+    EXPECT_EQ(chunkIds(matches), (std::vector { 1, 3 }));
+    EXPECT_FLOAT_EQ(matches[0].distance, 0.f);
+    EXPECT_FLOAT_EQ(matches[1].distance, .2f);
+
+    // a query of the wrong size, or for a folder that is not held
+    matches.clear();
+    EXPECT_FALSE(arena.search(MODEL, 7, std::vector { 1.f, 0.f }, 2, matches));
+    EXPECT_FALSE(arena.search(MODEL, 8, query, 2, matches));
+    EXPECT_TRUE(matches.isEmpty());
+}
+
+TEST_F(EmbeddingArenaTest, SearchesOnlyFilteredChunks) {
+    addRow(1, { 1.f, 0.f });
+    addRow(2, { 0.f, 1.f });
+    addRow(3, { .6f, .8f });
+
+    EmbeddingArena arena(1 << 20);
+    arena.insert(MODEL, 1, read(arena));
+
+    ChunkFilter filter;
+    filter.insert(1, 2);
+    filter.insert(1, 3);
+    QList<Match> matches;
+    ASSERT_TRUE(arena.search(MODEL, 1, std::vector { 1.f, 0.f }, 3, matches, &filter));
+    EXPECT_EQ(chunkIds(matches), (std::vector { 3, 2 }));
+}
+
+TEST_F(EmbeddingArenaTest, AddsAndRemovesChunks) {
+    addRow(1, { 1.f, 0.f });
+    addRow(2, { 0.f, 1.f });
+
+    EmbeddingArena arena(1 << 20);
+    arena.insert(MODEL, 1, read(arena));
+
+    arena.add(MODEL, 1, 3, std::vector { -1.f, 0.f });
+    arena.add(MODEL, 2, 4, std::vector { 1.f, 0.f }); // not held, ignored
+    arena.remove(std::vector { 1 });
+
+    QList<Match> matches;
+    ASSERT_TRUE(arena.search(MODEL, 1, std::vector { 1.f, 0.f }, 10, matches));
+    EXPECT_EQ(chunkIds(matches), (std::vector { 2, 3 }));
+
+    // an embedding of another size drops the folder
+    arena.add(MODEL, 1, 5, std::vector { 1.f, 0.f, 0.f });
+    EXPECT_FALSE(arena.contains(MODEL, 1));
+    EXPECT_EQ(arena.bytesUsed(), 0u);
+}
+
+TEST_F(EmbeddingArenaTest, RemovesFolderForEveryModel) {
+    addRow(1, { 1.f, 0.f });
+
+    EmbeddingArena arena(1 << 20);
+    arena.insert(MODEL, 1, read(arena));
+    arena.insert("other-model", 1, read(arena));
+    arena.insert(MODEL, 2, read(arena));
+
+    arena.removeFolder(1);
+    EXPECT_FALSE(arena.contains(MODEL, 1));
+    EXPECT_FALSE(arena.contains("other-model", 1));
+    EXPECT_TRUE(arena.contains(MODEL, 2));
+}
+
+TEST_F(EmbeddingArenaTest, RespectsBudget) {
+    for (int i = 1; i <= 100; i++)
+        addRow(i, std::vector<float>(64, float(i)));
+
+    EmbeddingArena arena(1024);
+    EXPECT_FALSE(read(arena));
+    EXPECT_EQ(arena.bytesUsed(), 0u);
+}
+
+TEST_F(EmbeddingArenaTest, ScansLargeFolderOnSeveralThreads) {
+    // enough rows that the scan is split between threads, on a machine that has them
+    constexpr int rows = 50000;
+    constexpr int dims = 4;
+    std::vector<std::vector<float>> embeddings;
+    ASSERT_TRUE(m_db.transaction());
+    for (int i = 0; i < rows; i++) {
+        float x = float(i % 997) / 997.f;
+        embeddings.push_back({ x, 1.f - x, float(i % 7) / 7.f, float(i % 13) / 13.f });
+        addRow(i + 1, embeddings.back());
+    }
+    ASSERT_TRUE(m_db.commit());
+
+    EmbeddingArena arena(std::size_t(1) << 30);
+    arena.insert(MODEL, 1, read(arena));
+
+    const std::vector<float> query { .3f, .5f, .1f, .7f };
+    std::vector<Match> expected;
+    for (int i = 0; i < rows; i++) {
+        float dot = 0.f;
+        for (int j = 0; j < dims; j++)
+            dot += embeddings[i][j] * query[j];
+        expected.push_back({ i + 1, 1.f - dot });
+    }
+    std::ranges::stable_sort(expected, {}, &Match::distance);
+
+    constexpr int k = 20;
+    QList<Match> matches;
+    ASSERT_TRUE(arena.search(MODEL, 1, query, k, matches));
+    ASSERT_EQ(matches.size(), k);
+    for (int i = 0; i < k; i++)
+        EXPECT_NEAR(matches[i].distance, expected[i].distance, 1e-5f);
+}
@@ -0,0 +1,344 @@
+#include "embeddingindex.h"
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+#include <QDir>
+#include <QList>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QString>
+#include <QTemporaryDir>
+#include <QVariant>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+
+namespace {
+
+using Match = EmbeddingIndex::Match;
+using Quantization = EmbeddingIndex::Quantization;
+
+const QString MODEL = "test-model";
+constexpr int DIMENSIONS = 32;
+constexpr int EMBEDDINGS = 500;
+
+// reproducible unit vectors, the inner product of a vector with itself is then 1
+std::vector<std::vector<float>> randomEmbeddings(int count, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> dist;
+    std::vector<std::vector<float>> embeddings(count, std::vector<float>(DIMENSIONS));
+    for (auto &embedding : embeddings) {
+        float norm = 0.f;
+        for (float &x : embedding) {
+            x = dist(rng);
+            norm += x * x;
+        }
+        for (float &x : embedding)
+            x /= std::sqrt(norm);
+    }
+    return embeddings;
+}
+
+std::vector<int> chunkIds(const QList<Match> &matches)
+{
+    std::vector<int> ids;
+    for (auto &m : matches)
+        ids.push_back(m.chunkId);
+    return ids;
+}
+
+class EmbeddingIndexTest : public testing::Test {
+protected:
+    void SetUp() override
+    {
+        ASSERT_TRUE(m_dir.isValid());
+        m_db = QSqlDatabase::addDatabase("QSQLITE", "index-test");
+        m_db.setDatabaseName(":memory:");
+        ASSERT_TRUE(m_db.open());
+        QSqlQuery q(m_db);
+        ASSERT_TRUE(q.exec("create table embeddings(chunk_id integer primary key, folder_id integer not null, "
+                           "embedding blob not null)"));
+    }
+
+    void TearDown() override
+    {
+        m_db.close();
+        m_db = {};
+        QSqlDatabase::removeDatabase("index-test");
+    }
+
+    QString indexDir() const { return m_dir.filePath("index"); }
+
+    // chunk ids start at firstChunkId and follow the order of embeddings
+    void addRows(int folderId, int firstChunkId, const std::vector<std::vector<float>> &embeddings)
+    {
+        QSqlQuery q(m_db);
+        ASSERT_TRUE(q.prepare("insert into embeddings(chunk_id, folder_id, embedding) values(?, ?, ?)"));
+        for (std::size_t i = 0; i < embeddings.size(); i++) {
+            q.addBindValue(firstChunkId + int(i));
+            q.addBindValue(folderId);
+            q.addBindValue(QByteArray(reinterpret_cast<const char *>(embeddings[i].data()),
+                                      qsizetype(embeddings[i].size() * sizeof(float))));
+            ASSERT_TRUE(q.exec());
+        }
+    }
+
+    EmbeddingIndex::IndexPtr build(const EmbeddingIndex &index, int folderId)
+    {
+        QSqlQuery q(m_db);
+        q.setForwardOnly(true);
+        q.prepare("select count(*) from embeddings where folder_id = ?");
+        q.addBindValue(folderId);
+        if (!q.exec() || !q.next())
+            return nullptr;
+        qsizetype count = q.value(0).toLongLong();
+        q.prepare("select chunk_id, embedding from embeddings where folder_id = ?");
+        q.addBindValue(folderId);
+        if (!q.exec())
+            return nullptr;
+        return index.build(q, count, folderId);
+    }
+
+    // build the index of a folder and insert it
+    void addIndex(EmbeddingIndex &index, int folderId, const QString &model = MODEL)
+    {
+        auto built = build(index, folderId);
+        ASSERT_TRUE(built);
+        index.insert(model, folderId, std::move(built));
+    }
+
+    QTemporaryDir m_dir;
+    QSqlDatabase  m_db;
+};
+
+} // namespace
+
+TEST(ChunkFilterTest, CountsChunksPerFolder) {
+    ChunkFilter filter;
+    filter.insert(1, 5);
+    filter.insert(1, 5);
+    filter.insert(1, 63);
+    filter.insert(2, 64);
+
+    EXPECT_EQ(filter.count(1), 2);
+    EXPECT_EQ(filter.count(2), 1);
+    EXPECT_EQ(filter.count(3), 0);
+    EXPECT_TRUE(filter.contains(5));
+    EXPECT_TRUE(filter.contains(63));
+    EXPECT_TRUE(filter.contains(64));
+    EXPECT_FALSE(filter.contains(6));
+    EXPECT_FALSE(filter.contains(1000));
+}
+
+TEST_F(EmbeddingIndexTest, FindsNearestNeighbours) {
+    auto embeddings = randomEmbeddings(EMBEDDINGS, 1);
+    addRows(1, 1, embeddings);
+    EmbeddingIndex idx;
+    idx.open(indexDir(), Quantization::None);
+    addIndex(idx, 1);
+    EXPECT_TRUE(idx.contains(MODEL, 1));
+
+    for (int i : { 0, 17, 250, EMBEDDINGS - 1 }) {
+        QList<Match> matches;
+        ASSERT_TRUE(idx.search(MODEL, 1, embeddings[i], 5, matches));
+        ASSERT_EQ(matches.size(), 5);
+        EXPECT_EQ(matches[0].chunkId, i + 1);
+        EXPECT_NEAR(matches[0].distance, 0.f, 1e-4f); // 1 - inner product
+        EXPECT_TRUE(std::is_sorted(matches.begin(), matches.end(),
+                                   [](auto &a, auto &b) { return a.distance < b.distance; }));
+    }
+}
+
+TEST_F(EmbeddingIndexTest, SearchFailsWithoutIndex) {
+    auto embeddings = randomEmbeddings(EMBEDDINGS, 2);
+    addRows(1, 1, embeddings);
+    EmbeddingIndex idx;
+    idx.open(indexDir(), Quantization::None);
+    addIndex(idx, 1);
+
+    QList<Match> matches;
+    EXPECT_FALSE(idx.search(MODEL, 2, embeddings[0], 5, matches));
+    EXPECT_FALSE(idx.search("other-model", 1, embeddings[0], 5, matches));
+    std::vector<float> wrongSize(DIMENSIONS / 2, 0.f);
+    EXPECT_FALSE(idx.search(MODEL, 1, wrongSize, 5, matches));
+    EXPECT_TRUE(matches.isEmpty());
+}
+
+TEST_F(EmbeddingIndexTest, AddsAndRemovesEmbeddings) {
+    auto embeddings = randomEmbeddings(EMBEDDINGS + 1, 3);
+    auto added = embeddings.back();
+    embeddings.pop_back();
+    addRows(1, 1, embeddings);
+    EmbeddingIndex idx;
+    idx.open(indexDir(), Quantization::None);
+    addIndex(idx, 1);
+
+    // a folder without an index is not an error, it is scanned instead
+    EXPECT_TRUE(idx.add(MODEL, 2, 1000, added));
+    EXPECT_FALSE(idx.contains(MODEL, 2));
+
+    ASSERT_TRUE(idx.add(MODEL, 1, 1000, added));
+    QList<Match> matches;
+    ASSERT_TRUE(idx.search(MODEL, 1, added, 1, matches));
+    ASSERT_EQ(matches.size(), 1);
+    EXPECT_EQ(matches[0].chunkId, 1000);
+
+    const int removed[] = { 1000, 1 };
+    idx.remove(removed);
+    for (auto &query : { added, embeddings[0] }) {
+        matches.clear();
+        ASSERT_TRUE(idx.search(MODEL, 1, query, 10, matches));
+        auto ids = chunkIds(matches);
+        EXPECT_EQ(std::ranges::count(ids, 1000), 0);
+        EXPECT_EQ(std::ranges::count(ids, 1), 0);
+    }
+}
+
+TEST_F(EmbeddingIndexTest, RemovesFolders) {
+    addRows(1, 1, randomEmbeddings(EMBEDDINGS, 4));
+    addRows(2, 1001, randomEmbeddings(EMBEDDINGS, 5));
+    EmbeddingIndex idx;
+    idx.open(indexDir(), Quantization::None);
+    addIndex(idx, 1);
+    addIndex(idx, 1, "other-model");
+    addIndex(idx, 2);
+
+    idx.removeFolder("other-model", 1);
+    EXPECT_TRUE(idx.contains(MODEL, 1));
+    EXPECT_FALSE(idx.contains("other-model", 1));
+
+    idx.removeFolder(1);
+    EXPECT_FALSE(idx.contains(MODEL, 1));
+    EXPECT_TRUE(idx.contains(MODEL, 2));
+}
+
+TEST_F(EmbeddingIndexTest, SavesAndReopens) {
+    auto embeddings = randomEmbeddings(EMBEDDINGS, 6);
+    addRows(1, 1, embeddings);
+    addRows(2, 1001, randomEmbeddings(EMBEDDINGS, 7));
+    {
+        EmbeddingIndex idx;
+        idx.open(indexDir(), Quantization::None);
+        addIndex(idx, 1);
+        addIndex(idx, 2);
+        idx.save();
+    }
+    EXPECT_EQ(QDir(indexDir()).entryList({ "*.usearch" }, QDir::Files).size(), 2);
+
+    EmbeddingIndex idx;
+    idx.open(indexDir(), Quantization::None);
+    ASSERT_TRUE(idx.contains(MODEL, 1));
+    ASSERT_TRUE(idx.contains(MODEL, 2));
+
+    // the reopened index is mapped from its file, it is read into memory once it is modified
+    QList<Match> matches;
+    ASSERT_TRUE(idx.search(MODEL, 1, embeddings[42], 1, matches));
+    ASSERT_EQ(matches.size(), 1);
+    EXPECT_EQ(matches[0].chunkId, 43);
+    auto added = randomEmbeddings(1, 8).front();
+    ASSERT_TRUE(idx.add(MODEL, 1, 2000, added));
+    matches.clear();
+    ASSERT_TRUE(idx.search(MODEL, 1, added, 1, matches));
+    ASSERT_EQ(matches.size(), 1);
+    EXPECT_EQ(matches[0].chunkId, 2000);
+
+    // folder 2 lost an embedding the index still holds, so its index is dropped along with its file
+    idx.verify({ { EmbeddingIndex::Key(1, MODEL), EMBEDDINGS + 1 },
+                 { EmbeddingIndex::Key(2, MODEL), EMBEDDINGS - 1 } });
+    EXPECT_TRUE(idx.contains(MODEL, 1));
+    EXPECT_FALSE(idx.contains(MODEL, 2));
+    EXPECT_EQ(QDir(indexDir()).entryList({ "*.usearch" }, QDir::Files).size(), 1);
+}
+
+TEST_F(EmbeddingIndexTest, IndexesOnlyLargeFoldersUnquantized) {
+    EmbeddingIndex idx;
+    idx.open(indexDir(), Quantization::None);
+    EXPECT_EQ(idx.minEmbeddings(), EmbeddingIndex::MIN_EMBEDDINGS);
+    idx.open(indexDir(), Quantization::Int8);
+    EXPECT_EQ(idx.minEmbeddings(), 1);
+    idx.open(indexDir(), Quantization::Binary);
+    EXPECT_EQ(idx.minEmbeddings(), 1);
+}
+
+TEST_F(EmbeddingIndexTest, QuantizedSearchReturnsCandidates) {
+    auto embeddings = randomEmbeddings(EMBEDDINGS, 9);
+    addRows(1, 1, embeddings);
+
+    // the candidates are to be rescored, so the true nearest neighbour need only be among them
+    const std::pair<Quantization, int> quantizations[] = { { Quantization::Int8, 4 }, { Quantization::Binary, 16 } };
+    for (auto [quantization, oversampling] : quantizations) {
+        EmbeddingIndex idx;
+        idx.open(m_dir.filePath(QString("index-%1").arg(int(quantization))), quantization);
+        EXPECT_EQ(idx.quantization(), quantization);
+        addIndex(idx, 1);
+
+        for (int i : { 0, 17, 250, EMBEDDINGS - 1 }) {
+            QList<Match> matches;
+            ASSERT_TRUE(idx.search(MODEL, 1, embeddings[i], 5, matches));
+            EXPECT_EQ(matches.size(), 5 * oversampling);
+            EXPECT_EQ(std::ranges::count(chunkIds(matches), i + 1), 1);
+        }
+    }
+}
+
+TEST_F(EmbeddingIndexTest, ReopensQuantizedIndex) {
+    auto embeddings = randomEmbeddings(EMBEDDINGS, 10);
+    addRows(1, 1, embeddings);
+    {
+        EmbeddingIndex idx;
+        idx.open(indexDir(), Quantization::Int8);
+        addIndex(idx, 1);
+    } // saved on destruction
+
+    // a quantized index is read into memory, so it can be added to straight away
+    EmbeddingIndex idx;
+    idx.open(indexDir(), Quantization::Int8);
+    ASSERT_TRUE(idx.contains(MODEL, 1));
+    auto added = randomEmbeddings(1, 11).front();
+    ASSERT_TRUE(idx.add(MODEL, 1, 1000, added));
+
+    QList<Match> matches;
+    ASSERT_TRUE(idx.search(MODEL, 1, added, 1, matches));
+    EXPECT_EQ(std::ranges::count(chunkIds(matches), 1000), 1);
+    matches.clear();
+    ASSERT_TRUE(idx.search(MODEL, 1, embeddings[42], 1, matches));
+    EXPECT_EQ(std::ranges::count(chunkIds(matches), 43), 1);
+}
+
+TEST_F(EmbeddingIndexTest, SearchesOnlyFilteredChunks) {
+    auto embeddings = randomEmbeddings(EMBEDDINGS, 12);
+    addRows(1, 1, embeddings);
+    EmbeddingIndex idx;
+    idx.open(indexDir(), Quantization::None);
+    addIndex(idx, 1);
+
+    // half of the folder is selected, the graph is searched skipping the others
+    ChunkFilter even;
+    for (int chunkId = 2; chunkId <= EMBEDDINGS; chunkId += 2)
+        even.insert(1, chunkId);
+    QList<Match> matches;
+    ASSERT_TRUE(idx.search(MODEL, 1, embeddings[41], 5, matches, &even));
+    ASSERT_EQ(matches.size(), 5);
+    EXPECT_EQ(matches[0].chunkId, 42);
+    for (auto &m : matches)
+        EXPECT_EQ(m.chunkId % 2, 0);
+
+    // a few chunks are selected, they are all compared with the query
+    ChunkFilter few;
+    for (int chunkId : { 3, 99, 250, 377 })
+        few.insert(1, chunkId);
+    matches.clear();
+    ASSERT_TRUE(idx.search(MODEL, 1, embeddings[249], 10, matches, &few));
+    auto ids = chunkIds(matches);
+    std::ranges::sort(ids);
+    EXPECT_EQ(ids, (std::vector { 3, 99, 250, 377 }));
+    EXPECT_EQ(matches[0].chunkId, 250);
+}
@@ -0,0 +1,172 @@
+#include "httpserver.h"
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QDeadlineTimer>
+#include <QEventLoop>
+#include <QHostAddress>
+#include <QList>
+#include <QTcpSocket>
+
+
+namespace {
+
+struct Reply {
+    int        status = 0;
+    QByteArray body;
+};
+
+class HttpServerTest : public testing::Test {
+protected:
+    void SetUp() override
+    {
+        m_server.route("GET", "/hello", [](const HttpRequest &) {
+            return HttpResponse("hello\n", "text/plain");
+        });
+        m_server.route("POST", "/echo", [](const HttpRequest &request) {
+            return HttpResponse(request.body, "application/octet-stream");
+        });
+        HttpServer::Limits limits;
+        limits.workerThreads = 0; // the handlers run on this thread, as the event loop is run by the test
+        m_server.setLimits(limits);
+        ASSERT_TRUE(m_server.listen(QHostAddress::LocalHost, 0));
+        ASSERT_TRUE(connectClient());
+    }
+
+    bool connectClient()
+    {
+        m_socket.abort();
+        m_socket.connectToHost(QHostAddress::LocalHost, m_server.serverPort());
+        QDeadlineTimer deadline(5000);
+        while (m_socket.state() != QAbstractSocket::ConnectedState && !deadline.hasExpired())
+            QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+        return m_socket.state() == QAbstractSocket::ConnectedState;
+    }
+
+    void send(QByteArrayView data)
+    {
+        m_socket.write(data.data(), data.size());
+        m_socket.flush();
+    }
+
+    // Run the event loop until n complete responses have arrived, or until it times out.
+    QList<Reply> receive(int n)
+    {
+        QList<Reply> replies;
+        QByteArray input;
+        QDeadlineTimer deadline(5000);
+        while (replies.size() < n && !deadline.hasExpired()) {
+            QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+            input += m_socket.readAll();
+            for (;;) {
+                qsizetype headEnd = input.indexOf("\r\n\r\n");
+                if (headEnd < 0)
+                    break;
+                auto lines = input.first(headEnd).split('\n');
+                Reply reply;
+                reply.status = lines.front().split(' ').value(1).toInt();
+                qsizetype length = 0;
+                for (auto &line : lines) {
+                    if (line.toLower().startsWith("content-length:"))
+                        length = line.sliced(15).trimmed().toLongLong();
+                }
+                if (input.size() < headEnd + 4 + length)
+                    break;
+                reply.body = input.sliced(headEnd + 4, length);
+                input.remove(0, headEnd + 4 + length);
+                replies.append(reply);
+            }
+        }
+        return replies;
+    }
+
+    HttpServer m_server;
+    QTcpSocket m_socket;
+};
+
+} // namespace
+
+TEST_F(HttpServerTest, ParsesRequestSentByteByByte) {
+    QByteArray request = "GET /hello?x=1 HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    for (char c : request) {
+        send(QByteArrayView(&c, 1));
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 1);
+    }
+    auto replies = receive(1);
+    ASSERT_EQ(replies.size(), 1);
+    EXPECT_EQ(replies[0].status, 200);
+    EXPECT_EQ(replies[0].body, "hello\n");
+}
+
+TEST_F(HttpServerTest, DecodesChunkedBody) {
+    send("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+         "5\r\nhello\r\n7;ext=1\r\n, world\r\n0\r\nTrailer: ignored\r\n\r\n");
+    auto replies = receive(1);
+    ASSERT_EQ(replies.size(), 1);
+    EXPECT_EQ(replies[0].status, 200);
+    EXPECT_EQ(replies[0].body, "hello, world");
+}
+
+TEST_F(HttpServerTest, AnswersPipelinedRequestsInOrder) {
+    send("GET /hello HTTP/1.1\r\n\r\n"
+         "POST /echo HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc"
+         "GET /missing HTTP/1.1\r\n\r\n"
+         "DELETE /hello HTTP/1.1\r\n\r\n");
+    auto replies = receive(4);
+    ASSERT_EQ(replies.size(), 4);
+    EXPECT_EQ(replies[0].status, 200);
+    EXPECT_EQ(replies[0].body, "hello\n");
+    EXPECT_EQ(replies[1].status, 200);
+    EXPECT_EQ(replies[1].body, "abc");
+    EXPECT_EQ(replies[2].status, 404);
+    EXPECT_EQ(replies[3].status, 405);
+}
+
+TEST_F(HttpServerTest, RejectsOtherHttpVersions) {
+    send("GET /hello HTTP/2.0\r\n\r\n");
+    auto replies = receive(1);
+    ASSERT_EQ(replies.size(), 1);
+    EXPECT_EQ(replies[0].status, 505);
+}
+
+TEST_F(HttpServerTest, RejectsMalformedRequestLine) {
+    send("GET hello\r\n\r\n");
+    auto replies = receive(1);
+    ASSERT_EQ(replies.size(), 1);
+    EXPECT_EQ(replies[0].status, 400);
+}
+
+TEST_F(HttpServerTest, RejectsAmbiguousFraming) {
+    send("POST /echo HTTP/1.1\r\nContent-Length: 3\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n");
+    auto replies = receive(1);
+    ASSERT_EQ(replies.size(), 1);
+    EXPECT_EQ(replies[0].status, 400);
+}
+
+TEST_F(HttpServerTest, RejectsUnsupportedTransferEncoding) {
+    send("POST /echo HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n");
+    auto replies = receive(1);
+    ASSERT_EQ(replies.size(), 1);
+    EXPECT_EQ(replies[0].status, 501);
+}
+
+TEST_F(HttpServerTest, EnforcesLimits) {
+    HttpServer::Limits limits = m_server.limits();
+    limits.maxBodySize   = 4;
+    limits.maxHeaderSize = 64;
+    m_server.setLimits(limits);
+
+    send("POST /echo HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello");
+    auto replies = receive(1);
+    ASSERT_EQ(replies.size(), 1);
+    EXPECT_EQ(replies[0].status, 413);
+
+    // the connection is closed after an error, so the next request needs another one
+    ASSERT_TRUE(connectClient());
+    send(QByteArray("GET /hello HTTP/1.1\r\nX-Padding: ").append(64, 'x').append("\r\n\r\n"));
+    replies = receive(1);
+    ASSERT_EQ(replies.size(), 1);
+    EXPECT_EQ(replies[0].status, 431);
+}
@@ -0,0 +1,196 @@
+#include "ingestpipeline.h"
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+#include <QChar>
+#include <QDeadlineTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QString>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+
+namespace {
+
+using Batch = IngestPipeline::Batch;
+using Status = ChunkStreamer::Status;
+
+const QString MODEL = "test-model";
+
+// count words of four characters each, which are a chunk each at a chunk size of four
+QStringList makeWords(int count)
+{
+    QStringList words;
+    for (int i = 0; i < count; i++)
+        words << QString("w%1").arg(i % 1000, 3, 10, QChar('0'));
+    return words;
+}
+
+class IngestPipelineTest : public testing::Test {
+protected:
+    void SetUp() override { ASSERT_TRUE(m_dir.isValid()); }
+
+    DocumentInfo writeDocument(int folderId, const QString &name, const QByteArray &contents)
+    {
+        QFile file(m_dir.filePath(name));
+        EXPECT_TRUE(file.open(QFile::WriteOnly));
+        file.write(contents);
+        file.close();
+        return { folderId, QFileInfo(file.fileName()) };
+    }
+
+    DocumentInfo writeWords(int folderId, const QString &name, int count)
+    { return writeDocument(folderId, name, makeWords(count).join(' ').toUtf8()); }
+
+    // take batches until every document that was submitted is done
+    static std::vector<Batch> drain(IngestPipeline &pipeline)
+    {
+        std::vector<Batch> batches;
+        QDeadlineTimer deadline(10000);
+        while (!pipeline.isIdle() && !deadline.hasExpired()) {
+            if (auto batch = pipeline.take())
+                batches.push_back(std::move(*batch));
+            else
+                QThread::msleep(1);
+        }
+        EXPECT_TRUE(pipeline.isIdle());
+        return batches;
+    }
+
+    QTemporaryDir m_dir;
+};
+
+} // namespace
+
+TEST_F(IngestPipelineTest, ChunksDocumentInBatches) {
+    auto doc = writeWords(1, "words.txt", 250);
+    IngestPipeline pipeline;
+    pipeline.submit(doc, 42, MODEL, 4);
+    EXPECT_TRUE(pipeline.isInFlight(doc));
+    EXPECT_EQ(pipeline.inFlight(1), 1u);
+    EXPECT_EQ(pipeline.inFlight(2), 0u);
+
+    auto batches = drain(pipeline);
+    ASSERT_EQ(batches.size(), 3u);
+    QStringList texts;
+    for (std::size_t i = 0; i < batches.size(); i++) {
+        auto &batch = batches[i];
+        EXPECT_EQ(batch.ticket, batches[0].ticket);
+        EXPECT_EQ(batch.documentId, 42);
+        EXPECT_EQ(batch.embeddingModel, MODEL);
+        EXPECT_EQ(batch.doc.key(), doc.key());
+        EXPECT_EQ(batch.chunks.size(), i < 2 ? 100 : 50);
+        // only the last batch of a document says how reading it ended
+        if (i < 2)
+            EXPECT_FALSE(batch.status);
+        else
+            EXPECT_EQ(batch.status, Status::DOC_COMPLETE);
+        for (auto &chunk : batch.chunks) {
+            EXPECT_EQ(chunk.words, 1);
+            texts << chunk.text;
+        }
+    }
+    EXPECT_EQ(texts, makeWords(250));
+    EXPECT_FALSE(pipeline.isInFlight(doc));
+    EXPECT_EQ(pipeline.inFlight(1), 0u);
+}
+
+TEST_F(IngestPipelineTest, JoinsWordsUpToChunkSize) {
+    auto doc = writeDocument(1, "short.txt", "one two three four five");
+    IngestPipeline pipeline;
+    pipeline.submit(doc, 1, MODEL, 9);
+
+    auto batches = drain(pipeline);
+    ASSERT_EQ(batches.size(), 1u);
+    EXPECT_EQ(batches[0].status, Status::DOC_COMPLETE);
+    ASSERT_EQ(batches[0].chunks.size(), 3);
+    EXPECT_EQ(batches[0].chunks[0].text, "one two");
+    EXPECT_EQ(batches[0].chunks[0].words, 2);
+    EXPECT_EQ(batches[0].chunks[1].text, "three");
+    EXPECT_EQ(batches[0].chunks[2].text, "four five");
+}
+
+TEST_F(IngestPipelineTest, ReportsUnreadableDocuments) {
+    auto binary = writeDocument(1, "binary.txt", QByteArray("some text\0\x01\x02 more", 17));
+    DocumentInfo missing { 1, QFileInfo(m_dir.filePath("missing.txt")) };
+    IngestPipeline pipeline;
+    pipeline.submit(binary, 1, MODEL, 100);
+    pipeline.submit(missing, 2, MODEL, 100);
+
+    auto batches = drain(pipeline);
+    ASSERT_EQ(batches.size(), 2u);
+    for (auto &batch : batches) {
+        if (batch.documentId == 1) {
+            EXPECT_EQ(batch.status, Status::BINARY_SEEN);
+        } else {
+            EXPECT_EQ(batch.status, Status::ERROR);
+            EXPECT_TRUE(batch.chunks.isEmpty());
+        }
+    }
+}
+
+TEST_F(IngestPipelineTest, CancelsFolder) {
+    // more batches than are queued at once, so the reader of the first document is still blocked when it is cancelled
+    auto cancelled = writeWords(1, "cancelled.txt", 20000);
+    auto kept = writeWords(2, "kept.txt", 10);
+    IngestPipeline pipeline;
+    pipeline.submit(cancelled, 1, MODEL, 4);
+    pipeline.submit(kept, 2, MODEL, 4);
+
+    std::vector<Batch> batches;
+    QDeadlineTimer deadline(10000);
+    while (batches.empty() && !deadline.hasExpired()) {
+        if (auto batch = pipeline.take())
+            batches.push_back(std::move(*batch));
+        else
+            QThread::msleep(1);
+    }
+    pipeline.cancelFolder(1);
+    EXPECT_FALSE(pipeline.isInFlight(cancelled));
+    EXPECT_EQ(pipeline.inFlight(1), 0u);
+
+    // the batches of the first document that were queued are dropped, the second one is read to the end
+    for (auto &batch : drain(pipeline)) {
+        EXPECT_EQ(batch.doc.folder, 2);
+        batches.push_back(std::move(batch));
+    }
+    EXPECT_EQ(std::ranges::count_if(batches, [](auto &b) { return b.doc.folder == 2 && b.status; }), 1);
+    EXPECT_FALSE(pipeline.take());
+}
+
+TEST_F(IngestPipelineTest, CountsStats) {
+    auto doc = writeWords(1, "words.txt", 250);
+    IngestPipeline pipeline;
+    pipeline.submit(doc, 1, MODEL, 4);
+    drain(pipeline);
+
+    auto stats = pipeline.takeStats();
+    EXPECT_EQ(stats.documents, 1);
+    EXPECT_EQ(stats.bytes, doc.file.size());
+    EXPECT_EQ(stats.chunks, 250);
+    EXPECT_GE(stats.elapsedMs, stats.busyMs); // one document is read by one thread
+
+    stats = pipeline.takeStats();
+    EXPECT_EQ(stats.documents, 0);
+    EXPECT_EQ(stats.chunks, 0);
+    EXPECT_EQ(stats.elapsedMs, 0);
+}
+
+TEST_F(IngestPipelineTest, LimitsDocumentsInFlight) {
+    IngestPipeline pipeline;
+    for (int i = 0; !pipeline.isFull(); i++) {
+        ASSERT_LT(i, 2 * pipeline.threadCount());
+        pipeline.submit(writeWords(1, QString("doc%1.txt").arg(i), 10), i, MODEL, 4);
+    }
+    EXPECT_EQ(pipeline.inFlight(1), std::size_t(2 * pipeline.threadCount()));
+    drain(pipeline);
+    EXPECT_FALSE(pipeline.isFull());
+}
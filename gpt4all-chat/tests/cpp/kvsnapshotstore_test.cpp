@@ -0,0 +1,291 @@
+#include "kvsnapshotstore.h"
+
+#include <gpt4all-backend/llmodel.h>
+
+#include <gtest/gtest.h>
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileDevice>
+#include <QIODevice>
+#include <QMetaObject>
+#include <QString>
+#include <QTemporaryDir>
+#include <QtGlobal>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+namespace {
+
+// A model that has nothing but a context state, some bytes and the input tokens they were computed from.
+class FakeModel : public LLModel {
+public:
+    // a state of stateSize counting bytes, an empty model if there is none
+    explicit FakeModel(std::size_t stateSize = 0)
+    {
+        for (std::size_t i = 0; i < stateSize; i++)
+            state.push_back(uint8_t(i));
+        if (stateSize)
+            tokens = { 1, 2, Token(stateSize) };
+    }
+
+    std::vector<uint8_t> state;
+    std::vector<Token>   tokens;
+    int32_t              nCtx = 2048;
+
+    size_t contextStateSize() const override { return state.size(); }
+
+    size_t saveContextState(std::span<uint8_t> stateOut, std::vector<Token> &inputTokensOut) const override
+    {
+        if (stateOut.size() < state.size())
+            return 0;
+        std::ranges::copy(state, stateOut.begin());
+        inputTokensOut = tokens;
+        return state.size();
+    }
+
+    size_t restoreContextState(std::span<const uint8_t> stateIn, std::span<const Token> inputTokens) override
+    {
+        state.assign(stateIn.begin(), stateIn.end());
+        tokens.assign(inputTokens.begin(), inputTokens.end());
+        return state.size();
+    }
+
+    int32_t contextLength() const override { return nCtx; }
+
+    // the store only uses the context state, so the rest is left unimplemented
+
+    bool supportsEmbedding() const override { return false; }
+    bool supportsCompletion() const override { return false; }
+    bool isModelLoaded() const override { return true; }
+
+    [[noreturn]]
+    bool loadModel(const std::string &modelPath, int n_ctx, int ngl) override
+    { Q_UNUSED(modelPath); Q_UNUSED(n_ctx); Q_UNUSED(ngl); throwNotImplemented(); }
+
+    [[noreturn]]
+    size_t requiredMem(const std::string &modelPath, int n_ctx, int ngl) override
+    { Q_UNUSED(modelPath); Q_UNUSED(n_ctx); Q_UNUSED(ngl); throwNotImplemented(); }
+
+    [[noreturn]]
+    size_t stateSize() const override
+    { throwNotImplemented(); }
+
+    [[noreturn]]
+    size_t saveState(std::span<uint8_t> stateOut, std::vector<Token> &inputTokensOut) const override
+    { Q_UNUSED(stateOut); Q_UNUSED(inputTokensOut); throwNotImplemented(); }
+
+    [[noreturn]]
+    size_t restoreState(std::span<const uint8_t> stateIn, std::span<const Token> inputTokens) override
+    { Q_UNUSED(stateIn); Q_UNUSED(inputTokens); throwNotImplemented(); }
+
+    auto specialTokens() -> std::unordered_map<std::string, std::string> const override
+    { return {}; }
+
+    [[noreturn]]
+    std::string_view tokenPiece(Token id) const override
+    { Q_UNUSED(id); throwNotImplemented(); }
+
+    [[noreturn]]
+    bool isSpecialToken(Token id) const override
+    { Q_UNUSED(id); throwNotImplemented(); }
+
+protected:
+    [[noreturn]]
+    static void throwNotImplemented() { throw std::logic_error("not implemented"); }
+
+    [[noreturn]]
+    std::vector<Token> tokenize(std::string_view str, bool addSpecial) const override
+    { Q_UNUSED(str); Q_UNUSED(addSpecial); throwNotImplemented(); }
+
+    [[noreturn]]
+    void initSampler(const PromptContext &ctx) override
+    { Q_UNUSED(ctx); throwNotImplemented(); }
+
+    [[noreturn]]
+    Token sampleToken(int32_t batchIdx) const override
+    { Q_UNUSED(batchIdx); throwNotImplemented(); }
+
+    [[noreturn]]
+    bool evalTokens(int32_t nPast, std::span<const Token> tokens) const override
+    { Q_UNUSED(nPast); Q_UNUSED(tokens); throwNotImplemented(); }
+
+    [[noreturn]]
+    void shiftContext(const PromptContext &promptCtx, int32_t *nPast) override
+    { Q_UNUSED(promptCtx); Q_UNUSED(nPast); throwNotImplemented(); }
+
+    [[noreturn]]
+    int32_t inputLength() const override
+    { throwNotImplemented(); }
+
+    [[noreturn]]
+    int32_t computeModelInputPosition(std::span<const Token> input) const override
+    { Q_UNUSED(input); throwNotImplemented(); }
+
+    [[noreturn]]
+    void setModelInputPosition(int32_t pos) override
+    { Q_UNUSED(pos); throwNotImplemented(); }
+
+    [[noreturn]]
+    void appendInputToken(Token tok) override
+    { Q_UNUSED(tok); throwNotImplemented(); }
+
+    [[noreturn]]
+    std::span<const Token> inputTokens() const override
+    { throwNotImplemented(); }
+
+    [[noreturn]]
+    const std::vector<Token> &endTokens() const override
+    { throwNotImplemented(); }
+
+    [[noreturn]]
+    bool shouldAddBOS() const override
+    { throwNotImplemented(); }
+
+    [[noreturn]]
+    void initSeqSampler(int32_t seq, const PromptContext &ctx) override
+    { Q_UNUSED(seq); Q_UNUSED(ctx); throwNotImplemented(); }
+
+    [[noreturn]]
+    Token sampleSeqToken(int32_t seq, int32_t batchIdx) const override
+    { Q_UNUSED(seq); Q_UNUSED(batchIdx); throwNotImplemented(); }
+
+    [[noreturn]]
+    bool evalBatch(std::span<const SeqToken> tokens) const override
+    { Q_UNUSED(tokens); throwNotImplemented(); }
+
+    [[noreturn]]
+    void clearSequence(int32_t seq) override
+    { Q_UNUSED(seq); throwNotImplemented(); }
+
+    [[noreturn]]
+    void shiftSequence(int32_t seq, int32_t nKeep, int32_t nDiscard, int32_t nPast) override
+    { Q_UNUSED(seq); Q_UNUSED(nKeep); Q_UNUSED(nDiscard); Q_UNUSED(nPast); throwNotImplemented(); }
+};
+
+// the store is a singleton in the application, a test gets one of its own
+class TestKVSnapshotStore : public KVSnapshotStore { };
+
+const KVSnapshotStore::ModelKey KEY { .hash = QByteArray("0123456789abcdef"), .nCtx = 2048 };
+
+class KVSnapshotStoreTest : public testing::Test {
+protected:
+    void SetUp() override
+    {
+        ASSERT_TRUE(m_dir.isValid());
+        m_store = std::make_unique<TestKVSnapshotStore>();
+        m_store->setDirectory(m_dir.path());
+    }
+
+    // wait for the snapshots that were saved to be written
+    void flush()
+    { QMetaObject::invokeMethod(m_store.get(), [] {}, Qt::BlockingQueuedConnection); }
+
+    QString snapshotPath(const QString &chatId) const { return m_dir.filePath("gpt4all-" + chatId + ".kvstate"); }
+
+    static void setModified(const QString &path, const QDateTime &time)
+    {
+        QFile file(path);
+        ASSERT_TRUE(file.open(QIODevice::ReadWrite));
+        ASSERT_TRUE(file.setFileTime(time, QFileDevice::FileModificationTime));
+    }
+
+    QTemporaryDir                        m_dir;
+    std::unique_ptr<TestKVSnapshotStore> m_store;
+};
+
+} // namespace
+
+TEST_F(KVSnapshotStoreTest, RestoresSavedContext) {
+    FakeModel model(100);
+    m_store->save("chat", KEY, &model);
+    flush();
+    EXPECT_TRUE(QFile::exists(snapshotPath("chat")));
+
+    FakeModel restored;
+    ASSERT_TRUE(m_store->restore("chat", KEY, &restored));
+    EXPECT_EQ(restored.state, model.state);
+    EXPECT_EQ(restored.tokens, model.tokens);
+}
+
+TEST_F(KVSnapshotStoreTest, RejectsOtherModel) {
+    FakeModel model(100);
+    m_store->save("chat", KEY, &model);
+    flush();
+
+    FakeModel restored;
+    auto otherHash = KEY;
+    otherHash.hash = QByteArray("fedcba9876543210");
+    EXPECT_FALSE(m_store->restore("chat", otherHash, &restored));
+    auto otherContext = KEY;
+    otherContext.nCtx = 4096;
+    EXPECT_FALSE(m_store->restore("chat", otherContext, &restored));
+    EXPECT_FALSE(m_store->restore("other-chat", KEY, &restored));
+    EXPECT_TRUE(restored.state.empty());
+}
+
+TEST_F(KVSnapshotStoreTest, NeedsDirectory) {
+    m_store->setDirectory({});
+    FakeModel model(100);
+    m_store->save("chat", KEY, &model);
+    flush();
+    EXPECT_TRUE(QDir(m_dir.path()).isEmpty());
+
+    FakeModel restored;
+    EXPECT_FALSE(m_store->restore("chat", KEY, &restored));
+}
+
+TEST_F(KVSnapshotStoreTest, SkipsContextTooLarge) {
+    m_store->setLimits({ .maxStateSize = 99, .maxTotalSize = qint64(1) << 20 });
+    FakeModel large(100);
+    FakeModel small(99);
+    m_store->save("large", KEY, &large);
+    m_store->save("small", KEY, &small);
+    flush();
+    EXPECT_FALSE(QFile::exists(snapshotPath("large")));
+    EXPECT_TRUE(QFile::exists(snapshotPath("small")));
+}
+
+TEST_F(KVSnapshotStoreTest, RemovesOldestSnapshots) {
+    // room for two snapshots of a little over 1000 bytes each
+    m_store->setLimits({ .maxStateSize = 1000, .maxTotalSize = 2500 });
+    FakeModel model(1000);
+    const QDateTime now = QDateTime::currentDateTime();
+
+    m_store->save("a", KEY, &model);
+    flush();
+    setModified(snapshotPath("a"), now.addSecs(-7200));
+    m_store->save("b", KEY, &model);
+    flush();
+    setModified(snapshotPath("b"), now.addSecs(-3600));
+    EXPECT_TRUE(QFile::exists(snapshotPath("a")));
+
+    m_store->save("c", KEY, &model);
+    flush();
+    EXPECT_FALSE(QFile::exists(snapshotPath("a")));
+    EXPECT_TRUE(QFile::exists(snapshotPath("b")));
+    EXPECT_TRUE(QFile::exists(snapshotPath("c")));
+}
+
+TEST_F(KVSnapshotStoreTest, RemovesSnapshot) {
+    FakeModel model(100);
+    m_store->save("chat", KEY, &model);
+    flush();
+    m_store->remove("chat");
+    EXPECT_FALSE(QFile::exists(snapshotPath("chat")));
+
+    FakeModel restored;
+    EXPECT_FALSE(m_store->restore("chat", KEY, &restored));
+}
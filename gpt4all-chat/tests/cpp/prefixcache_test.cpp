@@ -0,0 +1,123 @@
+#include "prefixcache.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+using Tokens = std::vector<PrefixCache::Token>;
+
+
+static std::vector<uint8_t> state(size_t size, uint8_t fill = 0)
+{
+    return std::vector<uint8_t>(size, fill);
+}
+
+TEST(PrefixCacheTest, FindsLongestCommonPrefix) {
+    PrefixCache cache(1000);
+    ASSERT_TRUE(cache.insert({ 1, 2, 3, 4 }, state(10, 1)));
+    ASSERT_TRUE(cache.insert({ 1, 5, 6 }, state(10, 2)));
+
+    auto match = cache.find(Tokens { 1, 2, 3, 9, 9 });
+    ASSERT_NE(match.entry, nullptr);
+    EXPECT_EQ(match.length, 3);
+    EXPECT_EQ(match.entry->tokens, (Tokens { 1, 2, 3, 4 }));
+
+    match = cache.find(Tokens { 1, 5, 6, 7 });
+    ASSERT_NE(match.entry, nullptr);
+    EXPECT_EQ(match.length, 3);
+    EXPECT_EQ(match.entry->state, state(10, 2));
+}
+
+TEST(PrefixCacheTest, NoMatch) {
+    PrefixCache cache(1000);
+    EXPECT_EQ(cache.find(Tokens { 1 }).entry, nullptr);
+
+    ASSERT_TRUE(cache.insert({ 1, 2 }, state(10)));
+    auto match = cache.find(Tokens { 2, 1 });
+    EXPECT_EQ(match.entry, nullptr);
+    EXPECT_EQ(match.length, 0);
+}
+
+TEST(PrefixCacheTest, PicksSmallestSnapshotSharingThePrefix) {
+    PrefixCache cache(1000);
+    ASSERT_TRUE(cache.insert({ 1, 2, 3, 4, 5, 6 }, state(10)));
+    ASSERT_TRUE(cache.insert({ 1, 2, 7, 8 }, state(10)));
+
+    auto match = cache.find(Tokens { 1, 2, 9 });
+    ASSERT_NE(match.entry, nullptr);
+    EXPECT_EQ(match.length, 2);
+    EXPECT_EQ(match.entry->tokens, (Tokens { 1, 2, 7, 8 }));
+}
+
+TEST(PrefixCacheTest, LongerSnapshotSupersedesItsPrefix) {
+    PrefixCache cache(1000);
+    ASSERT_TRUE(cache.insert({ 1, 2 }, state(10)));
+    ASSERT_TRUE(cache.insert({ 1, 2, 3 }, state(20)));
+
+    EXPECT_EQ(cache.usedBytes(), 20u);
+    auto match = cache.find(Tokens { 1, 2 });
+    ASSERT_NE(match.entry, nullptr);
+    EXPECT_EQ(match.length, 2);
+    EXPECT_EQ(match.entry->tokens, (Tokens { 1, 2, 3 }));
+}
+
+TEST(PrefixCacheTest, ReplacesSnapshotOfSameTokens) {
+    PrefixCache cache(1000);
+    ASSERT_TRUE(cache.insert({ 1, 2 }, state(10, 1)));
+    ASSERT_TRUE(cache.insert({ 1, 2 }, state(30, 2)));
+
+    EXPECT_EQ(cache.usedBytes(), 30u);
+    auto match = cache.find(Tokens { 1, 2 });
+    ASSERT_NE(match.entry, nullptr);
+    EXPECT_EQ(match.entry->state, state(30, 2));
+}
+
+TEST(PrefixCacheTest, Covers) {
+    PrefixCache cache(1000);
+    ASSERT_TRUE(cache.insert({ 1, 2, 3 }, state(10)));
+
+    EXPECT_TRUE(cache.covers(Tokens { 1, 2 }));
+    EXPECT_TRUE(cache.covers(Tokens { 1, 2, 3 }));
+    EXPECT_FALSE(cache.covers(Tokens { 1, 2, 3, 4 }));
+    EXPECT_FALSE(cache.covers(Tokens { 2 }));
+    EXPECT_FALSE(cache.covers(Tokens {}));
+}
+
+TEST(PrefixCacheTest, EvictsLeastRecentlyUsed) {
+    PrefixCache cache(30);
+    ASSERT_TRUE(cache.insert({ 1 }, state(10)));
+    ASSERT_TRUE(cache.insert({ 2 }, state(10)));
+    ASSERT_TRUE(cache.insert({ 3 }, state(10)));
+    ASSERT_NE(cache.find(Tokens { 1 }).entry, nullptr); // now { 2 } is the least recently used
+
+    ASSERT_TRUE(cache.insert({ 4 }, state(10)));
+    EXPECT_EQ(cache.usedBytes(), 30u);
+    EXPECT_TRUE(cache.covers(Tokens { 1 }));
+    EXPECT_FALSE(cache.covers(Tokens { 2 }));
+    EXPECT_TRUE(cache.covers(Tokens { 3 }));
+    EXPECT_TRUE(cache.covers(Tokens { 4 }));
+}
+
+TEST(PrefixCacheTest, RejectsWhatDoesNotFit) {
+    PrefixCache cache(10);
+    EXPECT_FALSE(cache.insert({ 1 }, state(11)));
+    EXPECT_FALSE(cache.insert({}, state(1)));
+    EXPECT_EQ(cache.usedBytes(), 0u);
+    EXPECT_EQ(cache.find(Tokens { 1 }).entry, nullptr);
+}
+
+TEST(PrefixCacheTest, SetBudgetEvicts) {
+    PrefixCache cache(100);
+    ASSERT_TRUE(cache.insert({ 1 }, state(40)));
+    ASSERT_TRUE(cache.insert({ 2 }, state(40)));
+
+    cache.setBudget(50);
+    EXPECT_EQ(cache.usedBytes(), 40u);
+    EXPECT_FALSE(cache.covers(Tokens { 1 }));
+    EXPECT_TRUE(cache.covers(Tokens { 2 }));
+
+    cache.clear();
+    EXPECT_EQ(cache.usedBytes(), 0u);
+    EXPECT_FALSE(cache.covers(Tokens { 2 }));
+}
@@ -0,0 +1,68 @@
+#include "stopmatcher.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+
+TEST(StopMatcherTest, FindsSequenceSplitAcrossPieces) {
+    std::vector<std::string> stops { "</s>" };
+    StopMatcher matcher(stops);
+
+    EXPECT_EQ(matcher.feed("Hello </"), StopMatcher::npos);
+    EXPECT_EQ(matcher.partialLength(), 2u);
+    EXPECT_EQ(matcher.feed("s> more"), 6u);
+}
+
+TEST(StopMatcherTest, ReturnsEarliestOfOverlappingSequences) {
+    std::vector<std::string> stops { "abcd", "bc" };
+    StopMatcher matcher(stops);
+
+    EXPECT_EQ(matcher.feed("xbc"), 1u);
+
+    StopMatcher other(stops);
+    EXPECT_EQ(other.feed("ab"), StopMatcher::npos);
+    EXPECT_EQ(other.feed("cd"), 0u); // "abcd" starts before "bc"
+}
+
+TEST(StopMatcherTest, FollowsFailureLinks) {
+    std::vector<std::string> stops { "aab" };
+    StopMatcher matcher(stops);
+
+    EXPECT_EQ(matcher.feed("aaab"), 1u);
+}
+
+TEST(StopMatcherTest, NoMatch) {
+    std::vector<std::string> stops { "###", "User:" };
+    StopMatcher matcher(stops);
+
+    EXPECT_EQ(matcher.feed("a normal ## response"), StopMatcher::npos);
+    EXPECT_EQ(matcher.partialLength(), 0u);
+    EXPECT_EQ(matcher.length(), 20u);
+    EXPECT_EQ(matcher.feed(" Use"), StopMatcher::npos);
+    EXPECT_EQ(matcher.partialLength(), 3u);
+}
+
+TEST(StopMatcherTest, SkipResetsPartialMatch) {
+    std::vector<std::string> stops { "</s>" };
+    StopMatcher matcher(stops);
+
+    EXPECT_EQ(matcher.feed("</"), StopMatcher::npos);
+    matcher.skip("<special>");
+    EXPECT_EQ(matcher.partialLength(), 0u);
+    EXPECT_EQ(matcher.length(), 11u);
+    EXPECT_EQ(matcher.feed("s>"), StopMatcher::npos);
+    EXPECT_EQ(matcher.feed(" </s>"), 14u);
+}
+
+TEST(StopMatcherTest, IgnoresEmptySequences) {
+    std::vector<std::string> stops { "", "end" };
+    StopMatcher matcher(stops);
+
+    EXPECT_TRUE(matcher.isStopSequence("end"));
+    EXPECT_FALSE(matcher.isStopSequence(""));
+    EXPECT_FALSE(matcher.isStopSequence("en"));
+    EXPECT_EQ(matcher.feed("abc"), StopMatcher::npos);
+    EXPECT_EQ(matcher.feed("the end"), 7u);
+}